@@ -0,0 +1,204 @@
+// Compares PatternSet with one std::regex per pattern, the way network-log
+// filtered before, over a URL corpus.
+//
+//   pattern_set_bench [--urls=FILE] [--patterns=FILE] [--count=N]
+//
+// FILE holds one entry per line. Without --urls a synthetic corpus of N URLs
+// (default 50000) is generated; without --patterns a mix of sub:, glob: and
+// regex filters is used.
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "app/pattern_set.h"
+
+namespace {
+
+bool ReadLines(const std::string& path, std::vector<std::string>* out) {
+  std::ifstream in(path);
+  if (!in.is_open()) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    if (!line.empty()) {
+      out->push_back(line);
+    }
+  }
+  return true;
+}
+
+std::vector<std::string> SyntheticUrls(int count) {
+  static const char* const kSchemes[] = {"https", "http"};
+  static const char* const kTlds[] = {"com", "net", "org", "io", "dev"};
+  static const char* const kWords[] = {
+      "static", "api", "cdn", "img", "assets", "v1", "v2", "search",
+      "video", "user", "profile", "feed", "track", "pixel", "bundle",
+      "vendor", "fonts", "media", "embed", "ads"};
+  static const char* const kExtensions[] = {".js", ".css", ".png", ".json",
+                                            ".woff2", ".mp4", ""};
+  std::mt19937 rng(42);
+  auto pick = [&rng](int n) {
+    return static_cast<int>(rng() % static_cast<unsigned>(n));
+  };
+  std::vector<std::string> urls;
+  urls.reserve(count);
+  for (int i = 0; i < count; ++i) {
+    std::string url = kSchemes[pick(2)];
+    url += "://";
+    url += kWords[pick(20)];
+    url += ".site";
+    url += std::to_string(pick(500));
+    url += ".";
+    url += kTlds[pick(5)];
+    const int depth = 1 + pick(6);
+    for (int d = 0; d < depth; ++d) {
+      url += "/";
+      url += kWords[pick(20)];
+      if (pick(3) == 0) {
+        url += std::to_string(rng() % 100000);
+      }
+    }
+    url += kExtensions[pick(7)];
+    if (pick(2) == 0) {
+      url += "?id=" + std::to_string(rng()) + "&ref=" + kWords[pick(20)];
+      // Long query strings are where backtracking regexes suffer.
+      if (pick(10) == 0) {
+        url += "&state=" + std::string(200 + pick(800), 'a' + pick(26));
+      }
+    }
+    urls.push_back(std::move(url));
+  }
+  return urls;
+}
+
+std::vector<std::string> DefaultPatterns() {
+  std::vector<std::string> patterns;
+  for (int i = 0; i < 200; i += 7) {
+    patterns.push_back("sub:ads.site" + std::to_string(i) + ".");
+  }
+  patterns.push_back("glob:https://cdn.*/*.woff2");
+  patterns.push_back("glob:*://api.site1??.io/v2/*");
+  patterns.push_back("re:/track[0-9]+/pixel");
+  patterns.push_back("\\.mp4(\\?|$)");
+  patterns.push_back("re:search.*ref=feed");
+  return patterns;
+}
+
+std::string EscapeRegex(const std::string& text) {
+  std::string out;
+  for (char c : text) {
+    if (std::string("\\^$.|?*+()[]{}/").find(c) != std::string::npos) {
+      out.push_back('\\');
+    }
+    out.push_back(c);
+  }
+  return out;
+}
+
+// The equivalent std::regex for a PatternSet spec.
+std::string SpecToRegex(const std::string& spec) {
+  if (spec.rfind("sub:", 0) == 0) {
+    return EscapeRegex(spec.substr(4));
+  }
+  if (spec.rfind("glob:", 0) == 0) {
+    std::string out = "^";
+    for (char c : spec.substr(5)) {
+      if (c == '*') {
+        out += "[^]*";
+      } else if (c == '?') {
+        out += "[^]";
+      } else {
+        out += EscapeRegex(std::string(1, c));
+      }
+    }
+    return out + "$";
+  }
+  return spec.rfind("re:", 0) == 0 ? spec.substr(3) : spec;
+}
+
+template <typename MatchFn>
+void Run(const char* label,
+         const std::vector<std::string>& urls,
+         MatchFn match) {
+  const auto start = std::chrono::steady_clock::now();
+  size_t matched = 0;
+  for (const std::string& url : urls) {
+    matched += match(url) ? 1 : 0;
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  std::cout << label << ": " << matched << " matched, "
+            << (seconds * 1e9 / static_cast<double>(urls.size()))
+            << " ns/url, " << seconds << " s total\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::string urls_path;
+  std::string patterns_path;
+  int count = 50000;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg.rfind("--urls=", 0) == 0) {
+      urls_path = arg.substr(7);
+    } else if (arg.rfind("--patterns=", 0) == 0) {
+      patterns_path = arg.substr(11);
+    } else if (arg.rfind("--count=", 0) == 0) {
+      count = std::atoi(arg.c_str() + 8);
+    } else {
+      std::cerr << "Usage: pattern_set_bench [--urls=FILE] "
+                   "[--patterns=FILE] [--count=N]\n";
+      return 1;
+    }
+  }
+
+  std::vector<std::string> urls;
+  if (!urls_path.empty() ? !ReadLines(urls_path, &urls) : false) {
+    std::cerr << "Failed to read " << urls_path << "\n";
+    return 1;
+  }
+  if (urls_path.empty()) {
+    urls = SyntheticUrls(count > 0 ? count : 1);
+  }
+  std::vector<std::string> patterns;
+  if (!patterns_path.empty() && !ReadLines(patterns_path, &patterns)) {
+    std::cerr << "Failed to read " << patterns_path << "\n";
+    return 1;
+  }
+  if (patterns_path.empty()) {
+    patterns = DefaultPatterns();
+  }
+
+  rethread::PatternSet set;
+  std::string error;
+  if (!set.Build(patterns, &error)) {
+    std::cerr << "Invalid pattern: " << error << "\n";
+    return 1;
+  }
+  std::vector<std::regex> regexes;
+  for (const std::string& spec : patterns) {
+    regexes.emplace_back(SpecToRegex(spec));
+  }
+
+  std::cout << urls.size() << " urls, " << patterns.size() << " patterns\n";
+  Run("std::regex", urls, [&regexes](const std::string& url) {
+    for (const std::regex& regex : regexes) {
+      if (std::regex_search(url, regex)) {
+        return true;
+      }
+    }
+    return false;
+  });
+  Run("PatternSet", urls,
+      [&set](const std::string& url) { return set.Match(url); });
+  return 0;
+}
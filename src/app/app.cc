@@ -10,6 +10,7 @@
 #include <QJsonParseError>
 #include <QProcess>
 #include <QProcessEnvironment>
+#include <QStackedWidget>
 #include <QStandardPaths>
 #include <QTimer>
 #include <QUrl>
@@ -35,6 +36,9 @@
 
 namespace rethread {
 namespace {
+constexpr int kHeadlessViewportWidth = 1280;
+constexpr int kHeadlessViewportHeight = 800;
+
 uint32_t QColorToRgba(const QColor& color) {
   return (static_cast<uint32_t>(color.alpha()) << 24) |
          (static_cast<uint32_t>(color.red()) << 16) |
@@ -300,16 +304,24 @@ QString BrowserApplication::DownloadHandlerPath() const {
 void BrowserApplication::InitializeUi() {
   tab_manager_ =
       std::make_unique<TabManager>(profile_, options_.background_color);
+  if (options_.headless) {
+    headless_stack_ = std::make_unique<QStackedWidget>();
+    headless_stack_->resize(kHeadlessViewportWidth, kHeadlessViewportHeight);
+    tab_manager_->setContainer(headless_stack_.get());
+    return;
+  }
   main_window_ = std::make_unique<MainWindow>(*tab_manager_);
   tab_manager_->setContainer(main_window_->tabStack());
 }
 
 void BrowserApplication::InitializeControllers() {
-  tab_strip_controller_ =
-      std::make_unique<TabStripController>(main_window_->tabStripOverlay());
-  QObject::connect(
-      tab_manager_.get(), &TabManager::tabsChanged,
-      tab_strip_controller_.get(), &TabStripController::SetTabs);
+  if (main_window_) {
+    tab_strip_controller_ =
+        std::make_unique<TabStripController>(main_window_->tabStripOverlay());
+    QObject::connect(
+        tab_manager_.get(), &TabManager::tabsChanged,
+        tab_strip_controller_.get(), &TabStripController::SetTabs);
+  }
   QObject::connect(tab_manager_.get(), &TabManager::allTabsClosed, this, []() {
     QCoreApplication::quit();
   });
@@ -343,7 +355,12 @@ void BrowserApplication::LoadInitialTab() {
   }
   const QUrl url = QUrl::fromUserInput(options_.initial_url);
   tab_manager_->openTab(url, true);
-  main_window_->show();
+  if (headless_stack_) {
+    // Shown on the offscreen platform so pages still lay out and paint.
+    headless_stack_->show();
+  } else if (main_window_) {
+    main_window_->show();
+  }
 }
 
 void BrowserApplication::RunStartupScript() const {
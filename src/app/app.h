@@ -9,6 +9,7 @@
 #include <QObject>
 #include <QString>
 
+class QStackedWidget;
 class QWebEngineProfile;
 class QWebEngineDownloadRequest;
 
@@ -42,6 +43,9 @@ struct BrowserOptions {
   ColorScheme color_scheme = ColorScheme::kDark;
   bool cdp_enabled = true;
   int cdp_port = 9222;
+  // Runs without a window or tab strip; pages render into an offscreen
+  // container so eval and CDP keep working.
+  bool headless = false;
 };
 
 class BrowserApplication : public QObject {
@@ -73,6 +77,7 @@ class BrowserApplication : public QObject {
   QWebEngineProfile* profile_ = nullptr;
   std::unique_ptr<TabManager> tab_manager_;
   std::unique_ptr<MainWindow> main_window_;
+  std::unique_ptr<QStackedWidget> headless_stack_;
   std::unique_ptr<TabStripController> tab_strip_controller_;
   std::unique_ptr<KeyBindingManager> key_binding_manager_;
   std::unique_ptr<ContextMenuBindingManager> context_menu_binding_manager_;
@@ -0,0 +1,390 @@
+#include "app/body_store.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
+namespace {
+
+constexpr uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+constexpr uint64_t kSecondSeed = 0x5265746872656164ULL;
+constexpr size_t kHashReadBytes = 1024 * 1024;
+constexpr const char kTempPrefix[] = ".tmp-";
+
+uint64_t RotateLeft(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+// XXH64 is defined on little-endian words whatever the host order.
+uint64_t Load64(const unsigned char* bytes) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+uint64_t Load32(const unsigned char* bytes) {
+  uint64_t value = 0;
+  for (int i = 3; i >= 0; --i) {
+    value = (value << 8) | bytes[i];
+  }
+  return value;
+}
+
+uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = RotateLeft(acc, 31);
+  return acc * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t acc, uint64_t value) {
+  acc ^= Round(0, value);
+  return acc * kPrime1 + kPrime4;
+}
+
+bool WriteAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    const ssize_t n = write(fd, data, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Copies |from| to the new file |to|, for moves across filesystems.
+bool CopyFile(const std::string& from, const std::string& to) {
+  const int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    return false;
+  }
+  const int out = open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                       0644);
+  if (out < 0) {
+    close(in);
+    return false;
+  }
+  std::string buffer(kHashReadBytes, '\0');
+  bool ok = true;
+  ssize_t n = 0;
+  while ((n = read(in, buffer.data(), buffer.size())) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      ok = false;
+      break;
+    }
+    if (!WriteAll(out, buffer.data(), static_cast<size_t>(n))) {
+      ok = false;
+      break;
+    }
+  }
+  close(in);
+  ok = close(out) == 0 && ok;
+  if (!ok) {
+    unlink(to.c_str());
+  }
+  return ok;
+}
+
+}  // namespace
+
+namespace rethread {
+
+BodyHasher::BodyHasher() {
+  lanes_[1].seed = kSecondSeed;
+  for (Lane& lane : lanes_) {
+    lane.acc[0] = lane.seed + kPrime1 + kPrime2;
+    lane.acc[1] = lane.seed + kPrime2;
+    lane.acc[2] = lane.seed;
+    lane.acc[3] = lane.seed - kPrime1;
+  }
+}
+
+void BodyHasher::ConsumeStripe(Lane* lane, const unsigned char* stripe) {
+  for (int i = 0; i < 4; ++i) {
+    lane->acc[i] = Round(lane->acc[i], Load64(stripe + 8 * i));
+  }
+}
+
+void BodyHasher::Update(std::string_view data) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data.data());
+  size_t size = data.size();
+  total_ += size;
+  if (buffered_ > 0) {
+    const size_t take = std::min(size, sizeof(buffer_) - buffered_);
+    std::memcpy(buffer_ + buffered_, bytes, take);
+    buffered_ += take;
+    bytes += take;
+    size -= take;
+    if (buffered_ < sizeof(buffer_)) {
+      return;
+    }
+    ConsumeStripe(&lanes_[0], buffer_);
+    ConsumeStripe(&lanes_[1], buffer_);
+    buffered_ = 0;
+  }
+  for (; size >= sizeof(buffer_); bytes += 32, size -= 32) {
+    ConsumeStripe(&lanes_[0], bytes);
+    ConsumeStripe(&lanes_[1], bytes);
+  }
+  std::memcpy(buffer_, bytes, size);
+  buffered_ = size;
+}
+
+uint64_t BodyHasher::Digest(const Lane& lane,
+                            uint64_t total,
+                            const unsigned char* tail,
+                            size_t tail_size) {
+  uint64_t hash;
+  if (total >= 32) {
+    hash = RotateLeft(lane.acc[0], 1) + RotateLeft(lane.acc[1], 7) +
+           RotateLeft(lane.acc[2], 12) + RotateLeft(lane.acc[3], 18);
+    for (uint64_t acc : lane.acc) {
+      hash = MergeRound(hash, acc);
+    }
+  } else {
+    hash = lane.seed + kPrime5;
+  }
+  hash += total;
+  size_t i = 0;
+  for (; i + 8 <= tail_size; i += 8) {
+    hash ^= Round(0, Load64(tail + i));
+    hash = RotateLeft(hash, 27) * kPrime1 + kPrime4;
+  }
+  if (i + 4 <= tail_size) {
+    hash ^= Load32(tail + i) * kPrime1;
+    hash = RotateLeft(hash, 23) * kPrime2 + kPrime3;
+    i += 4;
+  }
+  for (; i < tail_size; ++i) {
+    hash ^= tail[i] * kPrime5;
+    hash = RotateLeft(hash, 11) * kPrime1;
+  }
+  hash ^= hash >> 33;
+  hash *= kPrime2;
+  hash ^= hash >> 29;
+  hash *= kPrime3;
+  hash ^= hash >> 32;
+  return hash;
+}
+
+std::string BodyHasher::Finish() const {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string hex;
+  hex.reserve(32);
+  for (const Lane& lane : lanes_) {
+    const uint64_t digest = Digest(lane, total_, buffer_, buffered_);
+    for (int shift = 60; shift >= 0; shift -= 4) {
+      hex.push_back(kHex[(digest >> shift) & 0xF]);
+    }
+  }
+  return hex;
+}
+
+std::string HashBody(std::string_view data) {
+  BodyHasher hasher;
+  hasher.Update(data);
+  return hasher.Finish();
+}
+
+bool HashBodyFile(const std::string& path, std::string* hash) {
+  const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  BodyHasher hasher;
+  std::string buffer(kHashReadBytes, '\0');
+  ssize_t n = 0;
+  while ((n = read(fd, buffer.data(), buffer.size())) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      close(fd);
+      return false;
+    }
+    hasher.Update(std::string_view(buffer.data(), static_cast<size_t>(n)));
+  }
+  close(fd);
+  *hash = hasher.Finish();
+  return true;
+}
+
+bool IsBodyHash(std::string_view text) {
+  if (text.size() != 32) {
+    return false;
+  }
+  for (char c : text) {
+    if (!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string BodyStore::RelativePath(const std::string& hash) {
+  return hash.substr(0, 2) + "/" + hash;
+}
+
+std::string BodyStore::PathFor(const std::string& hash) const {
+  return root_ + "/" + RelativePath(hash);
+}
+
+bool BodyStore::Reuse(const std::string& hash, uint64_t size) {
+  const std::string path = PathFor(hash);
+  if (access(path.c_str(), F_OK) != 0) {
+    return false;
+  }
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  ++reused_count_;
+  reused_bytes_ += size;
+  return true;
+}
+
+bool BodyStore::PrepareShard(const std::string& hash,
+                             std::string* temp_path) {
+  const std::filesystem::path shard =
+      std::filesystem::path(root_) / hash.substr(0, 2);
+  std::error_code ec;
+  std::filesystem::create_directories(shard, ec);
+  if (ec) {
+    return false;
+  }
+  *temp_path = (shard / (kTempPrefix + std::to_string(getpid()) + "-" +
+                         std::to_string(++temp_counter_)))
+                   .string();
+  return true;
+}
+
+bool BodyStore::Put(std::string_view data, std::string* hash) {
+  *hash = HashBody(data);
+  if (Reuse(*hash, data.size())) {
+    return true;
+  }
+  std::string temp_path;
+  if (!PrepareShard(*hash, &temp_path)) {
+    return false;
+  }
+  const int fd = open(temp_path.c_str(),
+                      O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool ok = WriteAll(fd, data.data(), data.size());
+  ok = close(fd) == 0 && ok;
+  if (!ok || rename(temp_path.c_str(), PathFor(*hash).c_str()) != 0) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  ++stored_count_;
+  stored_bytes_ += data.size();
+  return true;
+}
+
+bool BodyStore::Adopt(const std::string& path, std::string* hash) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0 || !HashBodyFile(path, hash)) {
+    return false;
+  }
+  const uint64_t size = static_cast<uint64_t>(info.st_size);
+  if (Reuse(*hash, size)) {
+    unlink(path.c_str());
+    return true;
+  }
+  std::string temp_path;
+  if (!PrepareShard(*hash, &temp_path)) {
+    return false;
+  }
+  const std::string blob_path = PathFor(*hash);
+  if (rename(path.c_str(), blob_path.c_str()) != 0) {
+    if (errno != EXDEV || !CopyFile(path, temp_path)) {
+      return false;
+    }
+    if (rename(temp_path.c_str(), blob_path.c_str()) != 0) {
+      unlink(temp_path.c_str());
+      return false;
+    }
+    unlink(path.c_str());
+  }
+  ++stored_count_;
+  stored_bytes_ += size;
+  return true;
+}
+
+bool CollectBodyStoreGarbage(const std::string& root,
+                             const std::unordered_set<std::string>& live,
+                             int grace_seconds,
+                             bool dry_run,
+                             BodyStoreGcResult* result,
+                             std::string* error) {
+  *result = BodyStoreGcResult();
+  std::error_code ec;
+  if (!std::filesystem::exists(root, ec)) {
+    return true;
+  }
+  const auto cutoff = std::chrono::system_clock::now() -
+                      std::chrono::seconds(grace_seconds);
+  std::filesystem::directory_iterator shards(root, ec);
+  if (ec) {
+    if (error) {
+      *error = root + ": " + ec.message();
+    }
+    return false;
+  }
+  for (const auto& shard : shards) {
+    if (!shard.is_directory(ec)) {
+      continue;
+    }
+    for (const auto& blob :
+         std::filesystem::directory_iterator(shard.path(), ec)) {
+      const std::string name = blob.path().filename().string();
+      const bool temp = name.rfind(kTempPrefix, 0) == 0;
+      if (!temp && !IsBodyHash(name)) {
+        continue;
+      }
+      struct stat info;
+      if (stat(blob.path().c_str(), &info) != 0) {
+        continue;
+      }
+      const auto modified = std::chrono::system_clock::from_time_t(
+          info.st_mtim.tv_sec);
+      if (modified > cutoff || (!temp && live.count(name) > 0)) {
+        ++result->kept;
+        continue;
+      }
+      if (!dry_run && unlink(blob.path().c_str()) != 0) {
+        if (error) {
+          *error = blob.path().string() + ": " + std::strerror(errno);
+        }
+        return false;
+      }
+      ++result->removed;
+      result->removed_bytes += static_cast<uint64_t>(info.st_size);
+    }
+    if (!dry_run) {
+      // Only succeeds once the shard is empty.
+      rmdir(shard.path().c_str());
+    }
+  }
+  return true;
+}
+
+}  // namespace rethread
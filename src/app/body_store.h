@@ -0,0 +1,101 @@
+#ifndef RETHREAD_APP_BODY_STORE_H_
+#define RETHREAD_APP_BODY_STORE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+
+namespace rethread {
+
+// Content hash of a body, fed incrementally: two XXH64 digests with
+// different seeds, printed as 32 hex digits. Fast rather than
+// cryptographic; it only has to tell real-world bodies apart.
+class BodyHasher {
+ public:
+  BodyHasher();
+
+  void Update(std::string_view data);
+  std::string Finish() const;
+
+ private:
+  struct Lane {
+    uint64_t seed = 0;
+    uint64_t acc[4] = {};
+  };
+
+  static void ConsumeStripe(Lane* lane, const unsigned char* stripe);
+  static uint64_t Digest(const Lane& lane,
+                         uint64_t total,
+                         const unsigned char* tail,
+                         size_t tail_size);
+
+  Lane lanes_[2];
+  unsigned char buffer_[32] = {};
+  size_t buffered_ = 0;
+  uint64_t total_ = 0;
+};
+
+std::string HashBody(std::string_view data);
+bool HashBodyFile(const std::string& path, std::string* hash);
+bool IsBodyHash(std::string_view text);
+
+// Capture bodies kept once under their hash, as ROOT/ab/abcdef...; every
+// record that saw the same bytes refers to the same file. Blobs are written
+// to a temporary name and renamed into place, so captures running at the
+// same time can share a store.
+class BodyStore {
+ public:
+  explicit BodyStore(std::string root) : root_(std::move(root)) {}
+
+  const std::string& root() const { return root_; }
+  // "ab/<hash>", relative to root().
+  static std::string RelativePath(const std::string& hash);
+  std::string PathFor(const std::string& hash) const;
+
+  // Stores |data| unless its blob already exists; |hash| gets the key.
+  bool Put(std::string_view data, std::string* hash);
+  // The same for a body already on disk at |path|. The file is moved into
+  // the store, or deleted when the store already has those bytes.
+  bool Adopt(const std::string& path, std::string* hash);
+
+  uint64_t stored_count() const { return stored_count_; }
+  uint64_t stored_bytes() const { return stored_bytes_; }
+  uint64_t reused_count() const { return reused_count_; }
+  uint64_t reused_bytes() const { return reused_bytes_; }
+
+ private:
+  // True when the blob for |hash| exists. Its mtime is refreshed so a gc
+  // running meanwhile treats it as new.
+  bool Reuse(const std::string& hash, uint64_t size);
+  bool PrepareShard(const std::string& hash, std::string* temp_path);
+
+  std::string root_;
+  uint64_t temp_counter_ = 0;
+  uint64_t stored_count_ = 0;
+  uint64_t stored_bytes_ = 0;
+  uint64_t reused_count_ = 0;
+  uint64_t reused_bytes_ = 0;
+};
+
+struct BodyStoreGcResult {
+  uint64_t kept = 0;
+  uint64_t removed = 0;
+  uint64_t removed_bytes = 0;
+};
+
+// Deletes blobs under |root| whose hash is not in |live|, along with
+// abandoned temporary files. Anything modified in the last |grace_seconds|
+// is kept, since a running capture stores a body before writing the record
+// that refers to it.
+bool CollectBodyStoreGarbage(const std::string& root,
+                             const std::unordered_set<std::string>& live,
+                             int grace_seconds,
+                             bool dry_run,
+                             BodyStoreGcResult* result,
+                             std::string* error);
+
+}  // namespace rethread
+
+#endif  // RETHREAD_APP_BODY_STORE_H_
@@ -0,0 +1,1061 @@
+#include "app/cdp_pipeline.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <utility>
+#include <sstream>
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonValue>
+#include <QUrl>
+
+#include "app/cli_util.h"
+#include "app/tab_cli.h"
+#include "app/user_dirs.h"
+
+namespace rethread {
+namespace {
+
+std::optional<int> ReadCdpPortFile(const std::string& user_data_dir) {
+  const std::string path = rethread::CdpPortPath(user_data_dir);
+  std::ifstream file(path);
+  if (!file.is_open()) {
+    return std::nullopt;
+  }
+  int port = 0;
+  file >> port;
+  if (!file || port <= 0 || port >= 65536) {
+    return std::nullopt;
+  }
+  return port;
+}
+
+int ConnectTcp(const std::string& host, int port) {
+  struct addrinfo hints;
+  std::memset(&hints, 0, sizeof(hints));
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_family = AF_UNSPEC;
+
+  struct addrinfo* res = nullptr;
+  const std::string port_str = std::to_string(port);
+  if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &res) != 0) {
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* p = res; p; p = p->ai_next) {
+    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
+      break;
+    }
+    close(fd);
+    fd = -1;
+  }
+  freeaddrinfo(res);
+  return fd;
+}
+
+bool ReadExact(int fd, void* buffer, size_t length) {
+  char* out = static_cast<char*>(buffer);
+  size_t remaining = length;
+  while (remaining > 0) {
+    ssize_t n = recv(fd, out, remaining, 0);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+      if (g_stop_requested) {
+        return false;
+      }
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    out += n;
+    remaining -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool ReadHttpHeaders(int fd, std::string* header_out,
+                     std::string* remainder_out) {
+  if (header_out) {
+    header_out->clear();
+  }
+  if (remainder_out) {
+    remainder_out->clear();
+  }
+  std::string data;
+  char buffer[4096];
+  ssize_t n = 0;
+  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+    data.append(buffer, static_cast<size_t>(n));
+    const size_t split = data.find("\r\n\r\n");
+    if (split != std::string::npos) {
+      if (header_out) {
+        header_out->assign(data.data(), split);
+      }
+      if (remainder_out) {
+        remainder_out->assign(data.data() + split + 4,
+                               data.size() - split - 4);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReadHttpResponse(int fd, std::string* header_out, std::string* body_out) {
+  if (header_out) {
+    header_out->clear();
+  }
+  if (body_out) {
+    body_out->clear();
+  }
+  std::string headers;
+  std::string remainder;
+  if (!ReadHttpHeaders(fd, &headers, &remainder)) {
+    return false;
+  }
+  if (header_out) {
+    *header_out = headers;
+  }
+
+  size_t content_length = 0;
+  bool has_length = false;
+  bool chunked = false;
+  std::istringstream stream(headers);
+  std::string line;
+  while (std::getline(stream, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    const std::string lower = ToLower(line);
+    const std::string length_prefix = "content-length:";
+    const std::string chunked_prefix = "transfer-encoding:";
+    if (lower.rfind(length_prefix, 0) == 0) {
+      std::string value = line.substr(length_prefix.size());
+      value = TrimWhitespace(value);
+      try {
+        content_length = static_cast<size_t>(std::stoul(value));
+        has_length = true;
+      } catch (...) {
+      }
+    } else if (lower.rfind(chunked_prefix, 0) == 0) {
+      if (lower.find("chunked") != std::string::npos) {
+        chunked = true;
+      }
+    }
+  }
+
+  std::string body;
+  if (chunked) {
+    body = remainder;
+    while (true) {
+      size_t pos = body.find("\r\n");
+      while (pos == std::string::npos) {
+        char buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+          break;
+        }
+        body.append(buffer, static_cast<size_t>(n));
+        pos = body.find("\r\n");
+      }
+      if (pos == std::string::npos) {
+        break;
+      }
+      std::string len_text = body.substr(0, pos);
+      size_t chunk_len = 0;
+      try {
+        chunk_len = static_cast<size_t>(std::stoul(len_text, nullptr, 16));
+      } catch (...) {
+        break;
+      }
+      if (body.size() < pos + 2 + chunk_len + 2) {
+        char buffer[4096];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0) {
+          break;
+        }
+        body.append(buffer, static_cast<size_t>(n));
+        continue;
+      }
+      const size_t chunk_start = pos + 2;
+      std::string chunk = body.substr(chunk_start, chunk_len);
+      std::string rest = body.substr(chunk_start + chunk_len + 2);
+      if (chunk_len == 0) {
+        body = rest;
+        break;
+      }
+      body = chunk + rest;
+    }
+  } else if (has_length) {
+    body = remainder;
+    while (body.size() < content_length) {
+      char buffer[4096];
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        break;
+      }
+      body.append(buffer, static_cast<size_t>(n));
+    }
+    if (body.size() > content_length) {
+      body.resize(content_length);
+    }
+  } else {
+    body = remainder;
+    char buffer[4096];
+    ssize_t n = 0;
+    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+      body.append(buffer, static_cast<size_t>(n));
+    }
+  }
+
+  if (body_out) {
+    *body_out = std::move(body);
+  }
+  return true;
+}
+
+bool HttpGetJson(const std::string& host, int port, const std::string& path,
+                 QJsonDocument* doc_out, std::string* error_out) {
+  if (error_out) {
+    error_out->clear();
+  }
+  int fd = ConnectTcp(host, port);
+  if (fd < 0) {
+    if (error_out) {
+      *error_out = "Failed to connect to CDP port";
+    }
+    return false;
+  }
+  std::ostringstream request;
+  request << "GET " << path << " HTTP/1.1\r\n"
+          << "Host: " << host << ":" << port << "\r\n"
+          << "Connection: close\r\n\r\n";
+  const std::string payload = request.str();
+  if (!SendAll(fd, payload.data(), payload.size())) {
+    if (error_out) {
+      *error_out = "Failed to send HTTP request";
+    }
+    close(fd);
+    return false;
+  }
+  std::string headers;
+  std::string body;
+  if (!ReadHttpResponse(fd, &headers, &body)) {
+    if (error_out) {
+      *error_out = "Failed to read HTTP response";
+    }
+    close(fd);
+    return false;
+  }
+  close(fd);
+
+  if (headers.find("200") == std::string::npos) {
+    if (error_out) {
+      *error_out = "Unexpected HTTP response";
+    }
+    return false;
+  }
+
+  QJsonParseError parse_error;
+  QJsonDocument doc = QJsonDocument::fromJson(
+      QByteArray::fromStdString(body), &parse_error);
+  if (parse_error.error != QJsonParseError::NoError) {
+    if (error_out) {
+      *error_out = "Failed to parse JSON response";
+    }
+    return false;
+  }
+  if (doc_out) {
+    *doc_out = doc;
+  }
+  return true;
+}
+
+std::string GenerateWebSocketKey() {
+  std::array<unsigned char, 16> data;
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_int_distribution<int> dist(0, 255);
+  for (auto& byte : data) {
+    byte = static_cast<unsigned char>(dist(gen));
+  }
+  return Base64Encode(std::string(
+      reinterpret_cast<const char*>(data.data()), data.size()));
+}
+
+bool WebSocketHandshake(int fd, const std::string& host, int port,
+                        const std::string& path, std::string* error_out,
+                        std::string* prefetch_out) {
+  if (error_out) {
+    error_out->clear();
+  }
+  const std::string key = GenerateWebSocketKey();
+  std::ostringstream request;
+  request << "GET " << path << " HTTP/1.1\r\n"
+          << "Host: " << host << ":" << port << "\r\n"
+          << "Upgrade: websocket\r\n"
+          << "Connection: Upgrade\r\n"
+          << "Sec-WebSocket-Key: " << key << "\r\n"
+          << "Sec-WebSocket-Version: 13\r\n\r\n";
+  const std::string payload = request.str();
+  if (!SendAll(fd, payload.data(), payload.size())) {
+    if (error_out) {
+      *error_out = "Failed to send WebSocket handshake";
+    }
+    return false;
+  }
+  std::string headers;
+  std::string remainder;
+  if (!ReadHttpHeaders(fd, &headers, &remainder)) {
+    if (error_out) {
+      *error_out = "Failed to read WebSocket handshake";
+    }
+    return false;
+  }
+  if (headers.find("101") == std::string::npos) {
+    if (error_out) {
+      *error_out = "WebSocket handshake rejected";
+    }
+    return false;
+  }
+  if (prefetch_out) {
+    *prefetch_out = remainder;
+  }
+  return true;
+}
+
+// Client frames are always masked.
+std::string BuildWebSocketTextFrame(const std::string& payload) {
+  std::string frame;
+  frame.reserve(payload.size() + 14);
+  frame.push_back(0x81);
+  const size_t len = payload.size();
+  if (len < 126) {
+    frame.push_back(static_cast<unsigned char>(0x80 | len));
+  } else if (len <= 0xFFFF) {
+    frame.push_back(0x80 | 126);
+    frame.push_back(static_cast<unsigned char>((len >> 8) & 0xFF));
+    frame.push_back(static_cast<unsigned char>(len & 0xFF));
+  } else {
+    frame.push_back(0x80 | 127);
+    for (int i = 7; i >= 0; --i) {
+      frame.push_back(static_cast<unsigned char>((len >> (8 * i)) & 0xFF));
+    }
+  }
+  std::array<unsigned char, 4> mask;
+  std::random_device rd;
+  for (auto& byte : mask) {
+    byte = static_cast<unsigned char>(rd());
+  }
+  frame.insert(frame.end(), mask.begin(), mask.end());
+  for (size_t i = 0; i < payload.size(); ++i) {
+    frame.push_back(static_cast<char>(payload[i] ^ mask[i % mask.size()]));
+  }
+  return frame;
+}
+
+struct WebSocketFrame {
+  unsigned char opcode = 0;
+  bool fin = false;
+  char* payload = nullptr;
+  size_t payload_size = 0;
+  size_t frame_size = 0;
+};
+
+// Locates the frame at the start of |data| without copying it; a masked
+// payload is unmasked in place. Returns false until the whole frame is there.
+bool ParseWebSocketFrame(char* data, size_t available, WebSocketFrame* frame) {
+  const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+  if (available < 2) {
+    return false;
+  }
+  size_t header = 2;
+  uint64_t length = bytes[1] & 0x7F;
+  if (length == 126) {
+    header += 2;
+    if (available < header) {
+      return false;
+    }
+    length = (static_cast<uint64_t>(bytes[2]) << 8) | bytes[3];
+  } else if (length == 127) {
+    header += 8;
+    if (available < header) {
+      return false;
+    }
+    length = 0;
+    for (int i = 0; i < 8; ++i) {
+      length = (length << 8) | bytes[2 + i];
+    }
+  }
+  const bool masked = (bytes[1] & 0x80) != 0;
+  const size_t mask_offset = header;
+  if (masked) {
+    header += 4;
+  }
+  if (available < header || available - header < length) {
+    return false;
+  }
+  frame->opcode = bytes[0] & 0x0F;
+  frame->fin = (bytes[0] & 0x80) != 0;
+  frame->payload = data + header;
+  frame->payload_size = static_cast<size_t>(length);
+  frame->frame_size = header + frame->payload_size;
+  if (masked) {
+    const unsigned char mask[4] = {bytes[mask_offset], bytes[mask_offset + 1],
+                                   bytes[mask_offset + 2],
+                                   bytes[mask_offset + 3]};
+    for (size_t k = 0; k < frame->payload_size; ++k) {
+      frame->payload[k] = static_cast<char>(frame->payload[k] ^ mask[k % 4]);
+    }
+  }
+  return true;
+}
+
+// |session_id| routes the command to a target attached over a browser-wide
+// connection; leave it empty to talk to the connected target itself.
+std::string BuildCdpRequest(int request_id,
+                            const QString& method,
+                            const QJsonObject& params,
+                            const std::string& session_id) {
+  QJsonObject payload;
+  payload.insert(QStringLiteral("id"), request_id);
+  if (!session_id.empty()) {
+    payload.insert(QStringLiteral("sessionId"),
+                   QString::fromStdString(session_id));
+  }
+  payload.insert(QStringLiteral("method"), method);
+  if (!params.isEmpty()) {
+    payload.insert(QStringLiteral("params"), params);
+  }
+  QJsonDocument doc(payload);
+  return doc.toJson(QJsonDocument::Compact).toStdString();
+}
+
+class CdpMessageScanner {
+ public:
+  explicit CdpMessageScanner(std::string_view text) : text_(text) {}
+
+  bool Scan(CdpMessageSummary* summary) {
+    summary_ = summary;
+    SkipWhitespace();
+    return ScanObject(Scope::kRoot);
+  }
+
+ private:
+  enum class Scope {
+    kRoot,
+    kParams,
+    kRequest,
+    kResponse,
+    kIgnored,
+  };
+
+  void SkipWhitespace() {
+    while (pos_ < text_.size() &&
+           (text_[pos_] == ' ' || text_[pos_] == '\n' || text_[pos_] == '\r' ||
+            text_[pos_] == '\t')) {
+      ++pos_;
+    }
+  }
+
+  bool Consume(char expected) {
+    SkipWhitespace();
+    if (pos_ >= text_.size() || text_[pos_] != expected) {
+      return false;
+    }
+    ++pos_;
+    return true;
+  }
+
+  static void AppendUtf8(uint32_t code_point, std::string* out) {
+    if (code_point < 0x80) {
+      out->push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+      out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+      out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+      out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+      out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+      out->push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+      out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+      out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+  }
+
+  bool ReadHex4(uint32_t* value) {
+    if (text_.size() - pos_ < 4) {
+      return false;
+    }
+    *value = 0;
+    for (int i = 0; i < 4; ++i) {
+      const char c = text_[pos_++];
+      *value <<= 4;
+      if (c >= '0' && c <= '9') {
+        *value |= static_cast<uint32_t>(c - '0');
+      } else if (c >= 'a' && c <= 'f') {
+        *value |= static_cast<uint32_t>(c - 'a' + 10);
+      } else if (c >= 'A' && c <= 'F') {
+        *value |= static_cast<uint32_t>(c - 'A' + 10);
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Reads a string starting at the opening quote. |out| may be null to skip.
+  bool ReadString(std::string* out) {
+    if (!Consume('"')) {
+      return false;
+    }
+    while (pos_ < text_.size()) {
+      const size_t run_end = text_.find_first_of("\"\\", pos_);
+      if (run_end == std::string_view::npos) {
+        return false;
+      }
+      if (out) {
+        out->append(text_.substr(pos_, run_end - pos_));
+      }
+      pos_ = run_end + 1;
+      if (text_[run_end] == '"') {
+        return true;
+      }
+      if (pos_ >= text_.size()) {
+        return false;
+      }
+      const char escape = text_[pos_++];
+      char decoded = 0;
+      switch (escape) {
+        case '"':
+        case '\\':
+        case '/':
+          decoded = escape;
+          break;
+        case 'b':
+          decoded = '\b';
+          break;
+        case 'f':
+          decoded = '\f';
+          break;
+        case 'n':
+          decoded = '\n';
+          break;
+        case 'r':
+          decoded = '\r';
+          break;
+        case 't':
+          decoded = '\t';
+          break;
+        case 'u': {
+          uint32_t code_point = 0;
+          if (!ReadHex4(&code_point)) {
+            return false;
+          }
+          if (code_point >= 0xD800 && code_point < 0xDC00 &&
+              text_.substr(pos_, 2) == "\\u") {
+            pos_ += 2;
+            uint32_t low = 0;
+            if (!ReadHex4(&low)) {
+              return false;
+            }
+            code_point = 0x10000 + ((code_point - 0xD800) << 10) +
+                         (low - 0xDC00);
+          }
+          if (out) {
+            AppendUtf8(code_point, out);
+          }
+          continue;
+        }
+        default:
+          return false;
+      }
+      if (out) {
+        out->push_back(decoded);
+      }
+    }
+    return false;
+  }
+
+  // Reads a number or literal as its source text.
+  bool ReadScalar(std::string* out) {
+    SkipWhitespace();
+    const size_t start = pos_;
+    while (pos_ < text_.size() && text_[pos_] != ',' && text_[pos_] != '}' &&
+           text_[pos_] != ']' && text_[pos_] != ' ' && text_[pos_] != '\n' &&
+           text_[pos_] != '\r' && text_[pos_] != '\t') {
+      ++pos_;
+    }
+    if (pos_ == start) {
+      return false;
+    }
+    if (out) {
+      out->assign(text_.substr(start, pos_ - start));
+    }
+    return true;
+  }
+
+  bool SkipValue() {
+    SkipWhitespace();
+    if (pos_ >= text_.size()) {
+      return false;
+    }
+    const char c = text_[pos_];
+    if (c == '"') {
+      return ReadString(nullptr);
+    }
+    if (c == '{') {
+      return ScanObject(Scope::kIgnored);
+    }
+    if (c == '[') {
+      ++pos_;
+      if (Consume(']')) {
+        return true;
+      }
+      do {
+        if (!SkipValue()) {
+          return false;
+        }
+      } while (Consume(','));
+      return Consume(']');
+    }
+    return ReadScalar(nullptr);
+  }
+
+  // Returns where the value of |key| in |scope| should be stored, or null
+  // when it is not one of the summary fields.
+  std::string* StringSlot(Scope scope, const std::string& key) {
+    switch (scope) {
+      case Scope::kRoot:
+        if (key == "sessionId") {
+          return &summary_->session_id;
+        }
+        return key == "method" ? &summary_->method : nullptr;
+      case Scope::kParams:
+        if (key == "timestamp") {
+          return &summary_->timestamp;
+        }
+        if (key == "encodedDataLength") {
+          return &summary_->encoded_data_length;
+        }
+        return key == "requestId" ? &summary_->request_id : nullptr;
+      case Scope::kRequest:
+        if (key == "url") {
+          return &summary_->url;
+        }
+        return key == "method" ? &summary_->request_method : nullptr;
+      case Scope::kResponse:
+        if (key == "url") {
+          return &summary_->url;
+        }
+        if (key == "status") {
+          return &summary_->status;
+        }
+        return key == "mimeType" ? &summary_->mime_type : nullptr;
+      case Scope::kIgnored:
+        return nullptr;
+    }
+    return nullptr;
+  }
+
+  static Scope ChildScope(Scope scope, const std::string& key) {
+    if (scope == Scope::kRoot && key == "params") {
+      return Scope::kParams;
+    }
+    if (scope == Scope::kParams && key == "request") {
+      return Scope::kRequest;
+    }
+    if (scope == Scope::kParams && key == "response") {
+      return Scope::kResponse;
+    }
+    return Scope::kIgnored;
+  }
+
+  bool ScanObject(Scope scope) {
+    if (!Consume('{')) {
+      return false;
+    }
+    if (Consume('}')) {
+      return true;
+    }
+    std::string key;
+    do {
+      key.clear();
+      SkipWhitespace();
+      if (!ReadString(&key) || !Consume(':')) {
+        return false;
+      }
+      SkipWhitespace();
+      if (pos_ >= text_.size()) {
+        return false;
+      }
+      const char c = text_[pos_];
+      const Scope child = ChildScope(scope, key);
+      if (c == '{' && child != Scope::kIgnored) {
+        if (!ScanObject(child)) {
+          return false;
+        }
+        continue;
+      }
+      if (scope == Scope::kRoot && key == "id" && c != '"') {
+        std::string id_text;
+        if (!ReadScalar(&id_text)) {
+          return false;
+        }
+        summary_->has_id = true;
+        summary_->id = std::atoi(id_text.c_str());
+        continue;
+      }
+      std::string* slot = StringSlot(scope, key);
+      if (!slot) {
+        if (!SkipValue()) {
+          return false;
+        }
+        continue;
+      }
+      if (!(c == '"' ? ReadString(slot) : ReadScalar(slot))) {
+        return false;
+      }
+    } while (Consume(','));
+    return Consume('}');
+  }
+
+  std::string_view text_;
+  size_t pos_ = 0;
+  CdpMessageSummary* summary_ = nullptr;
+};
+
+}  // namespace
+
+void CdpPipeline::Prefill(const std::string& bytes) {
+  if (inbox.size() < bytes.size()) {
+    inbox.resize(bytes.size());
+  }
+  std::memcpy(inbox.data(), bytes.data(), bytes.size());
+  inbox_start = 0;
+  inbox_end = bytes.size();
+}
+
+int CdpPipeline::Send(const QString& method,
+                      const QJsonObject& params,
+                      const std::string& session_id) {
+  const int request_id = next_id++;
+  outbox += BuildWebSocketTextFrame(
+      BuildCdpRequest(request_id, method, params, session_id));
+  return request_id;
+}
+
+bool CdpPipeline::Flush() {
+  size_t sent = 0;
+  while (sent < outbox.size()) {
+    const ssize_t n = send(fd, outbox.data() + sent, outbox.size() - sent,
+                           MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  outbox.erase(0, sent);
+  return true;
+}
+
+void CdpPipeline::ReserveTail() {
+  if (inbox.size() - inbox_end >= kCdpReadBytes) {
+    return;
+  }
+  const size_t live = inbox_end - inbox_start;
+  if (inbox_start > 0) {
+    std::memmove(inbox.data(), inbox.data() + inbox_start, live);
+    inbox_start = 0;
+    inbox_end = live;
+  }
+  if (inbox.size() - inbox_end < kCdpReadBytes) {
+    inbox.resize(std::max(inbox.size() * 2, inbox_end + kCdpReadBytes));
+  }
+}
+
+bool CdpPipeline::Receive(std::vector<std::string_view>* messages) {
+  assembled.clear();
+  bool open = true;
+  while (true) {
+    ReserveTail();
+    const ssize_t n = recv(fd, inbox.data() + inbox_end,
+                           inbox.size() - inbox_end, 0);
+    if (n > 0) {
+      inbox_end += static_cast<size_t>(n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    }
+    open = false;
+    break;
+  }
+
+  WebSocketFrame frame;
+  while (ParseWebSocketFrame(inbox.data() + inbox_start,
+                             inbox_end - inbox_start, &frame)) {
+    inbox_start += frame.frame_size;
+    const std::string_view payload(frame.payload, frame.payload_size);
+    if (frame.opcode == 0x8) {
+      open = false;
+      break;
+    }
+    if (frame.opcode == 0x9) {
+      // Masked, empty pong.
+      outbox.append("\x8A\x80\0\0\0\0", 6);
+      continue;
+    }
+    if (frame.opcode == 0x1 && frame.fin) {
+      messages->push_back(payload);
+      continue;
+    }
+    if (frame.opcode == 0x1) {
+      assembling = true;
+      fragments.assign(payload);
+      continue;
+    }
+    if (frame.opcode != 0x0 || !assembling) {
+      continue;
+    }
+    fragments.append(payload);
+    if (frame.fin) {
+      assembling = false;
+      assembled.push_back(std::move(fragments));
+      fragments.clear();
+      messages->push_back(assembled.back());
+    }
+  }
+  if (inbox_start == inbox_end) {
+    inbox_start = 0;
+    inbox_end = 0;
+  }
+  return open;
+}
+
+bool ConnectCdpPipeline(const std::string& user_data_dir,
+                        int tab_id,
+                        int cdp_port,
+                        CdpPipeline* cdp,
+                        std::string* devtools_id) {
+  const bool all_tabs = tab_id <= 0;
+  devtools_id->clear();
+  if (!all_tabs) {
+    std::ostringstream payload;
+    payload << "devtools-id " << tab_id << "\n";
+    std::string response;
+    if (!SendCommandCapture(TabSocketPath(user_data_dir), payload.str(),
+                            &response)) {
+      return false;
+    }
+    response = TrimWhitespace(response);
+    if (response.rfind("ERR", 0) == 0) {
+      std::cerr << response << "\n";
+      return false;
+    }
+    *devtools_id = response;
+    if (devtools_id->empty()) {
+      std::cerr << "Failed to resolve devtools id\n";
+      return false;
+    }
+  }
+
+  if (cdp_port <= 0) {
+    const auto port_from_file = ReadCdpPortFile(user_data_dir);
+    cdp_port = port_from_file ? *port_from_file : 9222;
+  }
+
+  // The browser endpoint lets one connection attach to every page; a tab's
+  // own target is used directly otherwise.
+  QJsonDocument target_doc;
+  std::string http_error;
+  NetworkLogDebug("fetching targets");
+  if (!HttpGetJson("127.0.0.1", cdp_port,
+                   all_tabs ? "/json/version" : "/json/list", &target_doc,
+                   &http_error)) {
+    std::cerr << "Failed to fetch CDP targets: " << http_error << "\n";
+    return false;
+  }
+  QString ws_url;
+  if (all_tabs) {
+    ws_url = target_doc.object()
+                 .value(QStringLiteral("webSocketDebuggerUrl"))
+                 .toString();
+    if (ws_url.isEmpty()) {
+      std::cerr << "CDP browser endpoint not found\n";
+      return false;
+    }
+  } else {
+    if (!target_doc.isArray()) {
+      std::cerr << "Unexpected CDP target response\n";
+      return false;
+    }
+    const QJsonArray targets = target_doc.array();
+    for (const QJsonValue& entry : targets) {
+      const QJsonObject obj = entry.toObject();
+      if (obj.value(QStringLiteral("id")).toString().toStdString() ==
+          *devtools_id) {
+        ws_url = obj.value(QStringLiteral("webSocketDebuggerUrl")).toString();
+        break;
+      }
+    }
+    if (ws_url.isEmpty()) {
+      std::cerr << "CDP target not found for tab id " << tab_id << "\n";
+      return false;
+    }
+  }
+
+  QUrl url(ws_url);
+  if (!url.isValid() || url.scheme() != QStringLiteral("ws")) {
+    std::cerr << "Invalid WebSocket URL: " << ws_url.toStdString() << "\n";
+    return false;
+  }
+  const std::string host = url.host().toStdString();
+  const int port = url.port(cdp_port);
+  std::string path = url.path().toStdString();
+  if (!url.query().isEmpty()) {
+    path += "?" + url.query().toStdString();
+  }
+
+  int fd = ConnectTcp(host.empty() ? "127.0.0.1" : host, port);
+  if (fd < 0) {
+    std::cerr << "Failed to connect to CDP WebSocket\n";
+    return false;
+  }
+  NetworkLogDebug("connected websocket");
+  SetSocketTimeout(fd, 250);
+  std::string ws_error;
+  std::string ws_prefetch;
+  if (!WebSocketHandshake(fd, host.empty() ? "127.0.0.1" : host, port, path,
+                          &ws_error, &ws_prefetch)) {
+    std::cerr << "WebSocket handshake failed: " << ws_error << "\n";
+    close(fd);
+    return false;
+  }
+
+  if (!SetNonBlocking(fd)) {
+    std::cerr << "Failed to configure CDP socket\n";
+    close(fd);
+    return false;
+  }
+  cdp->fd = fd;
+  cdp->Prefill(ws_prefetch);
+  return true;
+}
+
+bool ScanCdpMessage(std::string_view text, CdpMessageSummary* summary) {
+  return CdpMessageScanner(text).Scan(summary);
+}
+
+QJsonObject ParseCdpMessage(std::string_view message) {
+  return QJsonDocument::fromJson(
+             QByteArray::fromRawData(message.data(),
+                                     static_cast<qsizetype>(message.size())))
+      .object();
+}
+
+double TimingTotalMs(const NetworkTiming& timing) {
+  double total = 0;
+  for (double phase : {timing.blocked, timing.dns, timing.connect,
+                       timing.send, timing.wait, timing.receive}) {
+    total += std::max(phase, 0.0);
+  }
+  return total;
+}
+
+NetworkTiming TimingFromResource(const QJsonObject& resource_timing,
+                                 double started_at) {
+  NetworkTiming timing;
+  const double request_time =
+      resource_timing.value(QStringLiteral("requestTime")).toDouble(-1);
+  if (request_time < 0) {
+    return timing;
+  }
+  auto offset = [&resource_timing](const char* key) {
+    return resource_timing.value(QString::fromLatin1(key)).toDouble(-1);
+  };
+  auto phase = [&offset](const char* start_key, const char* end_key) {
+    const double start = offset(start_key);
+    const double end = offset(end_key);
+    return start >= 0 && end >= start ? end - start : -1.0;
+  };
+  timing.dns = phase("dnsStart", "dnsEnd");
+  timing.connect = phase("connectStart", "connectEnd");
+  timing.ssl = phase("sslStart", "sslEnd");
+  timing.send = phase("sendStart", "sendEnd");
+  const double send_end = offset("sendEnd");
+  const double headers_end = offset("receiveHeadersEnd");
+  if (send_end >= 0 && headers_end >= send_end) {
+    timing.wait = headers_end - send_end;
+  }
+  double first_phase = 0;
+  for (const char* key : {"dnsStart", "connectStart", "sendStart"}) {
+    if (offset(key) >= 0) {
+      first_phase = offset(key);
+      break;
+    }
+  }
+  const double queued = started_at >= 0 && request_time >= started_at
+                            ? (request_time - started_at) * 1000
+                            : 0;
+  timing.blocked = queued + first_phase;
+  if (headers_end >= 0) {
+    timing.headers_at = request_time + headers_end / 1000;
+  }
+  return timing;
+}
+
+void FinishTiming(NetworkTiming* timing,
+                  double started_at,
+                  double finished_at) {
+  if (finished_at < 0) {
+    return;
+  }
+  if (timing->headers_at >= 0 && finished_at >= timing->headers_at) {
+    timing->receive = (finished_at - timing->headers_at) * 1000;
+  } else if (started_at >= 0 && finished_at >= started_at) {
+    timing->receive = (finished_at - started_at) * 1000;
+  }
+}
+
+QJsonObject TimingJson(const NetworkTiming& timing) {
+  QJsonObject object;
+  object.insert(QStringLiteral("blocked"), timing.blocked);
+  object.insert(QStringLiteral("dns"), timing.dns);
+  object.insert(QStringLiteral("connect"), timing.connect);
+  object.insert(QStringLiteral("ssl"), timing.ssl);
+  // HAR requires these three to be non-negative.
+  object.insert(QStringLiteral("send"), std::max(timing.send, 0.0));
+  object.insert(QStringLiteral("wait"), std::max(timing.wait, 0.0));
+  object.insert(QStringLiteral("receive"), std::max(timing.receive, 0.0));
+  return object;
+}
+
+}  // namespace rethread
@@ -0,0 +1,114 @@
+#ifndef RETHREAD_APP_CDP_PIPELINE_H_
+#define RETHREAD_APP_CDP_PIPELINE_H_
+
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <QJsonObject>
+#include <QString>
+
+namespace rethread {
+
+constexpr size_t kCdpInboxInitialBytes = 256 * 1024;
+constexpr size_t kCdpReadBytes = 64 * 1024;
+
+// Non-blocking CDP session for event loops. Requests queue in |outbox| until
+// the socket takes them, and any number may be outstanding at once; replies
+// are matched by id by the caller.
+struct CdpPipeline {
+  int fd = -1;
+  int next_id = 1;
+  // Incoming bytes live in [inbox_start, inbox_end). Consumed frames only
+  // advance inbox_start; the live tail is moved to the front lazily, when
+  // the free space behind it runs low, instead of after every message.
+  std::vector<char> inbox = std::vector<char>(kCdpInboxInitialBytes);
+  size_t inbox_start = 0;
+  size_t inbox_end = 0;
+  std::string outbox;
+  std::string fragments;
+  bool assembling = false;
+  // Reassembled fragmented messages, kept alive until the next Receive.
+  std::deque<std::string> assembled;
+
+  void Prefill(const std::string& bytes);
+  int Send(const QString& method,
+           const QJsonObject& params,
+           const std::string& session_id = std::string());
+  bool Flush();
+
+  // Makes room for at least kCdpReadBytes after inbox_end.
+  void ReserveTail();
+
+  // Reads whatever the socket has and appends a view of each complete text
+  // message to |messages|. The views point into the read buffer and stay
+  // valid until the next Receive. Returns false once the peer has closed.
+  bool Receive(std::vector<std::string_view>* messages);
+};
+
+// Connects |cdp|, non-blocking, to the CDP WebSocket of tab |tab_id|, or
+// to the browser-wide endpoint when |tab_id| is 0. A |cdp_port| of 0 means
+// the port the browser recorded in its profile, else 9222. Errors are
+// printed; |devtools_id| gets the tab's target id.
+bool ConnectCdpPipeline(const std::string& user_data_dir,
+                        int tab_id,
+                        int cdp_port,
+                        CdpPipeline* cdp,
+                        std::string* devtools_id);
+
+// The few fields network-log routes on, pulled from a CDP message in one pass
+// over its text. Everything else is skipped without being decoded, so a full
+// QJsonDocument parse is only paid for messages that are kept.
+struct CdpMessageSummary {
+  bool has_id = false;
+  int id = 0;
+  std::string method;
+  std::string session_id;
+  std::string request_id;
+  std::string url;
+  std::string request_method;
+  std::string status;
+  std::string mime_type;
+  // loadingFinished's timestamp and encodedDataLength, as source text.
+  std::string timestamp;
+  std::string encoded_data_length;
+};
+
+// Fills |summary| from |text|; false when the message is not valid JSON.
+bool ScanCdpMessage(std::string_view text, CdpMessageSummary* summary);
+QJsonObject ParseCdpMessage(std::string_view message);
+
+// Phase durations of one request in milliseconds, following HAR: -1 marks a
+// phase that did not happen, and |connect| includes |ssl|.
+struct NetworkTiming {
+  double blocked = -1;
+  double dns = -1;
+  double connect = -1;
+  double ssl = -1;
+  double send = -1;
+  double wait = -1;
+  double receive = -1;
+  // When the response headers arrived, on the CDP monotonic clock in
+  // seconds; loadingFinished measures |receive| from here.
+  double headers_at = -1;
+};
+
+double TimingTotalMs(const NetworkTiming& timing);
+// Builds the phases known once the response headers are in from CDP's
+// ResourceTiming, whose offsets are milliseconds after its requestTime.
+// |started_at| is requestWillBeSent's timestamp, so time queued before
+// requestTime counts as blocked.
+NetworkTiming TimingFromResource(const QJsonObject& resource_timing,
+                                 double started_at);
+// Completes |timing| with loadingFinished's timestamp. Responses without
+// ResourceTiming (cache, data: URLs) count as one receive phase.
+void FinishTiming(NetworkTiming* timing,
+                  double started_at,
+                  double finished_at);
+QJsonObject TimingJson(const NetworkTiming& timing);
+
+}  // namespace rethread
+
+#endif  // RETHREAD_APP_CDP_PIPELINE_H_
@@ -0,0 +1,387 @@
+#include "app/cli_util.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include <QByteArray>
+#include <QJsonDocument>
+
+#include "app/user_dirs.h"
+
+namespace {
+
+bool NetworkLogDebugEnabled() {
+  const char* value = std::getenv("RETHREAD_NETWORK_LOG_DEBUG");
+  return value && value[0] != '\0';
+}
+
+}  // namespace
+
+namespace rethread {
+
+volatile sig_atomic_t g_stop_requested = 0;
+
+void HandleStopSignal(int) {
+  g_stop_requested = 1;
+}
+
+bool ParseUserDataDir(int argc,
+                      char* argv[],
+                      const std::string& default_root,
+                      std::string* user_data_dir,
+                      int* index) {
+  if (!user_data_dir || !index) {
+    return false;
+  }
+  bool user_data_override = false;
+  bool profile_specified = false;
+  std::string profile_name = rethread::kDefaultProfileName;
+  const char* env_dir = std::getenv("RETHREAD_USER_DATA_DIR");
+  const std::string env_user_data_dir =
+      (env_dir && env_dir[0] != '\0') ? std::string(env_dir) : std::string();
+  for (; *index < argc; ++(*index)) {
+    std::string arg = argv[*index];
+    const std::string prefix = "--user-data-dir=";
+    if (arg.rfind(prefix, 0) == 0) {
+      *user_data_dir = arg.substr(prefix.size());
+      user_data_override = true;
+      continue;
+    }
+    if (arg == "--user-data-dir") {
+      if (*index + 1 >= argc) {
+        std::cerr << "Missing value after --user-data-dir\n";
+        return false;
+      }
+      *user_data_dir = argv[++(*index)];
+      user_data_override = true;
+      continue;
+    }
+    const std::string profile_prefix = "--profile=";
+    if (arg.rfind(profile_prefix, 0) == 0) {
+      profile_name = arg.substr(profile_prefix.size());
+      profile_specified = true;
+      continue;
+    }
+    if (arg == "--profile") {
+      if (*index + 1 >= argc) {
+        std::cerr << "Missing value after --profile\n";
+        return false;
+      }
+      profile_name = argv[++(*index)];
+      profile_specified = true;
+      continue;
+    }
+    break;
+  }
+  if (!user_data_override) {
+    if (profile_specified) {
+      std::string profile = profile_name.empty() ? rethread::kDefaultProfileName
+                                                 : profile_name;
+      if (default_root.empty()) {
+        *user_data_dir = profile;
+      } else if (default_root.back() == '/' || default_root.back() == '\\') {
+        *user_data_dir = default_root + profile;
+      } else {
+        *user_data_dir = default_root + "/" + profile;
+      }
+    } else if (!env_user_data_dir.empty()) {
+      *user_data_dir = env_user_data_dir;
+    } else {
+      std::string profile = rethread::kDefaultProfileName;
+      if (default_root.empty()) {
+        *user_data_dir = profile;
+      } else if (default_root.back() == '/' || default_root.back() == '\\') {
+        *user_data_dir = default_root + profile;
+      } else {
+        *user_data_dir = default_root + "/" + profile;
+      }
+    }
+  }
+  return true;
+}
+
+bool SendCommand(const std::string& socket_path, const std::string& payload) {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+                socket_path.c_str());
+
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    std::cerr << "Failed to connect to " << socket_path << ": "
+              << std::strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+
+  if (write(fd, payload.data(), payload.size()) < 0) {
+    std::cerr << "Failed to send command: " << std::strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+
+  // Large reads keep multi-megabyte responses (e.g. eval --raw-output) cheap.
+  static char buffer[64 * 1024];
+  ssize_t n = 0;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    // Flushing per read lets streamed replies reach a pipe as they arrive.
+    std::cout.write(buffer, n);
+    std::cout.flush();
+  }
+  close(fd);
+  return true;
+}
+
+bool SendCommandCapture(const std::string& socket_path,
+                        const std::string& payload,
+                        std::string* response) {
+  if (response) {
+    response->clear();
+  }
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
+    return false;
+  }
+
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+                socket_path.c_str());
+
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    std::cerr << "Failed to connect to " << socket_path << ": "
+              << std::strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+
+  if (write(fd, payload.data(), payload.size()) < 0) {
+    std::cerr << "Failed to send command: " << std::strerror(errno) << "\n";
+    close(fd);
+    return false;
+  }
+
+  char buffer[512];
+  ssize_t n = 0;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+    if (response) {
+      response->append(buffer, static_cast<size_t>(n));
+    }
+  }
+  close(fd);
+  return true;
+}
+
+bool ParsePositiveInt(const std::string& text, int* value) {
+  if (!value) {
+    return false;
+  }
+  errno = 0;
+  char* end = nullptr;
+  long parsed = std::strtol(text.c_str(), &end, 10);
+  if (errno != 0 || !end || *end != '\0' || parsed <= 0 ||
+      parsed > std::numeric_limits<int>::max()) {
+    return false;
+  }
+  *value = static_cast<int>(parsed);
+  return true;
+}
+
+bool IsValidScriptId(const std::string& id) {
+  if (id.empty()) {
+    return false;
+  }
+  for (char c : id) {
+    if (std::isalnum(static_cast<unsigned char>(c)) ||
+        c == '-' || c == '_' || c == '.') {
+      continue;
+    }
+    if (c == '/' || c == '\\') {
+      return false;
+    }
+    return false;
+  }
+  return true;
+}
+
+std::string HexEncode(const std::string& input) {
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string output;
+  output.reserve(input.size() * 2);
+  for (unsigned char c : input) {
+    output.push_back(kHex[(c >> 4) & 0xF]);
+    output.push_back(kHex[c & 0xF]);
+  }
+  return output;
+}
+
+std::string TrimWhitespace(const std::string& input) {
+  const size_t start = input.find_first_not_of(" \t\r\n");
+  if (start == std::string::npos) {
+    return std::string();
+  }
+  const size_t end = input.find_last_not_of(" \t\r\n");
+  return input.substr(start, end - start + 1);
+}
+
+std::string ToLower(std::string value) {
+  std::transform(value.begin(), value.end(), value.begin(),
+                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+  return value;
+}
+
+std::string Base64Encode(const std::string& data) {
+  static constexpr char kAlphabet[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  while (i + 2 < data.size()) {
+    const unsigned char a = static_cast<unsigned char>(data[i++]);
+    const unsigned char b = static_cast<unsigned char>(data[i++]);
+    const unsigned char c = static_cast<unsigned char>(data[i++]);
+    out.push_back(kAlphabet[a >> 2]);
+    out.push_back(kAlphabet[((a & 0x03) << 4) | (b >> 4)]);
+    out.push_back(kAlphabet[((b & 0x0F) << 2) | (c >> 6)]);
+    out.push_back(kAlphabet[c & 0x3F]);
+  }
+  if (i < data.size()) {
+    const unsigned char a = static_cast<unsigned char>(data[i++]);
+    out.push_back(kAlphabet[a >> 2]);
+    if (i < data.size()) {
+      const unsigned char b = static_cast<unsigned char>(data[i]);
+      out.push_back(kAlphabet[((a & 0x03) << 4) | (b >> 4)]);
+      out.push_back(kAlphabet[(b & 0x0F) << 2]);
+      out.push_back('=');
+    } else {
+      out.push_back(kAlphabet[(a & 0x03) << 4]);
+      out.push_back('=');
+      out.push_back('=');
+    }
+  }
+  return out;
+}
+
+bool Base64Decode(const std::string& input, std::string* output) {
+  if (!output) {
+    return false;
+  }
+  const QByteArray decoded =
+      QByteArray::fromBase64(QByteArray::fromStdString(input));
+  output->assign(decoded.constData(),
+                 static_cast<size_t>(decoded.size()));
+  return true;
+}
+
+bool SendAll(int fd, const void* data, size_t length) {
+  const char* buf = static_cast<const char*>(data);
+  size_t remaining = length;
+  while (remaining > 0) {
+    ssize_t n = send(fd, buf, remaining, 0);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    remaining -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+bool SetSocketTimeout(int fd, int timeout_ms) {
+  if (timeout_ms <= 0) {
+    return false;
+  }
+  struct timeval tv;
+  tv.tv_sec = timeout_ms / 1000;
+  tv.tv_usec = (timeout_ms % 1000) * 1000;
+  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+bool SetNonBlocking(int fd) {
+  const int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+void NetworkLogDebug(const std::string& message) {
+  if (!NetworkLogDebugEnabled()) {
+    return;
+  }
+  std::cerr << "[network-log] " << message << '\n';
+}
+
+std::string FormatBytes(double bytes) {
+  static const char* kUnits[] = {"B", "K", "M", "G", "T"};
+  int unit = 0;
+  while (bytes >= 1024.0 && unit < 4) {
+    bytes /= 1024.0;
+    ++unit;
+  }
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << bytes
+      << kUnits[unit];
+  return out.str();
+}
+
+std::string TruncateForColumn(const std::string& text, size_t width) {
+  auto is_continuation = [](char c) {
+    return (static_cast<unsigned char>(c) & 0xC0) == 0x80;
+  };
+  const size_t keep = width > 3 ? width - 3 : 0;
+  size_t code_points = 0;
+  size_t cut = text.size();
+  for (size_t i = 0; i < text.size(); ++i) {
+    if (is_continuation(text[i])) {
+      continue;
+    }
+    if (code_points == keep) {
+      cut = i;
+    }
+    if (++code_points > width) {
+      return text.substr(0, cut) + "...";
+    }
+  }
+  return text;
+}
+
+QJsonObject ReadJsonObjectFile(const std::filesystem::path& path) {
+  std::ifstream in(path, std::ios::binary);
+  const std::string data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  return QJsonDocument::fromJson(QByteArray::fromStdString(data)).object();
+}
+
+void InsertCaptureBody(QJsonObject* object,
+                       const QString& text_key,
+                       const std::string& body) {
+  const QByteArray bytes = QByteArray::fromStdString(body);
+  const QString text = QString::fromUtf8(bytes);
+  if (text.toUtf8() == bytes) {
+    object->insert(text_key, text);
+    return;
+  }
+  object->insert(text_key, QString::fromStdString(Base64Encode(body)));
+  object->insert(QStringLiteral("encoding"), QStringLiteral("base64"));
+}
+
+}  // namespace rethread
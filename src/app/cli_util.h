@@ -0,0 +1,64 @@
+#ifndef RETHREAD_APP_CLI_UTIL_H_
+#define RETHREAD_APP_CLI_UTIL_H_
+
+#include <csignal>
+#include <filesystem>
+#include <string>
+
+#include <QJsonObject>
+#include <QString>
+
+namespace rethread {
+
+// Plumbing shared by the rethread subcommands.
+
+// Set by HandleStopSignal; long-running commands poll it to stop cleanly.
+extern volatile sig_atomic_t g_stop_requested;
+void HandleStopSignal(int);
+
+// How often the CDP event loops wake up to check g_stop_requested.
+constexpr int kNetworkLogPollMs = 250;
+
+// Resolves --user-data-dir/--profile (or RETHREAD_USER_DATA_DIR) and leaves
+// |index| at the first argument it did not consume.
+bool ParseUserDataDir(int argc,
+                      char* argv[],
+                      const std::string& default_root,
+                      std::string* user_data_dir,
+                      int* index);
+// Sends |payload| to the browser and copies its reply to stdout.
+bool SendCommand(const std::string& socket_path, const std::string& payload);
+bool SendCommandCapture(const std::string& socket_path,
+                        const std::string& payload,
+                        std::string* response);
+
+bool ParsePositiveInt(const std::string& text, int* value);
+bool IsValidScriptId(const std::string& id);
+std::string HexEncode(const std::string& input);
+std::string TrimWhitespace(const std::string& input);
+std::string ToLower(std::string value);
+std::string Base64Encode(const std::string& data);
+bool Base64Decode(const std::string& input, std::string* output);
+
+bool SendAll(int fd, const void* data, size_t length);
+// Sets a receive timeout on |fd|.
+bool SetSocketTimeout(int fd, int timeout_ms);
+bool SetNonBlocking(int fd);
+
+// Prints |message| to stderr when RETHREAD_NETWORK_LOG_DEBUG is set.
+void NetworkLogDebug(const std::string& message);
+
+std::string FormatBytes(double bytes);
+// |width| counts UTF-8 code points, and the cut never splits one.
+std::string TruncateForColumn(const std::string& text, size_t width);
+
+QJsonObject ReadJsonObjectFile(const std::filesystem::path& path);
+// Bodies go into JSON as text when they are valid UTF-8 and as base64
+// otherwise, mirroring HAR's content.encoding.
+void InsertCaptureBody(QJsonObject* object,
+                       const QString& text_key,
+                       const std::string& body);
+
+}  // namespace rethread
+
+#endif  // RETHREAD_APP_CLI_UTIL_H_
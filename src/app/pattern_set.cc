@@ -0,0 +1,348 @@
+#include "app/pattern_set.h"
+
+#include <array>
+#include <cctype>
+#include <cstring>
+#include <deque>
+
+namespace {
+
+bool HasPrefix(const std::string& value, const char* prefix) {
+  return value.rfind(prefix, 0) == 0;
+}
+
+std::vector<std::string> SplitGlob(const std::string& glob) {
+  std::vector<std::string> segments(1);
+  for (char c : glob) {
+    if (c == '*') {
+      segments.emplace_back();
+    } else {
+      segments.back().push_back(c);
+    }
+  }
+  return segments;
+}
+
+bool SegmentMatchesAt(const std::string& segment,
+                      std::string_view subject,
+                      size_t pos) {
+  if (subject.size() - pos < segment.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < segment.size(); ++i) {
+    if (segment[i] != '?' && segment[i] != subject[pos + i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Leftmost occurrence of |segment| in subject[pos, limit), or npos.
+size_t FindSegment(const std::string& segment,
+                   std::string_view subject,
+                   size_t pos,
+                   size_t limit) {
+  if (limit < pos || limit - pos < segment.size()) {
+    return std::string_view::npos;
+  }
+  const std::string_view window = subject.substr(pos, limit - pos);
+  if (segment.find('?') == std::string::npos) {
+    const size_t found = window.find(segment);
+    return found == std::string_view::npos ? found : pos + found;
+  }
+  for (size_t i = pos; i + segment.size() <= limit; ++i) {
+    if (SegmentMatchesAt(segment, subject, i)) {
+      return i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Longest run of '?'-free text in any glob segment.
+std::string GlobAnchor(const std::vector<std::string>& segments) {
+  std::string best;
+  for (const std::string& segment : segments) {
+    size_t start = 0;
+    while (start <= segment.size()) {
+      size_t end = segment.find('?', start);
+      if (end == std::string::npos) {
+        end = segment.size();
+      }
+      if (end - start > best.size()) {
+        best = segment.substr(start, end - start);
+      }
+      start = end + 1;
+    }
+  }
+  return best;
+}
+
+// Longest literal that every match of |pattern| must contain, or "" when
+// that cannot be worked out cheaply. Only top-level text outside groups and
+// classes is considered, and any alternation gives up.
+std::string RegexAnchor(const std::string& pattern) {
+  std::string best;
+  std::string run;
+  auto end_run = [&]() {
+    if (run.size() > best.size()) {
+      best = run;
+    }
+    run.clear();
+  };
+  int depth = 0;
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    const char c = pattern[i];
+    switch (c) {
+      case '|':
+        return std::string();
+      case '\\': {
+        if (i + 1 >= pattern.size()) {
+          return std::string();
+        }
+        const char escaped = pattern[++i];
+        if (std::isalnum(static_cast<unsigned char>(escaped))) {
+          // Class escapes stand for one unknown character; anything else
+          // (\x41, A, backreferences) is not worth decoding here.
+          if (!std::strchr("dDwWsSbB", escaped)) {
+            return std::string();
+          }
+          end_run();
+          continue;
+        }
+        if (depth == 0) {
+          run.push_back(escaped);
+        }
+        continue;
+      }
+      case '[':
+        end_run();
+        ++i;
+        if (i < pattern.size() && pattern[i] == '^') {
+          ++i;
+        }
+        if (i < pattern.size() && pattern[i] == ']') {
+          ++i;
+        }
+        while (i < pattern.size() && pattern[i] != ']') {
+          if (pattern[i] == '\\') {
+            ++i;
+          }
+          ++i;
+        }
+        continue;
+      case '(':
+        end_run();
+        ++depth;
+        continue;
+      case ')':
+        end_run();
+        --depth;
+        continue;
+      case '?':
+      case '*':
+      case '{':
+        // The preceding character is optional.
+        if (!run.empty()) {
+          run.pop_back();
+        }
+        end_run();
+        if (c == '{') {
+          while (i < pattern.size() && pattern[i] != '}') {
+            ++i;
+          }
+        }
+        continue;
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+        end_run();
+        continue;
+      default:
+        if (depth == 0) {
+          run.push_back(c);
+        }
+        continue;
+    }
+  }
+  end_run();
+  return depth == 0 ? best : std::string();
+}
+
+}  // namespace
+
+namespace rethread {
+
+bool PatternSet::Build(const std::vector<std::string>& specs,
+                       std::string* error) {
+  patterns_.clear();
+  unanchored_.clear();
+  if (error) {
+    error->clear();
+  }
+  std::vector<std::string> anchors;
+  for (const std::string& spec : specs) {
+    Pattern pattern;
+    std::string anchor;
+    if (HasPrefix(spec, "sub:")) {
+      pattern.kind = Kind::kSubstring;
+      anchor = spec.substr(4);
+    } else if (HasPrefix(spec, "glob:")) {
+      pattern.kind = Kind::kGlob;
+      pattern.segments = SplitGlob(spec.substr(5));
+      anchor = GlobAnchor(pattern.segments);
+    } else {
+      const std::string source = HasPrefix(spec, "re:") ? spec.substr(3) : spec;
+      pattern.kind = Kind::kRegex;
+      try {
+        pattern.regex = std::regex(
+            source, std::regex::ECMAScript | std::regex::nosubs |
+                        std::regex::optimize);
+      } catch (const std::regex_error& err) {
+        if (error) {
+          *error = spec + ": " + err.what();
+        }
+        patterns_.clear();
+        unanchored_.clear();
+        return false;
+      }
+      anchor = RegexAnchor(source);
+    }
+    if (anchor.empty()) {
+      unanchored_.push_back(static_cast<int>(patterns_.size()));
+    }
+    anchors.push_back(std::move(anchor));
+    patterns_.push_back(std::move(pattern));
+  }
+  BuildAutomaton(anchors);
+  return true;
+}
+
+void PatternSet::BuildAutomaton(const std::vector<std::string>& anchors) {
+  byte_class_.assign(256, 0);
+  class_count_ = 1;
+  for (const std::string& anchor : anchors) {
+    for (unsigned char c : anchor) {
+      if (byte_class_[c] == 0) {
+        byte_class_[c] = static_cast<uint8_t>(class_count_++);
+      }
+    }
+  }
+
+  // Trie first; -1 marks a missing edge until the fail pass fills it in.
+  transitions_.assign(class_count_, -1);
+  outputs_.assign(1, {});
+  for (size_t i = 0; i < anchors.size(); ++i) {
+    if (anchors[i].empty()) {
+      continue;
+    }
+    int state = 0;
+    for (unsigned char c : anchors[i]) {
+      int32_t& next = transitions_[state * class_count_ + byte_class_[c]];
+      if (next < 0) {
+        next = static_cast<int32_t>(outputs_.size());
+        outputs_.emplace_back();
+        transitions_.resize(transitions_.size() + class_count_, -1);
+      }
+      // |next| may dangle after the resize, so re-read it.
+      state = transitions_[state * class_count_ + byte_class_[c]];
+    }
+    outputs_[state].push_back(static_cast<int>(i));
+  }
+
+  // Breadth-first over the trie, turning it into a DFA: each missing edge
+  // takes the edge of the state's longest proper suffix.
+  std::vector<int32_t> fail(outputs_.size(), 0);
+  std::deque<int32_t> queue;
+  for (int cls = 0; cls < class_count_; ++cls) {
+    int32_t& next = transitions_[cls];
+    if (next < 0) {
+      next = 0;
+    } else {
+      queue.push_back(next);
+    }
+  }
+  while (!queue.empty()) {
+    const int32_t state = queue.front();
+    queue.pop_front();
+    const std::vector<int>& inherited = outputs_[fail[state]];
+    outputs_[state].insert(outputs_[state].end(), inherited.begin(),
+                           inherited.end());
+    for (int cls = 0; cls < class_count_; ++cls) {
+      const int32_t fallback = transitions_[fail[state] * class_count_ + cls];
+      int32_t& next = transitions_[state * class_count_ + cls];
+      if (next < 0) {
+        next = fallback;
+      } else {
+        fail[next] = fallback;
+        queue.push_back(next);
+      }
+    }
+  }
+}
+
+bool PatternSet::Verify(const Pattern& pattern,
+                        std::string_view subject) const {
+  switch (pattern.kind) {
+    case Kind::kSubstring:
+      return true;
+    case Kind::kRegex:
+      return std::regex_search(subject.begin(), subject.end(), pattern.regex);
+    case Kind::kGlob:
+      break;
+  }
+  const std::vector<std::string>& segments = pattern.segments;
+  if (segments.size() == 1) {
+    return subject.size() == segments[0].size() &&
+           SegmentMatchesAt(segments[0], subject, 0);
+  }
+  const std::string& head = segments.front();
+  const std::string& tail = segments.back();
+  if (subject.size() < head.size() + tail.size() ||
+      !SegmentMatchesAt(head, subject, 0) ||
+      !SegmentMatchesAt(tail, subject, subject.size() - tail.size())) {
+    return false;
+  }
+  size_t pos = head.size();
+  const size_t limit = subject.size() - tail.size();
+  for (size_t i = 1; i + 1 < segments.size(); ++i) {
+    const size_t found = FindSegment(segments[i], subject, pos, limit);
+    if (found == std::string_view::npos) {
+      return false;
+    }
+    pos = found + segments[i].size();
+  }
+  return true;
+}
+
+bool PatternSet::Match(std::string_view subject) const {
+  if (patterns_.empty()) {
+    return false;
+  }
+  // Anchored patterns that were already verified and failed.
+  std::vector<bool> rejected;
+  int32_t state = 0;
+  for (unsigned char c : subject) {
+    state = transitions_[state * class_count_ + byte_class_[c]];
+    for (int index : outputs_[state]) {
+      if (!rejected.empty() && rejected[index]) {
+        continue;
+      }
+      if (Verify(patterns_[index], subject)) {
+        return true;
+      }
+      if (rejected.empty()) {
+        rejected.resize(patterns_.size());
+      }
+      rejected[index] = true;
+    }
+  }
+  for (int index : unanchored_) {
+    if (Verify(patterns_[index], subject)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace rethread
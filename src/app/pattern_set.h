@@ -0,0 +1,62 @@
+#ifndef RETHREAD_APP_PATTERN_SET_H_
+#define RETHREAD_APP_PATTERN_SET_H_
+
+#include <cstdint>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rethread {
+
+// Patterns matched together against one string; a subject matches when any
+// of them does. Each pattern takes one of these forms:
+//   glob:GLOB   whole-string match, '*' spans any run and '?' one character
+//   sub:TEXT    plain substring
+//   re:REGEX    ECMAScript regex searched anywhere in the subject
+//   REGEX       same as re:, so older filters keep working
+// Literal text every match must contain is compiled into one DFA, so the
+// subject is scanned once and only patterns whose literal was seen (or that
+// have none) run their full check.
+class PatternSet {
+ public:
+  // Replaces the set with |specs|. On failure the set is left empty.
+  bool Build(const std::vector<std::string>& specs, std::string* error);
+
+  bool empty() const { return patterns_.empty(); }
+  bool Match(std::string_view subject) const;
+
+ private:
+  enum class Kind {
+    kSubstring,
+    kGlob,
+    kRegex,
+  };
+
+  struct Pattern {
+    Kind kind = Kind::kSubstring;
+    // Glob pieces between '*'s; front() and back() are anchored to the ends
+    // of the subject and are empty when the glob starts or ends with '*'.
+    std::vector<std::string> segments;
+    std::regex regex;
+  };
+
+  bool Verify(const Pattern& pattern, std::string_view subject) const;
+  void BuildAutomaton(const std::vector<std::string>& anchors);
+
+  std::vector<Pattern> patterns_;
+  // Patterns without a required literal; always checked.
+  std::vector<int> unanchored_;
+
+  // Aho-Corasick DFA over the anchors. Bytes are folded into classes so the
+  // table only has a column per byte that appears in some anchor.
+  std::vector<uint8_t> byte_class_;
+  int class_count_ = 0;
+  std::vector<int32_t> transitions_;
+  // Patterns whose anchor ends at each state, including via fail links.
+  std::vector<std::vector<int>> outputs_;
+};
+
+}  // namespace rethread
+
+#endif  // RETHREAD_APP_PATTERN_SET_H_
@@ -0,0 +1,561 @@
+#include "app/tab_cli.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrl>
+
+#include "app/cdp_pipeline.h"
+#include "app/cli_util.h"
+
+namespace rethread {
+namespace {
+
+void PrintPerfUsage() {
+  std::cerr
+      << "Usage: rethread perf [--user-data-dir=PATH] [--profile=NAME]\n"
+      << "                     <tab-id> [--no-reload] [--no-cache] [--json]\n"
+      << "                     [--timeout-ms=N] [--width=N] [--cdp-port=PORT]\n"
+      << "Reloads the tab and reports where its page load spent its time.\n"
+      << "Options:\n"
+      << "  --id=N          Same as giving the tab id positionally\n"
+      << "  --no-reload     Measure the tab's next navigation instead\n"
+      << "  --no-cache      Disable the HTTP cache for the load\n"
+      << "  --json          Print the requests and timings as JSON\n"
+      << "  --timeout-ms=N  Give up after N ms (default: 30000)\n"
+      << "  --width=N       Waterfall width in columns (default: 40)\n"
+      << "  --cdp-port=PORT CDP port (default: the browser's, else 9222)\n";
+}
+
+constexpr int kPerfDefaultTimeoutMs = 30000;
+constexpr int kPerfDefaultBarWidth = 40;
+// How long the page must stay idle after its load event before the
+// report is printed.
+constexpr int kPerfQuietMs = 500;
+constexpr size_t kPerfTopHosts = 10;
+constexpr size_t kPerfUrlWidth = 48;
+
+struct PerfRequest {
+  std::string url;
+  std::string type;
+  std::string mime_type;
+  int status = 0;
+  bool from_cache = false;
+  bool failed = false;
+  // CDP monotonic timestamps in seconds.
+  double started_at = -1;
+  double finished_at = -1;
+  NetworkTiming timing;
+  uint64_t encoded_data_length = 0;
+};
+
+std::string FormatMs(double ms) {
+  if (ms < 0) {
+    return "-";
+  }
+  return std::to_string(std::llround(ms)) + "ms";
+}
+
+// One row of the waterfall: |width| cells spanning 0..|span_ms| after the
+// navigation started, with a glyph per phase.
+std::string PerfBar(const PerfRequest& request,
+                    double start_ms,
+                    double span_ms,
+                    int width) {
+  std::string bar(static_cast<size_t>(width), ' ');
+  auto column = [&](double ms) {
+    const int cell = static_cast<int>(ms / span_ms * width);
+    return std::clamp(cell, 0, width - 1);
+  };
+  auto fill = [&](double from_ms, double length_ms, char glyph) {
+    const int end = column(from_ms + length_ms);
+    for (int cell = column(from_ms); cell <= end; ++cell) {
+      bar[static_cast<size_t>(cell)] = glyph;
+    }
+  };
+  const NetworkTiming& timing = request.timing;
+  if (timing.headers_at < 0) {
+    // No phase breakdown (cache hits, data: URLs, failures).
+    const double total =
+        request.finished_at >= 0
+            ? (request.finished_at - request.started_at) * 1000
+            : 0;
+    fill(start_ms, total, '=');
+    return bar;
+  }
+  double at = start_ms;
+  const std::pair<double, char> phases[] = {
+      {std::max(timing.blocked, 0.0), '.'},
+      {std::max(timing.dns, 0.0) + std::max(timing.connect, 0.0), '-'},
+      {std::max(timing.send, 0.0) + std::max(timing.wait, 0.0), '~'},
+      {std::max(timing.receive, 0.0), '='},
+  };
+  for (const auto& [length, glyph] : phases) {
+    if (length > 0) {
+      fill(at, length, glyph);
+      at += length;
+    }
+  }
+  return bar;
+}
+
+QJsonObject PerfReportJson(const std::vector<PerfRequest>& requests,
+                           double navigation_start,
+                           double dom_content_loaded,
+                           double load_event) {
+  auto since_start = [navigation_start](double at) {
+    return at >= 0 ? (at - navigation_start) * 1000 : -1.0;
+  };
+  QJsonArray entries;
+  for (const PerfRequest& request : requests) {
+    QJsonObject entry;
+    entry.insert(QStringLiteral("url"), QString::fromStdString(request.url));
+    entry.insert(QStringLiteral("resourceType"),
+                 QString::fromStdString(request.type));
+    entry.insert(QStringLiteral("mimeType"),
+                 QString::fromStdString(request.mime_type));
+    entry.insert(QStringLiteral("status"), request.status);
+    entry.insert(QStringLiteral("fromCache"), request.from_cache);
+    entry.insert(QStringLiteral("failed"), request.failed);
+    entry.insert(QStringLiteral("startMs"), since_start(request.started_at));
+    entry.insert(QStringLiteral("endMs"), since_start(request.finished_at));
+    entry.insert(QStringLiteral("time"), TimingTotalMs(request.timing));
+    entry.insert(QStringLiteral("encodedDataLength"),
+                 static_cast<double>(request.encoded_data_length));
+    entry.insert(QStringLiteral("timings"), TimingJson(request.timing));
+    entries.append(entry);
+  }
+  QJsonObject report;
+  report.insert(QStringLiteral("url"),
+                QString::fromStdString(requests.front().url));
+  report.insert(QStringLiteral("domContentLoadedMs"),
+                since_start(dom_content_loaded));
+  report.insert(QStringLiteral("loadMs"), since_start(load_event));
+  report.insert(QStringLiteral("requests"), entries);
+  return report;
+}
+
+// Prints the page load in |requests|: a waterfall, the document's phases
+// and when the page was done, then totals per phase, MIME type and host.
+// The first request is the navigation's document.
+void PrintPerfReport(const std::vector<PerfRequest>& requests,
+                     double navigation_start,
+                     double dom_content_loaded,
+                     double load_event,
+                     int width,
+                     bool json_output) {
+  if (json_output) {
+    std::cout << QJsonDocument(PerfReportJson(requests, navigation_start,
+                                              dom_content_loaded, load_event))
+                     .toJson(QJsonDocument::Indented)
+                     .toStdString();
+    return;
+  }
+  auto since_start = [navigation_start](double at) {
+    return at >= 0 ? (at - navigation_start) * 1000 : -1.0;
+  };
+
+  uint64_t total_bytes = 0;
+  const PerfRequest* last = &requests.front();
+  for (const PerfRequest& request : requests) {
+    total_bytes += request.encoded_data_length;
+    if (request.finished_at > last->finished_at) {
+      last = &request;
+    }
+  }
+  const double last_byte_ms = since_start(last->finished_at);
+  const double span_ms =
+      std::max({last_byte_ms, since_start(load_event), 1.0});
+
+  std::ostringstream out;
+  out << requests.front().url << "\n"
+      << requests.size() << " requests, "
+      << FormatBytes(static_cast<double>(total_bytes)) << " transferred, "
+      << "DOMContentLoaded " << FormatMs(since_start(dom_content_loaded))
+      << ", load " << FormatMs(since_start(load_event)) << ", last byte "
+      << FormatMs(last_byte_ms) << "\n\n";
+
+  out << std::left << std::setw(8) << "START" << std::setw(8) << "TIME"
+      << std::setw(7) << "STATUS" << std::setw(12) << "TYPE"
+      << std::setw(8) << "SIZE" << std::setw(kPerfUrlWidth + 1) << "URL"
+      << "|" << std::string(static_cast<size_t>(width), ' ') << "|\n";
+  for (const PerfRequest& request : requests) {
+    const double start_ms = since_start(request.started_at);
+    const std::string status = request.failed ? "ERR"
+                               : request.status > 0
+                                   ? std::to_string(request.status)
+                                   : "-";
+    const std::string size =
+        request.from_cache
+            ? "cache"
+            : FormatBytes(static_cast<double>(request.encoded_data_length));
+    out << std::setw(8) << FormatMs(start_ms) << std::setw(8)
+        << FormatMs(request.finished_at >= 0
+                        ? TimingTotalMs(request.timing)
+                        : -1)
+        << std::setw(7) << status << std::setw(12)
+        << TruncateForColumn(request.type, 11) << std::setw(8) << size
+        << std::setw(kPerfUrlWidth + 1)
+        << TruncateForColumn(request.url, kPerfUrlWidth) << "|"
+        << PerfBar(request, start_ms, span_ms, width) << "|\n";
+  }
+  out << "  . queued  - dns/connect  ~ request/TTFB  = download\n\n";
+
+  const PerfRequest& document = requests.front();
+  const NetworkTiming& doc = document.timing;
+  out << "Critical path\n"
+      << "  document: queued " << FormatMs(doc.blocked) << ", dns "
+      << FormatMs(doc.dns) << ", connect " << FormatMs(doc.connect)
+      << ", tls " << FormatMs(doc.ssl) << ", TTFB " << FormatMs(doc.wait)
+      << ", download " << FormatMs(doc.receive) << "\n"
+      << "  load event at " << FormatMs(since_start(load_event)) << "\n"
+      << "  last request done at " << FormatMs(last_byte_ms) << ": "
+      << last->url << "\n\n";
+
+  NetworkTiming totals;
+  totals.blocked = totals.dns = totals.connect = totals.ssl = 0;
+  totals.send = totals.wait = totals.receive = 0;
+  for (const PerfRequest& request : requests) {
+    const NetworkTiming& timing = request.timing;
+    totals.blocked += std::max(timing.blocked, 0.0);
+    totals.dns += std::max(timing.dns, 0.0);
+    totals.connect += std::max(timing.connect, 0.0);
+    totals.ssl += std::max(timing.ssl, 0.0);
+    totals.send += std::max(timing.send, 0.0);
+    totals.wait += std::max(timing.wait, 0.0);
+    totals.receive += std::max(timing.receive, 0.0);
+  }
+  out << "Time by phase (summed over requests)\n"
+      << "  queued " << FormatMs(totals.blocked) << ", dns "
+      << FormatMs(totals.dns) << ", connect " << FormatMs(totals.connect)
+      << " (tls " << FormatMs(totals.ssl) << "), send "
+      << FormatMs(totals.send) << ", TTFB " << FormatMs(totals.wait)
+      << ", download " << FormatMs(totals.receive) << "\n\n";
+
+  struct Bucket {
+    std::string name;
+    int count = 0;
+    uint64_t bytes = 0;
+    double total_ms = 0;
+    double wait_ms = 0;
+    int waits = 0;
+  };
+  auto group = [&requests](auto key_of) {
+    std::map<std::string, Bucket> buckets;
+    for (const PerfRequest& request : requests) {
+      std::string key = key_of(request);
+      Bucket& bucket = buckets[key];
+      bucket.name = key.empty() ? "(none)" : std::move(key);
+      ++bucket.count;
+      bucket.bytes += request.encoded_data_length;
+      bucket.total_ms += TimingTotalMs(request.timing);
+      if (request.timing.wait >= 0) {
+        bucket.wait_ms += request.timing.wait;
+        ++bucket.waits;
+      }
+    }
+    std::vector<Bucket> sorted;
+    for (auto& entry : buckets) {
+      sorted.push_back(std::move(entry.second));
+    }
+    return sorted;
+  };
+
+  std::vector<Bucket> by_mime = group(
+      [](const PerfRequest& request) { return request.mime_type; });
+  std::sort(by_mime.begin(), by_mime.end(),
+            [](const Bucket& a, const Bucket& b) { return a.bytes > b.bytes; });
+  out << "Bytes by MIME type\n";
+  for (const Bucket& bucket : by_mime) {
+    out << "  " << std::setw(32) << TruncateForColumn(bucket.name, 31)
+        << std::right << std::setw(5) << bucket.count << " req "
+        << std::setw(8)
+        << FormatBytes(static_cast<double>(bucket.bytes)) << std::left
+        << "\n";
+  }
+
+  std::vector<Bucket> by_host = group([](const PerfRequest& request) {
+    return QUrl(QString::fromStdString(request.url)).host().toStdString();
+  });
+  std::sort(by_host.begin(), by_host.end(),
+            [](const Bucket& a, const Bucket& b) {
+              return a.total_ms > b.total_ms;
+            });
+  if (by_host.size() > kPerfTopHosts) {
+    by_host.resize(kPerfTopHosts);
+  }
+  out << "\nSlowest hosts\n";
+  for (const Bucket& bucket : by_host) {
+    out << "  " << std::setw(32) << TruncateForColumn(bucket.name, 31)
+        << std::right << std::setw(5) << bucket.count << " req "
+        << std::setw(8) << FormatMs(bucket.total_ms) << " total, avg TTFB "
+        << FormatMs(bucket.waits > 0 ? bucket.wait_ms / bucket.waits : -1)
+        << std::left << "\n";
+  }
+  std::cout << out.str() << std::flush;
+}
+
+}  // namespace
+
+int RunPerfCli(int argc, char* argv[], const std::string& default_user_data_dir) {
+  std::string user_data_dir;
+  int index = 0;
+  if (!ParseUserDataDir(argc, argv, default_user_data_dir, &user_data_dir,
+                        &index)) {
+    return 1;
+  }
+  int tab_id = 0;
+  int cdp_port = 0;
+  int timeout_ms = kPerfDefaultTimeoutMs;
+  int width = kPerfDefaultBarWidth;
+  bool reload = true;
+  bool no_cache = false;
+  bool json_output = false;
+  for (; index < argc; ++index) {
+    const std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintPerfUsage();
+      return 0;
+    }
+    if (arg == "--no-reload") {
+      reload = false;
+      continue;
+    }
+    if (arg == "--no-cache") {
+      no_cache = true;
+      continue;
+    }
+    if (arg == "--json") {
+      json_output = true;
+      continue;
+    }
+    const std::string id_prefix = "--id=";
+    if (arg.rfind(id_prefix, 0) == 0 || (!arg.empty() && arg[0] != '-')) {
+      const std::string value =
+          arg[0] == '-' ? arg.substr(id_prefix.size()) : arg;
+      if (!ParsePositiveInt(value, &tab_id)) {
+        std::cerr << "Invalid tab id: " << value << "\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string timeout_prefix = "--timeout-ms=";
+    if (arg.rfind(timeout_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(timeout_prefix.size()), &timeout_ms)) {
+        std::cerr << "Invalid --timeout-ms value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string width_prefix = "--width=";
+    if (arg.rfind(width_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(width_prefix.size()), &width)) {
+        std::cerr << "Invalid --width value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string cdp_port_prefix = "--cdp-port=";
+    if (arg.rfind(cdp_port_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(cdp_port_prefix.size()), &cdp_port) ||
+          cdp_port >= 65536) {
+        std::cerr << "Invalid --cdp-port value\n";
+        return 1;
+      }
+      continue;
+    }
+    std::cerr << "Unknown perf option: " << arg << "\n";
+    PrintPerfUsage();
+    return 1;
+  }
+  if (tab_id <= 0) {
+    std::cerr << "perf requires a tab id\n";
+    PrintPerfUsage();
+    return 1;
+  }
+
+  CdpPipeline cdp;
+  std::string devtools_id;
+  if (!ConnectCdpPipeline(user_data_dir, tab_id, cdp_port, &cdp,
+                          &devtools_id)) {
+    return 1;
+  }
+  cdp.Send(QStringLiteral("Network.enable"), QJsonObject());
+  cdp.Send(QStringLiteral("Page.enable"), QJsonObject());
+  if (no_cache) {
+    QJsonObject cache_params;
+    cache_params.insert(QStringLiteral("cacheDisabled"), true);
+    cdp.Send(QStringLiteral("Network.setCacheDisabled"), cache_params);
+  }
+  if (reload) {
+    QJsonObject reload_params;
+    reload_params.insert(QStringLiteral("ignoreCache"), no_cache);
+    cdp.Send(QStringLiteral("Page.reload"), reload_params);
+  } else {
+    std::cerr << "Waiting for tab " << tab_id << " to navigate...\n";
+  }
+
+  g_stop_requested = 0;
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
+
+  // Requests of the page load, in the order they started. Nothing counts
+  // until the navigation's document request shows up, so stragglers from
+  // the previous page are ignored.
+  std::vector<PerfRequest> requests;
+  std::map<std::string, size_t> by_id;
+  double navigation_start = -1;
+  double dom_content_loaded = -1;
+  double load_event = -1;
+  int in_flight = 0;
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(timeout_ms);
+  auto quiet_since = std::chrono::steady_clock::now();
+  bool connected = true;
+  bool timed_out = false;
+  std::vector<std::string_view> messages;
+  while (!g_stop_requested && connected) {
+    const auto now = std::chrono::steady_clock::now();
+    if (load_event >= 0 && in_flight <= 0 &&
+        now - quiet_since >= std::chrono::milliseconds(kPerfQuietMs)) {
+      break;
+    }
+    if (now >= deadline) {
+      timed_out = true;
+      break;
+    }
+    if (!cdp.Flush()) {
+      break;
+    }
+    pollfd watch{cdp.fd, static_cast<short>(
+                             POLLIN | (cdp.outbox.empty() ? 0 : POLLOUT)),
+                 0};
+    if (poll(&watch, 1, kNetworkLogPollMs) < 0 && errno != EINTR) {
+      break;
+    }
+    messages.clear();
+    connected = cdp.Receive(&messages);
+    for (std::string_view message : messages) {
+      const QJsonObject event = ParseCdpMessage(message);
+      const QString method = event.value(QStringLiteral("method")).toString();
+      const QJsonObject params =
+          event.value(QStringLiteral("params")).toObject();
+      const double timestamp =
+          params.value(QStringLiteral("timestamp")).toDouble(-1);
+      if (method == QStringLiteral("Page.domContentEventFired")) {
+        dom_content_loaded = navigation_start >= 0 ? timestamp : -1;
+        continue;
+      }
+      if (method == QStringLiteral("Page.loadEventFired")) {
+        if (navigation_start >= 0) {
+          load_event = timestamp;
+          quiet_since = std::chrono::steady_clock::now();
+        }
+        continue;
+      }
+      const std::string request_id =
+          params.value(QStringLiteral("requestId")).toString().toStdString();
+      if (method == QStringLiteral("Network.requestWillBeSent")) {
+        const QString type = params.value(QStringLiteral("type")).toString();
+        const bool navigation =
+            type == QStringLiteral("Document") &&
+            params.value(QStringLiteral("requestId")).toString() ==
+                params.value(QStringLiteral("loaderId")).toString();
+        if (navigation_start < 0 && !navigation) {
+          continue;
+        }
+        if (navigation_start < 0) {
+          navigation_start = timestamp;
+        }
+        auto existing = by_id.find(request_id);
+        if (existing != by_id.end()) {
+          // A redirect: the hop so far is folded into the final request.
+          requests[existing->second].url =
+              params.value(QStringLiteral("request"))
+                  .toObject()
+                  .value(QStringLiteral("url"))
+                  .toString()
+                  .toStdString();
+          continue;
+        }
+        PerfRequest request;
+        request.url = params.value(QStringLiteral("request"))
+                          .toObject()
+                          .value(QStringLiteral("url"))
+                          .toString()
+                          .toStdString();
+        request.type = type.toStdString();
+        request.started_at = timestamp;
+        by_id[request_id] = requests.size();
+        requests.push_back(std::move(request));
+        ++in_flight;
+        continue;
+      }
+      auto request_it = by_id.find(request_id);
+      if (request_it == by_id.end()) {
+        continue;
+      }
+      PerfRequest& request = requests[request_it->second];
+      if (method == QStringLiteral("Network.responseReceived")) {
+        const QJsonObject response =
+            params.value(QStringLiteral("response")).toObject();
+        request.status = response.value(QStringLiteral("status")).toInt();
+        request.mime_type =
+            response.value(QStringLiteral("mimeType")).toString().toStdString();
+        request.from_cache =
+            response.value(QStringLiteral("fromDiskCache")).toBool() ||
+            response.value(QStringLiteral("fromMemoryCache")).toBool();
+        request.timing = TimingFromResource(
+            response.value(QStringLiteral("timing")).toObject(),
+            request.started_at);
+        continue;
+      }
+      const bool finished = method == QStringLiteral("Network.loadingFinished");
+      const bool failed = method == QStringLiteral("Network.loadingFailed");
+      if ((!finished && !failed) || request.finished_at >= 0) {
+        continue;
+      }
+      request.finished_at = timestamp;
+      request.failed = failed;
+      request.encoded_data_length = static_cast<uint64_t>(
+          params.value(QStringLiteral("encodedDataLength")).toDouble());
+      FinishTiming(&request.timing, request.started_at, request.finished_at);
+      --in_flight;
+      quiet_since = std::chrono::steady_clock::now();
+    }
+  }
+  close(cdp.fd);
+  if (g_stop_requested && requests.empty()) {
+    return 1;
+  }
+  if (requests.empty()) {
+    std::cerr << (timed_out ? "Timed out waiting for a page load\n"
+                            : "CDP connection closed\n");
+    return 1;
+  }
+  if (timed_out) {
+    std::cerr << "Timed out; " << in_flight
+              << " requests were still loading\n";
+  }
+  PrintPerfReport(requests, navigation_start, dom_content_loaded, load_event,
+                  width, json_output);
+  return 0;
+}
+
+}  // namespace rethread
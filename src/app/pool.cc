@@ -0,0 +1,1045 @@
+#include "app/tab_cli.h"
+
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+
+#include "app/cli_util.h"
+
+namespace rethread {
+namespace {
+
+void PrintPoolUsage() {
+  std::cerr
+      << "Usage: rethread pool [start] [--name=NAME] [--workers=N]\n"
+      << "                     [--cdp-base-port=PORT] [-- browser flags...]\n"
+      << "       rethread pool status [--name=NAME]\n"
+      << "Options:\n"
+      << "  --name=NAME          Pool name (default: pool). The front socket\n"
+      << "                       lives in profile NAME, workers use NAME-1..N\n"
+      << "  --workers=N          Number of headless browsers (default: 2)\n"
+      << "  --cdp-base-port=PORT Give worker K the CDP port PORT+K-1\n"
+      << "                       (default: CDP disabled)\n"
+      << "The front socket load-balances eval --open=URL across ready\n"
+      << "workers and sends eval register to all of them; use\n"
+      << "--profile=NAME-K to open tabs or talk to one worker directly.\n";
+}
+
+constexpr int kPoolDefaultWorkers = 2;
+constexpr int kPoolProbeIntervalMs = 200;
+constexpr int kPoolRestartDelayMs = 1000;
+constexpr int kPoolShutdownGraceMs = 3000;
+// Replies are relayed in slices; reading a worker pauses once this much is
+// waiting on a slow client.
+constexpr size_t kPoolMaxPendingBytes = 1024 * 1024;
+constexpr size_t kPoolMaxRequestBytes = 64 * 1024 * 1024;
+// Bounds the supervisor's own exchanges with a worker (script registration,
+// pending lists, cancels, and the script replay of a new worker).
+constexpr int kPoolControlTimeoutMs = 5000;
+
+enum class PoolWorkerState {
+  kStopped,
+  kStarting,
+  // Answering, but still taking the registered scripts; gets no jobs yet.
+  kSyncing,
+  kReady,
+};
+
+struct PoolWorker {
+  int number = 0;
+  std::string user_data_dir;
+  std::string socket_path;
+  pid_t pid = -1;
+  bool launched = false;
+  PoolWorkerState state = PoolWorkerState::kStopped;
+  // Jobs routed to this worker whose reply has not finished yet.
+  int queue = 0;
+  uint64_t served = 0;
+  int restarts = 0;
+  std::chrono::steady_clock::time_point next_action;
+};
+
+// One exchange the supervisor runs with a worker on its own behalf. It is
+// driven by the same poll loop as routed jobs, so a slow worker holds up
+// only the request that asked for it.
+struct PoolControlCall {
+  int worker = -1;
+  int number = 0;
+  int fd = -1;
+  std::string request;
+  size_t sent = 0;
+  std::string reply;
+  bool done = false;
+  bool ok = false;
+  std::chrono::steady_clock::time_point deadline;
+  // The script a worker is being synced with, for the failure message.
+  std::string script;
+};
+
+struct PoolConnection {
+  int client_fd = -1;
+  int upstream_fd = -1;
+  int worker = -1;
+  std::string request;
+  bool request_complete = false;
+  size_t request_sent = 0;
+  std::string reply;
+  size_t reply_sent = 0;
+  bool reply_started = false;
+  bool upstream_done = false;
+  // Set while an eval control request waits on its worker exchanges.
+  std::string control_action;
+  std::string control_args;
+  std::vector<PoolControlCall> calls;
+};
+
+const char* PoolWorkerStateName(PoolWorkerState state) {
+  switch (state) {
+    case PoolWorkerState::kStopped:
+      return "stopped";
+    case PoolWorkerState::kStarting:
+      return "starting";
+    case PoolWorkerState::kSyncing:
+      return "syncing";
+    case PoolWorkerState::kReady:
+      return "ready";
+  }
+  return "stopped";
+}
+
+std::string JoinProfilePath(const std::string& root, const std::string& name) {
+  if (root.empty()) {
+    return name;
+  }
+  if (root.back() == '/') {
+    return root + name;
+  }
+  return root + "/" + name;
+}
+
+int ConnectUnix(const std::string& socket_path) {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+                socket_path.c_str());
+  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int ListenUnix(const std::string& socket_path) {
+  // A leftover socket file is only reused when nothing answers on it.
+  const int existing = ConnectUnix(socket_path);
+  if (existing >= 0) {
+    close(existing);
+    std::cerr << "A pool is already listening on " << socket_path << "\n";
+    return -1;
+  }
+  unlink(socket_path.c_str());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
+    return -1;
+  }
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+                socket_path.c_str());
+  if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 || !SetNonBlocking(fd)) {
+    std::cerr << "Failed to listen on " << socket_path << ": "
+              << std::strerror(errno) << "\n";
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool SpawnPoolWorker(const std::string& browser_binary,
+                     const std::vector<std::string>& browser_args,
+                     PoolWorker* worker) {
+  std::vector<std::string> args;
+  args.push_back(browser_binary);
+  args.push_back("--headless");
+  args.push_back("--user-data-dir=" + worker->user_data_dir);
+  args.push_back("--url=about:blank");
+  args.insert(args.end(), browser_args.begin(), browser_args.end());
+  std::vector<char*> exec_argv;
+  exec_argv.reserve(args.size() + 1);
+  for (std::string& arg : args) {
+    exec_argv.push_back(arg.data());
+  }
+  exec_argv.push_back(nullptr);
+
+  const pid_t pid = fork();
+  if (pid < 0) {
+    std::cerr << "Failed to start worker " << worker->number << ": "
+              << std::strerror(errno) << "\n";
+    return false;
+  }
+  if (pid == 0) {
+    // Workers must not outlive a supervisor that was killed outright.
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    execv(exec_argv[0], exec_argv.data());
+    std::perror("rethread pool");
+    _exit(127);
+  }
+  worker->pid = pid;
+  worker->launched = true;
+  worker->state = PoolWorkerState::kStarting;
+  worker->next_action = std::chrono::steady_clock::now();
+  return true;
+}
+
+std::string PoolStatusJson(const std::vector<PoolWorker>& workers) {
+  QJsonArray entries;
+  for (const PoolWorker& worker : workers) {
+    QJsonObject entry;
+    entry.insert(QStringLiteral("worker"), worker.number);
+    entry.insert(QStringLiteral("pid"), static_cast<qint64>(worker.pid));
+    entry.insert(QStringLiteral("state"),
+                 QString::fromLatin1(PoolWorkerStateName(worker.state)));
+    entry.insert(QStringLiteral("userDataDir"),
+                 QString::fromStdString(worker.user_data_dir));
+    entry.insert(QStringLiteral("queue"), worker.queue);
+    entry.insert(QStringLiteral("served"),
+                 static_cast<qint64>(worker.served));
+    entry.insert(QStringLiteral("restarts"), worker.restarts);
+    entries.append(entry);
+  }
+  return QJsonDocument(entries).toJson(QJsonDocument::Compact).toStdString() +
+         "\n";
+}
+
+void EndPoolControlCall(PoolControlCall* call, bool ok) {
+  if (call->fd >= 0) {
+    close(call->fd);
+    call->fd = -1;
+  }
+  call->done = true;
+  call->ok = ok;
+}
+
+// Connects to |worker| and queues |request|; the reply is read by
+// StepPoolControlCall until the worker closes the socket.
+PoolControlCall StartPoolControlCall(const PoolWorker& worker,
+                                     int index,
+                                     const std::string& request) {
+  PoolControlCall call;
+  call.worker = index;
+  call.number = worker.number;
+  call.request = request;
+  call.deadline = std::chrono::steady_clock::now() +
+                  std::chrono::milliseconds(kPoolControlTimeoutMs);
+  call.fd = ConnectUnix(worker.socket_path);
+  if (call.fd < 0 || !SetNonBlocking(call.fd)) {
+    EndPoolControlCall(&call, false);
+  }
+  return call;
+}
+
+short PoolControlCallEvents(const PoolControlCall& call) {
+  return call.sent < call.request.size() ? POLLOUT : POLLIN;
+}
+
+void StepPoolControlCall(PoolControlCall* call, short revents) {
+  if ((revents & POLLOUT) && call->sent < call->request.size()) {
+    const ssize_t n = send(call->fd, call->request.data() + call->sent,
+                           call->request.size() - call->sent, MSG_NOSIGNAL);
+    if (n > 0) {
+      call->sent += static_cast<size_t>(n);
+    } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      EndPoolControlCall(call, false);
+      return;
+    }
+  }
+  if (revents & (POLLIN | POLLHUP | POLLERR)) {
+    char buffer[4096];
+    const ssize_t n = read(call->fd, buffer, sizeof(buffer));
+    if (n > 0) {
+      call->reply.append(buffer, static_cast<size_t>(n));
+    } else if (n == 0) {
+      EndPoolControlCall(call, call->sent == call->request.size());
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+      EndPoolControlCall(call, false);
+    }
+  }
+}
+
+// Workers that are up take control requests even while they sync, so a
+// script registered meanwhile is not missed.
+bool PoolWorkerTakesControl(const PoolWorker& worker) {
+  return worker.state == PoolWorkerState::kReady ||
+         worker.state == PoolWorkerState::kSyncing;
+}
+
+// Starts eval register, unregister, pending, and cancel in the supervisor:
+// the first three go to every worker that is up, and cancel goes to the
+// worker named in its WORKER:ID. Malformed requests are answered at once.
+void StartPoolEvalControl(PoolConnection* connection,
+                          const std::string& action,
+                          const std::string& args,
+                          const std::vector<PoolWorker>& workers) {
+  if (action == "cancel") {
+    int number = 0;
+    int eval_id = 0;
+    const size_t colon = args.find(':');
+    if (colon == std::string::npos ||
+        !ParsePositiveInt(args.substr(0, colon), &number) ||
+        !ParsePositiveInt(args.substr(colon + 1), &eval_id)) {
+      connection->reply = "ERR pool eval ids look like WORKER:ID\n";
+      connection->upstream_done = true;
+      return;
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+      const PoolWorker& worker = workers[i];
+      if (worker.number != number) {
+        continue;
+      }
+      if (worker.state != PoolWorkerState::kReady) {
+        connection->reply = "ERR pool worker " + std::to_string(number) +
+                            " did not answer\n";
+        connection->upstream_done = true;
+        return;
+      }
+      connection->control_action = action;
+      connection->control_args = args;
+      connection->calls.push_back(StartPoolControlCall(
+          worker, static_cast<int>(i),
+          "eval cancel " + std::to_string(eval_id) + "\n"));
+      return;
+    }
+    connection->reply = "ERR no pool worker " + std::to_string(number) + "\n";
+    connection->upstream_done = true;
+    return;
+  }
+
+  connection->control_action = action;
+  connection->control_args = args;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    if (PoolWorkerTakesControl(workers[i])) {
+      connection->calls.push_back(StartPoolControlCall(
+          workers[i], static_cast<int>(i), connection->request));
+    }
+  }
+}
+
+// Builds the client's reply once every worker exchange has ended: pending
+// merges all of them, and register and unregister update |scripts|.
+std::string FinishPoolEvalControl(const PoolConnection& connection,
+                                  std::map<std::string, std::string>* scripts) {
+  const std::string& action = connection.control_action;
+  const std::string& args = connection.control_args;
+  if (action == "cancel") {
+    const PoolControlCall& call = connection.calls.front();
+    if (!call.ok) {
+      return "ERR pool worker " + std::to_string(call.number) +
+             " did not answer\n";
+    }
+    return call.reply;
+  }
+
+  QJsonArray pending;
+  std::string error;
+  for (const PoolControlCall& call : connection.calls) {
+    if (!call.ok) {
+      if (error.empty()) {
+        error = "ERR pool worker " + std::to_string(call.number) +
+                " did not answer\n";
+      }
+      continue;
+    }
+    if (call.reply.rfind("ERR", 0) == 0) {
+      if (error.empty()) {
+        error = "ERR pool worker " + std::to_string(call.number) + ":" +
+                call.reply.substr(3);
+      }
+      continue;
+    }
+    if (action != "pending") {
+      continue;
+    }
+    const QJsonArray entries =
+        QJsonDocument::fromJson(QByteArray::fromStdString(call.reply)).array();
+    for (const QJsonValue& value : entries) {
+      QJsonObject entry = value.toObject();
+      entry.insert(QStringLiteral("worker"), call.number);
+      entry.insert(QStringLiteral("id"),
+                   QStringLiteral("%1:%2").arg(call.number).arg(
+                       entry.value(QStringLiteral("id")).toInt()));
+      pending.append(entry);
+    }
+  }
+
+  if (action == "pending") {
+    return QJsonDocument(pending).toJson(QJsonDocument::Compact).toStdString() +
+           "\n";
+  }
+  if (action == "unregister") {
+    // Workers that missed the script already answered with an error, so only
+    // a name the pool never saw is reported.
+    if (scripts->erase(args) == 0) {
+      return "ERR no registered script named " + args + "\n";
+    }
+    return std::string();
+  }
+  if (!error.empty()) {
+    return error;
+  }
+  std::istringstream stream(args);
+  std::string token;
+  while (stream >> token) {
+    if (token.rfind("--name=", 0) == 0) {
+      (*scripts)[token.substr(7)] = connection.request;
+    }
+  }
+  return std::string();
+}
+
+// Replies to a control request whose worker exchanges have all ended. The
+// script map is updated even when the client has already gone.
+void MaybeFinishPoolEvalControl(PoolConnection* connection,
+                                std::map<std::string, std::string>* scripts) {
+  if (connection->control_action.empty()) {
+    return;
+  }
+  for (const PoolControlCall& call : connection->calls) {
+    if (!call.done) {
+      return;
+    }
+  }
+  std::string reply = FinishPoolEvalControl(*connection, scripts);
+  if (!connection->upstream_done) {
+    connection->reply = std::move(reply);
+    connection->upstream_done = true;
+  }
+  connection->control_action.clear();
+  connection->calls.clear();
+}
+
+// Replays every registered script into a worker that just came up, so
+// `eval call` works wherever the call is routed. The worker gets jobs once
+// all of its replays have ended.
+void StartPoolWorkerSync(const PoolWorker& worker,
+                         int index,
+                         const std::map<std::string, std::string>& scripts,
+                         std::vector<PoolControlCall>* syncs) {
+  for (const auto& [name, request] : scripts) {
+    syncs->push_back(StartPoolControlCall(worker, index, request));
+    syncs->back().script = name;
+  }
+}
+
+void FinishPoolWorkerSyncs(std::vector<PoolControlCall>* syncs,
+                           std::vector<PoolWorker>* workers) {
+  syncs->erase(
+      std::remove_if(syncs->begin(), syncs->end(),
+                     [](const PoolControlCall& call) {
+                       if (!call.done) {
+                         return false;
+                       }
+                       if (!call.ok || call.reply.rfind("ERR", 0) == 0) {
+                         std::cerr << "Pool worker " << call.number
+                                   << " did not take script " << call.script
+                                   << "\n";
+                       }
+                       return true;
+                     }),
+      syncs->end());
+  for (size_t i = 0; i < workers->size(); ++i) {
+    PoolWorker& worker = (*workers)[i];
+    if (worker.state != PoolWorkerState::kSyncing) {
+      continue;
+    }
+    const bool syncing =
+        std::any_of(syncs->begin(), syncs->end(),
+                    [i](const PoolControlCall& call) {
+                      return call.worker == static_cast<int>(i);
+                    });
+    if (!syncing) {
+      worker.state = PoolWorkerState::kReady;
+    }
+  }
+}
+
+// True when an eval request names the tab it runs in by something other than
+// --open, which means nothing outside a single worker.
+bool PoolEvalNeedsWorker(const std::string& request) {
+  std::istringstream stream(request);
+  std::string token;
+  bool opens = false;
+  while (stream >> token) {
+    if (token.rfind("--open=", 0) == 0) {
+      opens = true;
+    } else if (token.rfind("--tab-id=", 0) == 0 ||
+               token.rfind("--tab-index=", 0) == 0 || token == "--all" ||
+               token.rfind("--match=", 0) == 0) {
+      return true;
+    }
+  }
+  return !opens;
+}
+
+// Least-loaded ready worker; |cursor| rotates ties so idle workers share work.
+int PickPoolWorker(const std::vector<PoolWorker>& workers, size_t* cursor) {
+  int best = -1;
+  for (size_t i = 0; i < workers.size(); ++i) {
+    const size_t candidate = (*cursor + i) % workers.size();
+    const PoolWorker& worker = workers[candidate];
+    if (worker.state != PoolWorkerState::kReady) {
+      continue;
+    }
+    if (best < 0 || worker.queue < workers[best].queue) {
+      best = static_cast<int>(candidate);
+    }
+  }
+  if (best >= 0) {
+    *cursor = static_cast<size_t>(best) + 1;
+  }
+  return best;
+}
+
+void FinishUpstream(PoolConnection* connection,
+                    std::vector<PoolWorker>* workers,
+                    bool completed) {
+  if (connection->upstream_fd >= 0) {
+    close(connection->upstream_fd);
+    connection->upstream_fd = -1;
+  }
+  if (connection->upstream_done) {
+    return;
+  }
+  connection->upstream_done = true;
+  if (connection->worker < 0) {
+    return;
+  }
+  PoolWorker& worker = (*workers)[connection->worker];
+  worker.queue = std::max(0, worker.queue - 1);
+  if (completed && connection->reply_started) {
+    ++worker.served;
+    return;
+  }
+  if (!connection->reply_started) {
+    connection->reply = "ERR pool worker " + std::to_string(worker.number) +
+                        " dropped the request\n";
+  }
+}
+
+// Parses the request line and either answers it locally or routes it.
+void RoutePoolRequest(PoolConnection* connection,
+                      std::vector<PoolWorker>* workers,
+                      std::map<std::string, std::string>* scripts,
+                      size_t* cursor) {
+  const std::string& request = connection->request;
+  const size_t end = request.find_first_of(" \n");
+  const std::string verb = request.substr(0, end);
+  if (verb == "pool") {
+    const std::string action = TrimWhitespace(
+        end == std::string::npos ? std::string() : request.substr(end));
+    connection->reply = action == "status"
+                            ? PoolStatusJson(*workers)
+                            : std::string("ERR unknown pool command\n");
+    connection->upstream_done = true;
+    return;
+  }
+  // A tab id is only meaningful on the worker that made the tab, so open is
+  // refused here rather than balanced to an unknown worker.
+  if (verb != "eval") {
+    connection->reply =
+        "ERR pool only routes eval; address a worker profile for " + verb +
+        "\n";
+    connection->upstream_done = true;
+    return;
+  }
+  std::istringstream stream(request.substr(end));
+  std::string action;
+  stream >> action;
+  std::string args;
+  std::getline(stream, args);
+  args = TrimWhitespace(args);
+  if (action == "register" || action == "unregister" ||
+      action == "pending" || action == "cancel") {
+    StartPoolEvalControl(connection, action, args, *workers);
+    MaybeFinishPoolEvalControl(connection, scripts);
+    return;
+  }
+  if (action != "list" && PoolEvalNeedsWorker(request)) {
+    connection->reply =
+        "ERR pool evals run in their own tab; pass --open=URL (tab "
+        "selectors only mean something on one worker's profile)\n";
+    connection->upstream_done = true;
+    return;
+  }
+  const int index = PickPoolWorker(*workers, cursor);
+  if (index < 0) {
+    // Stays queued until a worker becomes ready.
+    return;
+  }
+  PoolWorker& worker = (*workers)[index];
+  connection->worker = index;
+  ++worker.queue;
+  connection->upstream_fd = ConnectUnix(worker.socket_path);
+  if (connection->upstream_fd < 0 ||
+      !SetNonBlocking(connection->upstream_fd)) {
+    FinishUpstream(connection, workers, false);
+  }
+}
+
+void HandlePoolWorkerExit(pid_t pid,
+                          std::vector<PoolWorker>* workers,
+                          std::vector<PoolConnection>* connections) {
+  for (size_t i = 0; i < workers->size(); ++i) {
+    PoolWorker& worker = (*workers)[i];
+    if (worker.pid != pid) {
+      continue;
+    }
+    std::cerr << "Pool worker " << worker.number << " (pid " << pid
+              << ") exited; restarting\n";
+    worker.pid = -1;
+    worker.state = PoolWorkerState::kStopped;
+    worker.next_action = std::chrono::steady_clock::now() +
+                         std::chrono::milliseconds(kPoolRestartDelayMs);
+    for (PoolConnection& connection : *connections) {
+      if (connection.worker == static_cast<int>(i)) {
+        FinishUpstream(&connection, workers, false);
+      }
+    }
+    return;
+  }
+}
+
+void StopPoolWorkers(std::vector<PoolWorker>* workers) {
+  for (PoolWorker& worker : *workers) {
+    if (worker.pid > 0) {
+      kill(worker.pid, SIGTERM);
+    }
+  }
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(kPoolShutdownGraceMs);
+  for (PoolWorker& worker : *workers) {
+    while (worker.pid > 0) {
+      if (waitpid(worker.pid, nullptr, WNOHANG) != 0) {
+        worker.pid = -1;
+        break;
+      }
+      if (std::chrono::steady_clock::now() >= deadline) {
+        kill(worker.pid, SIGKILL);
+        waitpid(worker.pid, nullptr, 0);
+        worker.pid = -1;
+        break;
+      }
+      usleep(50 * 1000);
+    }
+    worker.state = PoolWorkerState::kStopped;
+  }
+}
+
+int RunPool(const std::string& root,
+            const std::string& name,
+            int worker_count,
+            int cdp_base_port,
+            const std::string& browser_binary,
+            const std::vector<std::string>& browser_args) {
+  const std::string front_dir = JoinProfilePath(root, name);
+  std::error_code ec;
+  std::filesystem::create_directories(front_dir, ec);
+  const std::string front_socket = TabSocketPath(front_dir);
+  const int listen_fd = ListenUnix(front_socket);
+  if (listen_fd < 0) {
+    return 1;
+  }
+
+  std::vector<PoolWorker> workers(static_cast<size_t>(worker_count));
+  for (int i = 0; i < worker_count; ++i) {
+    PoolWorker& worker = workers[static_cast<size_t>(i)];
+    worker.number = i + 1;
+    worker.user_data_dir =
+        JoinProfilePath(root, name + "-" + std::to_string(worker.number));
+    worker.socket_path = TabSocketPath(worker.user_data_dir);
+  }
+  auto worker_args = [&](const PoolWorker& worker) {
+    std::vector<std::string> args;
+    if (cdp_base_port > 0) {
+      args.push_back("--cdp-port=" +
+                     std::to_string(cdp_base_port + worker.number - 1));
+    } else {
+      args.push_back("--cdp-disable");
+    }
+    args.insert(args.end(), browser_args.begin(), browser_args.end());
+    return args;
+  };
+
+  g_stop_requested = 0;
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
+  std::signal(SIGPIPE, SIG_IGN);
+  std::cerr << "Pool " << name << " listening on " << front_socket << " with "
+            << worker_count << " workers\n";
+
+  std::vector<PoolConnection> connections;
+  // Registered scripts by name, as the register request that created them.
+  std::map<std::string, std::string> scripts;
+  // Script replays into workers that just came up.
+  std::vector<PoolControlCall> syncs;
+  size_t cursor = 0;
+  static char buffer[64 * 1024];
+  while (!g_stop_requested) {
+    int status = 0;
+    pid_t exited = 0;
+    while ((exited = waitpid(-1, &status, WNOHANG)) > 0) {
+      HandlePoolWorkerExit(exited, &workers, &connections);
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < workers.size(); ++i) {
+      PoolWorker& worker = workers[i];
+      if (worker.state == PoolWorkerState::kStopped &&
+          now >= worker.next_action) {
+        if (worker.launched) {
+          ++worker.restarts;
+        }
+        if (!SpawnPoolWorker(browser_binary, worker_args(worker), &worker)) {
+          worker.next_action =
+              now + std::chrono::milliseconds(kPoolRestartDelayMs);
+        }
+        continue;
+      }
+      if (worker.state == PoolWorkerState::kStarting &&
+          now >= worker.next_action) {
+        const int probe = ConnectUnix(worker.socket_path);
+        if (probe >= 0) {
+          close(probe);
+          worker.state = PoolWorkerState::kSyncing;
+          StartPoolWorkerSync(worker, static_cast<int>(i), scripts, &syncs);
+        } else {
+          worker.next_action =
+              now + std::chrono::milliseconds(kPoolProbeIntervalMs);
+        }
+      }
+    }
+
+    FinishPoolWorkerSyncs(&syncs, &workers);
+
+    for (PoolConnection& connection : connections) {
+      if (connection.request_complete && !connection.upstream_done &&
+          connection.worker < 0 && connection.control_action.empty()) {
+        RoutePoolRequest(&connection, &workers, &scripts, &cursor);
+      }
+      for (PoolControlCall& call : connection.calls) {
+        if (!call.done && now >= call.deadline) {
+          EndPoolControlCall(&call, false);
+        }
+      }
+      MaybeFinishPoolEvalControl(&connection, &scripts);
+    }
+    for (PoolControlCall& call : syncs) {
+      if (!call.done && now >= call.deadline) {
+        EndPoolControlCall(&call, false);
+      }
+    }
+
+    std::vector<pollfd> fds;
+    fds.push_back({listen_fd, POLLIN, 0});
+    for (const PoolConnection& connection : connections) {
+      short client_events = 0;
+      if (!connection.request_complete) {
+        client_events |= POLLIN;
+      }
+      if (connection.reply_sent < connection.reply.size()) {
+        client_events |= POLLOUT;
+      }
+      // A client that left while its control calls finish is not polled,
+      // since its hangup would wake every round.
+      const bool client_gone =
+          connection.upstream_done && !connection.control_action.empty();
+      fds.push_back(
+          {client_gone ? -1 : connection.client_fd, client_events, 0});
+      short upstream_events = 0;
+      if (connection.upstream_fd >= 0) {
+        if (connection.request_sent < connection.request.size()) {
+          upstream_events |= POLLOUT;
+        } else if (connection.reply.size() - connection.reply_sent <
+                   kPoolMaxPendingBytes) {
+          upstream_events |= POLLIN;
+        }
+      }
+      fds.push_back({connection.upstream_fd, upstream_events, 0});
+    }
+    // Control calls follow the two fds of every connection, in order.
+    for (const PoolConnection& connection : connections) {
+      for (const PoolControlCall& call : connection.calls) {
+        if (!call.done) {
+          fds.push_back({call.fd, PoolControlCallEvents(call), 0});
+        }
+      }
+    }
+    for (const PoolControlCall& call : syncs) {
+      if (!call.done) {
+        fds.push_back({call.fd, PoolControlCallEvents(call), 0});
+      }
+    }
+
+    const int ready = poll(fds.data(), fds.size(), kPoolProbeIntervalMs);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      std::cerr << "poll failed: " << std::strerror(errno) << "\n";
+      break;
+    }
+
+    // Control calls go first: a request read below may start new ones that
+    // have no fd in this round.
+    size_t next_fd = 1 + connections.size() * 2;
+    for (PoolConnection& connection : connections) {
+      for (PoolControlCall& call : connection.calls) {
+        if (!call.done) {
+          StepPoolControlCall(&call, fds[next_fd++].revents);
+        }
+      }
+    }
+    for (PoolControlCall& call : syncs) {
+      if (!call.done) {
+        StepPoolControlCall(&call, fds[next_fd++].revents);
+      }
+    }
+
+    for (size_t i = 0; i < connections.size(); ++i) {
+      PoolConnection& connection = connections[i];
+      const pollfd& client = fds[1 + i * 2];
+      const pollfd& upstream = fds[2 + i * 2];
+      if (client.revents & POLLIN) {
+        const ssize_t n = read(connection.client_fd, buffer, sizeof(buffer));
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+          // Spurious wakeup; try again on the next poll.
+        } else if (n <= 0) {
+          connection.request_complete = true;
+          connection.upstream_done = true;
+          connection.reply_sent = connection.reply.size();
+        } else {
+          connection.request.append(buffer, static_cast<size_t>(n));
+          const size_t newline = connection.request.find('\n');
+          if (newline != std::string::npos) {
+            connection.request.resize(newline + 1);
+            connection.request_complete = true;
+            RoutePoolRequest(&connection, &workers, &scripts, &cursor);
+          } else if (connection.request.size() > kPoolMaxRequestBytes) {
+            connection.request_complete = true;
+            connection.upstream_done = true;
+            connection.reply = "ERR request too large\n";
+          }
+        }
+      } else if (client.revents & (POLLHUP | POLLERR)) {
+        connection.reply_sent = connection.reply.size();
+        FinishUpstream(&connection, &workers, false);
+        connection.request_complete = true;
+      }
+      if (client.revents & POLLOUT) {
+        const ssize_t n =
+            send(connection.client_fd,
+                 connection.reply.data() + connection.reply_sent,
+                 connection.reply.size() - connection.reply_sent,
+                 MSG_NOSIGNAL);
+        if (n > 0) {
+          connection.reply_sent += static_cast<size_t>(n);
+          if (connection.reply_sent == connection.reply.size()) {
+            connection.reply.clear();
+            connection.reply_sent = 0;
+          }
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+          connection.reply.clear();
+          connection.reply_sent = 0;
+          FinishUpstream(&connection, &workers, false);
+        }
+      }
+      if (connection.upstream_fd < 0) {
+        continue;
+      }
+      if (upstream.revents & POLLOUT) {
+        const ssize_t n =
+            send(connection.upstream_fd,
+                 connection.request.data() + connection.request_sent,
+                 connection.request.size() - connection.request_sent,
+                 MSG_NOSIGNAL);
+        if (n > 0) {
+          connection.request_sent += static_cast<size_t>(n);
+        } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+          FinishUpstream(&connection, &workers, false);
+          continue;
+        }
+      }
+      if (upstream.revents & (POLLIN | POLLHUP | POLLERR)) {
+        const ssize_t n =
+            read(connection.upstream_fd, buffer, sizeof(buffer));
+        if (n > 0) {
+          connection.reply.append(buffer, static_cast<size_t>(n));
+          connection.reply_started = true;
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+          FinishUpstream(&connection, &workers, n == 0);
+        }
+      }
+    }
+    for (PoolConnection& connection : connections) {
+      MaybeFinishPoolEvalControl(&connection, &scripts);
+    }
+    FinishPoolWorkerSyncs(&syncs, &workers);
+
+    connections.erase(
+        std::remove_if(connections.begin(), connections.end(),
+                       [](const PoolConnection& connection) {
+                         const bool done =
+                             connection.request_complete &&
+                             connection.upstream_done &&
+                             connection.control_action.empty() &&
+                             connection.reply_sent >= connection.reply.size();
+                         if (done) {
+                           close(connection.client_fd);
+                         }
+                         return done;
+                       }),
+        connections.end());
+
+    if (fds[0].revents & POLLIN) {
+      int client_fd = -1;
+      while ((client_fd = accept4(listen_fd, nullptr, nullptr,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        PoolConnection connection;
+        connection.client_fd = client_fd;
+        connections.push_back(std::move(connection));
+      }
+    }
+  }
+
+  for (PoolConnection& connection : connections) {
+    if (connection.upstream_fd >= 0) {
+      close(connection.upstream_fd);
+    }
+    for (PoolControlCall& call : connection.calls) {
+      EndPoolControlCall(&call, false);
+    }
+    close(connection.client_fd);
+  }
+  for (PoolControlCall& call : syncs) {
+    EndPoolControlCall(&call, false);
+  }
+  close(listen_fd);
+  unlink(front_socket.c_str());
+  StopPoolWorkers(&workers);
+  return 0;
+}
+
+}  // namespace
+
+int RunPoolCli(int argc,
+               char* argv[],
+               const std::string& default_user_data_root,
+               const std::string& browser_binary) {
+  std::string action = "start";
+  int index = 0;
+  if (index < argc && argv[index][0] != '-') {
+    action = argv[index++];
+  }
+  if (action != "start" && action != "status") {
+    std::cerr << "Unknown pool action: " << action << "\n";
+    PrintPoolUsage();
+    return 1;
+  }
+
+  std::string name = "pool";
+  int worker_count = kPoolDefaultWorkers;
+  int cdp_base_port = 0;
+  std::vector<std::string> browser_args;
+  for (; index < argc; ++index) {
+    std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintPoolUsage();
+      return 0;
+    }
+    if (arg == "--") {
+      if (action != "start") {
+        std::cerr << "Browser flags are only accepted by pool start\n";
+        return 1;
+      }
+      browser_args.assign(argv + index + 1, argv + argc);
+      break;
+    }
+    const std::string name_prefix = "--name=";
+    if (arg.rfind(name_prefix, 0) == 0) {
+      name = arg.substr(name_prefix.size());
+      if (!IsValidScriptId(name)) {
+        std::cerr << "Invalid --name value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string workers_prefix = "--workers=";
+    if (action == "start" && arg.rfind(workers_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(workers_prefix.size()),
+                            &worker_count)) {
+        std::cerr << "Invalid --workers value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string cdp_prefix = "--cdp-base-port=";
+    if (action == "start" && arg.rfind(cdp_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(cdp_prefix.size()), &cdp_base_port) ||
+          cdp_base_port > 65535) {
+        std::cerr << "Invalid --cdp-base-port value\n";
+        return 1;
+      }
+      continue;
+    }
+    std::cerr << "Unknown pool option: " << arg << "\n";
+    PrintPoolUsage();
+    return 1;
+  }
+
+  if (action == "status") {
+    const std::string socket_path =
+        TabSocketPath(JoinProfilePath(default_user_data_root, name));
+    return SendCommand(socket_path, "pool status\n") ? 0 : 1;
+  }
+  if (cdp_base_port > 0 && cdp_base_port + worker_count - 1 > 65535) {
+    std::cerr << "--cdp-base-port leaves no room for " << worker_count
+              << " workers\n";
+    return 1;
+  }
+  return RunPool(default_user_data_root, name, worker_count, cdp_base_port,
+                 browser_binary, browser_args);
+}
+
+}  // namespace rethread
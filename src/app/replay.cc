@@ -0,0 +1,597 @@
+#include "app/tab_cli.h"
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <QByteArray>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonValue>
+
+#include "app/cdp_pipeline.h"
+#include "app/cli_util.h"
+
+#ifdef RETHREAD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace rethread {
+namespace {
+
+void PrintReplayUsage() {
+  std::cerr
+      << "Usage: rethread replay [--user-data-dir=PATH] [--profile=NAME]\n"
+      << "                       <capture-dir> [--id=N] [--passthrough]\n"
+      << "                       [--cdp-port=PORT] [-- command...]\n"
+      << "Answers the browser's requests from a network-log capture.\n"
+      << "Options:\n"
+      << "  --id=N          Only replay for tab N (default: every tab)\n"
+      << "  --passthrough   Send requests the capture lacks to the network\n"
+      << "                  (default: fail them as offline)\n"
+      << "  --cdp-port=PORT CDP port (default: the browser's, else 9222)\n"
+      << "  -- command...   Run command once replay is active and exit with\n"
+      << "                  its status\n";
+}
+
+// Failure Chromium reports for requests the capture has no answer for.
+constexpr char kReplayMissError[] = "InternetDisconnected";
+
+// One recorded response as rethread replay serves it.
+struct ReplayResponse {
+  int status = 0;
+  std::vector<std::pair<std::string, std::string>> headers;
+  // The body, or |body_path| when it is a file on disk.
+  std::string body;
+  std::string body_path;
+};
+
+// Recorded responses by "METHOD URL", in capture order. A request made
+// several times gets the recordings in turn, the last one repeating.
+struct ReplayArchive {
+  std::unordered_map<std::string, std::vector<ReplayResponse>> responses;
+  std::unordered_map<std::string, size_t> served;
+  size_t count = 0;
+};
+
+std::string ReplayKey(const std::string& method, const std::string& url) {
+  return (method.empty() ? std::string("GET") : method) + " " + url;
+}
+
+void AddReplayResponse(ReplayArchive* archive,
+                       const std::string& method,
+                       const std::string& url,
+                       ReplayResponse response) {
+  // A 304 only makes sense against the cache it revalidated; pending and
+  // failed requests have no status at all.
+  if (url.empty() || response.status < 200 || response.status == 304) {
+    return;
+  }
+  archive->responses[ReplayKey(method, url)].push_back(std::move(response));
+  ++archive->count;
+}
+
+// Body files in records are relative to the capture directory unless they
+// live in a store elsewhere.
+std::string ResolveCaptureFile(const std::string& capture_dir,
+                               const std::string& file) {
+  if (file.empty() || file[0] == '/') {
+    return file;
+  }
+  return (std::filesystem::path(capture_dir) / file).string();
+}
+
+// Undoes InsertCaptureBody.
+std::string CaptureBodyBytes(const QJsonObject& body) {
+  const std::string text =
+      body.value(QStringLiteral("text")).toString().toStdString();
+  if (body.value(QStringLiteral("encoding")).toString() !=
+      QStringLiteral("base64")) {
+    return text;
+  }
+  std::string decoded;
+  return Base64Decode(text, &decoded) ? decoded : std::string();
+}
+
+void LoadReplayDirectories(const std::string& capture_dir,
+                           ReplayArchive* archive) {
+  std::vector<std::filesystem::path> requests;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(capture_dir, ec)) {
+    if (entry.is_directory(ec) &&
+        std::filesystem::exists(entry.path() / "metadata.json", ec)) {
+      requests.push_back(entry.path());
+    }
+  }
+  // Directory names start with the capture time in milliseconds.
+  std::sort(requests.begin(), requests.end());
+  for (const std::filesystem::path& dir : requests) {
+    const QJsonObject metadata = ReadJsonObjectFile(dir / "metadata.json");
+    ReplayResponse response;
+    response.status =
+        metadata.value(QStringLiteral("status")).toString().toInt();
+    const QJsonObject headers =
+        ReadJsonObjectFile(dir / "response-headers.json");
+    for (auto it = headers.begin(); it != headers.end(); ++it) {
+      response.headers.emplace_back(it.key().toStdString(),
+                                    it.value().toString().toStdString());
+    }
+    if (std::filesystem::exists(dir / "response-body.bin", ec)) {
+      response.body_path = (dir / "response-body.bin").string();
+    }
+    AddReplayResponse(
+        archive,
+        metadata.value(QStringLiteral("method")).toString().toStdString(),
+        metadata.value(QStringLiteral("url")).toString().toStdString(),
+        std::move(response));
+  }
+}
+
+// Reads a capture-NNNNN file, decompressing .zst ones.
+bool ReadCaptureArchive(const std::filesystem::path& path,
+                        std::string* data,
+                        std::string* error) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) {
+    *error = "cannot read " + path.string();
+    return false;
+  }
+  std::string raw((std::istreambuf_iterator<char>(in)),
+                  std::istreambuf_iterator<char>());
+  if (path.extension() != ".zst") {
+    *data = std::move(raw);
+    return true;
+  }
+#ifdef RETHREAD_HAVE_ZSTD
+  // Every record is its own frame, so the file is a run of frames.
+  ZSTD_DStream* stream = ZSTD_createDStream();
+  ZSTD_initDStream(stream);
+  ZSTD_inBuffer input{raw.data(), raw.size(), 0};
+  std::string chunk(ZSTD_DStreamOutSize(), '\0');
+  while (true) {
+    ZSTD_outBuffer output{chunk.data(), chunk.size(), 0};
+    const size_t result = ZSTD_decompressStream(stream, &output, &input);
+    if (ZSTD_isError(result)) {
+      *error = path.string() + ": " + ZSTD_getErrorName(result);
+      ZSTD_freeDStream(stream);
+      return false;
+    }
+    data->append(chunk.data(), output.pos);
+    if (input.pos == input.size && output.pos < output.size) {
+      break;
+    }
+  }
+  ZSTD_freeDStream(stream);
+  return true;
+#else
+  *error = path.string() + ": rethread was built without zstd support";
+  return false;
+#endif
+}
+
+void LoadReplayNdjson(const std::string& capture_dir,
+                      const std::string& data,
+                      ReplayArchive* archive) {
+  std::istringstream lines(data);
+  std::string line;
+  while (std::getline(lines, line)) {
+    const QJsonObject record =
+        QJsonDocument::fromJson(QByteArray::fromStdString(line)).object();
+    ReplayResponse response;
+    response.status =
+        record.value(QStringLiteral("status")).toString().toInt();
+    const QJsonObject headers =
+        record.value(QStringLiteral("responseHeaders")).toObject();
+    for (auto it = headers.begin(); it != headers.end(); ++it) {
+      response.headers.emplace_back(it.key().toStdString(),
+                                    it.value().toString().toStdString());
+    }
+    const QJsonObject body =
+        record.value(QStringLiteral("responseBody")).toObject();
+    if (body.contains(QStringLiteral("file"))) {
+      response.body_path = ResolveCaptureFile(
+          capture_dir,
+          body.value(QStringLiteral("file")).toString().toStdString());
+    } else {
+      response.body = CaptureBodyBytes(body);
+    }
+    AddReplayResponse(
+        archive,
+        record.value(QStringLiteral("method")).toString().toStdString(),
+        record.value(QStringLiteral("url")).toString().toStdString(),
+        std::move(response));
+  }
+}
+
+void LoadReplayHar(const std::string& capture_dir,
+                   const std::string& data,
+                   ReplayArchive* archive) {
+  QJsonDocument doc = QJsonDocument::fromJson(QByteArray::fromStdString(data));
+  if (doc.isNull()) {
+    // The file of a capture that is still running lacks its closing.
+    doc = QJsonDocument::fromJson(QByteArray::fromStdString(data + "]}}"));
+  }
+  const QJsonArray entries = doc.object()
+                                 .value(QStringLiteral("log"))
+                                 .toObject()
+                                 .value(QStringLiteral("entries"))
+                                 .toArray();
+  for (const QJsonValue& value : entries) {
+    const QJsonObject entry = value.toObject();
+    const QJsonObject request =
+        entry.value(QStringLiteral("request")).toObject();
+    const QJsonObject har_response =
+        entry.value(QStringLiteral("response")).toObject();
+    ReplayResponse response;
+    response.status = har_response.value(QStringLiteral("status")).toInt();
+    for (const QJsonValue& header :
+         har_response.value(QStringLiteral("headers")).toArray()) {
+      const QJsonObject pair = header.toObject();
+      response.headers.emplace_back(
+          pair.value(QStringLiteral("name")).toString().toStdString(),
+          pair.value(QStringLiteral("value")).toString().toStdString());
+    }
+    const QJsonObject content =
+        har_response.value(QStringLiteral("content")).toObject();
+    if (content.contains(QStringLiteral("_file"))) {
+      response.body_path = ResolveCaptureFile(
+          capture_dir,
+          content.value(QStringLiteral("_file")).toString().toStdString());
+    } else {
+      response.body = CaptureBodyBytes(content);
+    }
+    AddReplayResponse(
+        archive,
+        request.value(QStringLiteral("method")).toString().toStdString(),
+        request.value(QStringLiteral("url")).toString().toStdString(),
+        std::move(response));
+  }
+}
+
+// Loads every response network-log wrote to |capture_dir|, whatever
+// --format it used. WARC captures are skipped with a warning.
+bool LoadReplayArchive(const std::string& capture_dir,
+                       ReplayArchive* archive,
+                       std::string* error) {
+  LoadReplayDirectories(capture_dir, archive);
+  std::vector<std::filesystem::path> files;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(capture_dir, ec)) {
+    if (entry.is_regular_file(ec) &&
+        entry.path().filename().string().rfind("capture-", 0) == 0) {
+      files.push_back(entry.path());
+    }
+  }
+  if (ec) {
+    *error = capture_dir + ": " + ec.message();
+    return false;
+  }
+  std::sort(files.begin(), files.end());
+  size_t warc_files = 0;
+  for (const std::filesystem::path& path : files) {
+    std::filesystem::path format = path;
+    if (format.extension() == ".zst") {
+      format = format.stem();
+    }
+    if (format.extension() == ".warc") {
+      ++warc_files;
+      continue;
+    }
+    std::string data;
+    if (!ReadCaptureArchive(path, &data, error)) {
+      return false;
+    }
+    if (format.extension() == ".har") {
+      LoadReplayHar(capture_dir, data, archive);
+    } else if (format.extension() == ".ndjson") {
+      LoadReplayNdjson(capture_dir, data, archive);
+    }
+  }
+  if (warc_files > 0) {
+    std::cerr << "Skipping " << warc_files
+              << " WARC files; replay reads dir, har and ndjson captures\n";
+  }
+  return true;
+}
+
+// Fetch.fulfillRequest parameters for |response|. Bodies were recorded
+// decoded, so the framing headers are rewritten to match.
+QJsonObject ReplayFulfillParams(const QString& request_id,
+                                const ReplayResponse& response,
+                                const std::string& body) {
+  QJsonArray headers;
+  auto add_header = [&headers](const std::string& name,
+                               const std::string& value) {
+    QJsonObject header;
+    header.insert(QStringLiteral("name"), QString::fromStdString(name));
+    header.insert(QStringLiteral("value"), QString::fromStdString(value));
+    headers.append(header);
+  };
+  for (const auto& [name, value] : response.headers) {
+    const std::string lower = ToLower(name);
+    if (lower == "content-encoding" || lower == "transfer-encoding" ||
+        lower == "content-length" || (!name.empty() && name[0] == ':')) {
+      continue;
+    }
+    // CDP joins repeated headers such as Set-Cookie with newlines.
+    std::istringstream values(value);
+    std::string line;
+    while (std::getline(values, line)) {
+      add_header(name, line);
+    }
+  }
+  add_header("Content-Length", std::to_string(body.size()));
+  QJsonObject params;
+  params.insert(QStringLiteral("requestId"), request_id);
+  params.insert(QStringLiteral("responseCode"), response.status);
+  params.insert(QStringLiteral("responseHeaders"), headers);
+  params.insert(QStringLiteral("body"),
+                QString::fromStdString(Base64Encode(body)));
+  return params;
+}
+
+// Finds the recording for a request, advancing through repeats.
+const ReplayResponse* NextReplayResponse(ReplayArchive* archive,
+                                         const std::string& key) {
+  auto it = archive->responses.find(key);
+  if (it == archive->responses.end()) {
+    return nullptr;
+  }
+  size_t& served = archive->served[key];
+  const size_t index = std::min(served, it->second.size() - 1);
+  ++served;
+  return &it->second[index];
+}
+
+bool ReadReplayBody(const ReplayResponse& response, std::string* body) {
+  if (response.body_path.empty()) {
+    *body = response.body;
+    return true;
+  }
+  std::ifstream in(response.body_path, std::ios::binary);
+  if (!in.is_open()) {
+    return false;
+  }
+  body->assign(std::istreambuf_iterator<char>(in),
+               std::istreambuf_iterator<char>());
+  return true;
+}
+
+pid_t StartReplayCommand(std::vector<std::string> command) {
+  std::vector<char*> exec_argv;
+  exec_argv.reserve(command.size() + 1);
+  for (std::string& arg : command) {
+    exec_argv.push_back(arg.data());
+  }
+  exec_argv.push_back(nullptr);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+    execvp(exec_argv[0], exec_argv.data());
+    std::perror("rethread replay");
+    _exit(127);
+  }
+  return pid;
+}
+
+}  // namespace
+
+int RunReplayCli(int argc,
+                 char* argv[],
+                 const std::string& default_user_data_dir) {
+  std::string user_data_dir;
+  int index = 0;
+  if (!ParseUserDataDir(argc, argv, default_user_data_dir, &user_data_dir,
+                        &index)) {
+    return 1;
+  }
+  std::string capture_dir;
+  int tab_id = 0;
+  int cdp_port = 0;
+  bool passthrough = false;
+  std::vector<std::string> command;
+  for (; index < argc; ++index) {
+    const std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintReplayUsage();
+      return 0;
+    }
+    if (arg == "--") {
+      command.assign(argv + index + 1, argv + argc);
+      break;
+    }
+    if (arg == "--passthrough") {
+      passthrough = true;
+      continue;
+    }
+    const std::string id_prefix = "--id=";
+    if (arg.rfind(id_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(id_prefix.size()), &tab_id)) {
+        std::cerr << "Invalid --id value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string cdp_port_prefix = "--cdp-port=";
+    if (arg.rfind(cdp_port_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(cdp_port_prefix.size()), &cdp_port) ||
+          cdp_port >= 65536) {
+        std::cerr << "Invalid --cdp-port value\n";
+        return 1;
+      }
+      continue;
+    }
+    if (!arg.empty() && arg[0] != '-' && capture_dir.empty()) {
+      capture_dir = arg;
+      continue;
+    }
+    std::cerr << "Unknown replay option: " << arg << "\n";
+    PrintReplayUsage();
+    return 1;
+  }
+  if (capture_dir.empty()) {
+    std::cerr << "replay requires a capture directory\n";
+    PrintReplayUsage();
+    return 1;
+  }
+  if (!std::filesystem::is_directory(capture_dir)) {
+    std::cerr << "Not a directory: " << capture_dir << "\n";
+    return 1;
+  }
+
+  ReplayArchive archive;
+  std::string load_error;
+  if (!LoadReplayArchive(capture_dir, &archive, &load_error)) {
+    std::cerr << "Failed to load capture: " << load_error << "\n";
+    return 1;
+  }
+  if (archive.count == 0) {
+    std::cerr << "No replayable responses in " << capture_dir << "\n";
+    return 1;
+  }
+
+  CdpPipeline cdp;
+  std::string devtools_id;
+  if (!ConnectCdpPipeline(user_data_dir, tab_id, cdp_port, &cdp,
+                          &devtools_id)) {
+    return 1;
+  }
+  // On the browser endpoint Fetch intercepts every page, including ones
+  // opened later.
+  QJsonObject pattern;
+  pattern.insert(QStringLiteral("urlPattern"), QStringLiteral("*"));
+  pattern.insert(QStringLiteral("requestStage"), QStringLiteral("Request"));
+  QJsonArray patterns;
+  patterns.append(pattern);
+  QJsonObject enable_params;
+  enable_params.insert(QStringLiteral("patterns"), patterns);
+  const int enable_id = cdp.Send(QStringLiteral("Fetch.enable"), enable_params);
+
+  g_stop_requested = 0;
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
+
+  pid_t child = -1;
+  int exit_code = 1;
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  bool connected = true;
+  std::vector<std::string_view> messages;
+  while (!g_stop_requested && connected) {
+    if (child > 0) {
+      int status = 0;
+      if (waitpid(child, &status, WNOHANG) == child) {
+        child = -1;
+        exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        break;
+      }
+    }
+    if (!cdp.Flush()) {
+      break;
+    }
+    pollfd watch{cdp.fd, static_cast<short>(
+                             POLLIN | (cdp.outbox.empty() ? 0 : POLLOUT)),
+                 0};
+    if (poll(&watch, 1, kNetworkLogPollMs) < 0 && errno != EINTR) {
+      break;
+    }
+    messages.clear();
+    connected = cdp.Receive(&messages);
+    for (std::string_view message : messages) {
+      const QJsonObject event = ParseCdpMessage(message);
+      if (event.value(QStringLiteral("id")).toInt() == enable_id) {
+        if (event.contains(QStringLiteral("error"))) {
+          std::cerr << "Fetch.enable failed: "
+                    << QJsonDocument(
+                           event.value(QStringLiteral("error")).toObject())
+                           .toJson(QJsonDocument::Compact)
+                           .toStdString()
+                    << "\n";
+          close(cdp.fd);
+          return 1;
+        }
+        std::cerr << "Replaying " << archive.count << " responses from "
+                  << capture_dir << "\n";
+        // The command starts only once interception is in place.
+        if (!command.empty()) {
+          child = StartReplayCommand(command);
+          if (child < 0) {
+            std::cerr << "Failed to start " << command.front() << ": "
+                      << std::strerror(errno) << "\n";
+            close(cdp.fd);
+            return 1;
+          }
+        }
+        continue;
+      }
+      if (event.value(QStringLiteral("method")).toString() !=
+          QStringLiteral("Fetch.requestPaused")) {
+        continue;
+      }
+      const std::string session_id =
+          event.value(QStringLiteral("sessionId")).toString().toStdString();
+      const QJsonObject params =
+          event.value(QStringLiteral("params")).toObject();
+      const QString request_id =
+          params.value(QStringLiteral("requestId")).toString();
+      const QJsonObject request =
+          params.value(QStringLiteral("request")).toObject();
+      const std::string url =
+          request.value(QStringLiteral("url")).toString().toStdString();
+      const std::string method =
+          request.value(QStringLiteral("method")).toString().toStdString();
+      const ReplayResponse* response =
+          NextReplayResponse(&archive, ReplayKey(method, url));
+      std::string body;
+      QJsonObject reply;
+      reply.insert(QStringLiteral("requestId"), request_id);
+      if (response && ReadReplayBody(*response, &body)) {
+        ++hits;
+        cdp.Send(QStringLiteral("Fetch.fulfillRequest"),
+                 ReplayFulfillParams(request_id, *response, body),
+                 session_id);
+      } else if (passthrough) {
+        ++misses;
+        NetworkLogDebug("passthrough " + method + " " + url);
+        cdp.Send(QStringLiteral("Fetch.continueRequest"), reply, session_id);
+      } else {
+        ++misses;
+        std::cerr << "miss " << method << " " << url << "\n";
+        reply.insert(QStringLiteral("errorReason"),
+                     QString::fromLatin1(kReplayMissError));
+        cdp.Send(QStringLiteral("Fetch.failRequest"), reply, session_id);
+      }
+    }
+  }
+  if (child > 0) {
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+  }
+  close(cdp.fd);
+  std::cerr << "Replayed " << hits << " requests, " << misses
+            << (passthrough ? " passed through\n" : " missed\n");
+  if (command.empty()) {
+    return g_stop_requested ? 0 : 1;
+  }
+  return exit_code;
+}
+
+}  // namespace rethread
@@ -37,6 +37,19 @@ void PrintCliUsage() {
             << "    Open DevTools for the active tab.\n"
             << "  rethread network-log [--user-data-dir=PATH] [--profile=NAME] ...\n"
             << "    Capture network traffic for a tab via CDP.\n"
+            << "  rethread netlog [--user-data-dir=PATH] [--profile=NAME]\n"
+            << "                  [--id=N] [--follow]\n"
+            << "    Print requests recorded inside the browser; no CDP needed.\n"
+            << "  rethread perf [--user-data-dir=PATH] [--profile=NAME] <tab-id>\n"
+            << "    Reload a tab and show its request waterfall and load timings.\n"
+            << "  rethread replay [--user-data-dir=PATH] [--profile=NAME] <capture>\n"
+            << "                  [--id=N] [-- command...]\n"
+            << "    Answer the browser's requests from a network-log capture.\n"
+            << "  rethread top [--user-data-dir=PATH] [--profile=NAME]\n"
+            << "               [--interval=SECONDS] [--iterations=N] [--json]\n"
+            << "    Show live per-tab CPU, memory, and network usage.\n"
+            << "  rethread pool [start|status] [--name=NAME] [--workers=N]\n"
+            << "    Run N headless browsers behind one load-balancing socket.\n"
             << "  rethread browser [options]\n"
             << "    Launch the browser UI (same flags as rethread-browser).\n";
 }
@@ -120,11 +133,33 @@ int main(int argc, char* argv[]) {
     return rethread::RunNetworkLogCli(argc - 2, argv + 2,
                                       rethread::DefaultUserDataRoot());
   }
+  if (command == "netlog") {
+    return rethread::RunNetLogCli(argc - 2, argv + 2,
+                                  rethread::DefaultUserDataRoot());
+  }
+  if (command == "perf") {
+    return rethread::RunPerfCli(argc - 2, argv + 2,
+                                rethread::DefaultUserDataRoot());
+  }
+  if (command == "replay") {
+    return rethread::RunReplayCli(argc - 2, argv + 2,
+                                  rethread::DefaultUserDataRoot());
+  }
+  if (command == "top") {
+    return rethread::RunTopCli(argc - 2, argv + 2,
+                               rethread::DefaultUserDataRoot());
+  }
   if (command == "scripts") {
     return rethread::RunScriptsCli(argc - 2, argv + 2,
                                    rethread::DefaultUserDataRoot());
   }
 
+  if (command == "pool") {
+    return rethread::RunPoolCli(argc - 2, argv + 2,
+                                rethread::DefaultUserDataRoot(),
+                                ResolveBrowserBinary(argv[0]));
+  }
+
   if (command == "browser") {
     if (argc >= 3) {
       std::string next = argv[2];
@@ -1,9 +1,8 @@
 #include "app/tab_cli.h"
 
-#include <sys/socket.h>
-#include <sys/un.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
 #include <unistd.h>
-#include <netdb.h>
 
 #include <cerrno>
 #include <cctype>
@@ -13,18 +12,23 @@
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <cstdlib>
-#include <limits>
 #include <algorithm>
 #include <array>
 #include <chrono>
+#include <condition_variable>
 #include <deque>
 #include <filesystem>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <random>
-#include <regex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <csignal>
 #include <ctime>
@@ -37,8 +41,16 @@
 #include <QJsonValue>
 #include <QUrl>
 
+#include "app/body_store.h"
+#include "app/cdp_pipeline.h"
+#include "app/cli_util.h"
+#include "app/pattern_set.h"
 #include "app/user_dirs.h"
 
+#ifdef RETHREAD_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
 namespace rethread {
 namespace {
 
@@ -46,10 +58,25 @@ void PrintTabUsage() {
   std::cerr
       << "Usage: rethread tabs [--user-data-dir=PATH] [--profile=NAME] <command>\n"
          "Commands:\n"
-         "  get|list              List open tabs.\n"
+         "  get|list [--processes]\n"
+         "                        List open tabs; --processes adds each tab's\n"
+         "                        renderer pid and resident memory.\n"
          "  switch <id>           Activate the tab with the given id.\n"
          "  cycle <delta>         Move relative tab focus.\n"
          "  swap <target> [peer]  Swap/move tabs by index or +/- offset (wraps around).\n"
+         "  move [from] <to>      Move a tab (default: active) to another position;\n"
+         "                        a +/- <to> counts from <from>.\n"
+         "  sort [--by=KEY]       Reorder tabs by url (default), title, or host.\n"
+         "  dedupe                Close tabs whose URL is already open.\n"
+         "  stats                 Print per-tab renderer CPU ticks, RSS, request\n"
+         "                        count, and transferred bytes as JSON.\n"
+         "  group [list]          List tab groups.\n"
+         "  group switch <name> [--discard] [--url=URL]\n"
+         "                        Show a group (created if missing); the group\n"
+         "                        left behind is frozen, or discarded.\n"
+         "  group move <name> [--discard]\n"
+         "                        Move the active tab into another group.\n"
+         "  group close <name>    Close every tab in a group.\n"
          "  open [--at-end] <url> Open a new tab (default inserts after the active tab).\n"
          "  history-back          Navigate back in the active tab.\n"
          "  history-forward       Navigate forward in the active tab.\n"
@@ -102,7 +129,8 @@ void PrintRulesUsage() {
 void PrintScriptsUsage() {
   std::cerr
       << "Usage: rethread scripts [--user-data-dir=PATH] [--profile=NAME]\n"
-      << "       add --id=ID [--match=PATTERN] [--run-at=TYPE] [--stylesheet] < script\n"
+      << "       add --id=ID [--match=PATTERN] [--run-at=TYPE] [--stylesheet]\n"
+      << "           [--world=main|isolated] < script\n"
       << "       list\n"
       << "       rm --id=ID\n";
 }
@@ -114,19 +142,80 @@ void PrintDevToolsUsage() {
 void PrintEvalUsage() {
   std::cerr
       << "Usage: rethread eval [--user-data-dir=PATH] [--profile=NAME] [--stdin]\n"
-      << "                     [--tab-id=N|--tab-index=N] <script>\n"
+      << "                     [--tab-id=N|--tab-index=N|--all|--match=REGEX|\n"
+      << "                      --open=URL]\n"
+      << "                     [--timeout-ms=N] [--raw-output] [--stream]\n"
+      << "                     [--world=main|isolated] [--wait-for=CONDITION]\n"
+      << "                     <script>\n"
       << "Options:\n"
       << "  --stdin              Read the script from stdin instead of argv\n"
       << "  --tab-id=N           Target a specific tab id (default: active tab)\n"
-      << "  --tab-index=N        Target the 1-based tab index\n";
+      << "  --tab-index=N        Target the 1-based tab index\n"
+      << "  --all                Run in every tab of the current group at once\n"
+      << "  --match=REGEX        Run in every tab whose URL matches REGEX\n"
+      << "  --open=URL           Load URL in a new background tab, run there once\n"
+      << "                       it loads (or --wait-for), then close the tab\n"
+      << "  --timeout-ms=N       Give up after N ms (per tab with --all/--match;\n"
+      << "                       default: no limit, 10000 for fan-out)\n"
+      << "  --raw-output         Write a binary or string result as raw bytes\n"
+      << "                       (ArrayBuffer, typed array, Blob) instead of JSON\n"
+      << "  --stream             If the script returns a generator, iterator, or\n"
+      << "                       iterable, print each value as it is produced\n"
+      << "                       (one JSON line per value)\n"
+      << "  --world=WORLD        main (default) shares globals with the page;\n"
+      << "                       isolated sees the DOM but not page scripts\n"
+      << "  --wait-for=CONDITION Run once the tab reaches load, domcontentloaded,\n"
+      << "                       networkidle, or selector:CSS (shares the\n"
+      << "                       --timeout-ms budget; default limit 30000 ms)\n"
+      << "With --all/--match the output is a JSON array of\n"
+      << "{id, url, ok, value|error} objects, one per tab.\n"
+      << "\n"
+      << "       rethread eval pending      List evals still waiting, as JSON\n"
+      << "       rethread eval cancel <id>  Fail a pending eval with \"cancelled\"\n"
+      << "                                  (pool ids look like WORKER:ID)\n"
+      << "\n"
+      << "       rethread eval register --name=NAME [--stdin] [script]\n"
+      << "       rethread eval call NAME [tab options] [json-args]\n"
+      << "       rethread eval unregister NAME | rethread eval list\n"
+      << "Registered scripts are kept in the browser and see json-args as\n"
+      << "`args`; a call only sends the arguments.\n";
 }
 void PrintNetworkLogUsage() {
   std::cerr
       << "Usage: rethread network-log [--user-data-dir=PATH] [--profile=NAME]\n"
-      << "                           --id=N [--dir PATH]\n"
-      << "                           [--url REGEX] [--method REGEX]\n"
-      << "                           [--status REGEX] [--mime REGEX]\n"
-      << "                           [--cdp-port PORT]\n";
+      << "                           (--id=N | --all) [--dir PATH]\n"
+      << "                           [--url PATTERN]... [--method PATTERN]...\n"
+      << "                           [--status PATTERN]... [--mime PATTERN]...\n"
+      << "                           [--cdp-port PORT]\n"
+      << "                           [--format=dir|har|ndjson|warc]\n"
+      << "                           [--rotate-mb=N] [--compress=zstd]\n"
+      << "                           [--stream-bodies] [--inline-bodies]\n"
+      << "                           [--body-store=DIR]\n"
+      << "       rethread network-log gc [--body-store=DIR] [--dry-run] DIR...\n";
+}
+
+void PrintTopUsage() {
+  std::cerr
+      << "Usage: rethread top [--user-data-dir=PATH] [--profile=NAME]\n"
+      << "                    [--interval=SECONDS] [--iterations=N] [--json]\n"
+      << "Options:\n"
+      << "  --interval=SECONDS   Seconds between samples (default: 1)\n"
+      << "  --iterations=N       Stop after N samples (default: run until ^C)\n"
+      << "  --json               Print one JSON object per sample instead of a\n"
+      << "                       refreshing table\n";
+}
+
+void PrintNetLogUsage() {
+  std::cerr
+      << "Usage: rethread netlog [--user-data-dir=PATH] [--profile=NAME]\n"
+      << "                       [--id=N] [--since=SEQ] [--follow]\n"
+      << "                       [--interval-ms=N]\n"
+      << "Options:\n"
+      << "  --id=N          Only requests from tab N\n"
+      << "  --since=SEQ     Start after sequence number SEQ (default: oldest\n"
+      << "                  request still buffered)\n"
+      << "  --follow        Keep printing new requests until ^C\n"
+      << "  --interval-ms=N Poll interval with --follow (default: 250)\n";
 }
 
 struct BindingOptions {
@@ -209,826 +298,6 @@ bool ParseBindingOptions(int argc,
   return true;
 }
 
-bool ParseUserDataDir(int argc,
-                      char* argv[],
-                      const std::string& default_root,
-                      std::string* user_data_dir,
-                      int* index) {
-  if (!user_data_dir || !index) {
-    return false;
-  }
-  bool user_data_override = false;
-  bool profile_specified = false;
-  std::string profile_name = rethread::kDefaultProfileName;
-  const char* env_dir = std::getenv("RETHREAD_USER_DATA_DIR");
-  const std::string env_user_data_dir =
-      (env_dir && env_dir[0] != '\0') ? std::string(env_dir) : std::string();
-  for (; *index < argc; ++(*index)) {
-    std::string arg = argv[*index];
-    const std::string prefix = "--user-data-dir=";
-    if (arg.rfind(prefix, 0) == 0) {
-      *user_data_dir = arg.substr(prefix.size());
-      user_data_override = true;
-      continue;
-    }
-    if (arg == "--user-data-dir") {
-      if (*index + 1 >= argc) {
-        std::cerr << "Missing value after --user-data-dir\n";
-        return false;
-      }
-      *user_data_dir = argv[++(*index)];
-      user_data_override = true;
-      continue;
-    }
-    const std::string profile_prefix = "--profile=";
-    if (arg.rfind(profile_prefix, 0) == 0) {
-      profile_name = arg.substr(profile_prefix.size());
-      profile_specified = true;
-      continue;
-    }
-    if (arg == "--profile") {
-      if (*index + 1 >= argc) {
-        std::cerr << "Missing value after --profile\n";
-        return false;
-      }
-      profile_name = argv[++(*index)];
-      profile_specified = true;
-      continue;
-    }
-    break;
-  }
-  if (!user_data_override) {
-    if (profile_specified) {
-      std::string profile = profile_name.empty() ? rethread::kDefaultProfileName
-                                                 : profile_name;
-      if (default_root.empty()) {
-        *user_data_dir = profile;
-      } else if (default_root.back() == '/' || default_root.back() == '\\') {
-        *user_data_dir = default_root + profile;
-      } else {
-        *user_data_dir = default_root + "/" + profile;
-      }
-    } else if (!env_user_data_dir.empty()) {
-      *user_data_dir = env_user_data_dir;
-    } else {
-      std::string profile = rethread::kDefaultProfileName;
-      if (default_root.empty()) {
-        *user_data_dir = profile;
-      } else if (default_root.back() == '/' || default_root.back() == '\\') {
-        *user_data_dir = default_root + profile;
-      } else {
-        *user_data_dir = default_root + "/" + profile;
-      }
-    }
-  }
-  return true;
-}
-
-bool SendCommand(const std::string& socket_path, const std::string& payload) {
-  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-  if (fd < 0) {
-    std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
-    return false;
-  }
-
-  sockaddr_un addr;
-  std::memset(&addr, 0, sizeof(addr));
-  addr.sun_family = AF_UNIX;
-  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
-                socket_path.c_str());
-
-  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-    std::cerr << "Failed to connect to " << socket_path << ": "
-              << std::strerror(errno) << "\n";
-    close(fd);
-    return false;
-  }
-
-  if (write(fd, payload.data(), payload.size()) < 0) {
-    std::cerr << "Failed to send command: " << std::strerror(errno) << "\n";
-    close(fd);
-    return false;
-  }
-
-  char buffer[512];
-  ssize_t n = 0;
-  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
-    std::cout.write(buffer, n);
-  }
-  close(fd);
-  return true;
-}
-
-bool ParsePositiveInt(const std::string& text, int* value) {
-  if (!value) {
-    return false;
-  }
-  errno = 0;
-  char* end = nullptr;
-  long parsed = std::strtol(text.c_str(), &end, 10);
-  if (errno != 0 || !end || *end != '\0' || parsed <= 0 ||
-      parsed > std::numeric_limits<int>::max()) {
-    return false;
-  }
-  *value = static_cast<int>(parsed);
-  return true;
-}
-
-bool IsValidScriptId(const std::string& id) {
-  if (id.empty()) {
-    return false;
-  }
-  for (char c : id) {
-    if (std::isalnum(static_cast<unsigned char>(c)) ||
-        c == '-' || c == '_' || c == '.') {
-      continue;
-    }
-    if (c == '/' || c == '\\') {
-      return false;
-    }
-    return false;
-  }
-  return true;
-}
-
-std::string HexEncode(const std::string& input) {
-  static constexpr char kHex[] = "0123456789abcdef";
-  std::string output;
-  output.reserve(input.size() * 2);
-  for (unsigned char c : input) {
-    output.push_back(kHex[(c >> 4) & 0xF]);
-    output.push_back(kHex[c & 0xF]);
-  }
-  return output;
-}
-
-extern volatile sig_atomic_t g_stop_requested;
-
-bool ReadHttpHeaders(int fd, std::string* header_out,
-                     std::string* remainder_out);
-std::string TrimWhitespace(const std::string& input);
-std::string ToLower(std::string value);
-
-std::string TrimWhitespace(const std::string& input) {
-  const size_t start = input.find_first_not_of(" \t\r\n");
-  if (start == std::string::npos) {
-    return std::string();
-  }
-  const size_t end = input.find_last_not_of(" \t\r\n");
-  return input.substr(start, end - start + 1);
-}
-
-bool SendCommandCapture(const std::string& socket_path,
-                        const std::string& payload,
-                        std::string* response) {
-  if (response) {
-    response->clear();
-  }
-  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
-  if (fd < 0) {
-    std::cerr << "Failed to create socket: " << std::strerror(errno) << "\n";
-    return false;
-  }
-
-  sockaddr_un addr;
-  std::memset(&addr, 0, sizeof(addr));
-  addr.sun_family = AF_UNIX;
-  std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
-                socket_path.c_str());
-
-  if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
-    std::cerr << "Failed to connect to " << socket_path << ": "
-              << std::strerror(errno) << "\n";
-    close(fd);
-    return false;
-  }
-
-  if (write(fd, payload.data(), payload.size()) < 0) {
-    std::cerr << "Failed to send command: " << std::strerror(errno) << "\n";
-    close(fd);
-    return false;
-  }
-
-  char buffer[512];
-  ssize_t n = 0;
-  while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
-    if (response) {
-      response->append(buffer, static_cast<size_t>(n));
-    }
-  }
-  close(fd);
-  return true;
-}
-
-std::optional<int> ReadCdpPortFile(const std::string& user_data_dir) {
-  const std::string path = rethread::CdpPortPath(user_data_dir);
-  std::ifstream file(path);
-  if (!file.is_open()) {
-    return std::nullopt;
-  }
-  int port = 0;
-  file >> port;
-  if (!file || port <= 0 || port >= 65536) {
-    return std::nullopt;
-  }
-  return port;
-}
-
-int ConnectTcp(const std::string& host, int port) {
-  struct addrinfo hints;
-  std::memset(&hints, 0, sizeof(hints));
-  hints.ai_socktype = SOCK_STREAM;
-  hints.ai_family = AF_UNSPEC;
-
-  struct addrinfo* res = nullptr;
-  const std::string port_str = std::to_string(port);
-  if (getaddrinfo(host.c_str(), port_str.c_str(), &hints, &res) != 0) {
-    return -1;
-  }
-  int fd = -1;
-  for (struct addrinfo* p = res; p; p = p->ai_next) {
-    fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-    if (fd < 0) {
-      continue;
-    }
-    if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) {
-      break;
-    }
-    close(fd);
-    fd = -1;
-  }
-  freeaddrinfo(res);
-  return fd;
-}
-
-bool ReadExact(int fd, void* buffer, size_t length) {
-  char* out = static_cast<char*>(buffer);
-  size_t remaining = length;
-  while (remaining > 0) {
-    ssize_t n = recv(fd, out, remaining, 0);
-    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
-      if (g_stop_requested) {
-        return false;
-      }
-      continue;
-    }
-    if (n <= 0) {
-      return false;
-    }
-    out += n;
-    remaining -= static_cast<size_t>(n);
-  }
-  return true;
-}
-
-bool ReadExactWithBuffer(int fd, void* buffer, size_t length,
-                         std::string* prefetch) {
-  char* out = static_cast<char*>(buffer);
-  size_t remaining = length;
-  if (prefetch && !prefetch->empty()) {
-    const size_t take = std::min(remaining, prefetch->size());
-    std::memcpy(out, prefetch->data(), take);
-    prefetch->erase(0, take);
-    out += take;
-    remaining -= take;
-  }
-  while (remaining > 0) {
-    ssize_t n = recv(fd, out, remaining, 0);
-    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
-      if (g_stop_requested) {
-        return false;
-      }
-      continue;
-    }
-    if (n <= 0) {
-      return false;
-    }
-    out += n;
-    remaining -= static_cast<size_t>(n);
-  }
-  return true;
-}
-
-bool SendAll(int fd, const void* data, size_t length) {
-  const char* buf = static_cast<const char*>(data);
-  size_t remaining = length;
-  while (remaining > 0) {
-    ssize_t n = send(fd, buf, remaining, 0);
-    if (n <= 0) {
-      return false;
-    }
-    buf += n;
-    remaining -= static_cast<size_t>(n);
-  }
-  return true;
-}
-
-bool SetSocketTimeout(int fd, int timeout_ms) {
-  if (timeout_ms <= 0) {
-    return false;
-  }
-  struct timeval tv;
-  tv.tv_sec = timeout_ms / 1000;
-  tv.tv_usec = (timeout_ms % 1000) * 1000;
-  return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
-}
-
-bool ReadHttpResponse(int fd, std::string* header_out, std::string* body_out) {
-  if (header_out) {
-    header_out->clear();
-  }
-  if (body_out) {
-    body_out->clear();
-  }
-  std::string headers;
-  std::string remainder;
-  if (!ReadHttpHeaders(fd, &headers, &remainder)) {
-    return false;
-  }
-  if (header_out) {
-    *header_out = headers;
-  }
-
-  size_t content_length = 0;
-  bool has_length = false;
-  bool chunked = false;
-  std::istringstream stream(headers);
-  std::string line;
-  while (std::getline(stream, line)) {
-    if (!line.empty() && line.back() == '\r') {
-      line.pop_back();
-    }
-    const std::string lower = ToLower(line);
-    const std::string length_prefix = "content-length:";
-    const std::string chunked_prefix = "transfer-encoding:";
-    if (lower.rfind(length_prefix, 0) == 0) {
-      std::string value = line.substr(length_prefix.size());
-      value = TrimWhitespace(value);
-      try {
-        content_length = static_cast<size_t>(std::stoul(value));
-        has_length = true;
-      } catch (...) {
-      }
-    } else if (lower.rfind(chunked_prefix, 0) == 0) {
-      if (lower.find("chunked") != std::string::npos) {
-        chunked = true;
-      }
-    }
-  }
-
-  std::string body;
-  if (chunked) {
-    body = remainder;
-    while (true) {
-      size_t pos = body.find("\r\n");
-      while (pos == std::string::npos) {
-        char buffer[4096];
-        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
-        if (n <= 0) {
-          break;
-        }
-        body.append(buffer, static_cast<size_t>(n));
-        pos = body.find("\r\n");
-      }
-      if (pos == std::string::npos) {
-        break;
-      }
-      std::string len_text = body.substr(0, pos);
-      size_t chunk_len = 0;
-      try {
-        chunk_len = static_cast<size_t>(std::stoul(len_text, nullptr, 16));
-      } catch (...) {
-        break;
-      }
-      if (body.size() < pos + 2 + chunk_len + 2) {
-        char buffer[4096];
-        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
-        if (n <= 0) {
-          break;
-        }
-        body.append(buffer, static_cast<size_t>(n));
-        continue;
-      }
-      const size_t chunk_start = pos + 2;
-      std::string chunk = body.substr(chunk_start, chunk_len);
-      std::string rest = body.substr(chunk_start + chunk_len + 2);
-      if (chunk_len == 0) {
-        body = rest;
-        break;
-      }
-      body = chunk + rest;
-    }
-  } else if (has_length) {
-    body = remainder;
-    while (body.size() < content_length) {
-      char buffer[4096];
-      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
-      if (n <= 0) {
-        break;
-      }
-      body.append(buffer, static_cast<size_t>(n));
-    }
-    if (body.size() > content_length) {
-      body.resize(content_length);
-    }
-  } else {
-    body = remainder;
-    char buffer[4096];
-    ssize_t n = 0;
-    while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
-      body.append(buffer, static_cast<size_t>(n));
-    }
-  }
-
-  if (body_out) {
-    *body_out = std::move(body);
-  }
-  return true;
-}
-
-bool ReadHttpHeaders(int fd, std::string* header_out,
-                     std::string* remainder_out) {
-  if (header_out) {
-    header_out->clear();
-  }
-  if (remainder_out) {
-    remainder_out->clear();
-  }
-  std::string data;
-  char buffer[4096];
-  ssize_t n = 0;
-  while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
-    data.append(buffer, static_cast<size_t>(n));
-    const size_t split = data.find("\r\n\r\n");
-    if (split != std::string::npos) {
-      if (header_out) {
-        header_out->assign(data.data(), split);
-      }
-      if (remainder_out) {
-        remainder_out->assign(data.data() + split + 4,
-                               data.size() - split - 4);
-      }
-      return true;
-    }
-  }
-  return false;
-}
-
-bool HttpGetJson(const std::string& host, int port, const std::string& path,
-                 QJsonDocument* doc_out, std::string* error_out) {
-  if (error_out) {
-    error_out->clear();
-  }
-  int fd = ConnectTcp(host, port);
-  if (fd < 0) {
-    if (error_out) {
-      *error_out = "Failed to connect to CDP port";
-    }
-    return false;
-  }
-  std::ostringstream request;
-  request << "GET " << path << " HTTP/1.1\r\n"
-          << "Host: " << host << ":" << port << "\r\n"
-          << "Connection: close\r\n\r\n";
-  const std::string payload = request.str();
-  if (!SendAll(fd, payload.data(), payload.size())) {
-    if (error_out) {
-      *error_out = "Failed to send HTTP request";
-    }
-    close(fd);
-    return false;
-  }
-  std::string headers;
-  std::string body;
-  if (!ReadHttpResponse(fd, &headers, &body)) {
-    if (error_out) {
-      *error_out = "Failed to read HTTP response";
-    }
-    close(fd);
-    return false;
-  }
-  close(fd);
-
-  if (headers.find("200") == std::string::npos) {
-    if (error_out) {
-      *error_out = "Unexpected HTTP response";
-    }
-    return false;
-  }
-
-  QJsonParseError parse_error;
-  QJsonDocument doc = QJsonDocument::fromJson(
-      QByteArray::fromStdString(body), &parse_error);
-  if (parse_error.error != QJsonParseError::NoError) {
-    if (error_out) {
-      *error_out = "Failed to parse JSON response";
-    }
-    return false;
-  }
-  if (doc_out) {
-    *doc_out = doc;
-  }
-  return true;
-}
-
-std::string Base64Encode(const std::string& data) {
-  static constexpr char kAlphabet[] =
-      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-  std::string out;
-  size_t i = 0;
-  while (i + 2 < data.size()) {
-    const unsigned char a = static_cast<unsigned char>(data[i++]);
-    const unsigned char b = static_cast<unsigned char>(data[i++]);
-    const unsigned char c = static_cast<unsigned char>(data[i++]);
-    out.push_back(kAlphabet[a >> 2]);
-    out.push_back(kAlphabet[((a & 0x03) << 4) | (b >> 4)]);
-    out.push_back(kAlphabet[((b & 0x0F) << 2) | (c >> 6)]);
-    out.push_back(kAlphabet[c & 0x3F]);
-  }
-  if (i < data.size()) {
-    const unsigned char a = static_cast<unsigned char>(data[i++]);
-    out.push_back(kAlphabet[a >> 2]);
-    if (i < data.size()) {
-      const unsigned char b = static_cast<unsigned char>(data[i]);
-      out.push_back(kAlphabet[((a & 0x03) << 4) | (b >> 4)]);
-      out.push_back(kAlphabet[(b & 0x0F) << 2]);
-      out.push_back('=');
-    } else {
-      out.push_back(kAlphabet[(a & 0x03) << 4]);
-      out.push_back('=');
-      out.push_back('=');
-    }
-  }
-  return out;
-}
-
-bool Base64Decode(const std::string& input, std::string* output) {
-  if (!output) {
-    return false;
-  }
-  const QByteArray decoded =
-      QByteArray::fromBase64(QByteArray::fromStdString(input));
-  output->assign(decoded.constData(),
-                 static_cast<size_t>(decoded.size()));
-  return true;
-}
-
-std::string GenerateWebSocketKey() {
-  std::array<unsigned char, 16> data;
-  std::random_device rd;
-  std::mt19937 gen(rd());
-  std::uniform_int_distribution<int> dist(0, 255);
-  for (auto& byte : data) {
-    byte = static_cast<unsigned char>(dist(gen));
-  }
-  return Base64Encode(std::string(
-      reinterpret_cast<const char*>(data.data()), data.size()));
-}
-
-bool WebSocketHandshake(int fd, const std::string& host, int port,
-                        const std::string& path, std::string* error_out,
-                        std::string* prefetch_out) {
-  if (error_out) {
-    error_out->clear();
-  }
-  const std::string key = GenerateWebSocketKey();
-  std::ostringstream request;
-  request << "GET " << path << " HTTP/1.1\r\n"
-          << "Host: " << host << ":" << port << "\r\n"
-          << "Upgrade: websocket\r\n"
-          << "Connection: Upgrade\r\n"
-          << "Sec-WebSocket-Key: " << key << "\r\n"
-          << "Sec-WebSocket-Version: 13\r\n\r\n";
-  const std::string payload = request.str();
-  if (!SendAll(fd, payload.data(), payload.size())) {
-    if (error_out) {
-      *error_out = "Failed to send WebSocket handshake";
-    }
-    return false;
-  }
-  std::string headers;
-  std::string remainder;
-  if (!ReadHttpHeaders(fd, &headers, &remainder)) {
-    if (error_out) {
-      *error_out = "Failed to read WebSocket handshake";
-    }
-    return false;
-  }
-  if (headers.find("101") == std::string::npos) {
-    if (error_out) {
-      *error_out = "WebSocket handshake rejected";
-    }
-    return false;
-  }
-  if (prefetch_out) {
-    *prefetch_out = remainder;
-  }
-  return true;
-}
-
-bool SendWebSocketText(int fd, const std::string& payload) {
-  std::vector<unsigned char> frame;
-  frame.reserve(payload.size() + 14);
-  frame.push_back(0x81);
-  const size_t len = payload.size();
-  if (len < 126) {
-    frame.push_back(static_cast<unsigned char>(0x80 | len));
-  } else if (len <= 0xFFFF) {
-    frame.push_back(0x80 | 126);
-    frame.push_back(static_cast<unsigned char>((len >> 8) & 0xFF));
-    frame.push_back(static_cast<unsigned char>(len & 0xFF));
-  } else {
-    frame.push_back(0x80 | 127);
-    for (int i = 7; i >= 0; --i) {
-      frame.push_back(static_cast<unsigned char>((len >> (8 * i)) & 0xFF));
-    }
-  }
-  std::array<unsigned char, 4> mask;
-  std::random_device rd;
-  for (auto& byte : mask) {
-    byte = static_cast<unsigned char>(rd());
-  }
-  frame.insert(frame.end(), mask.begin(), mask.end());
-  for (size_t i = 0; i < payload.size(); ++i) {
-    frame.push_back(static_cast<unsigned char>(
-        payload[i] ^ mask[i % mask.size()]));
-  }
-  return SendAll(fd, frame.data(), frame.size());
-}
-
-bool ReadWebSocketMessage(int fd, std::string* payload_out,
-                          unsigned char* opcode_out) {
-  if (payload_out) {
-    payload_out->clear();
-  }
-  unsigned char header[2];
-  if (!ReadExact(fd, header, sizeof(header))) {
-    return false;
-  }
-  const bool fin = (header[0] & 0x80) != 0;
-  const unsigned char opcode = header[0] & 0x0F;
-  const bool masked = (header[1] & 0x80) != 0;
-  uint64_t length = header[1] & 0x7F;
-  if (length == 126) {
-    unsigned char ext[2];
-    if (!ReadExact(fd, ext, sizeof(ext))) {
-      return false;
-    }
-    length = (static_cast<uint64_t>(ext[0]) << 8) | ext[1];
-  } else if (length == 127) {
-    unsigned char ext[8];
-    if (!ReadExact(fd, ext, sizeof(ext))) {
-      return false;
-    }
-    length = 0;
-    for (int i = 0; i < 8; ++i) {
-      length = (length << 8) | ext[i];
-    }
-  }
-  std::array<unsigned char, 4> mask = {0, 0, 0, 0};
-  if (masked) {
-    if (!ReadExact(fd, mask.data(), mask.size())) {
-      return false;
-    }
-  }
-  if (!fin && opcode == 0x1) {
-    return false;
-  }
-  std::string payload;
-  payload.resize(static_cast<size_t>(length));
-  if (!payload.empty()) {
-    if (!ReadExact(fd, payload.data(), payload.size())) {
-      return false;
-    }
-    if (masked) {
-      for (size_t i = 0; i < payload.size(); ++i) {
-        payload[i] = static_cast<char>(
-            payload[i] ^ mask[i % mask.size()]);
-      }
-    }
-  }
-  if (opcode == 0x9) {
-    std::vector<unsigned char> pong;
-    pong.push_back(0x8A);
-    pong.push_back(0x00);
-    SendAll(fd, pong.data(), pong.size());
-    return ReadWebSocketMessage(fd, payload_out, opcode_out);
-  }
-  if (opcode_out) {
-    *opcode_out = opcode;
-  }
-  if (payload_out) {
-    *payload_out = std::move(payload);
-  }
-  return opcode != 0x8;
-}
-
-bool ReadWebSocketMessageWithBuffer(int fd, std::string* payload_out,
-                                    unsigned char* opcode_out,
-                                    std::string* prefetch) {
-  if (payload_out) {
-    payload_out->clear();
-  }
-  std::string assembled;
-  bool assembling = false;
-  while (true) {
-    unsigned char header[2];
-    if (!ReadExactWithBuffer(fd, header, sizeof(header), prefetch)) {
-      return false;
-    }
-    const bool fin = (header[0] & 0x80) != 0;
-    const unsigned char opcode = header[0] & 0x0F;
-    const bool masked = (header[1] & 0x80) != 0;
-    uint64_t length = header[1] & 0x7F;
-    if (length == 126) {
-      unsigned char ext[2];
-      if (!ReadExactWithBuffer(fd, ext, sizeof(ext), prefetch)) {
-        return false;
-      }
-      length = (static_cast<uint64_t>(ext[0]) << 8) | ext[1];
-    } else if (length == 127) {
-      unsigned char ext[8];
-      if (!ReadExactWithBuffer(fd, ext, sizeof(ext), prefetch)) {
-        return false;
-      }
-      length = 0;
-      for (int i = 0; i < 8; ++i) {
-        length = (length << 8) | ext[i];
-      }
-    }
-    std::array<unsigned char, 4> mask = {0, 0, 0, 0};
-    if (masked) {
-      if (!ReadExactWithBuffer(fd, mask.data(), mask.size(), prefetch)) {
-        return false;
-      }
-    }
-    std::string payload;
-    payload.resize(static_cast<size_t>(length));
-    if (!payload.empty()) {
-      if (!ReadExactWithBuffer(fd, payload.data(), payload.size(), prefetch)) {
-        return false;
-      }
-      if (masked) {
-        for (size_t i = 0; i < payload.size(); ++i) {
-          payload[i] = static_cast<char>(
-              payload[i] ^ mask[i % mask.size()]);
-        }
-      }
-    }
-
-    if (opcode == 0x8) {
-      return false;
-    }
-    if (opcode == 0x9) {
-      std::vector<unsigned char> pong;
-      pong.push_back(0x8A);
-      pong.push_back(0x00);
-      SendAll(fd, pong.data(), pong.size());
-      continue;
-    }
-    if (opcode == 0xA) {
-      continue;
-    }
-
-    if (opcode == 0x1) {
-      if (fin) {
-        if (opcode_out) {
-          *opcode_out = opcode;
-        }
-        if (payload_out) {
-          *payload_out = std::move(payload);
-        }
-        return true;
-      }
-      assembling = true;
-      assembled = std::move(payload);
-      continue;
-    }
-    if (opcode == 0x0) {
-      if (!assembling) {
-        continue;
-      }
-      assembled.append(payload);
-      if (fin) {
-        if (opcode_out) {
-          *opcode_out = 0x1;
-        }
-        if (payload_out) {
-          *payload_out = std::move(assembled);
-        }
-        return true;
-      }
-      continue;
-    }
-  }
-}
-
-std::string ToLower(std::string value) {
-  std::transform(value.begin(), value.end(), value.begin(),
-                 [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
-  return value;
-}
-
 std::string FormatTimestamp(std::chrono::system_clock::time_point tp) {
   using namespace std::chrono;
   const auto seconds = time_point_cast<std::chrono::seconds>(tp);
@@ -1131,82 +400,58 @@ std::string ShortenUrlFragment(const std::string& raw, size_t limit) {
          fragment.substr(fragment.size() - tail);
 }
 
-bool NetworkLogDebugEnabled() {
-  const char* value = std::getenv("RETHREAD_NETWORK_LOG_DEBUG");
-  return value && value[0] != '\0';
-}
-
-void NetworkLogDebug(const std::string& message) {
-  if (!NetworkLogDebugEnabled()) {
-    return;
-  }
-  std::cerr << "[network-log] " << message << '\n';
-}
-
-volatile sig_atomic_t g_stop_requested = 0;
-
-void HandleStopSignal(int) {
-  g_stop_requested = 1;
-}
+constexpr size_t kNetworkLogMaxBodyRequests = 64;
+// How long a stopped capture still waits for bodies it already asked for.
+constexpr int kNetworkLogStopDrainMs = 2000;
+constexpr int kCaptureZstdLevel = 3;
+constexpr size_t kCaptureCopySliceBytes = 1024 * 1024;
+// Deduplicated bodies live here, inside the output directory, unless
+// --body-store points elsewhere.
+constexpr char kBodyStoreDirName[] = "blobs";
+constexpr int kBodyStoreGcGraceSeconds = 600;
+// Labels BodyHasher digests in WARC-Payload-Digest.
+constexpr char kWarcDigestLabel[] = "xxh64x2:";
 
 struct NetworkFilters {
-  std::optional<std::regex> url;
-  std::optional<std::regex> method;
-  std::optional<std::regex> status;
-  std::optional<std::regex> mime;
+  PatternSet url;
+  PatternSet method;
+  PatternSet status;
+  PatternSet mime;
 
   bool Match(const std::string& url_value,
              const std::string& method_value,
              const std::string& status_value,
              const std::string& mime_value) const {
-    if (url && !std::regex_search(url_value, *url)) {
-      return false;
-    }
-    if (method && !std::regex_search(method_value, *method)) {
-      return false;
-    }
-    if (status && !std::regex_search(status_value, *status)) {
-      return false;
-    }
-    if (mime && !std::regex_search(mime_value, *mime)) {
-      return false;
-    }
-    return true;
+    return MatchRequest(url_value, method_value) &&
+           MatchStatus(status_value) &&
+           (mime.empty() || mime.Match(mime_value));
+  }
+
+  // Partial checks for routing a CDP event before it is fully parsed.
+  bool MatchRequest(const std::string& url_value,
+                    const std::string& method_value) const {
+    return (url.empty() || url.Match(url_value)) &&
+           (method.empty() || method.Match(method_value));
+  }
+
+  bool MatchStatus(const std::string& status_value) const {
+    return status.empty() || status.Match(status_value);
   }
 };
 
-bool BuildNetworkFilters(const std::string& url_pattern,
-                         const std::string& method_pattern,
-                         const std::string& status_pattern,
-                         const std::string& mime_pattern,
+bool BuildNetworkFilters(const std::vector<std::string>& url_patterns,
+                         const std::vector<std::string>& method_patterns,
+                         const std::vector<std::string>& status_patterns,
+                         const std::vector<std::string>& mime_patterns,
                          NetworkFilters* out,
                          std::string* error) {
   if (!out) {
     return false;
   }
-  if (error) {
-    error->clear();
-  }
-  try {
-    if (!url_pattern.empty()) {
-      out->url = std::regex(url_pattern);
-    }
-    if (!method_pattern.empty()) {
-      out->method = std::regex(method_pattern);
-    }
-    if (!status_pattern.empty()) {
-      out->status = std::regex(status_pattern);
-    }
-    if (!mime_pattern.empty()) {
-      out->mime = std::regex(mime_pattern);
-    }
-  } catch (const std::regex_error& err) {
-    if (error) {
-      *error = err.what();
-    }
-    return false;
-  }
-  return true;
+  return out->url.Build(url_patterns, error) &&
+         out->method.Build(method_patterns, error) &&
+         out->status.Build(status_patterns, error) &&
+         out->mime.Build(mime_patterns, error);
 }
 
 std::map<std::string, std::string> NormalizeHeaderList(
@@ -1230,12 +475,32 @@ std::map<std::string, std::string> NormalizeHeaderMap(
     if (it.key().isEmpty()) {
       continue;
     }
-    const QString value = it.value().toVariant().toString();
-    result[it.key().toStdString()] = value.toStdString();
+    const QJsonValue value = it.value();
+    result[it.key().toStdString()] =
+        (value.isString() ? value.toString() : value.toVariant().toString())
+            .toStdString();
   }
   return result;
 }
 
+// Maps DevTools target ids to tab ids using `devtools-id --all`.
+bool FetchTabTargets(const std::string& socket_path,
+                     std::map<std::string, int>* targets) {
+  std::string response;
+  if (!SendCommandCapture(socket_path, "devtools-id --all\n", &response) ||
+      response.rfind("ERR", 0) == 0) {
+    return false;
+  }
+  targets->clear();
+  std::istringstream lines(response);
+  int tab = 0;
+  std::string target_id;
+  while (lines >> tab >> target_id) {
+    (*targets)[target_id] = tab;
+  }
+  return true;
+}
+
 bool WriteJsonFile(const std::string& path, const QJsonObject& payload) {
   QJsonDocument doc(payload);
   QByteArray data = doc.toJson(QJsonDocument::Indented);
@@ -1326,7 +591,9 @@ bool WriteNetworkCapture(const std::string& base_dir,
                          const std::map<std::string, std::string>& response_headers,
                          const std::string& request_body,
                          const std::string& response_body,
-                         const std::string& response_body_error) {
+                         const std::string& response_body_error,
+                         int tab_id,
+                         const QJsonObject& extra_metadata) {
   const std::string dir_name =
       FormatCaptureDirName(timestamp, request_id, method, url);
   const std::filesystem::path capture_dir =
@@ -1342,6 +609,9 @@ bool WriteNetworkCapture(const std::string& base_dir,
                   QString::fromStdString(FormatTimestamp(timestamp)));
   metadata.insert(QStringLiteral("requestId"),
                   QString::fromStdString(request_id));
+  if (tab_id > 0) {
+    metadata.insert(QStringLiteral("tabId"), tab_id);
+  }
   metadata.insert(QStringLiteral("url"), QString::fromStdString(url));
   metadata.insert(QStringLiteral("method"),
                   QString::fromStdString(method));
@@ -1357,6 +627,9 @@ bool WriteNetworkCapture(const std::string& base_dir,
     metadata.insert(QStringLiteral("responseBodyError"),
                     QString::fromStdString(response_body_error));
   }
+  for (auto it = extra_metadata.begin(); it != extra_metadata.end(); ++it) {
+    metadata.insert(it.key(), it.value());
+  }
 
   const std::string metadata_path =
       (capture_dir / "metadata.json").string();
@@ -1373,109 +646,1047 @@ bool WriteNetworkCapture(const std::string& base_dir,
     return false;
   }
 
-  if (!request_body.empty()) {
-    std::ofstream out((capture_dir / "request-body.bin").string(),
-                      std::ios::binary);
-    if (!out.is_open()) {
+  if (!request_body.empty()) {
+    std::ofstream out((capture_dir / "request-body.bin").string(),
+                      std::ios::binary);
+    if (!out.is_open()) {
+      return false;
+    }
+    out.write(request_body.data(), request_body.size());
+  }
+  if (!response_body.empty()) {
+    std::ofstream out((capture_dir / "response-body.bin").string(),
+                      std::ios::binary);
+    if (!out.is_open()) {
+      return false;
+    }
+    out.write(response_body.data(), response_body.size());
+    if (!WriteResponseBodyJson(
+            (capture_dir / "response-body.json").string(), response_body)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+struct NetworkCaptureEntry {
+  std::chrono::system_clock::time_point timestamp;
+  std::string request_id;
+  // CDP session the request was seen on; empty for a single-tab capture.
+  std::string session_id;
+  // Rethread tab the request came from, 0 when it could not be mapped.
+  int tab_id = 0;
+  std::string url;
+  std::string method;
+  std::string status;
+  std::string content_type;
+  std::map<std::string, std::string> request_headers;
+  std::map<std::string, std::string> response_headers;
+  std::string request_body;
+  std::string response_body;
+  std::string response_body_error;
+  // Set instead of |response_body| when the body was streamed to disk.
+  std::string response_body_path;
+  uint64_t response_body_size = 0;
+  bool has_response = false;
+  // CDP's Network.ResourceType, e.g. "Document" or "Script".
+  std::string resource_type;
+  // requestWillBeSent and loadingFinished on the CDP monotonic clock, in
+  // seconds; -1 when not seen.
+  double started_at = -1;
+  double finished_at = -1;
+  NetworkTiming timing;
+  // Bytes on the wire, including headers and before decompression.
+  uint64_t encoded_data_length = 0;
+};
+
+// Timing and transfer fields shared by the metadata.json and NDJSON
+// layouts.
+void InsertCaptureTiming(QJsonObject* object,
+                         const NetworkCaptureEntry& entry) {
+  if (!entry.resource_type.empty()) {
+    object->insert(QStringLiteral("resourceType"),
+                   QString::fromStdString(entry.resource_type));
+  }
+  object->insert(QStringLiteral("encodedDataLength"),
+                 static_cast<qint64>(entry.encoded_data_length));
+  object->insert(QStringLiteral("time"), TimingTotalMs(entry.timing));
+  object->insert(QStringLiteral("timings"), TimingJson(entry.timing));
+}
+
+// Request ids are only unique within a target, so capture state is keyed by
+// session as well.
+std::string CaptureKey(const std::string& session_id,
+                       const std::string& request_id) {
+  return session_id.empty() ? request_id : session_id + "/" + request_id;
+}
+
+enum class CaptureFormat {
+  kDirectory,
+  kHar,
+  kNdjson,
+  kWarc,
+};
+
+bool ParseCaptureFormat(const std::string& text, CaptureFormat* format) {
+  if (text == "dir") {
+    *format = CaptureFormat::kDirectory;
+  } else if (text == "har") {
+    *format = CaptureFormat::kHar;
+  } else if (text == "ndjson") {
+    *format = CaptureFormat::kNdjson;
+  } else if (text == "warc") {
+    *format = CaptureFormat::kWarc;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// A response body kept in the body store rather than in the record.
+struct StoredBody {
+  std::string hash;
+  // How records refer to the blob: relative to the output directory when
+  // the store lives inside it, absolute otherwise.
+  std::string file;
+};
+
+// The body store a capture writes to. Prints what deduplication saved once
+// the capture is done.
+class CaptureBodyStore {
+ public:
+  CaptureBodyStore(std::string root, std::string record_prefix)
+      : store_(std::move(root)), record_prefix_(std::move(record_prefix)) {}
+
+  ~CaptureBodyStore() {
+    if (store_.reused_count() == 0) {
+      return;
+    }
+    std::cout << "Stored " << store_.stored_count() << " bodies ("
+              << FormatBytes(static_cast<double>(store_.stored_bytes()))
+              << "); " << store_.reused_count() << " repeats ("
+              << FormatBytes(static_cast<double>(store_.reused_bytes()))
+              << ") were not written again\n";
+  }
+
+  const BodyStore& store() const { return store_; }
+
+  // Stores the entry's response body, inline or streamed. Entries without
+  // a body leave |stored| empty.
+  bool Store(const NetworkCaptureEntry& entry, StoredBody* stored) {
+    if (!entry.response_body_path.empty()) {
+      if (!store_.Adopt(entry.response_body_path, &stored->hash)) {
+        return false;
+      }
+    } else if (entry.response_body.empty()) {
+      return true;
+    } else if (!store_.Put(entry.response_body, &stored->hash)) {
+      return false;
+    }
+    stored->file = record_prefix_ + BodyStore::RelativePath(stored->hash);
+    return true;
+  }
+
+ private:
+  BodyStore store_;
+  std::string record_prefix_;
+};
+
+uint64_t ResponseBodySize(const NetworkCaptureEntry& entry) {
+  return entry.response_body_path.empty() ? entry.response_body.size()
+                                          : entry.response_body_size;
+}
+
+class NetworkCaptureSink {
+ public:
+  virtual ~NetworkCaptureSink() = default;
+  virtual bool Write(const NetworkCaptureEntry& entry) = 0;
+};
+
+// The original layout: one directory per request with pretty-printed JSON.
+// With a body store, response-body.bin is a hard link to the stored blob,
+// so a body seen many times takes its space once.
+class DirectoryCaptureSink : public NetworkCaptureSink {
+ public:
+  DirectoryCaptureSink(std::string output_dir,
+                       std::unique_ptr<CaptureBodyStore> bodies)
+      : output_dir_(std::move(output_dir)), bodies_(std::move(bodies)) {}
+
+  bool Write(const NetworkCaptureEntry& entry) override {
+    QJsonObject extra_metadata;
+    InsertCaptureTiming(&extra_metadata, entry);
+    StoredBody stored;
+    if (bodies_) {
+      if (!bodies_->Store(entry, &stored)) {
+        return false;
+      }
+      if (!stored.hash.empty()) {
+        extra_metadata.insert(QStringLiteral("responseBodyHash"),
+                              QString::fromStdString(stored.hash));
+        extra_metadata.insert(
+            QStringLiteral("responseBodySize"),
+            static_cast<qint64>(ResponseBodySize(entry)));
+      }
+    }
+    if (!WriteNetworkCapture(
+            output_dir_, entry.timestamp, entry.request_id, entry.url,
+            entry.method, "Response",
+            entry.status.empty() ? "<pending>" : entry.status,
+            entry.content_type, entry.request_headers, entry.response_headers,
+            entry.request_body,
+            bodies_ ? std::string() : entry.response_body,
+            entry.response_body_error, entry.tab_id, extra_metadata)) {
+      return false;
+    }
+    const std::filesystem::path capture_dir =
+        std::filesystem::path(output_dir_) /
+        FormatCaptureDirName(entry.timestamp, entry.request_id, entry.method,
+                             entry.url);
+    const std::filesystem::path body_path = capture_dir / "response-body.bin";
+    std::error_code ec;
+    if (!stored.hash.empty()) {
+      const std::string blob = bodies_->store().PathFor(stored.hash);
+      // Stores on another filesystem cannot be linked to.
+      if (link(blob.c_str(), body_path.c_str()) != 0) {
+        std::filesystem::copy_file(blob, body_path, ec);
+        if (ec) {
+          return false;
+        }
+      }
+      return entry.response_body.empty() ||
+             WriteResponseBodyJson((capture_dir / "response-body.json").string(),
+                                   entry.response_body);
+    }
+    if (entry.response_body_path.empty()) {
+      return true;
+    }
+    std::filesystem::rename(entry.response_body_path, body_path, ec);
+    return !ec;
+  }
+
+ private:
+  std::string output_dir_;
+  // Null with --inline-bodies.
+  std::unique_ptr<CaptureBodyStore> bodies_;
+};
+
+bool WriteAllToFd(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    const ssize_t n = write(fd, data, length);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+QJsonArray HarHeaderList(const std::map<std::string, std::string>& headers) {
+  QJsonArray list;
+  for (const auto& [name, value] : headers) {
+    QJsonObject header;
+    header.insert(QStringLiteral("name"), QString::fromStdString(name));
+    header.insert(QStringLiteral("value"), QString::fromStdString(value));
+    list.append(header);
+  }
+  return list;
+}
+
+// A body in the store replaces the inline text; |body| is empty for bodies
+// that stay inline.
+QJsonObject HarEntry(const NetworkCaptureEntry& entry,
+                     const StoredBody& body) {
+  QJsonObject request;
+  request.insert(QStringLiteral("method"),
+                 QString::fromStdString(entry.method));
+  request.insert(QStringLiteral("url"), QString::fromStdString(entry.url));
+  request.insert(QStringLiteral("httpVersion"), QString());
+  request.insert(QStringLiteral("cookies"), QJsonArray());
+  request.insert(QStringLiteral("headers"),
+                 HarHeaderList(entry.request_headers));
+  request.insert(QStringLiteral("queryString"), QJsonArray());
+  request.insert(QStringLiteral("headersSize"), -1);
+  request.insert(QStringLiteral("bodySize"),
+                 static_cast<qint64>(entry.request_body.size()));
+  if (!entry.request_body.empty()) {
+    QJsonObject post_data;
+    QString mime_type;
+    for (const auto& [name, value] : entry.request_headers) {
+      if (ToLower(name) == "content-type") {
+        mime_type = QString::fromStdString(value);
+      }
+    }
+    post_data.insert(QStringLiteral("mimeType"), mime_type);
+    InsertCaptureBody(&post_data, QStringLiteral("text"), entry.request_body);
+    request.insert(QStringLiteral("postData"), post_data);
+  }
+
+  const uint64_t body_size = ResponseBodySize(entry);
+  QJsonObject content;
+  content.insert(QStringLiteral("size"), static_cast<qint64>(body_size));
+  content.insert(QStringLiteral("mimeType"),
+                 QString::fromStdString(entry.content_type));
+  if (!body.hash.empty()) {
+    content.insert(QStringLiteral("_file"), QString::fromStdString(body.file));
+    content.insert(QStringLiteral("_hash"), QString::fromStdString(body.hash));
+  } else if (!entry.response_body.empty()) {
+    InsertCaptureBody(&content, QStringLiteral("text"), entry.response_body);
+  }
+  if (!entry.response_body_error.empty()) {
+    content.insert(QStringLiteral("comment"),
+                   QString::fromStdString(entry.response_body_error));
+  }
+  QJsonObject response;
+  response.insert(QStringLiteral("status"),
+                  QString::fromStdString(entry.status).toInt());
+  response.insert(QStringLiteral("statusText"), QString());
+  response.insert(QStringLiteral("httpVersion"), QString());
+  response.insert(QStringLiteral("cookies"), QJsonArray());
+  response.insert(QStringLiteral("headers"),
+                  HarHeaderList(entry.response_headers));
+  response.insert(QStringLiteral("content"), content);
+  QString redirect_url;
+  for (const auto& [name, value] : entry.response_headers) {
+    if (ToLower(name) == "location") {
+      redirect_url = QString::fromStdString(value);
+    }
+  }
+  response.insert(QStringLiteral("redirectURL"), redirect_url);
+  response.insert(QStringLiteral("headersSize"), -1);
+  response.insert(QStringLiteral("bodySize"), static_cast<qint64>(body_size));
+
+  QJsonObject har_entry;
+  har_entry.insert(QStringLiteral("startedDateTime"),
+                   QString::fromStdString(FormatTimestamp(entry.timestamp)));
+  har_entry.insert(QStringLiteral("time"), TimingTotalMs(entry.timing));
+  har_entry.insert(QStringLiteral("request"), request);
+  har_entry.insert(QStringLiteral("response"), response);
+  har_entry.insert(QStringLiteral("cache"), QJsonObject());
+  har_entry.insert(QStringLiteral("timings"), TimingJson(entry.timing));
+  har_entry.insert(QStringLiteral("_transferSize"),
+                   static_cast<qint64>(entry.encoded_data_length));
+  if (!entry.resource_type.empty()) {
+    har_entry.insert(QStringLiteral("_resourceType"),
+                     QString::fromStdString(entry.resource_type));
+  }
+  har_entry.insert(QStringLiteral("_requestId"),
+                   QString::fromStdString(entry.request_id));
+  if (entry.tab_id > 0) {
+    har_entry.insert(QStringLiteral("_tabId"), entry.tab_id);
+  }
+  return har_entry;
+}
+
+QJsonObject NdjsonRecord(const NetworkCaptureEntry& entry,
+                         const StoredBody& stored) {
+  auto header_object = [](const std::map<std::string, std::string>& headers) {
+    QJsonObject object;
+    for (const auto& [name, value] : headers) {
+      object.insert(QString::fromStdString(name),
+                    QString::fromStdString(value));
+    }
+    return object;
+  };
+  QJsonObject record;
+  record.insert(QStringLiteral("timestamp"),
+                QString::fromStdString(FormatTimestamp(entry.timestamp)));
+  record.insert(QStringLiteral("requestId"),
+                QString::fromStdString(entry.request_id));
+  if (entry.tab_id > 0) {
+    record.insert(QStringLiteral("tabId"), entry.tab_id);
+  }
+  record.insert(QStringLiteral("url"), QString::fromStdString(entry.url));
+  record.insert(QStringLiteral("method"),
+                QString::fromStdString(entry.method));
+  record.insert(QStringLiteral("status"),
+                QString::fromStdString(entry.status));
+  record.insert(QStringLiteral("contentType"),
+                QString::fromStdString(entry.content_type));
+  record.insert(QStringLiteral("requestHeaders"),
+                header_object(entry.request_headers));
+  record.insert(QStringLiteral("responseHeaders"),
+                header_object(entry.response_headers));
+  InsertCaptureTiming(&record, entry);
+  if (!entry.request_body.empty()) {
+    QJsonObject body;
+    InsertCaptureBody(&body, QStringLiteral("text"), entry.request_body);
+    record.insert(QStringLiteral("requestBody"), body);
+  }
+  if (!stored.hash.empty()) {
+    QJsonObject body;
+    body.insert(QStringLiteral("file"), QString::fromStdString(stored.file));
+    body.insert(QStringLiteral("hash"), QString::fromStdString(stored.hash));
+    body.insert(QStringLiteral("size"),
+                static_cast<qint64>(ResponseBodySize(entry)));
+    record.insert(QStringLiteral("responseBody"), body);
+  } else if (!entry.response_body.empty()) {
+    QJsonObject body;
+    InsertCaptureBody(&body, QStringLiteral("text"), entry.response_body);
+    record.insert(QStringLiteral("responseBody"), body);
+  }
+  if (!entry.response_body_error.empty()) {
+    record.insert(QStringLiteral("responseBodyError"),
+                  QString::fromStdString(entry.response_body_error));
+  }
+  return record;
+}
+
+std::string WarcRecordId() {
+  static std::mt19937_64 generator{std::random_device{}()};
+  std::array<unsigned char, 16> bytes;
+  for (size_t i = 0; i < bytes.size(); i += 8) {
+    const uint64_t value = generator();
+    for (size_t j = 0; j < 8; ++j) {
+      bytes[i + j] = static_cast<unsigned char>(value >> (8 * j));
+    }
+  }
+  bytes[6] = static_cast<unsigned char>((bytes[6] & 0x0F) | 0x40);
+  bytes[8] = static_cast<unsigned char>((bytes[8] & 0x3F) | 0x80);
+  static constexpr char kHex[] = "0123456789abcdef";
+  std::string id = "<urn:uuid:";
+  for (size_t i = 0; i < bytes.size(); ++i) {
+    if (i == 4 || i == 6 || i == 8 || i == 10) {
+      id.push_back('-');
+    }
+    id.push_back(kHex[bytes[i] >> 4]);
+    id.push_back(kHex[bytes[i] & 0xF]);
+  }
+  id.push_back('>');
+  return id;
+}
+
+std::string WarcRecordHeader(const std::string& type,
+                             const std::string& record_id,
+                             const std::string& date,
+                             const std::string& target_uri,
+                             const std::string& concurrent_to,
+                             const std::string& content_type,
+                             uint64_t block_size,
+                             int tab_id = 0,
+                             const std::string& extra_fields = std::string()) {
+  std::string record = "WARC/1.1\r\nWARC-Type: " + type +
+                       "\r\nWARC-Record-ID: " + record_id +
+                       "\r\nWARC-Date: " + date + "\r\n";
+  if (tab_id > 0) {
+    record += "Rethread-Tab-Id: " + std::to_string(tab_id) + "\r\n";
+  }
+  if (!target_uri.empty()) {
+    record += "WARC-Target-URI: " + target_uri + "\r\n";
+  }
+  if (!concurrent_to.empty()) {
+    record += "WARC-Concurrent-To: " + concurrent_to + "\r\n";
+  }
+  record += extra_fields;
+  record += "Content-Type: " + content_type +
+            "\r\nContent-Length: " + std::to_string(block_size) +
+            "\r\n\r\n";
+  return record;
+}
+
+std::string WarcRecord(const std::string& type,
+                       const std::string& record_id,
+                       const std::string& date,
+                       const std::string& target_uri,
+                       const std::string& concurrent_to,
+                       const std::string& content_type,
+                       const std::string& block,
+                       int tab_id = 0) {
+  return WarcRecordHeader(type, record_id, date, target_uri, concurrent_to,
+                          content_type, block.size(), tab_id) +
+         block + "\r\n\r\n";
+}
+
+// CDP hands over decoded bodies, so transfer framing headers describing the
+// wire bytes are replaced by a Content-Length that matches what is stored.
+std::string HttpHeaderBlock(const std::map<std::string, std::string>& headers,
+                            uint64_t body_size) {
+  std::string block;
+  for (const auto& [name, value] : headers) {
+    const std::string lower = ToLower(name);
+    if (lower == "content-encoding" || lower == "transfer-encoding" ||
+        lower == "content-length" || (!name.empty() && name[0] == ':')) {
+      continue;
+    }
+    block += name + ": " + value + "\r\n";
+  }
+  if (body_size > 0) {
+    block += "Content-Length: " + std::to_string(body_size) + "\r\n";
+  }
+  return block;
+}
+
+// A response record followed by its request record. The response body is
+// left out: the caller writes |response_body_size| bytes of it between
+// |head| and |tail|, so streamed bodies can be copied from disk in slices.
+struct WarcCaptureRecords {
+  std::string head;
+  std::string tail;
+  std::string response_id;
+};
+
+// The response record that first stored a payload, for revisit records to
+// point back at.
+struct WarcOriginal {
+  std::string record_id;
+  std::string target_uri;
+  std::string date;
+};
+
+// |payload_hash| is the body's BodyHasher digest, or empty. With
+// |original|, the response becomes a revisit record holding only the HTTP
+// headers and the caller writes no body.
+WarcCaptureRecords WarcRecordsFor(const NetworkCaptureEntry& entry,
+                                  uint64_t response_body_size,
+                                  const std::string& payload_hash = "",
+                                  const WarcOriginal* original = nullptr) {
+  const std::string date = FormatTimestamp(entry.timestamp);
+  const QUrl url(QString::fromStdString(entry.url));
+  std::string target = url.path(QUrl::FullyEncoded).toStdString();
+  if (target.empty()) {
+    target = "/";
+  }
+  if (url.hasQuery()) {
+    target += "?" + url.query(QUrl::FullyEncoded).toStdString();
+  }
+  std::string request_block = entry.method + " " + target + " HTTP/1.1\r\n";
+  bool has_host = false;
+  for (const auto& [name, value] : entry.request_headers) {
+    has_host = has_host || ToLower(name) == "host";
+  }
+  if (!has_host) {
+    request_block += "Host: " + url.authority().toStdString() + "\r\n";
+  }
+  request_block +=
+      HttpHeaderBlock(entry.request_headers, entry.request_body.size());
+  request_block += "\r\n" + entry.request_body;
+
+  const std::string response_head =
+      "HTTP/1.1 " + (entry.status.empty() ? std::string("0") : entry.status) +
+      "\r\n" + HttpHeaderBlock(entry.response_headers, response_body_size) +
+      "\r\n";
+
+  const std::string response_id = WarcRecordId();
+  std::string extra_fields;
+  if (original) {
+    extra_fields =
+        "WARC-Profile: http://netpreserve.org/warc/1.1/revisit/"
+        "identical-payload-digest\r\nWARC-Refers-To: " +
+        original->record_id +
+        "\r\nWARC-Refers-To-Target-URI: " + original->target_uri +
+        "\r\nWARC-Refers-To-Date: " + original->date + "\r\n";
+  }
+  if (!payload_hash.empty()) {
+    extra_fields +=
+        "WARC-Payload-Digest: " + (kWarcDigestLabel + payload_hash) + "\r\n";
+  }
+  WarcCaptureRecords records;
+  records.response_id = response_id;
+  records.head =
+      WarcRecordHeader(original ? "revisit" : "response", response_id, date,
+                       entry.url, std::string(),
+                       "application/http; msgtype=response",
+                       response_head.size() +
+                           (original ? 0 : response_body_size),
+                       entry.tab_id, extra_fields) +
+      response_head;
+  records.tail =
+      "\r\n\r\n" +
+      WarcRecord("request", WarcRecordId(), date, entry.url, response_id,
+                 "application/http; msgtype=request", request_block,
+                 entry.tab_id);
+  return records;
+}
+
+// Appends every capture to one file per rotation, with an index.ndjson line
+// per record giving the file, byte offset, and length. With zstd every record
+// starts on a frame boundary, so an indexed range decompresses on its own.
+// HAR and NDJSON records refer to bodies in the body store; WARC records
+// embed them, and a payload seen before becomes a revisit record.
+class ArchiveCaptureSink : public NetworkCaptureSink {
+ public:
+  // |bodies| is null for WARC. |inline_bodies| keeps HAR and NDJSON
+  // bodies in the records (streamed ones still go to the store) and turns
+  // off WARC revisit records.
+  ArchiveCaptureSink(std::string output_dir,
+                     CaptureFormat format,
+                     uint64_t rotate_bytes,
+                     bool compress,
+                     std::unique_ptr<CaptureBodyStore> bodies,
+                     bool inline_bodies)
+      : output_dir_(std::move(output_dir)),
+        format_(format),
+        rotate_bytes_(rotate_bytes),
+        compress_(compress),
+        bodies_(std::move(bodies)),
+        inline_bodies_(inline_bodies) {}
+
+  ~ArchiveCaptureSink() override {
+    CloseFile();
+    if (index_fd_ >= 0) {
+      fdatasync(index_fd_);
+      close(index_fd_);
+    }
+  }
+
+  bool Write(const NetworkCaptureEntry& entry) override {
+    if (fd_ < 0 && !OpenNextFile()) {
+      return false;
+    }
+    StoredBody stored;
+    if (bodies_ && (!inline_bodies_ || !entry.response_body_path.empty()) &&
+        !bodies_->Store(entry, &stored)) {
+      return false;
+    }
+    std::string body_hash = stored.hash;
+    // Set when this WARC record holds a payload later ones may revisit.
+    std::string payload_record_id;
+    if (format_ == CaptureFormat::kHar && records_in_file_ > 0 &&
+        !Append(",")) {
+      return false;
+    }
+    const uint64_t offset = file_bytes_;
+    switch (format_) {
+      case CaptureFormat::kHar:
+        if (!Append(QJsonDocument(HarEntry(entry, stored))
+                        .toJson(QJsonDocument::Compact)
+                        .toStdString())) {
+          return false;
+        }
+        break;
+      case CaptureFormat::kNdjson:
+        if (!Append(QJsonDocument(NdjsonRecord(entry, stored))
+                            .toJson(QJsonDocument::Compact)
+                            .toStdString() +
+                        "\n")) {
+          return false;
+        }
+        break;
+      case CaptureFormat::kWarc:
+        if (!AppendWarc(entry, &body_hash, &payload_record_id)) {
+          return false;
+        }
+        break;
+      case CaptureFormat::kDirectory:
+        return false;
+    }
+    const uint64_t length = file_bytes_ - offset;
+    ++records_in_file_;
+
+    QJsonObject index_entry;
+    index_entry.insert(QStringLiteral("file"),
+                       QString::fromStdString(file_name_));
+    index_entry.insert(QStringLiteral("offset"), static_cast<qint64>(offset));
+    index_entry.insert(QStringLiteral("length"), static_cast<qint64>(length));
+    index_entry.insert(QStringLiteral("requestId"),
+                       QString::fromStdString(entry.request_id));
+    if (entry.tab_id > 0) {
+      index_entry.insert(QStringLiteral("tabId"), entry.tab_id);
+    }
+    index_entry.insert(QStringLiteral("url"),
+                       QString::fromStdString(entry.url));
+    if (!body_hash.empty()) {
+      index_entry.insert(QStringLiteral("bodyHash"),
+                         QString::fromStdString(body_hash));
+    }
+    if (!payload_record_id.empty()) {
+      index_entry.insert(QStringLiteral("recordId"),
+                         QString::fromStdString(payload_record_id));
+      index_entry.insert(
+          QStringLiteral("date"),
+          QString::fromStdString(FormatTimestamp(entry.timestamp)));
+    }
+    const std::string index_line =
+        QJsonDocument(index_entry).toJson(QJsonDocument::Compact)
+            .toStdString() +
+        "\n";
+    if (!WriteAllToFd(index_fd_, index_line.data(), index_line.size())) {
+      return false;
+    }
+
+    if (rotate_bytes_ > 0 && file_bytes_ >= rotate_bytes_) {
+      return CloseFile();
+    }
+    return true;
+  }
+
+ private:
+  bool OpenNextFile() {
+    if (index_fd_ < 0) {
+      const std::string index_path =
+          (std::filesystem::path(output_dir_) / "index.ndjson").string();
+      if (format_ == CaptureFormat::kWarc && !inline_bodies_) {
+        LoadWarcOriginals(index_path);
+      }
+      index_fd_ = open(index_path.c_str(),
+                       O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (index_fd_ < 0) {
+        return false;
+      }
+    }
+    const char* extension = format_ == CaptureFormat::kHar      ? "har"
+                            : format_ == CaptureFormat::kNdjson ? "ndjson"
+                                                                : "warc";
+    // Skip numbers left by an earlier run so their files stay intact.
+    do {
+      char name[64];
+      std::snprintf(name, sizeof(name), "capture-%05d.%s%s", ++file_number_,
+                    extension, compress_ ? ".zst" : "");
+      file_name_ = name;
+    } while (std::filesystem::exists(std::filesystem::path(output_dir_) /
+                                     file_name_));
+    const std::string path =
+        (std::filesystem::path(output_dir_) / file_name_).string();
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
       return false;
     }
-    out.write(request_body.data(), request_body.size());
+    file_bytes_ = 0;
+    records_in_file_ = 0;
+    switch (format_) {
+      case CaptureFormat::kHar:
+        return Append(
+            "{\"log\":{\"version\":\"1.2\",\"creator\":{\"name\":"
+            "\"rethread\",\"version\":\"\"},\"entries\":[");
+      case CaptureFormat::kWarc: {
+        const std::string info = "software: rethread network-log\r\n"
+                                 "format: WARC File Format 1.1\r\n";
+        return Append(WarcRecord("warcinfo", WarcRecordId(),
+                                 FormatTimestamp(
+                                     std::chrono::system_clock::now()),
+                                 std::string(), std::string(),
+                                 "application/warc-fields", info));
+      }
+      case CaptureFormat::kNdjson:
+      case CaptureFormat::kDirectory:
+        break;
+    }
+    return true;
   }
-  if (!response_body.empty()) {
-    std::ofstream out((capture_dir / "response-body.bin").string(),
-                      std::ios::binary);
-    if (!out.is_open()) {
+
+  // Payloads stored by earlier runs into the same directory can be
+  // revisited too, as long as the file holding them is still there.
+  void LoadWarcOriginals(const std::string& index_path) {
+    std::ifstream in(index_path);
+    std::map<std::string, bool> file_present;
+    std::string line;
+    while (std::getline(in, line)) {
+      const QJsonObject entry =
+          QJsonDocument::fromJson(QByteArray::fromStdString(line)).object();
+      const std::string hash =
+          entry.value(QStringLiteral("bodyHash")).toString().toStdString();
+      const std::string record_id =
+          entry.value(QStringLiteral("recordId")).toString().toStdString();
+      if (hash.empty() || record_id.empty()) {
+        continue;
+      }
+      const std::string file =
+          entry.value(QStringLiteral("file")).toString().toStdString();
+      auto present = file_present.find(file);
+      if (present == file_present.end()) {
+        present = file_present
+                      .emplace(file, std::filesystem::exists(
+                                         std::filesystem::path(output_dir_) /
+                                         file))
+                      .first;
+      }
+      if (!present->second) {
+        continue;
+      }
+      warc_originals_[hash] = WarcOriginal{
+          record_id,
+          entry.value(QStringLiteral("url")).toString().toStdString(),
+          entry.value(QStringLiteral("date")).toString().toStdString()};
+    }
+  }
+
+  // Streamed bodies are copied into the record in slices so memory stays
+  // bounded; each slice becomes its own zstd frame when compressing. A
+  // payload already in the archive is written as a revisit record instead.
+  // |payload_hash| gets the body's hash and |payload_record_id| the id of a
+  // record that now holds the payload.
+  bool AppendWarc(const NetworkCaptureEntry& entry,
+                  std::string* payload_hash,
+                  std::string* payload_record_id) {
+    const bool streamed = !entry.response_body_path.empty();
+    const uint64_t body_size = ResponseBodySize(entry);
+    const WarcOriginal* original = nullptr;
+    if (!inline_bodies_ && body_size > 0) {
+      if (!streamed) {
+        *payload_hash = HashBody(entry.response_body);
+      } else if (!HashBodyFile(entry.response_body_path, payload_hash)) {
+        return false;
+      }
+      auto found = warc_originals_.find(*payload_hash);
+      if (found != warc_originals_.end()) {
+        original = &found->second;
+      }
+    }
+    const WarcCaptureRecords records =
+        WarcRecordsFor(entry, body_size, *payload_hash, original);
+    if (!Append(records.head)) {
       return false;
     }
-    out.write(response_body.data(), response_body.size());
-    if (!WriteResponseBodyJson(
-            (capture_dir / "response-body.json").string(), response_body)) {
+    if (original) {
+      if (streamed) {
+        unlink(entry.response_body_path.c_str());
+      }
+      return Append(records.tail);
+    }
+    if (!payload_hash->empty()) {
+      warc_originals_[*payload_hash] =
+          WarcOriginal{records.response_id, entry.url,
+                       FormatTimestamp(entry.timestamp)};
+      *payload_record_id = records.response_id;
+    }
+    if (!streamed) {
+      if (!entry.response_body.empty() &&
+          !Append(entry.response_body)) {
+        return false;
+      }
+      return Append(records.tail);
+    }
+    const int body_fd =
+        open(entry.response_body_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (body_fd < 0) {
       return false;
     }
+    std::string slice(kCaptureCopySliceBytes, '\0');
+    uint64_t copied = 0;
+    ssize_t n = 0;
+    while (copied < body_size &&
+           (n = read(body_fd, slice.data(), slice.size())) > 0) {
+      if (!Append(slice.substr(0, static_cast<size_t>(n)))) {
+        close(body_fd);
+        return false;
+      }
+      copied += static_cast<uint64_t>(n);
+    }
+    close(body_fd);
+    unlink(entry.response_body_path.c_str());
+    return copied == body_size && Append(records.tail);
   }
-  return true;
-}
 
-bool SendCdpRequest(int fd,
-                    int* next_id,
-                    const QString& method,
-                    const QJsonObject& params,
-                    int* request_id_out) {
-  if (!next_id) {
-    return false;
-  }
-  const int request_id = (*next_id)++;
-  QJsonObject payload;
-  payload.insert(QStringLiteral("id"), request_id);
-  payload.insert(QStringLiteral("method"), method);
-  if (!params.isEmpty()) {
-    payload.insert(QStringLiteral("params"), params);
-  }
-  QJsonDocument doc(payload);
-  const std::string text = doc.toJson(QJsonDocument::Compact).toStdString();
-  if (!SendWebSocketText(fd, text)) {
-    return false;
+  // Finishes the current file (closing the HAR document) and syncs it.
+  bool CloseFile() {
+    if (fd_ < 0) {
+      return true;
+    }
+    bool ok = true;
+    if (format_ == CaptureFormat::kHar) {
+      ok = Append("]}}\n");
+    }
+    ok = fdatasync(fd_) == 0 && ok;
+    ok = close(fd_) == 0 && ok;
+    fd_ = -1;
+    return ok;
+  }
+
+  bool Append(const std::string& data) {
+    const std::string* bytes = &data;
+#ifdef RETHREAD_HAVE_ZSTD
+    std::string compressed;
+    if (compress_) {
+      compressed.resize(ZSTD_compressBound(data.size()));
+      const size_t size = ZSTD_compress(compressed.data(), compressed.size(),
+                                        data.data(), data.size(),
+                                        kCaptureZstdLevel);
+      if (ZSTD_isError(size)) {
+        return false;
+      }
+      compressed.resize(size);
+      bytes = &compressed;
+    }
+#endif
+    if (!WriteAllToFd(fd_, bytes->data(), bytes->size())) {
+      return false;
+    }
+    file_bytes_ += bytes->size();
+    return true;
   }
-  if (request_id_out) {
-    *request_id_out = request_id;
+
+  std::string output_dir_;
+  CaptureFormat format_;
+  uint64_t rotate_bytes_;
+  bool compress_;
+  std::unique_ptr<CaptureBodyStore> bodies_;
+  bool inline_bodies_;
+  // Payload hash to the WARC record holding it.
+  std::unordered_map<std::string, WarcOriginal> warc_originals_;
+  int fd_ = -1;
+  int index_fd_ = -1;
+  int file_number_ = 0;
+  std::string file_name_;
+  uint64_t file_bytes_ = 0;
+  size_t records_in_file_ = 0;
+};
+
+// Writes captures on its own thread so disk latency never delays reading the
+// CDP socket. The destructor drains the queue before joining.
+class NetworkCaptureWriter {
+ public:
+  explicit NetworkCaptureWriter(std::unique_ptr<NetworkCaptureSink> sink)
+      : sink_(std::move(sink)),
+        thread_([this]() { Run(); }) {}
+
+  ~NetworkCaptureWriter() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closing_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
   }
-  return true;
-}
 
-bool ReadCdpMessage(int fd, QJsonObject* message_out,
-                    std::string* prefetch) {
-  std::string payload;
-  unsigned char opcode = 0;
-  if (!ReadWebSocketMessageWithBuffer(fd, &payload, &opcode, prefetch)) {
-    return false;
+  void Enqueue(NetworkCaptureEntry entry) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(entry));
+    }
+    ready_.notify_one();
   }
-  if (opcode != 0x1) {
-    return true;
+
+ private:
+  void Run() {
+    while (true) {
+      NetworkCaptureEntry entry;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ready_.wait(lock, [this]() { return closing_ || !queue_.empty(); });
+        if (queue_.empty()) {
+          return;
+        }
+        entry = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      if (!sink_->Write(entry)) {
+        std::cerr << "Failed to write capture for " << entry.url << "\n";
+      } else {
+        NetworkLogDebug("capture " + entry.request_id + " " + entry.url);
+      }
+    }
   }
-  QJsonParseError parse_error;
-  QJsonDocument doc = QJsonDocument::fromJson(
-      QByteArray::fromStdString(payload), &parse_error);
-  if (parse_error.error != QJsonParseError::NoError || !doc.isObject()) {
-    return true;
+
+  std::unique_ptr<NetworkCaptureSink> sink_;
+  std::mutex mutex_;
+  std::condition_variable ready_;
+  std::deque<NetworkCaptureEntry> queue_;
+  bool closing_ = false;
+  std::thread thread_;
+};
+
+// Adds the hashes of every stored body that a capture in |output_dir|
+// still refers to: responseBodyHash in each request directory's
+// metadata.json, and bodyHash in index.ndjson lines whose archive file
+// still exists.
+void CollectCaptureBodyRefs(const std::string& output_dir,
+                            std::unordered_set<std::string>* live) {
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(output_dir, ec)) {
+    const std::filesystem::path metadata = entry.path() / "metadata.json";
+    if (!entry.is_directory(ec) || !std::filesystem::exists(metadata, ec)) {
+      continue;
+    }
+    const QString hash =
+        ReadJsonObjectFile(metadata)
+            .value(QStringLiteral("responseBodyHash"))
+            .toString();
+    if (!hash.isEmpty()) {
+      live->insert(hash.toStdString());
+    }
   }
-  if (message_out) {
-    *message_out = doc.object();
+  std::ifstream index(std::filesystem::path(output_dir) / "index.ndjson");
+  std::map<std::string, bool> file_present;
+  std::string line;
+  while (std::getline(index, line)) {
+    const QJsonObject entry =
+        QJsonDocument::fromJson(QByteArray::fromStdString(line)).object();
+    const std::string hash =
+        entry.value(QStringLiteral("bodyHash")).toString().toStdString();
+    if (hash.empty()) {
+      continue;
+    }
+    const std::string file =
+        entry.value(QStringLiteral("file")).toString().toStdString();
+    auto present = file_present.find(file);
+    if (present == file_present.end()) {
+      present = file_present
+                    .emplace(file, std::filesystem::exists(
+                                       std::filesystem::path(output_dir) /
+                                       file, ec))
+                    .first;
+    }
+    if (present->second) {
+      live->insert(hash);
+    }
   }
-  return true;
 }
 
-bool WaitForCdpResponse(int fd,
-                        int target_id,
-                        QJsonObject* response_out,
-                        std::deque<QJsonObject>* pending_events,
-                        std::string* prefetch) {
-  while (!g_stop_requested) {
-    QJsonObject message;
-    if (!ReadCdpMessage(fd, &message, prefetch)) {
-      return false;
+// network-log gc: deletes stored bodies no capture refers to any more.
+int RunNetworkLogGc(int argc, char* argv[]) {
+  std::string store_dir;
+  bool dry_run = false;
+  std::vector<std::string> output_dirs;
+  for (int index = 0; index < argc; ++index) {
+    const std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintNetworkLogUsage();
+      return 0;
     }
-    if (message.isEmpty()) {
+    if (arg == "--dry-run") {
+      dry_run = true;
       continue;
     }
-    if (message.contains(QStringLiteral("id"))) {
-      const int id = message.value(QStringLiteral("id")).toInt();
-      if (id == target_id) {
-        if (response_out) {
-          *response_out = message;
-        }
-        return true;
-      }
+    const std::string store_prefix = "--body-store=";
+    if (arg.rfind(store_prefix, 0) == 0) {
+      store_dir = arg.substr(store_prefix.size());
       continue;
     }
-    if (pending_events) {
-      pending_events->push_back(message);
+    if (!arg.empty() && arg[0] == '-') {
+      std::cerr << "Unknown network-log gc option: " << arg << "\n";
+      PrintNetworkLogUsage();
+      return 1;
+    }
+    output_dirs.push_back(arg);
+  }
+  if (output_dirs.empty()) {
+    std::cerr << "network-log gc needs the capture directories to keep\n";
+    PrintNetworkLogUsage();
+    return 1;
+  }
+  if (store_dir.empty()) {
+    store_dir =
+        (std::filesystem::path(output_dirs.front()) / kBodyStoreDirName)
+            .string();
+  }
+
+  std::unordered_set<std::string> live;
+  for (const std::string& output_dir : output_dirs) {
+    if (!std::filesystem::is_directory(output_dir)) {
+      std::cerr << "Not a directory: " << output_dir << "\n";
+      return 1;
     }
+    CollectCaptureBodyRefs(output_dir, &live);
+  }
+  BodyStoreGcResult result;
+  std::string error;
+  if (!CollectBodyStoreGarbage(store_dir, live, kBodyStoreGcGraceSeconds,
+                               dry_run, &result, &error)) {
+    std::cerr << "network-log gc failed: " << error << "\n";
+    return 1;
   }
-  return false;
+  std::cout << (dry_run ? "Would remove " : "Removed ") << result.removed
+            << " bodies ("
+            << FormatBytes(static_cast<double>(result.removed_bytes))
+            << "), kept " << result.kept << "\n";
+  return 0;
 }
 
 }  // namespace
-
 std::string TabSocketPath(const std::string& user_data_dir) {
   if (user_data_dir.empty()) {
     return std::string("tabs.sock");
@@ -1505,7 +1716,16 @@ int RunTabCli(int argc, char* argv[], const std::string& default_user_data_dir)
   std::ostringstream payload;
 
   if (cmd == "get" || cmd == "list") {
-    payload << "list\n";
+    payload << "list";
+    for (; index < argc; ++index) {
+      const std::string arg = argv[index];
+      if (arg != "--processes") {
+        std::cerr << "Unknown list option: " << arg << "\n";
+        return 1;
+      }
+      payload << " " << arg;
+    }
+    payload << "\n";
   } else if (cmd == "switch") {
     if (index >= argc) {
       std::cerr << "switch requires a tab id\n";
@@ -1528,6 +1748,78 @@ int RunTabCli(int argc, char* argv[], const std::string& default_user_data_dir)
       payload << " " << argv[i];
     }
     payload << "\n";
+  } else if (cmd == "move") {
+    if (index >= argc) {
+      std::cerr << "move requires a target index or offset\n";
+      return 1;
+    }
+    if (argc - index > 2) {
+      std::cerr << "move accepts at most two indexes\n";
+      return 1;
+    }
+    payload << "move";
+    for (int i = index; i < argc; ++i) {
+      payload << " " << argv[i];
+    }
+    payload << "\n";
+  } else if (cmd == "sort") {
+    std::string key = "url";
+    while (index < argc) {
+      std::string arg = argv[index];
+      const std::string by_prefix = "--by=";
+      if (arg.rfind(by_prefix, 0) == 0) {
+        key = arg.substr(by_prefix.size());
+        ++index;
+        continue;
+      }
+      if (arg == "--by") {
+        if (index + 1 >= argc) {
+          std::cerr << "--by requires a value\n";
+          return 1;
+        }
+        key = argv[index + 1];
+        index += 2;
+        continue;
+      }
+      std::cerr << "Unknown sort option: " << arg << "\n";
+      return 1;
+    }
+    if (key != "url" && key != "title" && key != "host") {
+      std::cerr << "sort --by must be url, title, or host\n";
+      return 1;
+    }
+    payload << "sort --by=" << key << "\n";
+  } else if (cmd == "dedupe") {
+    if (index < argc) {
+      std::cerr << "dedupe does not take arguments\n";
+      return 1;
+    }
+    payload << "dedupe\n";
+  } else if (cmd == "stats") {
+    if (index < argc) {
+      std::cerr << "stats does not take arguments\n";
+      return 1;
+    }
+    payload << "stats\n";
+  } else if (cmd == "group") {
+    std::string action = "list";
+    if (index < argc) {
+      action = argv[index++];
+    }
+    if (action != "list" && action != "switch" && action != "move" &&
+        action != "close") {
+      std::cerr << "Unknown group action: " << action << "\n";
+      return 1;
+    }
+    if (action != "list" && index >= argc) {
+      std::cerr << "group " << action << " requires a group name\n";
+      return 1;
+    }
+    payload << "group " << action;
+    for (int i = index; i < argc; ++i) {
+      payload << " " << argv[i];
+    }
+    payload << "\n";
   } else if (cmd == "open") {
     bool open_at_end = false;
     while (index < argc) {
@@ -1755,9 +2047,130 @@ int RunEvalCli(int argc,
     return 1;
   }
 
+  if (index < argc) {
+    const std::string action = argv[index];
+    if (action == "pending") {
+      if (index + 1 < argc) {
+        std::cerr << "eval pending does not take arguments\n";
+        return 1;
+      }
+      return SendCommand(TabSocketPath(user_data_dir), "eval pending\n") ? 0
+                                                                        : 1;
+    }
+    if (action == "cancel") {
+      // A pool prefixes ids with the worker number: `eval cancel 2:7`.
+      int worker = 0;
+      int eval_id = 0;
+      std::string id_text = index + 2 == argc ? argv[index + 1] : "";
+      const size_t colon = id_text.find(':');
+      if (colon != std::string::npos) {
+        if (!ParsePositiveInt(id_text.substr(0, colon), &worker)) {
+          id_text.clear();
+        } else {
+          id_text = id_text.substr(colon + 1);
+        }
+      }
+      if (!ParsePositiveInt(id_text, &eval_id)) {
+        std::cerr << "eval cancel requires a single eval id\n";
+        return 1;
+      }
+      std::ostringstream payload;
+      payload << "eval cancel ";
+      if (worker > 0) {
+        payload << worker << ":";
+      }
+      payload << eval_id << "\n";
+      return SendCommand(TabSocketPath(user_data_dir), payload.str()) ? 0 : 1;
+    }
+    if (action == "list") {
+      if (index + 1 < argc) {
+        std::cerr << "eval list does not take arguments\n";
+        return 1;
+      }
+      return SendCommand(TabSocketPath(user_data_dir), "eval list\n") ? 0 : 1;
+    }
+    if (action == "unregister") {
+      if (index + 2 != argc || !IsValidScriptId(argv[index + 1])) {
+        std::cerr << "eval unregister requires a single script name\n";
+        return 1;
+      }
+      std::ostringstream payload;
+      payload << "eval unregister " << argv[index + 1] << "\n";
+      return SendCommand(TabSocketPath(user_data_dir), payload.str()) ? 0 : 1;
+    }
+    if (action == "register") {
+      std::string name;
+      bool register_stdin = false;
+      int arg_index = index + 1;
+      for (; arg_index < argc; ++arg_index) {
+        const std::string arg = argv[arg_index];
+        const std::string name_prefix = "--name=";
+        if (arg.rfind(name_prefix, 0) == 0) {
+          name = arg.substr(name_prefix.size());
+        } else if (arg == "--stdin") {
+          register_stdin = true;
+        } else if (arg == "--") {
+          ++arg_index;
+          break;
+        } else {
+          break;
+        }
+      }
+      if (!IsValidScriptId(name)) {
+        std::cerr << "eval register requires --name=NAME "
+                     "(letters, digits, '-', '_', '.')\n";
+        return 1;
+      }
+      std::ostringstream buffer;
+      if (register_stdin) {
+        if (arg_index < argc) {
+          std::cerr << "--stdin cannot be combined with a script argument\n";
+          return 1;
+        }
+        buffer << std::cin.rdbuf();
+      } else {
+        for (int i = arg_index; i < argc; ++i) {
+          if (i > arg_index) {
+            buffer << " ";
+          }
+          buffer << argv[i];
+        }
+      }
+      const std::string script = buffer.str();
+      if (script.empty()) {
+        std::cerr << "eval register requires a non-empty script\n";
+        return 1;
+      }
+      std::ostringstream payload;
+      payload << "eval register --name=" << name
+              << " --code=" << HexEncode(script) << "\n";
+      return SendCommand(TabSocketPath(user_data_dir), payload.str()) ? 0 : 1;
+    }
+  }
+
+  // `eval call NAME [json-args]` shares the tab flags below; the positional
+  // text is the JSON argument instead of a script.
+  std::string call_name;
+  if (index < argc && std::string(argv[index]) == "call") {
+    if (index + 1 >= argc || !IsValidScriptId(argv[index + 1])) {
+      std::cerr << "eval call requires a script name\n";
+      return 1;
+    }
+    call_name = argv[index + 1];
+    index += 2;
+  }
+
   bool use_stdin = false;
   int tab_id = 0;
   int tab_index = 0;
+  int timeout_ms = 0;
+  bool all_tabs = false;
+  bool raw_output = false;
+  bool stream_output = false;
+  std::string world;
+  std::string wait_for;
+  std::string match_pattern;
+  std::string open_url;
   while (index < argc) {
     std::string arg = argv[index];
     if (arg == "--help" || arg == "-h") {
@@ -1811,6 +2224,90 @@ int RunEvalCli(int argc,
       ++index;
       continue;
     }
+    const std::string timeout_prefix = "--timeout-ms=";
+    if (arg.rfind(timeout_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(timeout_prefix.size()), &timeout_ms)) {
+        std::cerr << "Invalid --timeout-ms value\n";
+        return 1;
+      }
+      ++index;
+      continue;
+    }
+    if (arg == "--timeout-ms") {
+      if (index + 1 >= argc || !ParsePositiveInt(argv[index + 1], &timeout_ms)) {
+        std::cerr << "--timeout-ms requires a positive number\n";
+        return 1;
+      }
+      index += 2;
+      continue;
+    }
+    if (arg == "--all") {
+      all_tabs = true;
+      ++index;
+      continue;
+    }
+    if (arg == "--raw-output") {
+      raw_output = true;
+      ++index;
+      continue;
+    }
+    if (arg == "--stream") {
+      stream_output = true;
+      ++index;
+      continue;
+    }
+    const std::string world_prefix = "--world=";
+    if (arg.rfind(world_prefix, 0) == 0) {
+      world = arg.substr(world_prefix.size());
+      if (world != "main" && world != "isolated") {
+        std::cerr << "--world must be main or isolated\n";
+        return 1;
+      }
+      ++index;
+      continue;
+    }
+    const std::string wait_prefix = "--wait-for=";
+    if (arg.rfind(wait_prefix, 0) == 0) {
+      wait_for = arg.substr(wait_prefix.size());
+      if (wait_for != "load" && wait_for != "domcontentloaded" &&
+          wait_for != "networkidle" &&
+          (wait_for.rfind("selector:", 0) != 0 || wait_for.size() <= 9)) {
+        std::cerr << "--wait-for must be load, domcontentloaded, "
+                     "networkidle, or selector:CSS\n";
+        return 1;
+      }
+      ++index;
+      continue;
+    }
+    if (arg == "--match") {
+      if (index + 1 >= argc) {
+        std::cerr << "--match requires a regex\n";
+        return 1;
+      }
+      match_pattern = argv[index + 1];
+      index += 2;
+      continue;
+    }
+    const std::string match_prefix = "--match=";
+    if (arg.rfind(match_prefix, 0) == 0) {
+      match_pattern = arg.substr(match_prefix.size());
+      if (match_pattern.empty()) {
+        std::cerr << "--match requires a regex\n";
+        return 1;
+      }
+      ++index;
+      continue;
+    }
+    const std::string open_prefix = "--open=";
+    if (arg.rfind(open_prefix, 0) == 0) {
+      open_url = arg.substr(open_prefix.size());
+      if (open_url.empty()) {
+        std::cerr << "--open requires a URL\n";
+        return 1;
+      }
+      ++index;
+      continue;
+    }
     if (arg == "--") {
       ++index;
       break;
@@ -1818,8 +2315,24 @@ int RunEvalCli(int argc,
     break;
   }
 
-  if (tab_id > 0 && tab_index > 0) {
-    std::cerr << "Specify at most one tab selector (--tab-id or --tab-index)\n";
+  const int selector_count = (tab_id > 0 ? 1 : 0) + (tab_index > 0 ? 1 : 0) +
+                             (all_tabs ? 1 : 0) +
+                             (match_pattern.empty() ? 0 : 1) +
+                             (open_url.empty() ? 0 : 1);
+  if (selector_count > 1) {
+    std::cerr << "Specify at most one tab selector (--tab-id, --tab-index, "
+                 "--all, --match, or --open)\n";
+    return 1;
+  }
+  if ((raw_output || stream_output || !wait_for.empty()) &&
+      (all_tabs || !match_pattern.empty())) {
+    std::cerr << "--raw-output, --stream, and --wait-for cannot be combined "
+                 "with --all or --match\n";
+    return 1;
+  }
+
+  if (!call_name.empty() && (all_tabs || !match_pattern.empty())) {
+    std::cerr << "eval call cannot be combined with --all or --match\n";
     return 1;
   }
 
@@ -1832,6 +2345,15 @@ int RunEvalCli(int argc,
     std::ostringstream buffer;
     buffer << std::cin.rdbuf();
     script = buffer.str();
+  } else if (!call_name.empty()) {
+    std::ostringstream buffer;
+    for (int i = index; i < argc; ++i) {
+      if (i > index) {
+        buffer << " ";
+      }
+      buffer << argv[i];
+    }
+    script = buffer.str();
   } else {
     if (index >= argc) {
       std::cerr << "eval requires a script argument\n";
@@ -1848,7 +2370,7 @@ int RunEvalCli(int argc,
     script = buffer.str();
   }
 
-  if (script.empty()) {
+  if (script.empty() && call_name.empty()) {
     std::cerr << "eval requires a non-empty script\n";
     return 1;
   }
@@ -1856,13 +2378,40 @@ int RunEvalCli(int argc,
   const std::string encoded = HexEncode(script);
   std::ostringstream payload;
   payload << "eval";
+  if (!call_name.empty()) {
+    payload << " call " << call_name;
+  }
   if (tab_id > 0) {
     payload << " --tab-id=" << tab_id;
   }
-  if (tab_index > 0) {
-    payload << " --tab-index=" << tab_index;
+  if (tab_index > 0) {
+    payload << " --tab-index=" << tab_index;
+  }
+  if (all_tabs) {
+    payload << " --all";
+  }
+  if (timeout_ms > 0) {
+    payload << " --timeout-ms=" << timeout_ms;
+  }
+  if (raw_output) {
+    payload << " --raw-output";
+  }
+  if (stream_output) {
+    payload << " --stream";
+  }
+  if (!world.empty()) {
+    payload << " --world=" << world;
+  }
+  if (!wait_for.empty()) {
+    payload << " --wait-for=" << HexEncode(wait_for);
+  }
+  if (!match_pattern.empty()) {
+    payload << " --match=" << HexEncode(match_pattern);
+  }
+  if (!open_url.empty()) {
+    payload << " --open=" << HexEncode(open_url);
   }
-  payload << " --code=" << encoded << "\n";
+  payload << (call_name.empty() ? " --code=" : " --args=") << encoded << "\n";
 
   if (!SendCommand(TabSocketPath(user_data_dir), payload.str())) {
     return 1;
@@ -2146,6 +2695,7 @@ int RunScriptsCli(int argc,
     std::string id;
     std::string match;
     std::string run_at;
+    std::string world;
     bool stylesheet = false;
     while (index < argc) {
       std::string arg = argv[index];
@@ -2199,6 +2749,16 @@ int RunScriptsCli(int argc,
         ++index;
         continue;
       }
+      const std::string world_prefix = "--world=";
+      if (arg.rfind(world_prefix, 0) == 0) {
+        world = arg.substr(world_prefix.size());
+        if (world != "main" && world != "isolated") {
+          std::cerr << "--world must be main or isolated\n";
+          return 1;
+        }
+        ++index;
+        continue;
+      }
       if (arg == "--help" || arg == "-h") {
         PrintScriptsUsage();
         return 0;
@@ -2229,6 +2789,9 @@ int RunScriptsCli(int argc,
     if (!run_at.empty()) {
       payload << " --run-at=" << run_at;
     }
+    if (!world.empty()) {
+      payload << " --world=" << world;
+    }
     payload << " --code=" << HexEncode(script) << "\n";
   } else {
     std::cerr << "Unknown scripts command: " << action << "\n";
@@ -2297,20 +2860,72 @@ int RunNetworkLogCli(int argc,
   }
 
   int tab_id = 0;
+  bool all_tabs = false;
   std::string output_dir;
-  std::string url_pattern;
-  std::string method_pattern;
-  std::string status_pattern;
-  std::string mime_pattern;
+  std::vector<std::string> url_patterns;
+  std::vector<std::string> method_patterns;
+  std::vector<std::string> status_patterns;
+  std::vector<std::string> mime_patterns;
   int cdp_port = 0;
   bool cdp_port_set = false;
+  CaptureFormat format = CaptureFormat::kDirectory;
+  int rotate_mb = 0;
+  bool compress = false;
+  bool stream_bodies = false;
+  bool inline_bodies = false;
+  std::string body_store_dir;
 
+  if (index < argc && std::string(argv[index]) == "gc") {
+    return RunNetworkLogGc(argc - index - 1, argv + index + 1);
+  }
   for (; index < argc; ++index) {
     std::string arg = argv[index];
     if (arg == "--help" || arg == "-h") {
       PrintNetworkLogUsage();
       return 0;
     }
+    const std::string format_prefix = "--format=";
+    if (arg.rfind(format_prefix, 0) == 0) {
+      if (!ParseCaptureFormat(arg.substr(format_prefix.size()), &format)) {
+        std::cerr << "--format must be dir, har, ndjson, or warc\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--stream-bodies") {
+      stream_bodies = true;
+      continue;
+    }
+    if (arg == "--inline-bodies") {
+      inline_bodies = true;
+      continue;
+    }
+    const std::string store_prefix = "--body-store=";
+    if (arg.rfind(store_prefix, 0) == 0) {
+      body_store_dir = arg.substr(store_prefix.size());
+      continue;
+    }
+    if (arg == "--all") {
+      all_tabs = true;
+      continue;
+    }
+    const std::string rotate_prefix = "--rotate-mb=";
+    if (arg.rfind(rotate_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(rotate_prefix.size()), &rotate_mb)) {
+        std::cerr << "Invalid --rotate-mb value\n";
+        return 1;
+      }
+      continue;
+    }
+    if (arg == "--compress=zstd") {
+#ifdef RETHREAD_HAVE_ZSTD
+      compress = true;
+      continue;
+#else
+      std::cerr << "rethread was built without zstd support\n";
+      return 1;
+#endif
+    }
     const std::string id_prefix = "--id=";
     if (arg.rfind(id_prefix, 0) == 0) {
       if (!ParsePositiveInt(arg.substr(id_prefix.size()), &tab_id)) {
@@ -2343,7 +2958,7 @@ int RunNetworkLogCli(int argc,
     }
     const std::string url_prefix = "--url=";
     if (arg.rfind(url_prefix, 0) == 0) {
-      url_pattern = arg.substr(url_prefix.size());
+      url_patterns.push_back(arg.substr(url_prefix.size()));
       continue;
     }
     if (arg == "--url") {
@@ -2351,12 +2966,12 @@ int RunNetworkLogCli(int argc,
         std::cerr << "--url requires a value\n";
         return 1;
       }
-      url_pattern = argv[++index];
+      url_patterns.push_back(argv[++index]);
       continue;
     }
     const std::string method_prefix = "--method=";
     if (arg.rfind(method_prefix, 0) == 0) {
-      method_pattern = arg.substr(method_prefix.size());
+      method_patterns.push_back(arg.substr(method_prefix.size()));
       continue;
     }
     if (arg == "--method") {
@@ -2364,12 +2979,12 @@ int RunNetworkLogCli(int argc,
         std::cerr << "--method requires a value\n";
         return 1;
       }
-      method_pattern = argv[++index];
+      method_patterns.push_back(argv[++index]);
       continue;
     }
     const std::string status_prefix = "--status=";
     if (arg.rfind(status_prefix, 0) == 0) {
-      status_pattern = arg.substr(status_prefix.size());
+      status_patterns.push_back(arg.substr(status_prefix.size()));
       continue;
     }
     if (arg == "--status") {
@@ -2377,12 +2992,12 @@ int RunNetworkLogCli(int argc,
         std::cerr << "--status requires a value\n";
         return 1;
       }
-      status_pattern = argv[++index];
+      status_patterns.push_back(argv[++index]);
       continue;
     }
     const std::string mime_prefix = "--mime=";
     if (arg.rfind(mime_prefix, 0) == 0) {
-      mime_pattern = arg.substr(mime_prefix.size());
+      mime_patterns.push_back(arg.substr(mime_prefix.size()));
       continue;
     }
     if (arg == "--mime") {
@@ -2390,7 +3005,7 @@ int RunNetworkLogCli(int argc,
         std::cerr << "--mime requires a value\n";
         return 1;
       }
-      mime_pattern = argv[++index];
+      mime_patterns.push_back(argv[++index]);
       continue;
     }
     const std::string cdp_port_prefix = "--cdp-port=";
@@ -2425,21 +3040,27 @@ int RunNetworkLogCli(int argc,
     return 1;
   }
 
-  if (tab_id <= 0) {
-    std::cerr << "network-log requires --id\n";
+  if ((tab_id <= 0) == !all_tabs) {
+    std::cerr << "network-log requires exactly one of --id or --all\n";
     PrintNetworkLogUsage();
     return 1;
   }
 
   if (output_dir.empty()) {
-    output_dir = "rethread-tab-" + std::to_string(tab_id) + "-network-log";
+    output_dir = all_tabs ? std::string("rethread-network-log")
+                          : "rethread-tab-" + std::to_string(tab_id) +
+                                "-network-log";
+  }
+  if (format == CaptureFormat::kDirectory && (rotate_mb > 0 || compress)) {
+    std::cerr << "--rotate-mb and --compress need --format=har|ndjson|warc\n";
+    return 1;
   }
 
   NetworkFilters filters;
   std::string filter_error;
-  if (!BuildNetworkFilters(url_pattern, method_pattern, status_pattern,
-                           mime_pattern, &filters, &filter_error)) {
-    std::cerr << "Invalid filter regex: " << filter_error << "\n";
+  if (!BuildNetworkFilters(url_patterns, method_patterns, status_patterns,
+                           mime_patterns, &filters, &filter_error)) {
+    std::cerr << "Invalid filter pattern: " << filter_error << "\n";
     return 1;
   }
 
@@ -2449,99 +3070,67 @@ int RunNetworkLogCli(int argc,
     std::cerr << "Failed to create output directory: " << output_dir << "\n";
     return 1;
   }
+  const std::filesystem::path spool_dir =
+      std::filesystem::path(output_dir) / ".spool";
+  if (stream_bodies) {
+    std::filesystem::create_directories(spool_dir, ec);
+    if (ec) {
+      std::cerr << "Failed to create spool directory: " << spool_dir.string()
+                << "\n";
+      return 1;
+    }
+  }
   std::cout << "Logging to " << output_dir << "\n";
 
   const std::string socket_path = TabSocketPath(user_data_dir);
-  std::ostringstream payload;
-  payload << "devtools-id " << tab_id << "\n";
-  std::string response;
-  if (!SendCommandCapture(socket_path, payload.str(), &response)) {
-    return 1;
-  }
-  response = TrimWhitespace(response);
-  if (response.rfind("ERR", 0) == 0) {
-    std::cerr << response << "\n";
-    return 1;
-  }
-  const std::string devtools_id = response;
-  if (devtools_id.empty()) {
-    std::cerr << "Failed to resolve devtools id\n";
+  std::string devtools_id;
+  CdpPipeline cdp;
+  if (!ConnectCdpPipeline(user_data_dir, all_tabs ? 0 : tab_id,
+                          cdp_port_set ? cdp_port : 0, &cdp, &devtools_id)) {
     return 1;
   }
+  const int fd = cdp.fd;
+  QJsonObject network_params;
+  network_params.insert(QStringLiteral("maxResourceBufferSize"), 64 * 1024 * 1024);
+  network_params.insert(QStringLiteral("maxTotalBufferSize"), 128 * 1024 * 1024);
 
-  if (!cdp_port_set) {
-    const auto port_from_file = ReadCdpPortFile(user_data_dir);
-    if (port_from_file) {
-      cdp_port = *port_from_file;
-    }
-  }
-  if (cdp_port <= 0) {
-    cdp_port = 9222;
+  // Pages being captured, keyed by CDP session id. A single-tab capture has
+  // one entry under the empty session id.
+  struct CaptureSession {
+    std::string target_id;
+    int tab_id = 0;
+  };
+  std::map<std::string, CaptureSession> sessions;
+  std::map<std::string, std::string> target_sessions;
+  std::unordered_set<std::string> attaching;
+  std::map<std::string, int> tab_targets;
+  if (all_tabs) {
+    // Pages that open later, popups included, are attached paused so no
+    // request slips out before Network.enable reaches them. Discovery covers
+    // pages that auto-attach does not report.
+    QJsonObject discover_params;
+    discover_params.insert(QStringLiteral("discover"), true);
+    cdp.Send(QStringLiteral("Target.setDiscoverTargets"), discover_params);
+    QJsonObject attach_params;
+    attach_params.insert(QStringLiteral("autoAttach"), true);
+    attach_params.insert(QStringLiteral("waitForDebuggerOnStart"), true);
+    attach_params.insert(QStringLiteral("flatten"), true);
+    cdp.Send(QStringLiteral("Target.setAutoAttach"), attach_params);
+  } else {
+    sessions[std::string()] = CaptureSession{devtools_id, tab_id};
+    cdp.Send(QStringLiteral("Network.enable"), network_params);
   }
 
-  QJsonDocument target_doc;
-  std::string http_error;
-  NetworkLogDebug("fetching targets");
-  if (!HttpGetJson("127.0.0.1", cdp_port, "/json/list", &target_doc,
-                   &http_error)) {
-    std::cerr << "Failed to fetch CDP targets: " << http_error << "\n";
-    return 1;
-  }
-  if (!target_doc.isArray()) {
-    std::cerr << "Unexpected CDP target response\n";
-    return 1;
-  }
-  QString ws_url;
-  const QJsonArray targets = target_doc.array();
-  for (const QJsonValue& entry : targets) {
-    const QJsonObject obj = entry.toObject();
-    if (obj.value(QStringLiteral("id")).toString().toStdString() ==
-        devtools_id) {
-      ws_url = obj.value(QStringLiteral("webSocketDebuggerUrl")).toString();
-      break;
+  const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event watch{};
+  watch.events = EPOLLIN;
+  watch.data.fd = fd;
+  if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &watch) < 0) {
+    std::cerr << "Failed to watch CDP socket: " << std::strerror(errno)
+              << "\n";
+    if (epoll_fd >= 0) {
+      close(epoll_fd);
     }
-  }
-  if (ws_url.isEmpty()) {
-    std::cerr << "CDP target not found for tab id " << tab_id << "\n";
-    return 1;
-  }
-
-  QUrl url(ws_url);
-  if (!url.isValid() || url.scheme() != QStringLiteral("ws")) {
-    std::cerr << "Invalid WebSocket URL: " << ws_url.toStdString() << "\n";
-    return 1;
-  }
-  const std::string host = url.host().toStdString();
-  const int port = url.port(cdp_port);
-  std::string path = url.path().toStdString();
-  if (!url.query().isEmpty()) {
-    path += "?" + url.query().toStdString();
-  }
-
-  int fd = ConnectTcp(host.empty() ? "127.0.0.1" : host, port);
-  if (fd < 0) {
-    std::cerr << "Failed to connect to CDP WebSocket\n";
-    return 1;
-  }
-  NetworkLogDebug("connected websocket");
-  SetSocketTimeout(fd, 250);
-  std::string ws_error;
-  std::string ws_prefetch;
-  if (!WebSocketHandshake(fd, host.empty() ? "127.0.0.1" : host, port, path,
-                          &ws_error, &ws_prefetch)) {
-    std::cerr << "WebSocket handshake failed: " << ws_error << "\n";
-    close(fd);
-    return 1;
-  }
-
-  int next_id = 1;
-  QJsonObject empty_params;
-  QJsonObject network_params;
-  network_params.insert(QStringLiteral("maxResourceBufferSize"), 64 * 1024 * 1024);
-  network_params.insert(QStringLiteral("maxTotalBufferSize"), 128 * 1024 * 1024);
-  if (!SendCdpRequest(fd, &next_id, QStringLiteral("Network.enable"),
-                      network_params, nullptr)) {
-    std::cerr << "Failed to enable Network domain\n";
     close(fd);
     return 1;
   }
@@ -2550,193 +3139,890 @@ int RunNetworkLogCli(int argc,
   std::signal(SIGINT, HandleStopSignal);
   std::signal(SIGTERM, HandleStopSignal);
 
-  struct CaptureEntry {
-    std::chrono::system_clock::time_point timestamp;
-    std::string request_id;
-    std::string url;
-    std::string method;
-    std::string status;
-    std::string content_type;
-    std::map<std::string, std::string> request_headers;
-    std::map<std::string, std::string> response_headers;
-    std::string request_body;
-    bool has_response = false;
-    bool captured = false;
-  };
-
-  std::map<std::string, CaptureEntry> pending;
-  std::deque<QJsonObject> pending_events;
-  auto try_capture_entry = [&](CaptureEntry* entry) -> bool {
-    if (!entry || entry->captured) {
-      return true;
-    }
-    if (!filters.Match(entry->url, entry->method, entry->status,
-                       entry->content_type)) {
-      NetworkLogDebug("skip " + entry->request_id + " " + entry->url +
-                      " " + entry->method + " " + entry->status +
-                      " " + entry->content_type);
-      entry->captured = true;
-      return true;
+  // Directory captures link to the store unless bodies are inlined, and
+  // HAR/NDJSON always need it for streamed bodies. WARC embeds payloads.
+  std::unique_ptr<CaptureBodyStore> bodies;
+  if (format == CaptureFormat::kHar || format == CaptureFormat::kNdjson ||
+      (format == CaptureFormat::kDirectory && !inline_bodies)) {
+    if (body_store_dir.empty()) {
+      bodies = std::make_unique<CaptureBodyStore>(
+          (std::filesystem::path(output_dir) / kBodyStoreDirName).string(),
+          std::string(kBodyStoreDirName) + "/");
+    } else {
+      const std::string root =
+          std::filesystem::absolute(body_store_dir).lexically_normal()
+              .string();
+      bodies = std::make_unique<CaptureBodyStore>(root, root + "/");
     }
-
-    std::string response_body;
-    std::string response_body_error;
+  }
+  std::unique_ptr<NetworkCaptureSink> sink;
+  if (format == CaptureFormat::kDirectory) {
+    sink = std::make_unique<DirectoryCaptureSink>(output_dir,
+                                                  std::move(bodies));
+  } else {
+    sink = std::make_unique<ArchiveCaptureSink>(
+        output_dir, format, static_cast<uint64_t>(rotate_mb) * 1024 * 1024,
+        compress, std::move(bodies), inline_bodies);
+  }
+  NetworkCaptureWriter writer(std::move(sink));
+  std::map<std::string, NetworkCaptureEntry> pending;
+  // Network.getResponseBody calls in flight, keyed by CDP message id. Bodies
+  // beyond the cap wait in |body_backlog| so a burst cannot flood the socket.
+  std::unordered_map<int, NetworkCaptureEntry> body_requests;
+  std::deque<NetworkCaptureEntry> body_backlog;
+  auto send_body_request = [&](NetworkCaptureEntry entry) {
     QJsonObject body_params;
     body_params.insert(QStringLiteral("requestId"),
-                       QString::fromStdString(entry->request_id));
-    int body_request_id = 0;
-    if (SendCdpRequest(fd, &next_id, QStringLiteral("Network.getResponseBody"),
-                       body_params, &body_request_id)) {
-      QJsonObject body_response;
-      if (WaitForCdpResponse(fd, body_request_id, &body_response,
-                             &pending_events, &ws_prefetch)) {
-        if (body_response.contains(QStringLiteral("error"))) {
-          const QJsonObject err_obj =
-              body_response.value(QStringLiteral("error")).toObject();
-          response_body_error =
-              err_obj.value(QStringLiteral("message")).toString().toStdString();
-        } else {
-          const QJsonObject result =
-              body_response.value(QStringLiteral("result")).toObject();
-          const std::string body_text =
-              result.value(QStringLiteral("body")).toString().toStdString();
-          const bool base64_encoded =
-              result.value(QStringLiteral("base64Encoded")).toBool();
-          if (!body_text.empty()) {
-            if (base64_encoded) {
-              std::string decoded;
-              if (Base64Decode(body_text, &decoded)) {
-                response_body = std::move(decoded);
-              } else {
-                response_body_error = "decode body: invalid base64";
-              }
-            } else {
-              response_body = body_text;
-            }
+                       QString::fromStdString(entry.request_id));
+    const int body_request_id = cdp.Send(
+        QStringLiteral("Network.getResponseBody"), body_params,
+        entry.session_id);
+    body_requests.emplace(body_request_id, std::move(entry));
+  };
+  auto capture_entry = [&](NetworkCaptureEntry entry) {
+    if (!filters.Match(entry.url, entry.method, entry.status,
+                       entry.content_type)) {
+      NetworkLogDebug("skip " + entry.request_id + " " + entry.url +
+                      " " + entry.method + " " + entry.status +
+                      " " + entry.content_type);
+      return;
+    }
+    if (body_requests.size() >= kNetworkLogMaxBodyRequests) {
+      body_backlog.push_back(std::move(entry));
+      return;
+    }
+    send_body_request(std::move(entry));
+  };
+  // Fills |entry| from a CDP Network.Response.
+  auto apply_response = [](const QJsonObject& response,
+                           NetworkCaptureEntry* entry) {
+    entry->url =
+        response.value(QStringLiteral("url")).toString().toStdString();
+    entry->status =
+        std::to_string(response.value(QStringLiteral("status")).toInt());
+    entry->response_headers = NormalizeHeaderMap(
+        response.value(QStringLiteral("headers")).toObject());
+    entry->content_type = ToLower(
+        response.value(QStringLiteral("mimeType")).toString().toStdString());
+    auto content_it = entry->response_headers.find("content-type");
+    if (content_it != entry->response_headers.end()) {
+      entry->content_type = ToLower(content_it->second);
+    }
+    entry->timing = TimingFromResource(
+        response.value(QStringLiteral("timing")).toObject(),
+        entry->started_at);
+    entry->timestamp = std::chrono::system_clock::now();
+    entry->has_response = true;
+  };
+  // A redirect hop has no body of its own (getResponseBody would return the
+  // final one), so it goes straight to the writer.
+  auto capture_redirect = [&](NetworkCaptureEntry hop,
+                              const QJsonObject& params) {
+    apply_response(params.value(QStringLiteral("redirectResponse")).toObject(),
+                   &hop);
+    hop.finished_at = params.value(QStringLiteral("timestamp")).toDouble(-1);
+    FinishTiming(&hop.timing, hop.started_at, hop.finished_at);
+    if (filters.Match(hop.url, hop.method, hop.status, hop.content_type)) {
+      NetworkLogDebug("redirect " + hop.request_id + " " + hop.status + " " +
+                      hop.url);
+      writer.Enqueue(std::move(hop));
+    }
+  };
+  auto finish_body_request = [&](NetworkCaptureEntry entry,
+                                 const QJsonObject& body_response) {
+    if (body_response.contains(QStringLiteral("error"))) {
+      const QJsonObject err_obj =
+          body_response.value(QStringLiteral("error")).toObject();
+      entry.response_body_error =
+          err_obj.value(QStringLiteral("message")).toString().toStdString();
+    } else {
+      const QJsonObject result =
+          body_response.value(QStringLiteral("result")).toObject();
+      std::string body_text =
+          result.value(QStringLiteral("body")).toString().toStdString();
+      const bool base64_encoded =
+          result.value(QStringLiteral("base64Encoded")).toBool();
+      if (!body_text.empty()) {
+        if (base64_encoded) {
+          std::string decoded;
+          if (Base64Decode(body_text, &decoded)) {
+            entry.response_body = std::move(decoded);
+          } else {
+            entry.response_body_error = "decode body: invalid base64";
           }
+        } else {
+          entry.response_body = std::move(body_text);
         }
       }
     }
+    writer.Enqueue(std::move(entry));
+    if (!body_backlog.empty()) {
+      send_body_request(std::move(body_backlog.front()));
+      body_backlog.pop_front();
+    }
+  };
 
-    if (!WriteNetworkCapture(output_dir, entry->timestamp, entry->request_id,
-                             entry->url, entry->method, "Response",
-                             entry->status.empty() ? "<pending>" : entry->status,
-                             entry->content_type, entry->request_headers,
-                             entry->response_headers, entry->request_body,
-                             response_body, response_body_error)) {
-      std::cerr << "Failed to write capture for " << entry->url << "\n";
-    } else {
-      NetworkLogDebug("capture " + entry->request_id + " " + entry->url);
+  // --stream-bodies: Network.streamResourceContent makes Chromium push each
+  // chunk in Network.dataReceived, and chunks are appended to a spool file
+  // as they arrive, so no body is ever held whole in memory.
+  struct BodyStream {
+    int fd = -1;
+    std::string path;
+    uint64_t bytes = 0;
+    bool enabled = false;
+    bool finished = false;
+    bool failed = false;
+  };
+  std::map<std::string, BodyStream> body_streams;
+  std::unordered_map<int, std::string> stream_requests;
+  bool streaming_available = stream_bodies;
+  auto start_stream = [&](const NetworkCaptureEntry& entry) {
+    const std::string key = CaptureKey(entry.session_id, entry.request_id);
+    BodyStream stream;
+    stream.path =
+        (spool_dir / (SanitizePathFragment(key) + ".body")).string();
+    stream.fd = open(stream.path.c_str(),
+                     O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (stream.fd < 0) {
+      return;
+    }
+    QJsonObject stream_params;
+    stream_params.insert(QStringLiteral("requestId"),
+                         QString::fromStdString(entry.request_id));
+    const int stream_request_id =
+        cdp.Send(QStringLiteral("Network.streamResourceContent"),
+                 stream_params, entry.session_id);
+    stream_requests.emplace(stream_request_id, key);
+    body_streams.emplace(key, std::move(stream));
+  };
+  auto append_stream = [&](BodyStream* stream, const QJsonValue& data) {
+    const std::string encoded = data.toString().toStdString();
+    if (stream->failed || encoded.empty()) {
+      return;
+    }
+    std::string chunk;
+    if (!Base64Decode(encoded, &chunk) ||
+        !WriteAllToFd(stream->fd, chunk.data(), chunk.size())) {
+      stream->failed = true;
+      return;
+    }
+    stream->bytes += chunk.size();
+  };
+  auto drop_stream = [&](const std::string& key) {
+    auto stream_it = body_streams.find(key);
+    if (stream_it == body_streams.end()) {
+      return;
+    }
+    close(stream_it->second.fd);
+    unlink(stream_it->second.path.c_str());
+    body_streams.erase(stream_it);
+  };
+  // Called once the response has finished and streaming was acknowledged.
+  // A stream that broke falls back to a regular getResponseBody capture.
+  auto finish_stream = [&](const std::string& key) {
+    auto entry_it = pending.find(key);
+    auto stream_it = body_streams.find(key);
+    if (entry_it == pending.end() || stream_it == body_streams.end()) {
+      drop_stream(key);
+      return;
+    }
+    NetworkCaptureEntry entry = std::move(entry_it->second);
+    pending.erase(entry_it);
+    BodyStream stream = std::move(stream_it->second);
+    body_streams.erase(stream_it);
+    const bool closed = close(stream.fd) == 0;
+    if (stream.failed || !closed) {
+      unlink(stream.path.c_str());
+      capture_entry(std::move(entry));
+      return;
+    }
+    entry.response_body_path = stream.path;
+    entry.response_body_size = stream.bytes;
+    NetworkLogDebug("streamed " + entry.request_id + " " +
+                    std::to_string(stream.bytes) + " bytes");
+    writer.Enqueue(std::move(entry));
+  };
+  auto handle_stream_reply = [&](const std::string& key,
+                                 const QJsonObject& reply) {
+    auto stream_it = body_streams.find(key);
+    if (stream_it == body_streams.end()) {
+      return;
+    }
+    BodyStream& stream = stream_it->second;
+    if (reply.contains(QStringLiteral("error"))) {
+      const QJsonObject err_obj =
+          reply.value(QStringLiteral("error")).toObject();
+      // -32601: this Chromium has no streamResourceContent.
+      if (err_obj.value(QStringLiteral("code")).toInt() == -32601 &&
+          streaming_available) {
+        streaming_available = false;
+        std::cerr << "Network.streamResourceContent is not supported by this "
+                     "browser; falling back to getResponseBody\n";
+      }
+      const bool finished = stream.finished;
+      drop_stream(key);
+      auto entry_it = pending.find(key);
+      if (finished && entry_it != pending.end()) {
+        NetworkCaptureEntry entry = std::move(entry_it->second);
+        pending.erase(entry_it);
+        capture_entry(std::move(entry));
+      }
+      return;
+    }
+    append_stream(&stream, reply.value(QStringLiteral("result"))
+                               .toObject()
+                               .value(QStringLiteral("bufferedData")));
+    stream.enabled = true;
+    if (stream.finished) {
+      finish_stream(key);
     }
-    entry->captured = true;
-    return true;
   };
-  while (!g_stop_requested) {
-    QJsonObject event;
-    if (!pending_events.empty()) {
-      event = pending_events.front();
-      pending_events.pop_front();
-    } else {
-      QJsonObject message;
-      if (!ReadCdpMessage(fd, &message, &ws_prefetch)) {
-        break;
+
+  // Requests whose latest URL and method already fail the filters; their
+  // remaining events are dropped after the cheap scan.
+  std::unordered_set<std::string> skipped;
+
+  // --all: attach to every page target once and forget a page's requests
+  // when it goes away.
+  auto handle_target_event = [&](const std::string& method,
+                                 std::string_view message) {
+    const QJsonObject params =
+        ParseCdpMessage(message).value(QStringLiteral("params")).toObject();
+    const QJsonObject info =
+        params.value(QStringLiteral("targetInfo")).toObject();
+    const std::string target_id =
+        info.value(QStringLiteral("targetId")).toString().toStdString();
+    const bool is_page =
+        info.value(QStringLiteral("type")).toString() == QStringLiteral("page");
+    if (method == "Target.targetCreated") {
+      if (is_page && !target_sessions.count(target_id) &&
+          attaching.insert(target_id).second) {
+        QJsonObject attach_params;
+        attach_params.insert(QStringLiteral("targetId"),
+                             QString::fromStdString(target_id));
+        attach_params.insert(QStringLiteral("flatten"), true);
+        cdp.Send(QStringLiteral("Target.attachToTarget"), attach_params);
+      }
+      return;
+    }
+    const std::string session_id =
+        params.value(QStringLiteral("sessionId")).toString().toStdString();
+    if (method == "Target.attachedToTarget") {
+      attaching.erase(target_id);
+      const bool duplicate = target_sessions.count(target_id) > 0;
+      if (is_page && !duplicate) {
+        target_sessions[target_id] = session_id;
+        // Tabs opened after the last lookup are not in the map yet.
+        if (!tab_targets.count(target_id)) {
+          FetchTabTargets(socket_path, &tab_targets);
+        }
+        auto tab_it = tab_targets.find(target_id);
+        sessions[session_id] = CaptureSession{
+            target_id, tab_it == tab_targets.end() ? 0 : tab_it->second};
+        NetworkLogDebug("attached " + target_id + " as tab " +
+                        std::to_string(sessions[session_id].tab_id));
+        cdp.Send(QStringLiteral("Network.enable"), network_params,
+                 session_id);
+      }
+      if (params.value(QStringLiteral("waitingForDebugger")).toBool()) {
+        cdp.Send(QStringLiteral("Runtime.runIfWaitingForDebugger"),
+                 QJsonObject(), session_id);
+      }
+      if (!is_page || duplicate) {
+        QJsonObject detach_params;
+        detach_params.insert(QStringLiteral("sessionId"),
+                             QString::fromStdString(session_id));
+        cdp.Send(QStringLiteral("Target.detachFromTarget"), detach_params);
+      }
+      return;
+    }
+    if (method != "Target.detachedFromTarget") {
+      return;
+    }
+    auto session_it = sessions.find(session_id);
+    if (session_it == sessions.end()) {
+      return;
+    }
+    target_sessions.erase(session_it->second.target_id);
+    sessions.erase(session_it);
+    const std::string prefix = CaptureKey(session_id, std::string());
+    auto in_session = [&prefix](const std::string& key) {
+      return key.rfind(prefix, 0) == 0;
+    };
+    for (auto it = pending.begin(); it != pending.end();) {
+      it = in_session(it->first) ? pending.erase(it) : std::next(it);
+    }
+    for (auto it = skipped.begin(); it != skipped.end();) {
+      it = in_session(*it) ? skipped.erase(it) : std::next(it);
+    }
+    for (auto it = stream_requests.begin(); it != stream_requests.end();) {
+      it = in_session(it->second) ? stream_requests.erase(it) : std::next(it);
+    }
+    std::vector<std::string> streams;
+    for (const auto& [key, stream] : body_streams) {
+      if (in_session(key)) {
+        streams.push_back(key);
+      }
+    }
+    for (const std::string& key : streams) {
+      drop_stream(key);
+    }
+    // Body fetches still in flight will not be answered any more.
+    std::vector<int> orphaned;
+    for (const auto& [id, entry] : body_requests) {
+      if (entry.session_id == session_id) {
+        orphaned.push_back(id);
+      }
+    }
+    for (int id : orphaned) {
+      NetworkCaptureEntry entry = std::move(body_requests[id]);
+      body_requests.erase(id);
+      QJsonObject error;
+      error.insert(QStringLiteral("message"), QStringLiteral("target closed"));
+      QJsonObject reply;
+      reply.insert(QStringLiteral("error"), error);
+      finish_body_request(std::move(entry), reply);
+    }
+  };
+
+  bool connected = true;
+  bool watching_writes = false;
+  std::vector<std::string_view> messages;
+  while (!g_stop_requested && connected) {
+    if (!cdp.Flush()) {
+      break;
+    }
+    const bool want_writes = !cdp.outbox.empty();
+    if (want_writes != watching_writes) {
+      watch.events = want_writes ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+      epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &watch);
+      watching_writes = want_writes;
+    }
+    epoll_event event_out;
+    const int ready = epoll_wait(epoll_fd, &event_out, 1, kNetworkLogPollMs);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    messages.clear();
+    connected = cdp.Receive(&messages);
+
+    for (std::string_view message : messages) {
+      CdpMessageSummary summary;
+      if (!ScanCdpMessage(message, &summary)) {
+        NetworkLogDebug("unparseable CDP message");
+        continue;
       }
-      if (message.isEmpty()) {
+      if (summary.has_id) {
+        auto body_it = body_requests.find(summary.id);
+        if (body_it != body_requests.end()) {
+          NetworkCaptureEntry entry = std::move(body_it->second);
+          body_requests.erase(body_it);
+          finish_body_request(std::move(entry), ParseCdpMessage(message));
+          continue;
+        }
+        auto stream_request_it = stream_requests.find(summary.id);
+        if (stream_request_it != stream_requests.end()) {
+          const std::string stream_request = stream_request_it->second;
+          stream_requests.erase(stream_request_it);
+          handle_stream_reply(stream_request, ParseCdpMessage(message));
+        }
         continue;
       }
-      if (!message.contains(QStringLiteral("method"))) {
+
+      const std::string& method = summary.method;
+      if (method.rfind("Target.", 0) == 0) {
+        if (all_tabs) {
+          handle_target_event(method, message);
+        }
         continue;
       }
-      event = message;
-    }
-
-    const QString method = event.value(QStringLiteral("method")).toString();
-    const QJsonObject params = event.value(QStringLiteral("params")).toObject();
-    if (method == QStringLiteral("Network.requestWillBeSent")) {
-      const QString request_id =
-          params.value(QStringLiteral("requestId")).toString();
-      const QJsonObject request =
-          params.value(QStringLiteral("request")).toObject();
-      CaptureEntry entry;
-      entry.request_id = request_id.toStdString();
-      entry.url = request.value(QStringLiteral("url")).toString().toStdString();
-      entry.method =
-          request.value(QStringLiteral("method")).toString().toStdString();
-      entry.request_headers =
-          NormalizeHeaderMap(request.value(QStringLiteral("headers")).toObject());
-      entry.request_body =
-          request.value(QStringLiteral("postData")).toString().toStdString();
-      entry.timestamp = std::chrono::system_clock::now();
-      pending[entry.request_id] = std::move(entry);
-      NetworkLogDebug("request " + request_id.toStdString() + " " + entry.url);
-      continue;
-    }
-    if (method == QStringLiteral("Network.responseReceived")) {
-      const QString request_id =
-          params.value(QStringLiteral("requestId")).toString();
-      CaptureEntry& entry = pending[request_id.toStdString()];
-      entry.request_id = request_id.toStdString();
-      const QJsonObject response =
-          params.value(QStringLiteral("response")).toObject();
-      entry.url = response.value(QStringLiteral("url")).toString().toStdString();
-      entry.status = std::to_string(
-          response.value(QStringLiteral("status")).toInt());
-      entry.response_headers =
-          NormalizeHeaderMap(response.value(QStringLiteral("headers")).toObject());
-      entry.content_type =
-          ToLower(response.value(QStringLiteral("mimeType")).toString().toStdString());
-      auto content_it = entry.response_headers.find("content-type");
-      if (content_it != entry.response_headers.end()) {
-        entry.content_type = ToLower(content_it->second);
-      }
-      entry.timestamp = std::chrono::system_clock::now();
-      entry.has_response = true;
-      NetworkLogDebug("response " + request_id.toStdString() + " " +
-                      std::to_string(response.value(QStringLiteral("status")).toInt()) +
-                      " " + entry.url);
-      if (!entry.status.empty()) {
-        int status_code = 0;
-        try {
-          status_code = std::stoi(entry.status);
-        } catch (...) {
-          status_code = 0;
+      const std::string key =
+          CaptureKey(summary.session_id, summary.request_id);
+      auto session_it = sessions.find(summary.session_id);
+      const int event_tab_id =
+          session_it == sessions.end() ? 0 : session_it->second.tab_id;
+      if (method == "Network.requestWillBeSent") {
+        // A redirect re-sends the same requestId along with the 3xx that
+        // ended the previous hop. The hop is captured on its own, so replay
+        // can answer the URL the page originally asked for.
+        auto hop_it = pending.find(key);
+        if (hop_it != pending.end() &&
+            message.find("\"redirectResponse\"") != std::string_view::npos) {
+          NetworkCaptureEntry hop = std::move(hop_it->second);
+          pending.erase(hop_it);
+          capture_redirect(std::move(hop), ParseCdpMessage(message)
+                                               .value(QStringLiteral("params"))
+                                               .toObject());
         }
+        // The latest URL and method decide whether the request is still
+        // wanted.
+        if (!filters.MatchRequest(summary.url, summary.request_method)) {
+          pending.erase(key);
+          skipped.insert(key);
+          continue;
+        }
+        skipped.erase(key);
+        const QJsonObject params = ParseCdpMessage(message)
+                                       .value(QStringLiteral("params"))
+                                       .toObject();
+        const QJsonObject request =
+            params.value(QStringLiteral("request")).toObject();
+        NetworkCaptureEntry entry;
+        entry.request_id = summary.request_id;
+        entry.session_id = summary.session_id;
+        entry.tab_id = event_tab_id;
+        entry.url =
+            request.value(QStringLiteral("url")).toString().toStdString();
+        entry.method =
+            request.value(QStringLiteral("method")).toString().toStdString();
+        entry.request_headers = NormalizeHeaderMap(
+            request.value(QStringLiteral("headers")).toObject());
+        entry.request_body =
+            request.value(QStringLiteral("postData")).toString().toStdString();
+        entry.resource_type =
+            params.value(QStringLiteral("type")).toString().toStdString();
+        entry.started_at =
+            params.value(QStringLiteral("timestamp")).toDouble(-1);
+        entry.timestamp = std::chrono::system_clock::now();
+        NetworkLogDebug("request " + entry.request_id + " " + entry.url);
+        pending[key] = std::move(entry);
+        continue;
+      }
+      if (method == "Network.responseReceived") {
+        if (skipped.count(key)) {
+          continue;
+        }
+        if (!filters.MatchStatus(summary.status)) {
+          pending.erase(key);
+          skipped.insert(key);
+          continue;
+        }
+        const QJsonObject params = ParseCdpMessage(message)
+                                       .value(QStringLiteral("params"))
+                                       .toObject();
+        NetworkCaptureEntry& entry = pending[key];
+        entry.request_id = summary.request_id;
+        entry.session_id = summary.session_id;
+        entry.tab_id = event_tab_id;
+        const QJsonObject response =
+            params.value(QStringLiteral("response")).toObject();
+        const int status_code =
+            response.value(QStringLiteral("status")).toInt();
+        apply_response(response, &entry);
+        if (params.contains(QStringLiteral("type"))) {
+          entry.resource_type =
+              params.value(QStringLiteral("type")).toString().toStdString();
+        }
+        NetworkLogDebug("response " + entry.request_id + " " +
+                        entry.status + " " + entry.url);
         if (status_code >= 400) {
-          if (try_capture_entry(&entry)) {
-            pending.erase(request_id.toStdString());
-          }
+          NetworkCaptureEntry captured = std::move(entry);
+          pending.erase(key);
+          capture_entry(std::move(captured));
+        } else if (streaming_available &&
+                   filters.Match(entry.url, entry.method, entry.status,
+                                 entry.content_type)) {
+          start_stream(entry);
+        }
+        continue;
+      }
+      if (method == "Network.dataReceived") {
+        auto stream_it = body_streams.find(key);
+        if (stream_it != body_streams.end() && stream_it->second.enabled) {
+          append_stream(&stream_it->second,
+                        ParseCdpMessage(message)
+                            .value(QStringLiteral("params"))
+                            .toObject()
+                            .value(QStringLiteral("data")));
+        }
+        continue;
+      }
+      if (method == "Network.loadingFailed") {
+        skipped.erase(key);
+        drop_stream(key);
+        pending.erase(key);
+        NetworkLogDebug("failed " + key);
+        continue;
+      }
+      if (method != "Network.loadingFinished") {
+        continue;
+      }
+
+      if (skipped.erase(key)) {
+        continue;
+      }
+      auto it = pending.find(key);
+      if (it == pending.end()) {
+        NetworkLogDebug("finished missing " + key);
+        continue;
+      }
+      if (!summary.timestamp.empty()) {
+        it->second.finished_at =
+            std::strtod(summary.timestamp.c_str(), nullptr);
+      }
+      it->second.encoded_data_length = static_cast<uint64_t>(
+          std::strtod(summary.encoded_data_length.c_str(), nullptr));
+      FinishTiming(&it->second.timing, it->second.started_at,
+                   it->second.finished_at);
+      auto stream_it = body_streams.find(key);
+      if (stream_it != body_streams.end()) {
+        // Completed once Chromium has acknowledged the stream.
+        stream_it->second.finished = true;
+        if (stream_it->second.enabled) {
+          finish_stream(key);
         }
+        continue;
+      }
+      NetworkCaptureEntry entry = std::move(it->second);
+      pending.erase(it);
+      capture_entry(std::move(entry));
+    }
+  }
+  // Finished requests still waiting for their body were already captured;
+  // give the outstanding replies a moment, then write what is left without
+  // a body rather than dropping it.
+  const auto drain_deadline = std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(kNetworkLogStopDrainMs);
+  while (connected && !body_requests.empty() &&
+         std::chrono::steady_clock::now() < drain_deadline) {
+    if (!cdp.Flush()) {
+      break;
+    }
+    const bool want_writes = !cdp.outbox.empty();
+    if (want_writes != watching_writes) {
+      watch.events = want_writes ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+      epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &watch);
+      watching_writes = want_writes;
+    }
+    epoll_event event_out;
+    if (epoll_wait(epoll_fd, &event_out, 1, kNetworkLogPollMs) < 0 &&
+        errno != EINTR) {
+      break;
+    }
+    messages.clear();
+    connected = cdp.Receive(&messages);
+    for (std::string_view message : messages) {
+      CdpMessageSummary summary;
+      if (!ScanCdpMessage(message, &summary) || !summary.has_id) {
+        continue;
+      }
+      auto body_it = body_requests.find(summary.id);
+      if (body_it != body_requests.end()) {
+        NetworkCaptureEntry entry = std::move(body_it->second);
+        body_requests.erase(body_it);
+        finish_body_request(std::move(entry), ParseCdpMessage(message));
+      }
+    }
+  }
+  auto write_without_body = [&](NetworkCaptureEntry entry) {
+    entry.response_body_error = "capture stopped before the body arrived";
+    writer.Enqueue(std::move(entry));
+  };
+  for (auto& [id, entry] : body_requests) {
+    write_without_body(std::move(entry));
+  }
+  body_requests.clear();
+  for (NetworkCaptureEntry& entry : body_backlog) {
+    write_without_body(std::move(entry));
+  }
+  body_backlog.clear();
+  // Streams still open have no complete body either, whether or not their
+  // loadingFinished arrived; their entries are written the same way.
+  while (!body_streams.empty()) {
+    const std::string key = body_streams.begin()->first;
+    drop_stream(key);
+    auto entry_it = pending.find(key);
+    if (entry_it != pending.end()) {
+      NetworkCaptureEntry entry = std::move(entry_it->second);
+      pending.erase(entry_it);
+      write_without_body(std::move(entry));
+    }
+  }
+  if (stream_bodies) {
+    std::filesystem::remove(spool_dir, ec);
+  }
+  close(epoll_fd);
+  close(fd);
+  return g_stop_requested ? 0 : 1;
+}
+
+int RunTopCli(int argc, char* argv[], const std::string& default_user_data_dir) {
+  std::string user_data_dir;
+  int index = 0;
+  if (!ParseUserDataDir(argc, argv, default_user_data_dir, &user_data_dir,
+                        &index)) {
+    return 1;
+  }
+  double interval_seconds = 1.0;
+  int iterations = 0;
+  bool json_output = false;
+  for (; index < argc; ++index) {
+    std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintTopUsage();
+      return 0;
+    }
+    if (arg == "--json") {
+      json_output = true;
+      continue;
+    }
+    const std::string interval_prefix = "--interval=";
+    if (arg.rfind(interval_prefix, 0) == 0) {
+      char* end = nullptr;
+      const std::string value = arg.substr(interval_prefix.size());
+      interval_seconds = std::strtod(value.c_str(), &end);
+      if (value.empty() || !end || *end != '\0' || interval_seconds < 0.1) {
+        std::cerr << "--interval must be a number of seconds >= 0.1\n";
+        return 1;
       }
       continue;
     }
-    if (method == QStringLiteral("Network.loadingFailed")) {
-      const QString request_id =
-          params.value(QStringLiteral("requestId")).toString();
-      pending.erase(request_id.toStdString());
-      NetworkLogDebug("failed " + request_id.toStdString());
+    const std::string iterations_prefix = "--iterations=";
+    if (arg.rfind(iterations_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(iterations_prefix.size()),
+                            &iterations)) {
+        std::cerr << "Invalid --iterations value\n";
+        return 1;
+      }
       continue;
     }
-    if (method != QStringLiteral("Network.loadingFinished")) {
+    std::cerr << "Unknown top option: " << arg << "\n";
+    PrintTopUsage();
+    return 1;
+  }
+
+  g_stop_requested = 0;
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
+
+  const std::string socket_path = TabSocketPath(user_data_dir);
+  // CPU ticks are cumulative per renderer; percentages come from the delta
+  // between two samples of the same pid.
+  std::map<qint64, double> previous_ticks;
+  auto previous_time = std::chrono::steady_clock::now();
+  bool have_previous = false;
+  for (int sample = 0; !g_stop_requested; ++sample) {
+    if (iterations > 0 && sample >= iterations) {
+      break;
+    }
+    if (sample > 0) {
+      const auto deadline =
+          std::chrono::steady_clock::now() +
+          std::chrono::duration<double>(interval_seconds);
+      while (!g_stop_requested && std::chrono::steady_clock::now() < deadline) {
+        usleep(50 * 1000);
+      }
+      if (g_stop_requested) {
+        break;
+      }
+    }
+
+    std::string response;
+    if (!SendCommandCapture(socket_path, "stats\n", &response)) {
+      return 1;
+    }
+    if (response.rfind("ERR", 0) == 0) {
+      std::cerr << response;
+      return 1;
+    }
+    QJsonParseError parse_error;
+    const QJsonDocument doc = QJsonDocument::fromJson(
+        QByteArray::fromStdString(response), &parse_error);
+    if (parse_error.error != QJsonParseError::NoError || !doc.isObject()) {
+      std::cerr << "Failed to parse stats response\n";
+      return 1;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed =
+        std::chrono::duration<double>(now - previous_time).count();
+    QJsonObject root = doc.object();
+    const double ticks_per_second =
+        root.value(QStringLiteral("clock_ticks_per_second")).toDouble(100.0);
+    QJsonArray tabs = root.value(QStringLiteral("tabs")).toArray();
+    std::map<qint64, double> current_ticks;
+    for (int i = 0; i < tabs.size(); ++i) {
+      QJsonObject tab = tabs.at(i).toObject();
+      const qint64 pid = tab.value(QStringLiteral("pid")).toInteger();
+      const QJsonValue ticks_value = tab.value(QStringLiteral("cpu_ticks"));
+      QJsonValue cpu_percent;
+      if (ticks_value.isDouble()) {
+        const double ticks = ticks_value.toDouble();
+        current_ticks[pid] = ticks;
+        auto prev = previous_ticks.find(pid);
+        if (have_previous && prev != previous_ticks.end() && elapsed > 0 &&
+            ticks >= prev->second) {
+          cpu_percent =
+              100.0 * (ticks - prev->second) / (ticks_per_second * elapsed);
+        }
+      }
+      tab.insert(QStringLiteral("cpu_percent"), cpu_percent);
+      tabs.replace(i, tab);
+    }
+    previous_ticks = std::move(current_ticks);
+    previous_time = now;
+    have_previous = true;
+
+    if (json_output) {
+      QJsonObject line;
+      line.insert(QStringLiteral("timestamp_ms"),
+                  static_cast<qint64>(
+                      std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::system_clock::now().time_since_epoch())
+                          .count()));
+      line.insert(QStringLiteral("tabs"), tabs);
+      std::cout << QJsonDocument(line).toJson(QJsonDocument::Compact)
+                       .toStdString()
+                << std::endl;
       continue;
     }
 
-    const QString request_id =
-        params.value(QStringLiteral("requestId")).toString();
-    auto it = pending.find(request_id.toStdString());
-    if (it == pending.end()) {
-      NetworkLogDebug("finished missing " + request_id.toStdString());
+    std::ostringstream table;
+    table << "\x1b[H\x1b[2J";
+    table << std::left << std::setw(6) << "ID" << std::setw(9) << "PID"
+          << std::right << std::setw(7) << "CPU%" << std::setw(9) << "RSS"
+          << std::setw(7) << "REQS" << std::setw(9) << "BYTES" << "  "
+          << "TITLE\n";
+    for (const QJsonValue& value : tabs) {
+      const QJsonObject tab = value.toObject();
+      std::ostringstream id_cell;
+      id_cell << tab.value(QStringLiteral("id")).toInteger()
+              << (tab.value(QStringLiteral("active")).toBool() ? "*" : "");
+      std::ostringstream cpu_cell;
+      const QJsonValue cpu = tab.value(QStringLiteral("cpu_percent"));
+      if (cpu.isDouble()) {
+        cpu_cell << std::fixed << std::setprecision(1) << cpu.toDouble();
+      } else {
+        cpu_cell << "-";
+      }
+      const QJsonValue rss = tab.value(QStringLiteral("rss_bytes"));
+      const QJsonValue bytes = tab.value(QStringLiteral("transfer_bytes"));
+      table << std::left << std::setw(6) << id_cell.str() << std::setw(9)
+            << tab.value(QStringLiteral("pid")).toInteger() << std::right
+            << std::setw(7) << cpu_cell.str() << std::setw(9)
+            << (rss.isDouble() ? FormatBytes(rss.toDouble()) : "-")
+            << std::setw(7) << tab.value(QStringLiteral("requests")).toInteger()
+            << std::setw(9)
+            << (bytes.isDouble() ? FormatBytes(bytes.toDouble()) : "-") << "  "
+            << TruncateForColumn(
+                   tab.value(QStringLiteral("title")).toString().toStdString(),
+                   60)
+            << "\n";
+    }
+    std::cout << table.str() << std::flush;
+  }
+  return 0;
+}
+
+int RunNetLogCli(int argc,
+                 char* argv[],
+                 const std::string& default_user_data_dir) {
+  std::string user_data_dir;
+  int index = 0;
+  if (!ParseUserDataDir(argc, argv, default_user_data_dir, &user_data_dir,
+                        &index)) {
+    return 1;
+  }
+  int tab_id = 0;
+  long long since = 0;
+  bool follow = false;
+  int interval_ms = 250;
+  for (; index < argc; ++index) {
+    const std::string arg = argv[index];
+    if (arg == "--help" || arg == "-h") {
+      PrintNetLogUsage();
+      return 0;
+    }
+    if (arg == "--follow" || arg == "-f") {
+      follow = true;
+      continue;
+    }
+    const std::string id_prefix = "--id=";
+    if (arg.rfind(id_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(id_prefix.size()), &tab_id)) {
+        std::cerr << "Invalid --id value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string since_prefix = "--since=";
+    if (arg.rfind(since_prefix, 0) == 0) {
+      char* end = nullptr;
+      const std::string value = arg.substr(since_prefix.size());
+      since = std::strtoll(value.c_str(), &end, 10);
+      if (value.empty() || !end || *end != '\0' || since < 0) {
+        std::cerr << "Invalid --since value\n";
+        return 1;
+      }
+      continue;
+    }
+    const std::string interval_prefix = "--interval-ms=";
+    if (arg.rfind(interval_prefix, 0) == 0) {
+      if (!ParsePositiveInt(arg.substr(interval_prefix.size()),
+                            &interval_ms)) {
+        std::cerr << "Invalid --interval-ms value\n";
+        return 1;
+      }
       continue;
     }
-    CaptureEntry entry = std::move(it->second);
-    pending.erase(it);
+    std::cerr << "Unknown netlog option: " << arg << "\n";
+    PrintNetLogUsage();
+    return 1;
+  }
+
+  g_stop_requested = 0;
+  std::signal(SIGINT, HandleStopSignal);
+  std::signal(SIGTERM, HandleStopSignal);
 
-    if (!try_capture_entry(&entry)) {
-      pending[request_id.toStdString()] = entry;
+  const std::string socket_path = TabSocketPath(user_data_dir);
+  while (!g_stop_requested) {
+    std::ostringstream command;
+    command << "netlog --since=" << since;
+    if (tab_id > 0) {
+      command << " --id=" << tab_id;
+    }
+    command << "\n";
+    std::string response;
+    if (!SendCommandCapture(socket_path, command.str(), &response)) {
+      return 1;
+    }
+    if (response.rfind("ERR", 0) == 0) {
+      std::cerr << response;
+      return 1;
+    }
+    const size_t header_end = response.find('\n');
+    const QJsonObject header =
+        QJsonDocument::fromJson(
+            QByteArray::fromStdString(response.substr(0, header_end)))
+            .object();
+    if (header.isEmpty()) {
+      std::cerr << "Unexpected netlog response\n";
+      return 1;
+    }
+    const long long last = header.value(QStringLiteral("last")).toInteger();
+    const long long dropped =
+        header.value(QStringLiteral("dropped")).toInteger();
+    if (dropped > 0) {
+      std::cerr << "netlog: " << dropped
+                << " requests were overwritten before they were read\n";
+    }
+    if (header_end != std::string::npos) {
+      std::cout << response.substr(header_end + 1) << std::flush;
+    }
+    // A smaller sequence than ours means the browser restarted.
+    since = last < since ? 0
+                         : header.value(QStringLiteral("next")).toInteger();
+    if (since < last) {
       continue;
     }
+    if (!follow) {
+      break;
+    }
+    usleep(static_cast<useconds_t>(interval_ms) * 1000);
   }
-  close(fd);
-  return g_stop_requested ? 0 : 1;
+  return 0;
 }
 
 }  // namespace rethread
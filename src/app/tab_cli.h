@@ -17,6 +17,20 @@ int RunDevToolsCli(int argc, char* argv[],
                    const std::string& default_user_data_dir);
 int RunNetworkLogCli(int argc, char* argv[],
                      const std::string& default_user_data_dir);
+int RunTopCli(int argc, char* argv[], const std::string& default_user_data_dir);
+int RunNetLogCli(int argc,
+                 char* argv[],
+                 const std::string& default_user_data_dir);
+int RunPerfCli(int argc, char* argv[], const std::string& default_user_data_dir);
+// Serves a network-log capture back to the browser over CDP.
+int RunReplayCli(int argc,
+                 char* argv[],
+                 const std::string& default_user_data_dir);
+// Supervises headless workers in profiles under |default_user_data_root|.
+int RunPoolCli(int argc,
+               char* argv[],
+               const std::string& default_user_data_root,
+               const std::string& browser_binary);
 
 std::string TabSocketPath(const std::string& user_data_dir);
 
@@ -1,27 +1,62 @@
 #include "browser/command_dispatcher.h"
 
+#include <algorithm>
 #include <cctype>
 #include <sstream>
 #include <string>
 
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QJsonArray>
 #include <QJsonDocument>
+#include <QJsonObject>
 #include <QJsonValue>
+#include <QRegularExpression>
 #include <QStringList>
 #include <QUrl>
 #include <QVariant>
 
 #include "browser/context_menu_binding_manager.h"
 #include "browser/key_binding_manager.h"
+#include "browser/net_log.h"
 #include "browser/rules_manager.h"
 #include "browser/script_manager.h"
 #include "browser/tab_manager.h"
 #include "browser/tab_strip_controller.h"
+#include "common/proc_stats.h"
 
 namespace rethread {
 namespace {
 
+// Per-tab budget for `eval --all` / `eval --match`; one hung tab must not
+// hold up the aggregated reply.
+constexpr int kEvalFanOutTimeoutMs = 10000;
+// `eval --wait-for` without --timeout-ms still gives up eventually.
+constexpr int kWaitForDefaultTimeoutMs = 30000;
+// Records per `netlog` reply unless --limit asks for fewer.
+constexpr int kNetLogDefaultLimit = 1000;
+
+bool ParseWaitCondition(const std::string& text,
+                        TabManager::PageCondition* condition,
+                        QString* selector) {
+  const std::string selector_prefix = "selector:";
+  if (text == "load") {
+    *condition = TabManager::PageCondition::kLoad;
+  } else if (text == "domcontentloaded") {
+    *condition = TabManager::PageCondition::kDomContentLoaded;
+  } else if (text == "networkidle") {
+    *condition = TabManager::PageCondition::kNetworkIdle;
+  } else if (text.rfind(selector_prefix, 0) == 0 &&
+             text.size() > selector_prefix.size()) {
+    *condition = TabManager::PageCondition::kSelector;
+    *selector = QString::fromStdString(text.substr(selector_prefix.size()));
+  } else {
+    return false;
+  }
+  return true;
+}
+
 std::string Trim(const std::string& input) {
   size_t start = input.find_first_not_of(" \t\r\n");
   if (start == std::string::npos) {
@@ -115,9 +150,18 @@ bool ParsePositiveInt(const std::string& text, int* value) {
   return true;
 }
 
+// Binary eval results (ArrayBuffer, typed arrays, Blob) arrive as
+// QByteArray; in JSON they are rendered as a base64 string.
+QJsonValue VariantToJsonValue(const QVariant& value) {
+  if (value.typeId() == QMetaType::QByteArray) {
+    return QString::fromLatin1(value.toByteArray().toBase64());
+  }
+  return QJsonValue::fromVariant(value);
+}
+
 QString VariantToJson(const QVariant& value) {
   QJsonArray wrapper;
-  wrapper.append(QJsonValue::fromVariant(value));
+  wrapper.append(VariantToJsonValue(value));
   QJsonDocument doc(wrapper);
   QByteArray raw = doc.toJson(QJsonDocument::Compact);
   if (raw.size() >= 2 && raw.front() == '[' && raw.back() == ']') {
@@ -126,16 +170,37 @@ QString VariantToJson(const QVariant& value) {
   return QStringLiteral("null");
 }
 
-QString ParseSwapToken(const QString& token,
-                       int active_index,
-                       int tab_count,
-                       int* index_out) {
+QString FormatEvalResult(const QVariant& result,
+                         bool raw_output,
+                         CommandOutput* output) {
+  // Raw bytes skip the QString/JSON round trip entirely and go to the
+  // socket in chunks; other result types still print as JSON.
+  if (raw_output && output &&
+      (result.typeId() == QMetaType::QByteArray ||
+       result.typeId() == QMetaType::QString)) {
+    const QByteArray bytes = result.typeId() == QMetaType::QByteArray
+                                 ? result.toByteArray()
+                                 : result.toString().toUtf8();
+    output->Write(bytes);
+    return QString();
+  }
+  return VariantToJson(result) + QChar('\n');
+}
+
+// "+N"/"-N" count from |offset_base|; "current" is always the active tab.
+QString ParseTabIndexToken(const QString& token,
+                           const char* verb,
+                           int active_index,
+                           int offset_base,
+                           int tab_count,
+                           int* index_out) {
   if (!index_out) {
-    return QStringLiteral("ERR internal swap error\n");
+    return QStringLiteral("ERR internal %1 error\n").arg(QLatin1String(verb));
   }
   const QString trimmed = token.trimmed();
   if (trimmed.isEmpty()) {
-    return QStringLiteral("ERR swap requires index arguments\n");
+    return QStringLiteral("ERR %1 requires index arguments\n")
+        .arg(QLatin1String(verb));
   }
   const QString lower = trimmed.toLower();
   if (lower == QStringLiteral("current") || lower == QStringLiteral("active")) {
@@ -147,12 +212,12 @@ QString ParseSwapToken(const QString& token,
     bool ok = false;
     int delta = trimmed.toInt(&ok);
     if (!ok) {
-      return QStringLiteral("ERR invalid swap offset\n");
+      return QStringLiteral("ERR invalid %1 offset\n").arg(QLatin1String(verb));
     }
     if (tab_count <= 0) {
       return QStringLiteral("ERR no tabs available\n");
     }
-    int target = (active_index + delta) % tab_count;
+    int target = (offset_base + delta) % tab_count;
     if (target < 0) {
       target += tab_count;
     }
@@ -162,15 +227,26 @@ QString ParseSwapToken(const QString& token,
   bool ok = false;
   int parsed = trimmed.toInt(&ok);
   if (!ok) {
-    return QStringLiteral("ERR invalid swap index\n");
+    return QStringLiteral("ERR invalid %1 index\n").arg(QLatin1String(verb));
   }
   if (parsed <= 0 || parsed > tab_count) {
-    return QStringLiteral("ERR swap index %1 out of range\n").arg(parsed);
+    return QStringLiteral("ERR %1 index %2 out of range\n")
+        .arg(QLatin1String(verb))
+        .arg(parsed);
   }
   *index_out = parsed - 1;
   return QString();
 }
 
+int ActiveSnapshotIndex(const QList<TabManager::TabSnapshot>& tabs) {
+  for (int i = 0; i < tabs.size(); ++i) {
+    if (tabs.at(i).active) {
+      return i;
+    }
+  }
+  return 0;
+}
+
 }  // namespace
 
 CommandDispatcher::CommandDispatcher(TabManager* tab_manager,
@@ -186,7 +262,8 @@ CommandDispatcher::CommandDispatcher(TabManager* tab_manager,
       script_manager_(script_manager),
       tab_strip_controller_(tab_strip_controller) {}
 
-QString CommandDispatcher::Execute(const QString& command) const {
+QString CommandDispatcher::Execute(const QString& command,
+                                   CommandOutput* output) const {
   const std::string trimmed = Trim(command.toStdString());
   if (trimmed.empty()) {
     return QStringLiteral("ERR empty command\n");
@@ -197,7 +274,12 @@ QString CommandDispatcher::Execute(const QString& command) const {
   stream >> op;
 
   if (op == "get" || op == "list") {
-    return HandleList();
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleList(QString::fromStdString(rest));
+  }
+  if (op == "stats") {
+    return HandleStats();
   }
   if (op == "switch") {
     int target_id = 0;
@@ -230,6 +312,26 @@ QString CommandDispatcher::Execute(const QString& command) const {
     std::getline(stream, rest);
     return HandleSwap(QString::fromStdString(rest));
   }
+  if (op == "move") {
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleMove(QString::fromStdString(rest));
+  }
+  if (op == "sort") {
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleSort(QString::fromStdString(rest));
+  }
+  if (op == "dedupe") {
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleDedupe(QString::fromStdString(rest));
+  }
+  if (op == "group") {
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleGroup(QString::fromStdString(rest));
+  }
   if (op == "bind") {
     std::string rest;
     std::getline(stream, rest);
@@ -260,6 +362,11 @@ QString CommandDispatcher::Execute(const QString& command) const {
     std::getline(stream, rest);
     return HandleDevToolsId(QString::fromStdString(rest));
   }
+  if (op == "netlog") {
+    std::string rest;
+    std::getline(stream, rest);
+    return HandleNetLog(QString::fromStdString(rest));
+  }
   if (op == "tabstrip") {
     std::string rest;
     std::getline(stream, rest);
@@ -268,19 +375,30 @@ QString CommandDispatcher::Execute(const QString& command) const {
   if (op == "eval") {
     std::string rest;
     std::getline(stream, rest);
-    return HandleEval(QString::fromStdString(rest));
+    return HandleEval(QString::fromStdString(rest), output);
   }
 
   return QStringLiteral("ERR unknown command\n");
 }
 
-QString CommandDispatcher::HandleList() const {
+QString CommandDispatcher::HandleList(const QString& args) const {
   if (!tab_manager_) {
     return QStringLiteral("ERR tab manager unavailable\n");
   }
+  bool include_processes = false;
+  for (const QString& token : args.split(QChar(' '), Qt::SkipEmptyParts)) {
+    if (token == QStringLiteral("--processes")) {
+      include_processes = true;
+      continue;
+    }
+    return QStringLiteral("ERR unknown list flag\n");
+  }
   auto tabs = tab_manager_->snapshot();
+  // Tabs frequently share a renderer, so read each /proc entry once.
+  QHash<qint64, qint64> rss_by_pid;
   std::ostringstream out;
-  out << "{\n  \"tabs\": [";
+  out << "{\n  \"group\": \"" << JsonEscape(tab_manager_->currentGroup())
+      << "\",\n  \"tabs\": [";
   for (int i = 0; i < tabs.size(); ++i) {
     const auto& tab = tabs.at(i);
     if (i == 0) {
@@ -289,7 +407,24 @@ QString CommandDispatcher::HandleList() const {
     out << "    {\"id\": " << tab.id << ", \"active\": "
         << (tab.active ? "true" : "false") << ", \"url\": \""
         << JsonEscape(tab.url) << "\", \"title\": \""
-        << JsonEscape(tab.title) << "\"}";
+        << JsonEscape(tab.title) << "\"";
+    if (include_processes) {
+      auto rss = rss_by_pid.constFind(tab.render_pid);
+      if (rss == rss_by_pid.constEnd()) {
+        uint64_t rss_bytes = 0;
+        const qint64 value = ReadProcessRssBytes(tab.render_pid, &rss_bytes)
+                                 ? static_cast<qint64>(rss_bytes)
+                                 : -1;
+        rss = rss_by_pid.insert(tab.render_pid, value);
+      }
+      out << ", \"pid\": " << tab.render_pid << ", \"rss_bytes\": ";
+      if (rss.value() < 0) {
+        out << "null";
+      } else {
+        out << rss.value();
+      }
+    }
+    out << "}";
     if (i + 1 < tabs.size()) {
       out << ",";
     }
@@ -299,6 +434,54 @@ QString CommandDispatcher::HandleList() const {
   return QString::fromStdString(out.str());
 }
 
+QString CommandDispatcher::HandleStats() const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tab manager unavailable\n");
+  }
+  const auto tabs = tab_manager_->statsSnapshot();
+  // CPU time is per renderer, so tabs sharing a process report the same
+  // counters; the client derives percentages from successive samples.
+  QHash<qint64, ProcessSample> samples;
+  QHash<qint64, bool> sample_ok;
+  std::ostringstream out;
+  out << "{\"clock_ticks_per_second\": " << ClockTicksPerSecond()
+      << ", \"tabs\": [";
+  for (int i = 0; i < tabs.size(); ++i) {
+    const auto& tab = tabs.at(i);
+    if (!sample_ok.contains(tab.render_pid)) {
+      ProcessSample sample;
+      sample_ok.insert(tab.render_pid,
+                       ReadProcessSample(tab.render_pid, &sample));
+      samples.insert(tab.render_pid, sample);
+    }
+    const bool have_sample = sample_ok.value(tab.render_pid);
+    const ProcessSample sample = samples.value(tab.render_pid);
+    if (i > 0) {
+      out << ", ";
+    }
+    out << "{\"id\": " << tab.id << ", \"active\": "
+        << (tab.active ? "true" : "false") << ", \"url\": \""
+        << JsonEscape(tab.url) << "\", \"title\": \""
+        << JsonEscape(tab.title) << "\", \"pid\": " << tab.render_pid
+        << ", \"cpu_ticks\": ";
+    if (have_sample) {
+      out << sample.cpu_ticks << ", \"rss_bytes\": " << sample.rss_bytes;
+    } else {
+      out << "null, \"rss_bytes\": null";
+    }
+    out << ", \"requests\": " << tab.request_count
+        << ", \"transfer_bytes\": ";
+    if (tab.transfer_bytes < 0) {
+      out << "null";
+    } else {
+      out << tab.transfer_bytes;
+    }
+    out << "}";
+  }
+  out << "]}\n";
+  return QString::fromStdString(out.str());
+}
+
 QString CommandDispatcher::HandleSwitch(int id) const {
   if (id <= 0 || !tab_manager_) {
     return QStringLiteral("ERR missing tab id\n");
@@ -403,29 +586,25 @@ QString CommandDispatcher::HandleSwap(const QString& args) const {
   if (tokens.size() < 1 || tokens.size() > 2) {
     return QStringLiteral("ERR swap expects one or two indexes\n");
   }
-  int active_index = 0;
-  for (int i = 0; i < tabs.size(); ++i) {
-    if (tabs.at(i).active) {
-      active_index = i;
-      break;
-    }
-  }
+  const int active_index = ActiveSnapshotIndex(tabs);
   int first_index = active_index;
   int second_index = -1;
   if (tokens.size() == 1) {
-    QString error =
-        ParseSwapToken(tokens.first(), active_index, tabs.size(), &second_index);
+    QString error = ParseTabIndexToken(tokens.first(), "swap", active_index,
+                                       active_index, tabs.size(),
+                                       &second_index);
     if (!error.isEmpty()) {
       return error;
     }
   } else {
-    QString error =
-        ParseSwapToken(tokens.at(0), active_index, tabs.size(), &first_index);
+    QString error = ParseTabIndexToken(tokens.at(0), "swap", active_index,
+                                       active_index, tabs.size(),
+                                       &first_index);
     if (!error.isEmpty()) {
       return error;
     }
-    error =
-        ParseSwapToken(tokens.at(1), active_index, tabs.size(), &second_index);
+    error = ParseTabIndexToken(tokens.at(1), "swap", active_index,
+                               active_index, tabs.size(), &second_index);
     if (!error.isEmpty()) {
       return error;
     }
@@ -439,6 +618,173 @@ QString CommandDispatcher::HandleSwap(const QString& args) const {
   return QString();
 }
 
+QString CommandDispatcher::HandleMove(const QString& args) const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tabs unavailable\n");
+  }
+  auto tabs = tab_manager_->snapshot();
+  if (tabs.isEmpty()) {
+    return QStringLiteral("ERR no tabs to move\n");
+  }
+  const QStringList tokens = args.trimmed().split(QChar(' '), Qt::SkipEmptyParts);
+  if (tokens.size() < 1 || tokens.size() > 2) {
+    return QStringLiteral("ERR move expects [from] <to>\n");
+  }
+  const int active_index = ActiveSnapshotIndex(tabs);
+  int from_index = active_index;
+  int to_index = -1;
+  if (tokens.size() == 2) {
+    QString error = ParseTabIndexToken(tokens.at(0), "move", active_index,
+                                       active_index, tabs.size(), &from_index);
+    if (!error.isEmpty()) {
+      return error;
+    }
+  }
+  // An offset destination is relative to the tab being moved.
+  QString error = ParseTabIndexToken(tokens.last(), "move", active_index,
+                                     from_index, tabs.size(), &to_index);
+  if (!error.isEmpty()) {
+    return error;
+  }
+  if (!tab_manager_->MoveTab(from_index, to_index)) {
+    return QStringLiteral("ERR failed to move tab\n");
+  }
+  return QString();
+}
+
+QString CommandDispatcher::HandleSort(const QString& args) const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tabs unavailable\n");
+  }
+  std::istringstream stream(args.toStdString());
+  std::string token;
+  std::string key_text = "url";
+  while (stream >> token) {
+    if (token == "--by") {
+      if (!(stream >> key_text)) {
+        return QStringLiteral("ERR sort requires a value after --by\n");
+      }
+      continue;
+    }
+    const std::string by_prefix = "--by=";
+    if (token.rfind(by_prefix, 0) == 0) {
+      key_text = token.substr(by_prefix.size());
+      continue;
+    }
+    return QStringLiteral("ERR unknown sort flag\n");
+  }
+  TabManager::TabSortKey key;
+  if (key_text == "url") {
+    key = TabManager::TabSortKey::kUrl;
+  } else if (key_text == "title") {
+    key = TabManager::TabSortKey::kTitle;
+  } else if (key_text == "host") {
+    key = TabManager::TabSortKey::kHost;
+  } else {
+    return QStringLiteral("ERR sort key must be url, title, or host\n");
+  }
+  if (!tab_manager_->SortTabs(key)) {
+    return QStringLiteral("ERR no tabs to sort\n");
+  }
+  return QString();
+}
+
+QString CommandDispatcher::HandleDedupe(const QString& args) const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tabs unavailable\n");
+  }
+  if (!args.trimmed().isEmpty()) {
+    return QStringLiteral("ERR dedupe takes no arguments\n");
+  }
+  const int removed = tab_manager_->DedupeTabs();
+  return QStringLiteral("Closed %1 duplicate tab(s)\n").arg(removed);
+}
+
+QString CommandDispatcher::HandleGroup(const QString& args) const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tabs unavailable\n");
+  }
+  std::istringstream stream(args.toStdString());
+  std::string action;
+  if (!(stream >> action) || action == "list") {
+    const auto groups = tab_manager_->groupSnapshot();
+    std::ostringstream out;
+    out << "{\n  \"groups\": [";
+    for (int i = 0; i < groups.size(); ++i) {
+      const auto& group = groups.at(i);
+      if (i == 0) {
+        out << "\n";
+      }
+      out << "    {\"name\": \"" << JsonEscape(group.name)
+          << "\", \"tabs\": " << group.tab_count << ", \"current\": "
+          << (group.current ? "true" : "false") << "}";
+      if (i + 1 < groups.size()) {
+        out << ",";
+      }
+      out << "\n";
+    }
+    out << "  ]\n}\n";
+    return QString::fromStdString(out.str());
+  }
+
+  std::string name;
+  bool discard = false;
+  std::string url_text;
+  std::string token;
+  while (stream >> token) {
+    if (token == "--discard") {
+      discard = true;
+      continue;
+    }
+    if (token == "--freeze") {
+      discard = false;
+      continue;
+    }
+    const std::string url_prefix = "--url=";
+    if (token.rfind(url_prefix, 0) == 0) {
+      url_text = token.substr(url_prefix.size());
+      continue;
+    }
+    if (token.rfind("--", 0) == 0) {
+      return QStringLiteral("ERR unknown group flag\n");
+    }
+    if (!name.empty()) {
+      return QStringLiteral("ERR group expects a single name\n");
+    }
+    name = token;
+  }
+  if (name.empty()) {
+    return QStringLiteral("ERR group %1 requires a name\n")
+        .arg(QString::fromStdString(action));
+  }
+  const QString group_name = QString::fromStdString(name);
+  const auto mode = discard ? TabManager::GroupSuspendMode::kDiscard
+                            : TabManager::GroupSuspendMode::kFreeze;
+
+  if (action == "switch") {
+    const QUrl url = url_text.empty()
+                         ? QUrl(QStringLiteral("about:blank"))
+                         : QUrl::fromUserInput(QString::fromStdString(url_text));
+    if (!tab_manager_->SwitchGroup(group_name, mode, url)) {
+      return QStringLiteral("ERR failed to switch group\n");
+    }
+    return QString();
+  }
+  if (action == "move") {
+    if (!tab_manager_->MoveActiveTabToGroup(group_name, mode)) {
+      return QStringLiteral("ERR failed to move tab to group\n");
+    }
+    return QString();
+  }
+  if (action == "close") {
+    if (!tab_manager_->CloseGroup(group_name)) {
+      return QStringLiteral("ERR unknown group\n");
+    }
+    return QString();
+  }
+  return QStringLiteral("ERR unknown group action\n");
+}
+
 QString CommandDispatcher::HandleHistoryBack() const {
   if (!tab_manager_) {
     return QStringLiteral("ERR failed to go back\n");
@@ -705,6 +1051,19 @@ QString CommandDispatcher::HandleDevToolsId(const QString& args) const {
   if (trimmed.isEmpty()) {
     return QStringLiteral("ERR missing tab id\n");
   }
+  if (trimmed == QStringLiteral("--all")) {
+    // One "<tab id> <devtools id>" line per tab, so a browser-wide CDP
+    // session can map targets back to tabs.
+    QString result;
+    for (const auto& tab : tab_manager_->snapshot()) {
+      const QString devtools_id = tab_manager_->DevToolsIdForTab(tab.id);
+      if (!devtools_id.isEmpty()) {
+        result += QString::number(tab.id) + QLatin1Char(' ') + devtools_id +
+                  QLatin1Char('\n');
+      }
+    }
+    return result;
+  }
   QStringList pieces = trimmed.split(QChar(' '), Qt::SkipEmptyParts);
   if (pieces.size() != 1) {
     return QStringLiteral("ERR devtools-id expects one tab id\n");
@@ -721,6 +1080,74 @@ QString CommandDispatcher::HandleDevToolsId(const QString& args) const {
   return devtools_id + QLatin1Char('\n');
 }
 
+QString CommandDispatcher::HandleNetLog(const QString& args) const {
+  if (!tab_manager_) {
+    return QStringLiteral("ERR tab manager unavailable\n");
+  }
+  quint64 since = 0;
+  int limit = kNetLogDefaultLimit;
+  int tab_id = 0;
+  for (const QString& token : args.split(QChar(' '), Qt::SkipEmptyParts)) {
+    bool ok = false;
+    if (token.startsWith(QStringLiteral("--since="))) {
+      since = token.mid(8).toULongLong(&ok);
+    } else if (token.startsWith(QStringLiteral("--limit="))) {
+      limit = token.mid(8).toInt(&ok);
+      ok = ok && limit > 0;
+    } else if (token.startsWith(QStringLiteral("--id="))) {
+      tab_id = token.mid(5).toInt(&ok);
+      ok = ok && tab_id > 0;
+    }
+    if (!ok) {
+      return QStringLiteral("ERR invalid netlog flag: %1\n").arg(token);
+    }
+  }
+  // One JSON object per line. The first gives the cursor to pass as the next
+  // --since and how many records after this --since were overwritten before
+  // they could be read.
+  const NetLog& net_log = tab_manager_->netLog();
+  quint64 dropped = 0;
+  const QList<NetLogRecord> records =
+      net_log.Since(since, std::min(limit, NetLog::kCapacity), &dropped);
+  QJsonObject header;
+  header.insert(QStringLiteral("next"),
+                static_cast<qint64>(
+                    records.isEmpty()
+                        ? std::min(since, net_log.lastSequence())
+                        : records.back().sequence));
+  header.insert(QStringLiteral("last"),
+                static_cast<qint64>(net_log.lastSequence()));
+  header.insert(QStringLiteral("dropped"), static_cast<qint64>(dropped));
+  QByteArray out = QJsonDocument(header).toJson(QJsonDocument::Compact);
+  out.append('\n');
+  for (const NetLogRecord& record : records) {
+    if (tab_id > 0 && record.tab_id != tab_id) {
+      continue;
+    }
+    QJsonObject line;
+    line.insert(QStringLiteral("seq"), static_cast<qint64>(record.sequence));
+    line.insert(QStringLiteral("time_ms"), record.time_ms);
+    line.insert(QStringLiteral("uptime_us"), record.uptime_us);
+    line.insert(QStringLiteral("tab"), record.tab_id);
+    line.insert(QStringLiteral("method"), QString::fromLatin1(record.method));
+    line.insert(QStringLiteral("url"), record.url.toString());
+    line.insert(QStringLiteral("type"),
+                QLatin1String(record.resource_type));
+    line.insert(QStringLiteral("navigation"),
+                QLatin1String(record.navigation_type));
+    if (!record.first_party.isEmpty()) {
+      line.insert(QStringLiteral("first_party"),
+                  record.first_party.toString());
+    }
+    if (!record.initiator.isEmpty()) {
+      line.insert(QStringLiteral("initiator"), record.initiator.toString());
+    }
+    out.append(QJsonDocument(line).toJson(QJsonDocument::Compact));
+    out.append('\n');
+  }
+  return QString::fromUtf8(out);
+}
+
 QString CommandDispatcher::HandleTabStrip(const QString& args) const {
   if (!tab_strip_controller_) {
     return QStringLiteral("ERR tab strip unavailable\n");
@@ -803,14 +1230,53 @@ QString CommandDispatcher::HandleTabStrip(const QString& args) const {
   return QStringLiteral("ERR unknown tabstrip action\n");
 }
 
-QString CommandDispatcher::HandleEval(const QString& args) const {
+QString CommandDispatcher::HandleEval(const QString& args,
+                                     CommandOutput* output) const {
   if (!tab_manager_) {
     return QStringLiteral("ERR tabs unavailable\n");
   }
   std::istringstream stream(args.toStdString());
   std::string token;
+  {
+    std::istringstream peek(args.toStdString());
+    std::string action;
+    peek >> action;
+    if (action == "pending" || action == "cancel" || action == "register" ||
+        action == "unregister" || action == "list") {
+      std::string rest;
+      std::getline(peek, rest);
+      return HandleEvalControl(QString::fromStdString(action),
+                               QString::fromStdString(Trim(rest)));
+    }
+  }
+  // `call NAME` takes the same tab flags as a plain eval, with --args in
+  // place of --code.
+  std::string call_name;
+  {
+    std::istringstream peek(args.toStdString());
+    std::string action;
+    peek >> action;
+    if (action == "call") {
+      stream >> action;
+      if (!(stream >> call_name) || call_name.rfind("--", 0) == 0) {
+        return QStringLiteral("ERR eval call requires a script name\n");
+      }
+    }
+  }
+  std::string call_args_hex;
   int tab_id = 0;
   int tab_index = 0;
+  int timeout_ms = 0;
+  bool all_tabs = false;
+  bool raw_output = false;
+  bool stream_output = false;
+  bool wait_for = false;
+  TabManager::PageCondition wait_condition =
+      TabManager::PageCondition::kLoad;
+  QString wait_selector;
+  TabManager::EvalWorld world = TabManager::EvalWorld::kMain;
+  std::string match_pattern;
+  std::string open_url;
   std::string code_hex;
   while (stream >> token) {
     if (token == "--tab-id") {
@@ -853,35 +1319,359 @@ QString CommandDispatcher::HandleEval(const QString& args) const {
       code_hex = token.substr(code_prefix.size());
       continue;
     }
+    const std::string args_prefix = "--args=";
+    if (token.rfind(args_prefix, 0) == 0) {
+      call_args_hex = token.substr(args_prefix.size());
+      continue;
+    }
+    if (token == "--all") {
+      all_tabs = true;
+      continue;
+    }
+    if (token == "--raw-output") {
+      raw_output = true;
+      continue;
+    }
+    if (token == "--stream") {
+      stream_output = true;
+      continue;
+    }
+    if (token == "--world=main") {
+      world = TabManager::EvalWorld::kMain;
+      continue;
+    }
+    if (token == "--world=isolated") {
+      world = TabManager::EvalWorld::kIsolated;
+      continue;
+    }
+    const std::string timeout_prefix = "--timeout-ms=";
+    if (token.rfind(timeout_prefix, 0) == 0) {
+      if (!ParsePositiveInt(token.substr(timeout_prefix.size()),
+                            &timeout_ms)) {
+        return QStringLiteral("ERR invalid --timeout-ms value\n");
+      }
+      continue;
+    }
+    // Hex-encoded because selectors may contain spaces.
+    const std::string wait_prefix = "--wait-for=";
+    if (token.rfind(wait_prefix, 0) == 0) {
+      std::string condition;
+      if (!DecodeHex(token.substr(wait_prefix.size()), &condition) ||
+          !ParseWaitCondition(condition, &wait_condition, &wait_selector)) {
+        return QStringLiteral("ERR invalid --wait-for value\n");
+      }
+      wait_for = true;
+      continue;
+    }
+    const std::string open_prefix = "--open=";
+    if (token.rfind(open_prefix, 0) == 0) {
+      if (!DecodeHex(token.substr(open_prefix.size()), &open_url) ||
+          Trim(open_url).empty()) {
+        return QStringLiteral("ERR invalid --open value\n");
+      }
+      continue;
+    }
+    // The pattern is hex-encoded like the code so it may contain spaces.
+    const std::string match_prefix = "--match=";
+    if (token.rfind(match_prefix, 0) == 0) {
+      if (!DecodeHex(token.substr(match_prefix.size()), &match_pattern) ||
+          match_pattern.empty()) {
+        return QStringLiteral("ERR invalid --match value\n");
+      }
+      continue;
+    }
     if (token.empty()) {
       continue;
     }
     return QStringLiteral("ERR unknown eval flag\n");
   }
 
-  if (code_hex.empty()) {
-    return QStringLiteral("ERR missing eval payload\n");
-  }
-  if (tab_id > 0 && tab_index > 0) {
+  const int selector_count = (tab_id > 0 ? 1 : 0) + (tab_index > 0 ? 1 : 0) +
+                             (all_tabs ? 1 : 0) +
+                             (match_pattern.empty() ? 0 : 1) +
+                             (open_url.empty() ? 0 : 1);
+  if (selector_count > 1) {
     return QStringLiteral("ERR specify only one tab selector\n");
   }
 
+  if (stream_output && !output) {
+    return QStringLiteral("ERR --stream needs a streaming connection\n");
+  }
+  if (stream_output && (all_tabs || !match_pattern.empty())) {
+    return QStringLiteral("ERR --stream needs a single tab\n");
+  }
+  if (call_name.empty() && code_hex.empty()) {
+    return QStringLiteral("ERR missing eval payload\n");
+  }
+  if (wait_for && (all_tabs || !match_pattern.empty())) {
+    return QStringLiteral("ERR --wait-for needs a single tab\n");
+  }
+  // Everything the payload can get wrong is checked here, before --open
+  // spends a page load on a command that was never going to run.
+  QString args_json;
   std::string decoded;
-  if (!DecodeHex(code_hex, &decoded)) {
+  if (!call_name.empty()) {
+    if (!code_hex.empty()) {
+      return QStringLiteral("ERR eval call takes --args, not --code\n");
+    }
+    if (all_tabs || !match_pattern.empty()) {
+      return QStringLiteral("ERR eval call needs a single tab\n");
+    }
+    std::string call_args;
+    if (!DecodeHex(call_args_hex, &call_args)) {
+      return QStringLiteral("ERR invalid --args encoding\n");
+    }
+    args_json = QString::fromStdString(Trim(call_args));
+    if (!args_json.isEmpty()) {
+      // Wrapping in an array lets scalars through QJsonDocument as well.
+      QJsonParseError parse_error;
+      const QJsonDocument doc = QJsonDocument::fromJson(
+          QStringLiteral("[%1]").arg(args_json).toUtf8(), &parse_error);
+      if (parse_error.error != QJsonParseError::NoError ||
+          doc.array().size() != 1) {
+        return QStringLiteral("ERR eval call args must be one JSON value\n");
+      }
+    }
+  } else if (!DecodeHex(code_hex, &decoded)) {
     return QStringLiteral("ERR invalid eval payload encoding\n");
   }
+  if (raw_output && (all_tabs || !match_pattern.empty())) {
+    return QStringLiteral("ERR --raw-output needs a single tab\n");
+  }
+  // --open makes the eval a self-contained job: a background tab that only
+  // lives for this command, which is what lets a pool route it anywhere.
+  struct OpenedTab {
+    TabManager* tab_manager = nullptr;
+    int id = 0;
+    ~OpenedTab() {
+      // The last tab stays, since closing it would quit the browser.
+      if (id > 0 && tab_manager->snapshot().size() > 1) {
+        tab_manager->closeById(id);
+      }
+    }
+  } opened_tab{tab_manager_, 0};
+  if (!open_url.empty()) {
+    opened_tab.id = tab_manager_->openTab(
+        QUrl::fromUserInput(QString::fromStdString(Trim(open_url))), false,
+        true);
+    if (opened_tab.id <= 0) {
+      return QStringLiteral("ERR failed to open tab\n");
+    }
+    tab_id = opened_tab.id;
+    if (!wait_for) {
+      wait_for = true;
+      wait_condition = TabManager::PageCondition::kLoad;
+    }
+  }
+  // The wait and the script share one --timeout-ms budget, and the script
+  // runs in the tab the wait resolved even if the active tab changes.
+  if (wait_for) {
+    QString wait_error;
+    tab_id = tab_manager_->ResolveEvalTabId(tab_id, tab_index, &wait_error);
+    tab_index = 0;
+    if (tab_id <= 0) {
+      return QStringLiteral("ERR %1\n").arg(wait_error);
+    }
+    QElapsedTimer waited;
+    waited.start();
+    if (!tab_manager_->WaitForPageCondition(
+            tab_id, wait_condition, wait_selector,
+            timeout_ms > 0 ? timeout_ms : kWaitForDefaultTimeoutMs, world,
+            &wait_error)) {
+      return QStringLiteral("ERR %1\n").arg(wait_error);
+    }
+    if (timeout_ms > 0) {
+      timeout_ms = static_cast<int>(
+          std::max<qint64>(1, timeout_ms - waited.elapsed()));
+    }
+  }
+  // Each chunk goes out as soon as the page yields it: one JSON line, or
+  // the bytes themselves with --raw-output.
+  TabManager::EvalChunkCallback on_chunk;
+  if (stream_output) {
+    on_chunk = [output, raw_output](const QVariant& chunk,
+                                    const TabManager::EvalChunkAck& ack) {
+      bool written = false;
+      if (raw_output && (chunk.typeId() == QMetaType::QByteArray ||
+                         chunk.typeId() == QMetaType::QString)) {
+        written = output->Write(chunk.typeId() == QMetaType::QByteArray
+                                    ? chunk.toByteArray()
+                                    : chunk.toString().toUtf8());
+      } else {
+        written =
+            output->Write((VariantToJson(chunk) + QChar('\n')).toUtf8());
+      }
+      if (written) {
+        output->WhenDrained(ack);
+      }
+      return written;
+    };
+  }
 
   QVariant result;
   QString error_message;
+  if (!call_name.empty()) {
+    if (!tab_manager_->CallEvalScript(QString::fromStdString(call_name),
+                                      args_json, tab_id, tab_index, timeout_ms,
+                                      world, on_chunk, &result,
+                                      &error_message)) {
+      if (!error_message.isEmpty()) {
+        return QStringLiteral("ERR %1\n").arg(error_message);
+      }
+      return QStringLiteral("ERR failed to evaluate script\n");
+    }
+    if (stream_output) {
+      return QString();
+    }
+    return FormatEvalResult(result, raw_output, output);
+  }
+
+  if (all_tabs || !match_pattern.empty()) {
+    return HandleEvalFanOut(
+        QString::fromUtf8(decoded.c_str(), static_cast<int>(decoded.size())),
+        QString::fromStdString(match_pattern),
+        timeout_ms > 0 ? timeout_ms : kEvalFanOutTimeoutMs,
+        world == TabManager::EvalWorld::kIsolated);
+  }
+
   if (!tab_manager_->EvaluateJavaScript(
           QString::fromUtf8(decoded.c_str(), static_cast<int>(decoded.size())),
-          tab_id, tab_index, &result, &error_message)) {
+          tab_id, tab_index, timeout_ms, world, on_chunk, &result,
+          &error_message)) {
     if (!error_message.isEmpty()) {
       return QStringLiteral("ERR %1\n").arg(error_message);
     }
     return QStringLiteral("ERR failed to evaluate script\n");
   }
-  return VariantToJson(result) + QChar('\n');
+  if (stream_output) {
+    return QString();
+  }
+  return FormatEvalResult(result, raw_output, output);
+}
+
+QString CommandDispatcher::HandleEvalFanOut(const QString& script,
+                                            const QString& url_pattern,
+                                            int timeout_ms,
+                                            bool isolated_world) const {
+  QRegularExpression matcher;
+  if (!url_pattern.isEmpty()) {
+    matcher.setPattern(url_pattern);
+    if (!matcher.isValid()) {
+      return QStringLiteral("ERR invalid --match regex: %1\n")
+          .arg(matcher.errorString());
+    }
+  }
+  QList<int> tab_ids;
+  QHash<int, QString> urls;
+  for (const auto& tab : tab_manager_->snapshot()) {
+    if (!url_pattern.isEmpty() && !matcher.match(tab.url).hasMatch()) {
+      continue;
+    }
+    tab_ids.append(tab.id);
+    urls.insert(tab.id, tab.url);
+  }
+
+  const auto outcomes = tab_manager_->EvaluateJavaScriptInTabs(
+      script, tab_ids, timeout_ms,
+      isolated_world ? TabManager::EvalWorld::kIsolated
+                     : TabManager::EvalWorld::kMain);
+  QJsonArray results;
+  for (const auto& outcome : outcomes) {
+    QJsonObject entry;
+    entry.insert(QStringLiteral("id"), outcome.tab_id);
+    entry.insert(QStringLiteral("url"), urls.value(outcome.tab_id));
+    entry.insert(QStringLiteral("ok"), outcome.success);
+    if (outcome.success) {
+      entry.insert(QStringLiteral("value"), VariantToJsonValue(outcome.value));
+    } else {
+      entry.insert(QStringLiteral("error"), outcome.error);
+    }
+    results.append(entry);
+  }
+  return QString::fromUtf8(QJsonDocument(results).toJson(
+             QJsonDocument::Compact)) +
+         QChar('\n');
+}
+
+QString CommandDispatcher::HandleEvalControl(const QString& action,
+                                             const QString& args) const {
+  if (action == QStringLiteral("register")) {
+    std::istringstream stream(args.toStdString());
+    std::string token;
+    std::string name;
+    std::string code_hex;
+    while (stream >> token) {
+      const std::string name_prefix = "--name=";
+      const std::string code_prefix = "--code=";
+      if (token.rfind(name_prefix, 0) == 0) {
+        name = token.substr(name_prefix.size());
+      } else if (token.rfind(code_prefix, 0) == 0) {
+        code_hex = token.substr(code_prefix.size());
+      } else {
+        return QStringLiteral("ERR unknown eval register flag\n");
+      }
+    }
+    if (name.empty()) {
+      return QStringLiteral("ERR eval register requires --name\n");
+    }
+    std::string decoded;
+    if (code_hex.empty() || !DecodeHex(code_hex, &decoded)) {
+      return QStringLiteral("ERR invalid eval payload encoding\n");
+    }
+    tab_manager_->RegisterEvalScript(
+        QString::fromStdString(name),
+        QString::fromUtf8(decoded.c_str(), static_cast<int>(decoded.size())));
+    return QString();
+  }
+  if (action == QStringLiteral("unregister")) {
+    if (args.isEmpty()) {
+      return QStringLiteral("ERR eval unregister requires a script name\n");
+    }
+    if (!tab_manager_->UnregisterEvalScript(args)) {
+      return QStringLiteral("ERR no registered script named %1\n").arg(args);
+    }
+    return QString();
+  }
+  if (action == QStringLiteral("list")) {
+    QJsonArray scripts;
+    for (const auto& info : tab_manager_->registeredEvalScripts()) {
+      QJsonObject entry;
+      entry.insert(QStringLiteral("name"), info.name);
+      entry.insert(QStringLiteral("bytes"), info.source_bytes);
+      scripts.append(entry);
+    }
+    return QString::fromUtf8(
+               QJsonDocument(scripts).toJson(QJsonDocument::Compact)) +
+           QChar('\n');
+  }
+  if (action == QStringLiteral("cancel")) {
+    bool ok = false;
+    const int eval_id = args.toInt(&ok);
+    if (!ok || eval_id <= 0) {
+      return QStringLiteral("ERR eval cancel requires an eval id\n");
+    }
+    if (!tab_manager_->CancelEval(eval_id)) {
+      return QStringLiteral("ERR no pending eval with id %1\n").arg(eval_id);
+    }
+    return QString();
+  }
+  if (!args.isEmpty()) {
+    return QStringLiteral("ERR eval pending takes no arguments\n");
+  }
+  QJsonArray pending;
+  for (const auto& info : tab_manager_->pendingEvals()) {
+    QJsonObject entry;
+    entry.insert(QStringLiteral("id"), info.id);
+    entry.insert(QStringLiteral("tab_id"), info.tab_id);
+    entry.insert(QStringLiteral("elapsed_ms"), info.elapsed_ms);
+    entry.insert(QStringLiteral("timeout_ms"), info.timeout_ms);
+    entry.insert(QStringLiteral("awaiting_promise"), info.awaiting_promise);
+    entry.insert(QStringLiteral("script"), info.script_preview);
+    pending.append(entry);
+  }
+  return QString::fromUtf8(
+             QJsonDocument(pending).toJson(QJsonDocument::Compact)) +
+         QChar('\n');
 }
 
 QString CommandDispatcher::HandleScripts(const QString& args) const {
@@ -911,7 +1701,9 @@ QString CommandDispatcher::HandleScripts(const QString& args) const {
         out << "\n";
       }
       out << "    {\"id\": \"" << JsonEscape(entry.id) << "\", "
-          << "\"path\": \"" << JsonEscape(entry.path) << "\"}";
+          << "\"path\": \"" << JsonEscape(entry.path) << "\", "
+          << "\"world\": \""
+          << (entry.isolated_world ? "isolated" : "main") << "\"}";
       if (i + 1 < scripts.size()) {
         out << ",";
       }
@@ -957,6 +1749,7 @@ QString CommandDispatcher::HandleScripts(const QString& args) const {
     QString id;
     QString match;
     QString run_at;
+    bool isolated_world = false;
     bool stylesheet = false;
     std::string code_hex;
     std::istringstream add_stream(rest);
@@ -1002,6 +1795,10 @@ QString CommandDispatcher::HandleScripts(const QString& args) const {
         run_at = QString::fromStdString(token.substr(run_at_prefix.size()));
         continue;
       }
+      if (token == "--world=main" || token == "--world=isolated") {
+        isolated_world = token == "--world=isolated";
+        continue;
+      }
       const std::string code_prefix = "--code=";
       if (token == "--code") {
         if (!(add_stream >> token)) {
@@ -1031,7 +1828,7 @@ QString CommandDispatcher::HandleScripts(const QString& args) const {
     QString error;
     if (!script_manager_->AddScript(
             id, QByteArray::fromStdString(decoded), stylesheet, match, run_at,
-            &error)) {
+            isolated_world, &error)) {
       if (error.isEmpty()) {
         return QStringLiteral("ERR failed to add script\n");
       }
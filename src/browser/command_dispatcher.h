@@ -1,6 +1,9 @@
 #ifndef RETHREAD_BROWSER_COMMAND_DISPATCHER_H_
 #define RETHREAD_BROWSER_COMMAND_DISPATCHER_H_
 
+#include <functional>
+
+#include <QByteArray>
 #include <QString>
 
 namespace rethread {
@@ -12,6 +15,19 @@ class ScriptManager;
 class TabManager;
 class TabStripController;
 
+// Byte sink for commands that stream a large reply instead of returning it
+// as a QString. Neither call blocks: Write queues the bytes and returns false
+// once the peer has gone away or stopped reading, and producers that can
+// wait pace themselves with WhenDrained.
+class CommandOutput {
+ public:
+  virtual ~CommandOutput() = default;
+  virtual bool Write(const QByteArray& data) = 0;
+  // Runs |done| with true once the queued bytes are down to a small backlog,
+  // possibly right away, or with false if the peer disconnects or stalls.
+  virtual void WhenDrained(std::function<void(bool)> done) = 0;
+};
+
 class CommandDispatcher {
  public:
   CommandDispatcher(TabManager* tab_manager,
@@ -21,10 +37,14 @@ class CommandDispatcher {
                     ScriptManager* script_manager,
                     TabStripController* tab_strip_controller);
 
-  QString Execute(const QString& command) const;
+  // |output|, when given, lets a command stream raw bytes ahead of (or
+  // instead of) the returned text.
+  QString Execute(const QString& command,
+                  CommandOutput* output = nullptr) const;
 
  private:
-  QString HandleList() const;
+  QString HandleList(const QString& args) const;
+  QString HandleStats() const;
   QString HandleSwitch(int id) const;
   QString HandleCycle(int delta) const;
   QString HandleClose(const QString& index_text) const;
@@ -34,11 +54,21 @@ class CommandDispatcher {
   QString HandleBind(const QString& args) const;
   QString HandleUnbind(const QString& args) const;
   QString HandleSwap(const QString& args) const;
+  QString HandleMove(const QString& args) const;
+  QString HandleSort(const QString& args) const;
+  QString HandleDedupe(const QString& args) const;
+  QString HandleGroup(const QString& args) const;
   QString HandleTabStrip(const QString& args) const;
-  QString HandleEval(const QString& args) const;
+  QString HandleEval(const QString& args, CommandOutput* output) const;
+  QString HandleEvalFanOut(const QString& script,
+                           const QString& url_pattern,
+                           int timeout_ms,
+                           bool isolated_world) const;
+  QString HandleEvalControl(const QString& action, const QString& args) const;
   QString HandleRules(const QString& args) const;
   QString HandleDevTools(const QString& args) const;
   QString HandleDevToolsId(const QString& args) const;
+  QString HandleNetLog(const QString& args) const;
   QString HandleScripts(const QString& args) const;
 
   TabManager* tab_manager_;
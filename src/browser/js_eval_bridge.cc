@@ -12,8 +12,8 @@ void JsEvalBridge::Reject(int request_id, const QString& error_message) {
   emit EvalCompleted(request_id, false, QVariant(), error_message);
 }
 
-void JsEvalBridge::NotifyReady() {
-  emit Ready();
+void JsEvalBridge::Yield(int request_id, const QVariant& chunk) {
+  emit EvalChunk(request_id, chunk);
 }
 
 }  // namespace rethread
@@ -21,8 +21,8 @@ class JsEvalBridge : public QObject {
                      const QVariant& result,
                      const QString& error);
 
-  // Emitted when the JS helper notifies that the transport is ready.
-  void Ready();
+  // Emitted for each chunk a streaming eval produces, in order.
+  void EvalChunk(int request_id, const QVariant& chunk);
 
  public slots:
   // Called from JS when evaluation succeeds.
@@ -31,8 +31,9 @@ class JsEvalBridge : public QObject {
   // Called from JS when evaluation throws/rejects.
   void Reject(int request_id, const QString& error_message);
 
-  // Called from JS after the helper script wires up the WebChannel.
-  void NotifyReady();
+  // Called from JS for every value a streamed iterator produces; the page
+  // waits for acknowledgements before producing more.
+  void Yield(int request_id, const QVariant& chunk);
 };
 
 }  // namespace rethread
@@ -0,0 +1,31 @@
+#include "browser/net_log.h"
+
+#include <algorithm>
+
+namespace rethread {
+
+NetLog::NetLog() : slots_(kCapacity) {}
+
+void NetLog::Record(NetLogRecord record) {
+  record.sequence = next_sequence_++;
+  slots_[record.sequence % kCapacity] = std::move(record);
+}
+
+QList<NetLogRecord> NetLog::Since(quint64 after,
+                                  int limit,
+                                  quint64* dropped) const {
+  const quint64 oldest =
+      next_sequence_ > kCapacity ? next_sequence_ - kCapacity : 1;
+  const quint64 first = std::max(after + 1, oldest);
+  if (dropped) {
+    *dropped = first - (after + 1);
+  }
+  QList<NetLogRecord> records;
+  for (quint64 sequence = first;
+       sequence < next_sequence_ && records.size() < limit; ++sequence) {
+    records.append(slots_[sequence % kCapacity]);
+  }
+  return records;
+}
+
+}  // namespace rethread
@@ -0,0 +1,54 @@
+#ifndef RETHREAD_BROWSER_NET_LOG_H_
+#define RETHREAD_BROWSER_NET_LOG_H_
+
+#include <vector>
+
+#include <QByteArray>
+#include <QList>
+#include <QUrl>
+#include <QtGlobal>
+
+namespace rethread {
+
+// What the request interceptor sees of a request as it starts. Interceptors
+// are not told about responses, so there is no status or completion time.
+struct NetLogRecord {
+  quint64 sequence = 0;
+  qint64 time_ms = 0;
+  // Monotonic, for intervals that survive wall-clock changes.
+  qint64 uptime_us = 0;
+  int tab_id = 0;
+  QByteArray method;
+  QUrl url;
+  QUrl first_party;
+  QUrl initiator;
+  // Static strings, so recording does not allocate for them.
+  const char* resource_type = "";
+  const char* navigation_type = "";
+};
+
+// Fixed-size ring of the most recent requests across all tabs. Recording
+// only moves a record into a preallocated slot; readers page through it by
+// sequence number, so each client keeps its own cursor. Interceptors and
+// the IPC server both run on the UI thread, so no locking is involved.
+class NetLog {
+ public:
+  static constexpr int kCapacity = 8192;
+
+  NetLog();
+
+  void Record(NetLogRecord record);
+
+  // Up to |limit| records with a sequence above |after|, oldest first.
+  // |dropped| is set to how many such records were already overwritten.
+  QList<NetLogRecord> Since(quint64 after, int limit, quint64* dropped) const;
+  quint64 lastSequence() const { return next_sequence_ - 1; }
+
+ private:
+  std::vector<NetLogRecord> slots_;
+  quint64 next_sequence_ = 1;
+};
+
+}  // namespace rethread
+
+#endif  // RETHREAD_BROWSER_NET_LOG_H_
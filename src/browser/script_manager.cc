@@ -38,6 +38,27 @@ bool StartsWithUserScriptHeader(const QByteArray& data) {
          data.mid(offset).startsWith("// ==UserScript==");
 }
 
+// Follows the Violentmonkey convention: `@inject-into content` keeps the
+// script away from page globals, which for us means the ApplicationWorld.
+bool HeaderRequestsIsolatedWorld(const QByteArray& data) {
+  const int end = data.indexOf("// ==/UserScript==");
+  if (end < 0) {
+    return false;
+  }
+  const QList<QByteArray> lines = data.left(end).split('\n');
+  for (const QByteArray& line : lines) {
+    const QByteArray trimmed = line.trimmed();
+    if (!trimmed.startsWith("//")) {
+      continue;
+    }
+    const QList<QByteArray> parts = trimmed.mid(2).simplified().split(' ');
+    if (parts.size() >= 2 && parts.at(0) == "@inject-into") {
+      return parts.at(1) == "content";
+    }
+  }
+  return false;
+}
+
 QString JsonQuote(const QString& text) {
   QJsonArray wrapper;
   wrapper.append(text);
@@ -85,6 +106,7 @@ bool ScriptManager::AddScript(const QString& id,
                               bool stylesheet,
                               const QString& match_pattern,
                               const QString& run_at_hint,
+                              bool isolated_world,
                               QString* error_message) {
   if (!IsValidScriptId(id)) {
     if (error_message) {
@@ -113,8 +135,8 @@ bool ScriptManager::AddScript(const QString& id,
     if (run_at.isEmpty()) {
       return false;
     }
-    final_source =
-        BuildUserscript(id, source, stylesheet, trimmed_match, run_at);
+    final_source = BuildUserscript(id, source, stylesheet, trimmed_match,
+                                   run_at, isolated_world);
     if (final_source.isEmpty()) {
       return false;
     }
@@ -169,6 +191,7 @@ bool ScriptManager::RemoveScript(const QString& id,
     return false;
   }
   script_paths_.remove(id);
+  script_isolated_.remove(id);
   return true;
 }
 
@@ -179,6 +202,7 @@ std::vector<ScriptInfo> ScriptManager::ListScripts() const {
     ScriptInfo info;
     info.id = it.key();
     info.path = it.value();
+    info.isolated_world = script_isolated_.value(it.key());
     entries.push_back(info);
   }
   return entries;
@@ -229,14 +253,23 @@ bool ScriptManager::RegisterScript(const QString& id,
     collection->remove(script);
   }
 
+  bool isolated_world = false;
+  QFile file(path);
+  if (file.open(QIODevice::ReadOnly)) {
+    isolated_world = HeaderRequestsIsolatedWorld(file.readAll());
+    file.close();
+  }
+
   QWebEngineScript script;
   script.setSourceUrl(QUrl::fromLocalFile(path));
   script.setName(id);
-  script.setWorldId(QWebEngineScript::MainWorld);
+  script.setWorldId(isolated_world ? QWebEngineScript::ApplicationWorld
+                                   : QWebEngineScript::MainWorld);
   script.setRunsOnSubFrames(true);
 
   collection->insert(script);
   script_paths_.insert(id, path);
+  script_isolated_.insert(id, isolated_world);
   return true;
 }
 
@@ -253,6 +286,7 @@ void ScriptManager::RemoveFromProfile(const QString& id) {
     collection->remove(script);
   }
   script_paths_.remove(id);
+  script_isolated_.remove(id);
 }
 
 bool ScriptManager::IsValidScriptId(const QString& id) {
@@ -291,12 +325,16 @@ QByteArray ScriptManager::BuildUserscript(const QString& id,
                                           const QByteArray& source,
                                           bool stylesheet,
                                           const QString& match_pattern,
-                                          const QString& run_at) const {
+                                          const QString& run_at,
+                                          bool isolated_world) const {
   QStringList header_lines;
   header_lines << QStringLiteral("// ==UserScript==");
   header_lines << QStringLiteral("// @name     rethread: %1").arg(id);
   header_lines << QStringLiteral("// @match    %1").arg(match_pattern);
   header_lines << QStringLiteral("// @run-at   %1").arg(run_at);
+  if (isolated_world) {
+    header_lines << QStringLiteral("// @inject-into content");
+  }
   header_lines << QStringLiteral("// ==/UserScript==");
 
   QByteArray result = header_lines.join(QLatin1Char('\n')).toUtf8();
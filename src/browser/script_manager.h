@@ -14,6 +14,7 @@ namespace rethread {
 struct ScriptInfo {
   QString id;
   QString path;
+  bool isolated_world = false;
 };
 
 class ScriptManager {
@@ -28,6 +29,7 @@ class ScriptManager {
                  bool stylesheet,
                  const QString& match_pattern,
                  const QString& run_at_hint,
+                 bool isolated_world,
                  QString* error_message);
 
   bool RemoveScript(const QString& id, QString* error_message);
@@ -51,11 +53,13 @@ class ScriptManager {
                              const QByteArray& source,
                              bool stylesheet,
                              const QString& match_pattern,
-                             const QString& run_at) const;
+                             const QString& run_at,
+                             bool isolated_world) const;
 
   QWebEngineProfile* profile_;
   QString user_data_dir_;
   QMap<QString, QString> script_paths_;
+  QMap<QString, bool> script_isolated_;
 };
 
 }  // namespace rethread
@@ -1,16 +1,100 @@
 #include "browser/tab_ipc_server.h"
 
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include <QByteArray>
 #include <QFile>
 #include <QLocalServer>
 #include <QLocalSocket>
+#include <QPointer>
+#include <QTimer>
 
 #include "browser/command_dispatcher.h"
 #include "common/debug_log.h"
 
 namespace rethread {
+namespace {
+
+// Above this, WhenDrained holds producers back until the socket catches up.
+constexpr qint64 kMaxBufferedOutputBytes = 1024 * 1024;
+// A write finding this much still queued fails instead of growing further.
+constexpr qint64 kOutputBacklogLimitBytes = 64 * 1024 * 1024;
+constexpr int kOutputDrainTimeoutMs = 30000;
+
+// Streams command output straight to the client socket. Nothing waits on
+// the socket here: bytes go into Qt's write buffer and drain from the event
+// loop, while WhenDrained callers are released from bytesWritten.
+class SocketCommandOutput : public CommandOutput {
+ public:
+  explicit SocketCommandOutput(QLocalSocket* socket) : socket_(socket) {
+    QObject::connect(socket_, &QLocalSocket::bytesWritten, &context_,
+                     [this]() { Release(); });
+    QObject::connect(socket_, &QLocalSocket::disconnected, &context_,
+                     [this]() { Release(); });
+    drain_timer_.setSingleShot(true);
+    drain_timer_.setInterval(kOutputDrainTimeoutMs);
+    QObject::connect(&drain_timer_, &QTimer::timeout, &context_,
+                     [this]() { Notify(false); });
+  }
+
+  bool Write(const QByteArray& data) override {
+    if (!Connected() || socket_->bytesToWrite() > kOutputBacklogLimitBytes) {
+      return false;
+    }
+    return socket_->write(data) == data.size();
+  }
+
+  void WhenDrained(std::function<void(bool)> done) override {
+    if (!Connected()) {
+      done(false);
+      return;
+    }
+    if (socket_->bytesToWrite() <= kMaxBufferedOutputBytes) {
+      done(true);
+      return;
+    }
+    waiters_.push_back(std::move(done));
+    if (!drain_timer_.isActive()) {
+      drain_timer_.start();
+    }
+  }
+
+ private:
+  bool Connected() const {
+    return socket_ && socket_->state() == QLocalSocket::ConnectedState;
+  }
+
+  void Release() {
+    if (!Connected()) {
+      Notify(false);
+    } else if (socket_->bytesToWrite() <= kMaxBufferedOutputBytes) {
+      Notify(true);
+    } else if (!waiters_.empty()) {
+      // Still moving, so only a reader that stops entirely times out.
+      drain_timer_.start();
+    }
+  }
+
+  void Notify(bool drained) {
+    drain_timer_.stop();
+    std::vector<std::function<void(bool)>> waiters;
+    waiters.swap(waiters_);
+    for (auto& done : waiters) {
+      done(drained);
+    }
+  }
+
+  QPointer<QLocalSocket> socket_;
+  // Owns the connections, so they go away with this object.
+  QObject context_;
+  QTimer drain_timer_;
+  std::vector<std::function<void(bool)>> waiters_;
+};
+
+}  // namespace
+
 TabIpcServer::TabIpcServer(CommandDispatcher* dispatcher, QObject* parent)
     : QObject(parent), dispatcher_(dispatcher) {}
 
@@ -72,7 +156,9 @@ void TabIpcServer::HandleSocket(QLocalSocket* socket) {
     }
     *finished = true;
     const QString command = QString::fromUtf8(*buffer).trimmed();
-    QString response = dispatcher_ ? dispatcher_->Execute(command) : QString();
+    SocketCommandOutput output(socket);
+    QString response =
+        dispatcher_ ? dispatcher_->Execute(command, &output) : QString();
     if (!response.isEmpty()) {
       socket->write(response.toUtf8());
       socket->flush();
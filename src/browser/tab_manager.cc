@@ -1,10 +1,15 @@
 #include "browser/tab_manager.h"
 
 #include <algorithm>
+#include <utility>
 
 #include <QCoreApplication>
 #include <QEventLoop>
 #include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QRegularExpression>
 #include <QSizePolicy>
 #include <QStackedWidget>
 #include <QTimer>
@@ -14,7 +19,6 @@
 #include <QWebEnginePage>
 #include <QWebEngineProfile>
 #include <QWebEngineScript>
-#include <QWebEngineScriptCollection>
 #include <QWebEngineSettings>
 #include <QWebEngineView>
 #include <QDebug>
@@ -22,170 +26,249 @@
 #include "browser/context_menu_binding_manager.h"
 #include "browser/js_eval_bridge.h"
 #include "browser/rules_manager.h"
+#include "browser/tab_request_interceptor.h"
 #include "browser/web_page.h"
 #include "browser/web_view.h"
 
 namespace rethread {
 namespace {
+constexpr char kDefaultGroupName[] = "default";
+
+// Resource timing only sees same-origin or Timing-Allow-Origin responses, so
+// this is a lower bound; it costs one pass over the entry buffer per sample.
+constexpr char kTransferSizeScript[] = R"JS(
+(function() {
+  let total = 0;
+  for (const type of ['navigation', 'resource']) {
+    for (const entry of performance.getEntriesByType(type)) {
+      total += entry.transferSize || 0;
+    }
+  }
+  return total;
+})()
+)JS";
+
 QString TabTitleOrUrl(const QString& title, const QString& url) {
   return title.isEmpty() ? url : title;
 }
 
-QString EvalHelperSource() {
+// Installs the promise bridge into the current document. Only evals whose
+// result is a thenable need it, so it is sent on demand instead of being
+// injected into every page; settled values parked in
+// window.__rethreadSettled are delivered as soon as the channel is up.
+QString EvalBridgeBootstrapSource() {
   static QString cached;
   if (!cached.isEmpty()) {
     return cached;
   }
 
-  QString script;
+  QString qwebchannel_source;
   QFile qweb_file(QStringLiteral(":/qtwebchannel/qwebchannel.js"));
   if (qweb_file.open(QIODevice::ReadOnly)) {
-    script.append(QString::fromUtf8(qweb_file.readAll()));
+    qwebchannel_source = QString::fromUtf8(qweb_file.readAll());
     qweb_file.close();
   } else {
     qWarning() << "Failed to load qwebchannel.js for eval bridge";
   }
 
-  script.append(QStringLiteral(R"JS(
+  QString script = QStringLiteral(R"JS(
 (function() {
-  if (window.__rethreadEvalBridgeInstalled) {
+  if (window.__rethreadFlushSettled) {
+    window.__rethreadFlushSettled();
+    window.__rethreadPumpStreams();
     return;
   }
-
-  var retryAttempts = 0;
-  function markInstalled() {
-    window.__rethreadEvalBridgeInstalled = true;
+  if (window.__rethreadEvalBridgeInstalling) {
+    return;
   }
-
-  function ensureBridgeReady(channel, force) {
-    if (!force && window.__rethreadEvalBridgeInstalled) {
-      return;
-    }
-    retryAttempts += 1;
-    if (!channel || !channel.objects) {
-      console.warn('[rethread] eval helper attempt ' + retryAttempts +
-                   ': channel objects unavailable; retrying…');
-      window.setTimeout(function() { ensureBridgeReady(channel); }, 50);
-      return;
-    }
+  window.__rethreadEvalBridgeInstalling = true;
+__RETHREAD_QWEBCHANNEL__
+  function install(channel) {
+    var storedCallbacks = channel.execCallbacks || {};
+    var noop = function() {};
+    channel.execCallbacks = new Proxy(storedCallbacks, {
+      get: function(target, prop) {
+        var value = target[prop];
+        return typeof value === 'function' ? value : noop;
+      },
+      set: function(target, prop, value) {
+        target[prop] = value;
+        return true;
+      },
+      deleteProperty: function(target, prop) {
+        delete target[prop];
+        return true;
+      }
+    });
     var bridge = channel.objects.rethreadEvalBridge;
     if (!bridge) {
-      console.warn('[rethread] eval helper attempt ' + retryAttempts +
-                   ': missing bridge object; retrying…');
-      window.setTimeout(function() { ensureBridgeReady(channel); }, 50);
-      return;
-    }
-
-    var resolveMethod = bridge.resolve || bridge.Resolve;
-    var rejectMethod = bridge.reject || bridge.Reject;
-    var readyMethod = bridge.notifyReady || bridge.NotifyReady;
-    if (!resolveMethod || !rejectMethod || !readyMethod) {
-      console.warn('[rethread] eval helper attempt ' + retryAttempts +
-                   ': missing slots/signals (resolve=' + typeof resolveMethod +
-                   ', reject=' + typeof rejectMethod +
-                   ', notifyReady=' + typeof readyMethod + '); retrying…');
-      window.setTimeout(function() { ensureBridgeReady(channel); }, 100);
+      console.warn('[rethread] eval bridge object missing');
+      window.__rethreadEvalBridgeInstalling = false;
       return;
     }
-
-    window.__rethreadPromiseBridge = {
-      resolve: function(requestId, value) {
-        resolveMethod.call(bridge, requestId, value);
-      },
-      reject: function(requestId, value) {
-        var message = value;
-        if (message && typeof message === 'object' && message.message) {
-          message = message.message;
+    window.__rethreadFlushSettled = function() {
+      var settled = window.__rethreadSettled || {};
+      Object.keys(settled).forEach(function(id) {
+        var entry = settled[id];
+        delete settled[id];
+        if (entry.ok) {
+          bridge.Resolve(Number(id), entry.value);
+        } else {
+          bridge.Reject(Number(id), String(entry.error));
         }
-        rejectMethod.call(bridge, requestId, String(message !== undefined ? message : 'Unknown error'));
-      }
+      });
     };
-
-    markInstalled();
-    console.log('[rethread] eval helper installed after ' +
-                retryAttempts + ' attempts');
-    readyMethod.call(bridge);
-  }
-
-  function install(channel) {
-    if (!channel) {
-      return;
+    // Streams keep at most this many chunks unacknowledged, so a fast
+    // producer waits for the CLI instead of piling up in page memory.
+    var maxInFlight = 4;
+    var streamStates = window.__rethreadStreamStates = {};
+    function wake(state) {
+      if (state.wake) {
+        var resume = state.wake;
+        state.wake = null;
+        resume();
+      }
     }
-    if (!channel.__rethreadPatched) {
-      channel.__rethreadPatched = true;
-      var storedCallbacks = channel.execCallbacks || {};
-      var noop = function() {};
-      channel.execCallbacks = new Proxy(storedCallbacks, {
-        get: function(target, prop) {
-          var value = target[prop];
-          return typeof value === 'function' ? value : noop;
-        },
-        set: function(target, prop, value) {
-          target[prop] = value;
-          return true;
-        },
-        deleteProperty: function(target, prop) {
-          delete target[prop];
-          return true;
+    window.__rethreadAckStream = function(id) {
+      var state = streamStates[id];
+      if (state) {
+        state.inFlight--;
+        wake(state);
+      }
+    };
+    window.__rethreadCancelStream = function(id) {
+      var state = streamStates[id];
+      if (state) {
+        state.cancelled = true;
+        wake(state);
+      }
+    };
+    function pumpStream(id, stream) {
+      var state = { inFlight: 0, cancelled: false, wake: null };
+      streamStates[id] = state;
+      var count = 0;
+      (async function() {
+        try {
+          for (;;) {
+            while (state.inFlight >= maxInFlight && !state.cancelled) {
+              await new Promise(function(resolve) { state.wake = resolve; });
+            }
+            if (state.cancelled) {
+              if (typeof stream.iterator.return === 'function') {
+                await stream.iterator.return();
+              }
+              return;
+            }
+            var step = await stream.iterator.next();
+            if (step.done) {
+              break;
+            }
+            state.inFlight++;
+            count++;
+            bridge.Yield(Number(id), stream.encode(step.value));
+          }
+          stream.settle({ ok: true, value: { __rethreadStreamEnd: count } });
+        } catch (err) {
+          stream.settle({ ok: false, error: String(err && err.message || err) });
+        } finally {
+          delete streamStates[id];
         }
-      });
+      })();
     }
-    window.__rethreadEvalChannel = channel;
-    ensureBridgeReady(channel, false);
+    window.__rethreadPumpStreams = function() {
+      var streams = window.__rethreadStreams || {};
+      Object.keys(streams).forEach(function(id) {
+        var stream = streams[id];
+        delete streams[id];
+        pumpStream(id, stream);
+      });
+    };
+    window.__rethreadFlushSettled();
+    window.__rethreadPumpStreams();
   }
 
-  window.__rethreadRequestEvalBridgeReady = function() {
-    console.log('[rethread] eval helper reinstall requested');
-    window.__rethreadEvalBridgeInstalled = false;
-    retryAttempts = 0;
-    ensureBridgeReady(window.__rethreadEvalChannel || null, true);
-  };
-
-  function initChannel() {
-    if (!window.qt || !window.qt.webChannelTransport) {
-      window.setTimeout(initChannel, 50);
+  // setWebChannel exposes the transport asynchronously when the channel is
+  // attached to an already loaded document.
+  var attempts = 0;
+  function connect() {
+    if (window.qt && window.qt.webChannelTransport) {
+      new QWebChannel(window.qt.webChannelTransport, install);
+      return;
+    }
+    if (++attempts > 200) {
+      console.warn('[rethread] eval bridge transport unavailable');
+      window.__rethreadEvalBridgeInstalling = false;
       return;
     }
-    new QWebChannel(window.qt.webChannelTransport, install);
+    window.setTimeout(connect, 10);
   }
-
-  initChannel();
+  connect();
 })();
-)JS"));
-
+)JS");
+  script.replace(QStringLiteral("__RETHREAD_QWEBCHANNEL__"),
+                 qwebchannel_source);
   cached = script;
   return cached;
 }
 
-void InstallEvalHelperScript(QWebEnginePage* page) {
-  if (!page) {
-    return;
-  }
-  QWebEngineScriptCollection* collection = &page->scripts();
-  const auto existing =
-      collection->find(QStringLiteral("rethread_eval_helper"));
-  if (!existing.isEmpty()) {
-    return;
-  }
-
-  QWebEngineScript script;
-  script.setName(QStringLiteral("rethread_eval_helper"));
-  script.setInjectionPoint(QWebEngineScript::DocumentCreation);
-  script.setRunsOnSubFrames(false);
-  script.setWorldId(QWebEngineScript::MainWorld);
-  script.setSourceCode(EvalHelperSource());
-  collection->insert(script);
-  page->runJavaScript(EvalHelperSource(), QWebEngineScript::MainWorld);
+constexpr size_t kSpareTabPoolSize = 2;
+constexpr int kEvalPreviewLength = 80;
+constexpr int kEvalPollIntervalMs = 25;
+// `--wait-for=networkidle` needs this long without a new request.
+constexpr int kNetworkIdleQuietMs = 500;
+
+// Run in the ApplicationWorld at loadStarted, while the outgoing document is
+// still current, so DOM-ready probes can tell it from its replacement.
+constexpr char kMarkOutgoingDocumentScript[] =
+    "window.__rethreadOutgoingDocument = true;";
+// Yields the document URL once it is past 'loading', or '' before that.
+constexpr char kDomReadyProbeScript[] =
+    "!window.__rethreadOutgoingDocument && document.readyState !== 'loading'"
+    " ? location.href : '';";
+constexpr char kSelectorWaitScript[] = R"JS(
+if (document.querySelector(args)) {
+  return true;
+}
+return new Promise(function(resolve) {
+  const observer = new MutationObserver(function() {
+    if (document.querySelector(args)) {
+      observer.disconnect();
+      resolve(true);
+    }
+  });
+  observer.observe(document, { childList: true, subtree: true, attributes: true });
+});
+)JS";
+
+quint32 WorldIdFor(TabManager::EvalWorld world) {
+  return world == TabManager::EvalWorld::kIsolated
+             ? QWebEngineScript::ApplicationWorld
+             : QWebEngineScript::MainWorld;
 }
 
-constexpr int kEvalReadyTimeoutMs = 3000;
+// Binary results (ArrayBuffer, typed arrays, Blob) cross as base64 tagged with
+// __rethreadBinary, since neither runJavaScript nor WebChannel carry raw bytes.
+QVariant DecodeEvalValue(const QVariant& value) {
+  const QVariantMap map = value.toMap();
+  const QString key = QStringLiteral("__rethreadBinary");
+  if (map.size() != 1 || !map.contains(key)) {
+    return value;
+  }
+  return QByteArray::fromBase64(map.value(key).toString().toLatin1());
+}
 
-QString BuildEvalWrapper(const QString& script, int request_id) {
+// Snippets run as a function body. Only bodies that use `await` are wrapped
+// in an async function; everything else returns straight through the
+// runJavaScript callback. Thenables are parked in window.__rethreadSettled
+// for the lazily installed bridge to pick up.
+// The result is a function expression taking (request id, args); callers
+// append the invocation so registered scripts can reuse the source as-is.
+QString BuildEvalFunction(const QString& script, bool takes_args) {
+  static const QRegularExpression await_pattern(
+      QStringLiteral("\\bawait\\b"));
   QString wrapper = QStringLiteral(
       R"JS(
-(function() {
-  const __RETHREAD_REQUEST_ID__ = __REQUEST_ID__;
-  const __RETHREAD_BRIDGE__ = window.__rethreadPromiseBridge || null;
+(function(__RETHREAD_REQUEST_ID__, __RETHREAD_ARGS__, __RETHREAD_STREAM__) {
   function __rethreadFormatError(err) {
     if (!err) {
       return "Unknown error";
@@ -205,33 +288,107 @@ QString BuildEvalWrapper(const QString& script, int request_id) {
     }
     return String(err);
   }
+  function __rethreadIsBinary(value) {
+    return value instanceof ArrayBuffer || ArrayBuffer.isView(value);
+  }
+  function __rethreadToBase64(value) {
+    const bytes = value instanceof ArrayBuffer
+        ? new Uint8Array(value)
+        : new Uint8Array(value.buffer, value.byteOffset, value.byteLength);
+    let binary = "";
+    for (let i = 0; i < bytes.length; i += 0x8000) {
+      binary += String.fromCharCode.apply(null, bytes.subarray(i, i + 0x8000));
+    }
+    return btoa(binary);
+  }
+  function __rethreadEncode(value) {
+    return __rethreadIsBinary(value)
+        ? { __rethreadBinary: __rethreadToBase64(value) }
+        : value;
+  }
+  // In stream mode, generators, iterators, and iterables (arrays included)
+  // are parked for the bridge to pump one chunk per value.
+  function __rethreadQueueStream(value) {
+    if (!__RETHREAD_STREAM__ || !value || typeof value !== "object") {
+      return false;
+    }
+    let iterator = null;
+    if (typeof value.next === "function") {
+      iterator = value;
+    } else if (typeof value[Symbol.asyncIterator] === "function") {
+      iterator = value[Symbol.asyncIterator]();
+    } else if (typeof value[Symbol.iterator] === "function") {
+      iterator = value[Symbol.iterator]();
+    }
+    if (!iterator) {
+      return false;
+    }
+    (window.__rethreadStreams = window.__rethreadStreams || {})[__RETHREAD_REQUEST_ID__] = {
+      iterator: iterator,
+      encode: __rethreadEncode,
+      settle: __rethreadSettle
+    };
+    return true;
+  }
+  function __rethreadSettle(entry) {
+    if (entry.ok) {
+      entry.value = __rethreadEncode(entry.value);
+    }
+    const dropped = window.__rethreadDroppedEvals;
+    if (dropped && dropped[__RETHREAD_REQUEST_ID__]) {
+      delete dropped[__RETHREAD_REQUEST_ID__];
+      return;
+    }
+    window.__rethreadSettled = window.__rethreadSettled || {};
+    window.__rethreadSettled[__RETHREAD_REQUEST_ID__] = entry;
+    if (window.__rethreadFlushSettled) {
+      window.__rethreadFlushSettled();
+    }
+  }
   try {
-    const __RETHREAD_RESULT__ = (async function() {
+    let __RETHREAD_RESULT__ = (__RETHREAD_ASYNC__function(__RETHREAD_PARAMS__) {
 __RETHREAD_USER_CODE__
-    })();
+    })(__RETHREAD_ARGS__);
+    if (__rethreadQueueStream(__RETHREAD_RESULT__)) {
+      return { status: "stream", id: __RETHREAD_REQUEST_ID__ };
+    }
+    // Blobs can only be read asynchronously, so they take the promise path.
+    if (typeof Blob !== "undefined" && __RETHREAD_RESULT__ instanceof Blob) {
+      __RETHREAD_RESULT__ = __RETHREAD_RESULT__.arrayBuffer();
+    }
     if (__RETHREAD_RESULT__ && typeof __RETHREAD_RESULT__.then === "function") {
       Promise.resolve(__RETHREAD_RESULT__).then(
         function(value) {
-          if (__RETHREAD_BRIDGE__ && __RETHREAD_BRIDGE__.resolve) {
-            __RETHREAD_BRIDGE__.resolve(__RETHREAD_REQUEST_ID__, value);
+          if (__rethreadQueueStream(value)) {
+            if (window.__rethreadPumpStreams) {
+              window.__rethreadPumpStreams();
+            }
+            return;
+          }
+          if (typeof Blob !== "undefined" && value instanceof Blob) {
+            return value.arrayBuffer().then(function(buffer) {
+              __rethreadSettle({ ok: true, value: buffer });
+            });
           }
+          __rethreadSettle({ ok: true, value: value });
         },
         function(error) {
-          if (__RETHREAD_BRIDGE__ && __RETHREAD_BRIDGE__.reject) {
-            __RETHREAD_BRIDGE__.reject(__RETHREAD_REQUEST_ID__, __rethreadFormatError(error));
-          }
+          __rethreadSettle({ ok: false, error: __rethreadFormatError(error) });
         }
       );
       return { status: "promise", id: __RETHREAD_REQUEST_ID__ };
     }
-    return { status: "ok", id: __RETHREAD_REQUEST_ID__, value: __RETHREAD_RESULT__ };
+    return { status: "ok", id: __RETHREAD_REQUEST_ID__, value: __rethreadEncode(__RETHREAD_RESULT__) };
   } catch (err) {
     return { status: "error", id: __RETHREAD_REQUEST_ID__, error: __rethreadFormatError(err) };
   }
-})();
+})
 )JS");
-  wrapper.replace(QStringLiteral("__REQUEST_ID__"),
-                  QString::number(request_id));
+  wrapper.replace(QStringLiteral("__RETHREAD_PARAMS__"),
+                  takes_args ? QStringLiteral("args") : QString());
+  wrapper.replace(QStringLiteral("__RETHREAD_ASYNC__"),
+                  script.contains(await_pattern) ? QStringLiteral("async ")
+                                                 : QString());
   QString indented_script = script;
   indented_script.replace(QStringLiteral("\r"), QStringLiteral(""));
   indented_script.replace(QStringLiteral("\n"),
@@ -242,6 +399,21 @@ __RETHREAD_USER_CODE__
   wrapper.replace(QStringLiteral("__RETHREAD_USER_CODE__"), indented_script);
   return wrapper;
 }
+
+QString JsonStringLiteral(const QString& text) {
+  const QByteArray raw =
+      QJsonDocument(QJsonArray{text}).toJson(QJsonDocument::Compact);
+  return QString::fromUtf8(raw.mid(1, raw.size() - 2));
+}
+
+QString BuildEvalInvocation(const QString& function_source,
+                            int request_id,
+                            const QString& args_json,
+                            bool stream) {
+  return function_source + QChar('(') + QString::number(request_id) +
+         QStringLiteral(", ") + args_json +
+         (stream ? QStringLiteral(", true);\n") : QStringLiteral(");\n"));
+}
 }  // namespace
 
 TabManager::TabManager(QWebEngineProfile* profile,
@@ -249,9 +421,18 @@ TabManager::TabManager(QWebEngineProfile* profile,
                        QObject* parent)
     : QObject(parent),
       profile_(profile),
-      background_color_(background_color) {}
+      background_color_(background_color),
+      current_group_(QString::fromLatin1(kDefaultGroupName)) {}
 
 TabManager::~TabManager() {
+  // Spare views have no parent, so a deferred delete could leave their pages
+  // alive after the profile; delete them now.
+  for (auto& tab : spare_tabs_) {
+    tab->eval_bridge.reset();
+    tab->eval_channel.reset();
+    delete tab->view;
+  }
+  spare_tabs_.clear();
   closeAllTabs();
 }
 
@@ -277,6 +458,10 @@ void TabManager::setContainer(QStackedWidget* stack) {
 
 void TabManager::setContextMenuBindingManager(
     ContextMenuBindingManager* manager) {
+  if (context_menu_binding_manager_ != manager) {
+    // Spare views captured the previous manager at construction.
+    DestroyTabList(&spare_tabs_);
+  }
   context_menu_binding_manager_ = manager;
 }
 
@@ -301,17 +486,15 @@ int TabManager::openTab(const QUrl& url, bool activate, bool append_to_end) {
   }
 
   const int prior_active_index = activeIndex();
-  auto tab = std::make_unique<TabEntry>();
+  std::unique_ptr<TabEntry> tab = TakeSpareTab();
   tab->id = nextTabId();
+  if (tab->request_interceptor) {
+    tab->request_interceptor->setTabId(tab->id);
+  }
   tab->active = tabs_.empty() || activate;
 
-  auto* view =
-      new WebView(context_menu_binding_manager_, background_color_);
-  auto* page = new WebPage(profile_, this, view);
-  page->setBackgroundColor(background_color_);
-  view->setPage(page);
-  view->BindPageSignals(page);
-  tab->view = view;
+  WebView* view = tab->view;
+  QWebEnginePage* page = view->page();
   tab->url = url.isEmpty() ? QStringLiteral("about:blank") : url.toString();
   tab->title = tab->url;
 
@@ -327,11 +510,25 @@ int TabManager::openTab(const QUrl& url, bool activate, bool append_to_end) {
                      if (tab_ptr->title.isEmpty() || tab_ptr->title == tab_ptr->url) {
                        tab_ptr->title = tab_ptr->url;
                      }
+                     // A sample requested from the previous document may
+                     // never answer; let the next stats call ask again.
+                     tab_ptr->transfer_sample_pending = false;
                      notifyTabsChanged();
                      ApplyRulesToView(tab_ptr->view, new_url);
                    });
   QObject::connect(page, &QWebEnginePage::windowCloseRequested, this,
                    [this, tab_id = tab->id]() { closeById(tab_id); });
+  QObject::connect(page, &QWebEnginePage::loadStarted, this,
+                   [tab_ptr]() {
+                     tab_ptr->loading = true;
+                     if (tab_ptr->view && tab_ptr->view->page()) {
+                       tab_ptr->view->page()->runJavaScript(
+                           QString::fromLatin1(kMarkOutgoingDocumentScript),
+                           QWebEngineScript::ApplicationWorld);
+                     }
+                   });
+  QObject::connect(page, &QWebEnginePage::loadFinished, this,
+                   [tab_ptr]() { tab_ptr->loading = false; });
 
   if (stack_) {
     view->setParent(stack_);
@@ -363,9 +560,11 @@ int TabManager::openTab(const QUrl& url, bool activate, bool append_to_end) {
   tabs_.insert(tabs_.begin() + insert_pos, std::move(tab));
   ApplyRulesToView(view, url);
   if (!url.isEmpty()) {
+    // loadStarted arrives asynchronously; an eval --wait-for issued right
+    // after `tabs open` must already see the navigation.
+    tab_ptr->loading = true;
     view->setUrl(url);
   }
-  EnsureEvalBridge(tab_ptr);
   applyActiveState();
   notifyTabsChanged();
   if (tab_ptr->active && tab_ptr->view) {
@@ -374,7 +573,58 @@ int TabManager::openTab(const QUrl& url, bool activate, bool append_to_end) {
   return tab_ptr->id;
 }
 
-void TabManager::EnsureEvalBridge(TabEntry* tab) {
+std::unique_ptr<TabManager::TabEntry> TabManager::CreateSpareTab() {
+  auto tab = std::make_unique<TabEntry>();
+  auto* view =
+      new WebView(context_menu_binding_manager_, background_color_);
+  auto* page = new WebPage(profile_, this, view);
+  page->setBackgroundColor(background_color_);
+  view->setPage(page);
+  view->BindPageSignals(page);
+  tab->request_interceptor = new TabRequestInterceptor(&net_log_, page);
+  page->setUrlRequestInterceptor(tab->request_interceptor);
+  tab->view = view;
+  return tab;
+}
+
+std::unique_ptr<TabManager::TabEntry> TabManager::TakeSpareTab() {
+  std::unique_ptr<TabEntry> tab;
+  if (spare_tabs_.empty()) {
+    tab = CreateSpareTab();
+  } else {
+    tab = std::move(spare_tabs_.back());
+    spare_tabs_.pop_back();
+  }
+  ScheduleSpareRefill();
+  return tab;
+}
+
+void TabManager::ScheduleSpareRefill() {
+  if (!spare_refill_timer_) {
+    spare_refill_timer_ = new QTimer(this);
+    spare_refill_timer_->setSingleShot(true);
+    // A zero timer fires once the event queue is drained, so the refill
+    // runs when the UI is idle instead of inside the open that used a spare.
+    spare_refill_timer_->setInterval(0);
+    QObject::connect(spare_refill_timer_, &QTimer::timeout, this,
+                     &TabManager::RefillSparePool);
+  }
+  if (!spare_refill_timer_->isActive() &&
+      spare_tabs_.size() < kSpareTabPoolSize) {
+    spare_refill_timer_->start();
+  }
+}
+
+void TabManager::RefillSparePool() {
+  if (!profile_ || spare_tabs_.size() >= kSpareTabPoolSize) {
+    return;
+  }
+  // One spare per tick keeps each idle slice short.
+  spare_tabs_.push_back(CreateSpareTab());
+  ScheduleSpareRefill();
+}
+
+void TabManager::EnsureEvalBridge(TabEntry* tab, quint32 world_id) {
   if (!tab || tab->eval_bridge || !tab->view) {
     return;
   }
@@ -382,36 +632,12 @@ void TabManager::EnsureEvalBridge(TabEntry* tab) {
   if (!page) {
     return;
   }
-  InstallEvalHelperScript(page);
-
   auto bridge = std::make_unique<JsEvalBridge>();
-  const int tab_id = tab->id;
-  QPointer<QWebEnginePage> page_guard(page);
-  QObject::connect(bridge.get(), &JsEvalBridge::Ready, tab->view,
-                   [this, tab_id]() {
-                     if (TabEntry* entry = findById(tab_id)) {
-                       entry->eval_bridge_ready = true;
-                     }
-                   });
-  QObject::connect(page, &QWebEnginePage::loadStarted, tab->view,
-                   [this, tab_id, page_guard]() {
-                     if (TabEntry* entry = findById(tab_id)) {
-                       entry->eval_bridge_ready = false;
-                     }
-                     if (page_guard) {
-                       page_guard->runJavaScript(
-                           QStringLiteral(
-                               "if (window.__rethreadRequestEvalBridgeReady) "
-                               "{ window.__rethreadRequestEvalBridgeReady(); }"),
-                           QWebEngineScript::MainWorld);
-                     }
-                   });
-
   auto channel = std::make_unique<QWebChannel>(tab->view);
   channel->registerObject(QStringLiteral("rethreadEvalBridge"),
                           bridge.get());
-  page->setWebChannel(channel.get());
-  tab->eval_bridge_ready = false;
+  page->setWebChannel(channel.get(), world_id);
+  tab->eval_bridge_world = world_id;
   tab->eval_bridge = std::move(bridge);
   tab->eval_channel = std::move(channel);
 }
@@ -457,11 +683,56 @@ QList<TabManager::TabSnapshot> TabManager::snapshot() const {
     snap.url = tab->url;
     snap.title = TabTitleOrUrl(tab->title, tab->url);
     snap.active = tab->active;
+    if (tab->view && tab->view->page()) {
+      snap.render_pid = tab->view->page()->renderProcessPid();
+    }
     result.append(snap);
   }
   return result;
 }
 
+QList<TabManager::TabStats> TabManager::statsSnapshot() {
+  QList<TabStats> result;
+  result.reserve(static_cast<int>(tabs_.size()));
+  for (const auto& tab : tabs_) {
+    TabStats stats;
+    stats.id = tab->id;
+    stats.url = tab->url;
+    stats.title = TabTitleOrUrl(tab->title, tab->url);
+    stats.active = tab->active;
+    stats.transfer_bytes = tab->transfer_bytes;
+    if (tab->request_interceptor) {
+      stats.request_count = tab->request_interceptor->requestCount();
+    }
+    QWebEnginePage* page = tab->view ? tab->view->page() : nullptr;
+    if (page) {
+      stats.render_pid = page->renderProcessPid();
+    }
+    result.append(stats);
+
+    if (!page || tab->transfer_sample_pending) {
+      continue;
+    }
+    tab->transfer_sample_pending = true;
+    const int tab_id = tab->id;
+    page->runJavaScript(QString::fromLatin1(kTransferSizeScript),
+                        QWebEngineScript::ApplicationWorld,
+                        [this, tab_id](const QVariant& value) {
+                          TabEntry* entry = findById(tab_id);
+                          if (!entry) {
+                            return;
+                          }
+                          entry->transfer_sample_pending = false;
+                          bool ok = false;
+                          const qint64 bytes = value.toLongLong(&ok);
+                          if (ok) {
+                            entry->transfer_bytes = bytes;
+                          }
+                        });
+  }
+  return result;
+}
+
 bool TabManager::SwapTabs(int first_index, int second_index) {
   if (first_index < 0 || second_index < 0 ||
       first_index >= static_cast<int>(tabs_.size()) ||
@@ -477,13 +748,98 @@ bool TabManager::SwapTabs(int first_index, int second_index) {
   return true;
 }
 
+bool TabManager::MoveTab(int from_index, int to_index) {
+  const int count = static_cast<int>(tabs_.size());
+  if (from_index < 0 || to_index < 0 || from_index >= count ||
+      to_index >= count) {
+    return false;
+  }
+  if (from_index == to_index) {
+    return true;
+  }
+  // Rotate the range instead of swapping hop by hop so every tab in between
+  // shifts by one slot and observers see a single change.
+  auto first = tabs_.begin();
+  if (from_index < to_index) {
+    std::rotate(first + from_index, first + from_index + 1,
+                first + to_index + 1);
+  } else {
+    std::rotate(first + to_index, first + from_index, first + from_index + 1);
+  }
+  notifyTabsChanged();
+  return true;
+}
+
+bool TabManager::SortTabs(TabSortKey key) {
+  if (tabs_.size() < 2) {
+    return !tabs_.empty();
+  }
+  auto sort_value = [key](const TabEntry& tab) {
+    switch (key) {
+      case TabSortKey::kTitle:
+        return TabTitleOrUrl(tab.title, tab.url).toCaseFolded();
+      case TabSortKey::kHost:
+        return QUrl(tab.url).host().toCaseFolded();
+      case TabSortKey::kUrl:
+        break;
+    }
+    return tab.url;
+  };
+  std::stable_sort(tabs_.begin(), tabs_.end(),
+                   [&sort_value](const std::unique_ptr<TabEntry>& a,
+                                 const std::unique_ptr<TabEntry>& b) {
+                     const QString lhs = sort_value(*a);
+                     const QString rhs = sort_value(*b);
+                     if (lhs != rhs) {
+                       return lhs < rhs;
+                     }
+                     return a->url < b->url;
+                   });
+  notifyTabsChanged();
+  return true;
+}
+
+int TabManager::DedupeTabs() {
+  if (tabs_.size() < 2) {
+    return 0;
+  }
+  // Keep the first tab for each URL, except that the active tab always
+  // survives so dedupe never moves focus.
+  QHash<QString, TabEntry*> keepers;
+  for (const auto& tab : tabs_) {
+    auto it = keepers.find(tab->url);
+    if (it == keepers.end()) {
+      keepers.insert(tab->url, tab.get());
+    } else if (tab->active) {
+      it.value() = tab.get();
+    }
+  }
+  if (static_cast<size_t>(keepers.size()) == tabs_.size()) {
+    return 0;
+  }
+
+  int removed = 0;
+  for (auto it = tabs_.begin(); it != tabs_.end();) {
+    TabEntry* tab = it->get();
+    if (keepers.value(tab->url) == tab) {
+      ++it;
+      continue;
+    }
+    ReleaseTabView(tab);
+    it = tabs_.erase(it);
+    ++removed;
+  }
+  applyActiveState();
+  notifyTabsChanged();
+  return removed;
+}
+
 bool TabManager::closeTabAtIndex(int index) {
   if (index < 0 || index >= static_cast<int>(tabs_.size())) {
     return false;
   }
   auto it = tabs_.begin() + index;
   TabEntry* tab_to_close = it->get();
-  WebView* view_to_close = tab_to_close ? tab_to_close->view : nullptr;
   const bool was_active = tab_to_close && tab_to_close->active;
 
   if (was_active && tabs_.size() > 1) {
@@ -496,16 +852,14 @@ bool TabManager::closeTabAtIndex(int index) {
     applyActiveState();
   }
 
-  if (stack_ && view_to_close) {
-    stack_->removeWidget(view_to_close);
-  }
-  if (view_to_close) {
-    view_to_close->deleteLater();
-  }
-
+  ReleaseTabView(tab_to_close);
   tabs_.erase(it);
 
-  if (tabs_.empty()) {
+  if (tabs_.empty() && !parked_groups_.empty()) {
+    // Closing the last tab of a group falls back to another group instead of
+    // quitting while suspended tabs still exist.
+    RestoreGroup(parked_groups_.begin()->first);
+  } else if (tabs_.empty()) {
     emit allTabsClosed();
   } else {
     applyActiveState();
@@ -523,11 +877,177 @@ bool TabManager::closeActiveTab() {
 }
 
 void TabManager::closeAllTabs() {
+  for (auto& [name, group] : parked_groups_) {
+    DestroyTabList(&group);
+  }
+  parked_groups_.clear();
   while (!tabs_.empty()) {
     closeTabAtIndex(0);
   }
 }
 
+QList<TabManager::GroupSnapshot> TabManager::groupSnapshot() const {
+  QList<GroupSnapshot> result;
+  GroupSnapshot current;
+  current.name = current_group_;
+  current.tab_count = static_cast<int>(tabs_.size());
+  current.current = true;
+  result.append(current);
+  for (const auto& [name, group] : parked_groups_) {
+    GroupSnapshot snap;
+    snap.name = name;
+    snap.tab_count = static_cast<int>(group.size());
+    result.append(snap);
+  }
+  return result;
+}
+
+bool TabManager::SwitchGroup(const QString& name,
+                             GroupSuspendMode mode,
+                             const QUrl& url_if_new) {
+  if (name.isEmpty()) {
+    return false;
+  }
+  if (name == current_group_) {
+    return true;
+  }
+  for (auto& tab : tabs_) {
+    SuspendTab(tab.get(), mode);
+  }
+  if (!tabs_.empty()) {
+    parked_groups_[current_group_] = std::move(tabs_);
+    tabs_.clear();
+  }
+  if (parked_groups_.count(name) > 0) {
+    RestoreGroup(name);
+    notifyTabsChanged();
+    return true;
+  }
+  current_group_ = name;
+  return openTab(url_if_new, true) > 0;
+}
+
+bool TabManager::MoveActiveTabToGroup(const QString& name,
+                                      GroupSuspendMode mode) {
+  const int index = activeIndex();
+  if (name.isEmpty() || index < 0) {
+    return false;
+  }
+  if (name == current_group_) {
+    return true;
+  }
+  auto it = tabs_.begin() + index;
+  std::unique_ptr<TabEntry> tab = std::move(*it);
+  tabs_.erase(it);
+  if (!tabs_.empty()) {
+    const int replacement =
+        std::min(index, static_cast<int>(tabs_.size()) - 1);
+    tabs_[static_cast<size_t>(replacement)]->active = true;
+  }
+
+  TabList& target = parked_groups_[name];
+  tab->active = target.empty();
+  SuspendTab(tab.get(), mode);
+  target.push_back(std::move(tab));
+
+  if (tabs_.empty()) {
+    RestoreGroup(name);
+  } else {
+    applyActiveState();
+  }
+  notifyTabsChanged();
+  return true;
+}
+
+bool TabManager::CloseGroup(const QString& name) {
+  if (name == current_group_) {
+    if (tabs_.empty()) {
+      return false;
+    }
+    DestroyTabList(&tabs_);
+    if (!parked_groups_.empty()) {
+      RestoreGroup(parked_groups_.begin()->first);
+      notifyTabsChanged();
+    } else {
+      notifyTabsChanged();
+      emit allTabsClosed();
+    }
+    return true;
+  }
+  auto it = parked_groups_.find(name);
+  if (it == parked_groups_.end()) {
+    return false;
+  }
+  DestroyTabList(&it->second);
+  parked_groups_.erase(it);
+  return true;
+}
+
+void TabManager::SuspendTab(TabEntry* tab, GroupSuspendMode mode) {
+  if (!tab || !tab->view) {
+    return;
+  }
+  // Pages must be hidden before Chromium accepts a frozen/discarded state.
+  tab->view->setVisible(false);
+  if (QWebEnginePage* page = tab->view->page()) {
+    page->setLifecycleState(mode == GroupSuspendMode::kDiscard
+                                ? QWebEnginePage::LifecycleState::Discarded
+                                : QWebEnginePage::LifecycleState::Frozen);
+  }
+}
+
+void TabManager::RestoreGroup(const QString& name) {
+  auto it = parked_groups_.find(name);
+  if (it == parked_groups_.end()) {
+    return;
+  }
+  tabs_ = std::move(it->second);
+  parked_groups_.erase(it);
+  current_group_ = name;
+  // Every tab in tabs_ must be live: evals, waits, and transfer samples
+  // address background tabs too, and hang on a frozen page or see an empty
+  // discarded one. Discarded pages reload here.
+  for (const auto& tab : tabs_) {
+    if (tab->view && tab->view->page() &&
+        tab->view->page()->lifecycleState() !=
+            QWebEnginePage::LifecycleState::Active) {
+      tab->view->page()->setLifecycleState(
+          QWebEnginePage::LifecycleState::Active);
+    }
+  }
+  applyActiveState();
+}
+
+void TabManager::DestroyTabList(TabList* tabs) {
+  if (!tabs) {
+    return;
+  }
+  for (auto& tab : *tabs) {
+    ReleaseTabView(tab.get());
+  }
+  tabs->clear();
+}
+
+void TabManager::ReleaseTabView(TabEntry* tab) {
+  if (!tab || !tab->view) {
+    return;
+  }
+  if (stack_) {
+    stack_->removeWidget(tab->view);
+  }
+  // The page and its interceptor live until deleteLater runs, which can be
+  // after net_log_ is gone, so cut the interceptor off first.
+  if (tab->request_interceptor) {
+    tab->request_interceptor->setNetLog(nullptr);
+    if (QWebEnginePage* page = tab->view->page()) {
+      page->setUrlRequestInterceptor(nullptr);
+    }
+    tab->request_interceptor = nullptr;
+  }
+  tab->view->deleteLater();
+  tab->view = nullptr;
+}
+
 bool TabManager::historyBack() {
   QWebEngineView* view = activeView();
   if (!view) {
@@ -573,12 +1093,7 @@ QWebEngineView* TabManager::createPopupTab() {
 }
 
 TabManager::TabEntry* TabManager::findById(int id) {
-  for (auto& tab : tabs_) {
-    if (tab->id == id) {
-      return tab.get();
-    }
-  }
-  return nullptr;
+  return const_cast<TabEntry*>(std::as_const(*this).findById(id));
 }
 
 const TabManager::TabEntry* TabManager::findById(int id) const {
@@ -587,9 +1102,25 @@ const TabManager::TabEntry* TabManager::findById(int id) const {
       return tab.get();
     }
   }
+  for (const auto& [name, group] : parked_groups_) {
+    for (const auto& tab : group) {
+      if (tab->id == id) {
+        return tab.get();
+      }
+    }
+  }
   return nullptr;
 }
 
+bool TabManager::isInCurrentGroup(const TabEntry* tab) const {
+  for (const auto& entry : tabs_) {
+    if (entry.get() == tab) {
+      return true;
+    }
+  }
+  return false;
+}
+
 int TabManager::activeIndex() const {
   for (size_t i = 0; i < tabs_.size(); ++i) {
     if (tabs_[i]->active) {
@@ -604,6 +1135,12 @@ void TabManager::applyActiveState() {
     return;
   }
   for (const auto& tab : tabs_) {
+    if (tab->active && tab->view && tab->view->page() &&
+        tab->view->page()->lifecycleState() !=
+            QWebEnginePage::LifecycleState::Active) {
+      tab->view->page()->setLifecycleState(
+          QWebEnginePage::LifecycleState::Active);
+    }
     if (tab->view) {
       tab->view->setVisible(tab->active);
     }
@@ -633,14 +1170,18 @@ void TabManager::ApplyRulesToView(WebView* view, const QUrl& url) const {
 }
 
 void TabManager::ApplyRulesToAllTabs() const {
-  if (tabs_.empty()) {
-    return;
-  }
   for (const auto& tab : tabs_) {
     if (tab->view) {
       ApplyRulesToView(tab->view, tab->view->url());
     }
   }
+  for (const auto& [name, group] : parked_groups_) {
+    for (const auto& tab : group) {
+      if (tab->view) {
+        ApplyRulesToView(tab->view, tab->view->url());
+      }
+    }
+  }
 }
 
 bool TabManager::OpenDevToolsForActiveTab() {
@@ -717,13 +1258,260 @@ void TabManager::CloseDevTools(QWebEnginePage* page, bool close_view) {
 bool TabManager::EvaluateJavaScript(const QString& script,
                                     int tab_id,
                                     int tab_index,
+                                    int timeout_ms,
+                                    EvalWorld world,
+                                    const EvalChunkCallback& on_chunk,
                                     QVariant* result,
                                     QString* error_message) {
+  const TabEntry* target = ResolveEvalTarget(tab_id, tab_index, error_message);
+  if (!target) {
+    return false;
+  }
+  return WaitForEvaluation(target->id, BuildEvalFunction(script, false),
+                           QStringLiteral("undefined"), script, timeout_ms,
+                           world, on_chunk, result, error_message);
+}
+
+void TabManager::RegisterEvalScript(const QString& name,
+                                    const QString& script) {
+  RegisteredEvalScript entry;
+  entry.function_source = BuildEvalFunction(script, true);
+  entry.source_bytes = script.toUtf8().size();
+  eval_scripts_[name] = std::move(entry);
+}
+
+bool TabManager::UnregisterEvalScript(const QString& name) {
+  return eval_scripts_.erase(name) > 0;
+}
+
+QList<TabManager::EvalScriptInfo> TabManager::registeredEvalScripts() const {
+  QList<EvalScriptInfo> scripts;
+  for (const auto& [name, entry] : eval_scripts_) {
+    EvalScriptInfo info;
+    info.name = name;
+    info.source_bytes = entry.source_bytes;
+    scripts.append(info);
+  }
+  return scripts;
+}
+
+bool TabManager::CallEvalScript(const QString& name,
+                                const QString& args_json,
+                                int tab_id,
+                                int tab_index,
+                                int timeout_ms,
+                                EvalWorld world,
+                                const EvalChunkCallback& on_chunk,
+                                QVariant* result,
+                                QString* error_message) {
+  auto it = eval_scripts_.find(name);
+  if (it == eval_scripts_.end()) {
+    if (error_message) {
+      *error_message = QStringLiteral("no registered script named %1").arg(name);
+    }
+    return false;
+  }
+  const TabEntry* target = ResolveEvalTarget(tab_id, tab_index, error_message);
+  if (!target) {
+    return false;
+  }
+  // Copy the source: the nested event loop may serve an unregister meanwhile.
+  const QString function_source = it->second.function_source;
+  return WaitForEvaluation(target->id, function_source,
+                           args_json.isEmpty() ? QStringLiteral("undefined")
+                                               : args_json,
+                           QStringLiteral("call %1").arg(name), timeout_ms,
+                           world, on_chunk, result, error_message);
+}
+
+int TabManager::ResolveEvalTabId(int tab_id,
+                                 int tab_index,
+                                 QString* error_message) {
+  const TabEntry* target = ResolveEvalTarget(tab_id, tab_index, error_message);
+  return target ? target->id : 0;
+}
+
+bool TabManager::WaitForPageCondition(int tab_id,
+                                      PageCondition condition,
+                                      const QString& selector,
+                                      int timeout_ms,
+                                      EvalWorld world,
+                                      QString* error_message) {
+  TabEntry* tab = findById(tab_id);
+  if (!tab || !tab->view || !tab->view->page()) {
+    if (error_message) {
+      *error_message = QStringLiteral("unknown tab id");
+    }
+    return false;
+  }
+  if (!isInCurrentGroup(tab)) {
+    if (error_message) {
+      *error_message = QStringLiteral("tab belongs to a suspended group");
+    }
+    return false;
+  }
+  QElapsedTimer elapsed;
+  elapsed.start();
+  auto remaining_ms = [&elapsed, timeout_ms]() {
+    return timeout_ms > 0
+               ? std::max<qint64>(1, timeout_ms - elapsed.elapsed())
+               : 0;
+  };
+
+  const bool until_loaded = condition == PageCondition::kLoad ||
+                            condition == PageCondition::kNetworkIdle;
+  if (tab->loading &&
+      !WaitForNavigation(tab, until_loaded, timeout_ms, error_message)) {
+    return false;
+  }
+  // The nested loop may have let another command close the tab.
+  tab = findById(tab_id);
+  if (!tab) {
+    if (error_message) {
+      *error_message = QStringLiteral("tab closed while waiting");
+    }
+    return false;
+  }
+  if (condition == PageCondition::kNetworkIdle &&
+      !WaitForNetworkIdle(tab, static_cast<int>(remaining_ms()),
+                          error_message)) {
+    return false;
+  }
+  if (condition == PageCondition::kSelector) {
+    QString wait_error;
+    if (!WaitForEvaluation(tab_id, BuildEvalFunction(
+                                       QString::fromLatin1(kSelectorWaitScript),
+                                       true),
+                           JsonStringLiteral(selector),
+                           QStringLiteral("wait-for selector:%1").arg(selector),
+                           static_cast<int>(remaining_ms()), world, nullptr,
+                           nullptr, &wait_error)) {
+      if (error_message) {
+        *error_message = QStringLiteral("wait-for: %1").arg(wait_error);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TabManager::WaitForNavigation(TabEntry* tab,
+                                   bool until_loaded,
+                                   int timeout_ms,
+                                   QString* error_message) {
+  struct NavigationWait {
+    bool done = false;
+    // A fresh tab's initial about:blank is already complete and unmarked, so
+    // it only counts once this wait has seen the navigation start.
+    bool started = false;
+    QString error;
+  };
+  auto wait = std::make_shared<NavigationWait>();
+  QEventLoop loop;
+  QPointer<QEventLoop> loop_guard(&loop);
+  auto finish = [wait, loop_guard](const QString& error) {
+    if (wait->done) {
+      return;
+    }
+    wait->done = true;
+    wait->error = error;
+    if (loop_guard) {
+      loop_guard->quit();
+    }
+  };
+  // Every connection below dies with |context| when this returns.
+  QObject context;
+  QWebEnginePage* page = tab->view->page();
+  QObject::connect(page, &QWebEnginePage::loadFinished, &context,
+                   [finish]() { finish(QString()); });
+  QObject::connect(tab->view, &QObject::destroyed, &context, [finish]() {
+    finish(QStringLiteral("tab closed while waiting"));
+  });
+  if (timeout_ms > 0) {
+    QTimer::singleShot(timeout_ms, &context, [finish, timeout_ms]() {
+      finish(QStringLiteral("wait-for timed out after %1 ms").arg(timeout_ms));
+    });
+  }
+  if (!until_loaded) {
+    // DOMContentLoaded has no Qt signal; probe the incoming document each
+    // time Chromium reports progress.
+    QPointer<QWebEnginePage> page_guard(page);
+    auto probe = [page_guard, wait, finish]() {
+      if (!page_guard || wait->done) {
+        return;
+      }
+      page_guard->runJavaScript(
+          QString::fromLatin1(kDomReadyProbeScript),
+          QWebEngineScript::ApplicationWorld,
+          [wait, finish](const QVariant& result) {
+            const QString href = result.toString();
+            if (!wait->done && !href.isEmpty() &&
+                (wait->started || href != QStringLiteral("about:blank"))) {
+              finish(QString());
+            }
+          });
+    };
+    QObject::connect(page, &QWebEnginePage::loadStarted, &context,
+                     [wait]() { wait->started = true; });
+    QObject::connect(page, &QWebEnginePage::loadProgress, &context, probe);
+    probe();
+  }
+  if (!wait->done) {
+    loop.exec();
+  }
+  if (!wait->error.isEmpty()) {
+    if (error_message) {
+      *error_message = wait->error;
+    }
+    return false;
+  }
+  return true;
+}
+
+bool TabManager::WaitForNetworkIdle(TabEntry* tab,
+                                    int timeout_ms,
+                                    QString* error_message) {
+  if (!tab->request_interceptor) {
+    return true;
+  }
+  QEventLoop loop;
+  QString error;
+  QObject context;
+  QTimer quiet(&context);
+  quiet.setSingleShot(true);
+  QObject::connect(&quiet, &QTimer::timeout, &loop, &QEventLoop::quit);
+  QObject::connect(tab->request_interceptor,
+                   &TabRequestInterceptor::requestStarted, &context,
+                   [&quiet]() { quiet.start(kNetworkIdleQuietMs); });
+  QObject::connect(tab->view, &QObject::destroyed, &context, [&]() {
+    error = QStringLiteral("tab closed while waiting");
+    loop.quit();
+  });
+  if (timeout_ms > 0) {
+    QTimer::singleShot(timeout_ms, &context, [&, timeout_ms]() {
+      error = QStringLiteral("wait-for timed out after %1 ms").arg(timeout_ms);
+      loop.quit();
+    });
+  }
+  quiet.start(kNetworkIdleQuietMs);
+  loop.exec();
+  if (!error.isEmpty()) {
+    if (error_message) {
+      *error_message = error;
+    }
+    return false;
+  }
+  return true;
+}
+
+TabManager::TabEntry* TabManager::ResolveEvalTarget(int tab_id,
+                                                    int tab_index,
+                                                    QString* error_message) {
   if (tabs_.empty()) {
     if (error_message) {
       *error_message = QStringLiteral("no tabs available");
     }
-    return false;
+    return nullptr;
   }
   TabEntry* target = nullptr;
   if (tab_id > 0) {
@@ -732,7 +1520,7 @@ bool TabManager::EvaluateJavaScript(const QString& script,
       if (error_message) {
         *error_message = QStringLiteral("unknown tab id");
       }
-      return false;
+      return nullptr;
     }
   } else if (tab_index > 0) {
     const int zero_based = tab_index - 1;
@@ -741,7 +1529,7 @@ bool TabManager::EvaluateJavaScript(const QString& script,
       if (error_message) {
         *error_message = QStringLiteral("tab index out of range");
       }
-      return false;
+      return nullptr;
     }
     target = tabs_[static_cast<size_t>(zero_based)].get();
   } else {
@@ -756,147 +1544,410 @@ bool TabManager::EvaluateJavaScript(const QString& script,
     }
   }
 
-  if (!target || !target->view || !target->view->page()) {
-    if (error_message) {
-      *error_message = QStringLiteral("tab has no page");
-    }
+  if (!target && error_message) {
+    *error_message = QStringLiteral("tab has no page");
+  }
+  return target;
+}
+
+bool TabManager::WaitForEvaluation(int tab_id,
+                                   const QString& function_source,
+                                   const QString& args_json,
+                                   const QString& preview,
+                                   int timeout_ms,
+                                   EvalWorld world,
+                                   const EvalChunkCallback& on_chunk,
+                                   QVariant* result,
+                                   QString* error_message) {
+  struct SyncEvalWait {
+    bool completed = false;
+    EvalOutcome outcome;
+  };
+  auto wait = std::make_shared<SyncEvalWait>();
+  QEventLoop loop;
+  QPointer<QEventLoop> loop_guard(&loop);
+  if (!StartWrappedEvaluation(tab_id, function_source, args_json, preview,
+                              timeout_ms, world, on_chunk,
+                              [wait, loop_guard](const EvalOutcome& outcome) {
+                                wait->completed = true;
+                                wait->outcome = outcome;
+                                if (loop_guard) {
+                                  loop_guard->quit();
+                                }
+                              },
+                              error_message)) {
     return false;
   }
+  if (!wait->completed) {
+    loop.exec();
+  }
 
-  EnsureEvalBridge(target);
-  if (!target->eval_bridge) {
+  if (!wait->completed) {
     if (error_message) {
-      *error_message = QStringLiteral("eval bridge unavailable");
+      *error_message = QStringLiteral("script did not produce a result");
     }
     return false;
   }
-
-  if (!target->eval_bridge_ready) {
-    QEventLoop ready_loop;
-    QMetaObject::Connection ready_conn = QObject::connect(
-        target->eval_bridge.get(), &JsEvalBridge::Ready, &ready_loop,
-        &QEventLoop::quit);
-    QTimer ready_timer;
-    ready_timer.setSingleShot(true);
-    QObject::connect(&ready_timer, &QTimer::timeout, &ready_loop,
-                     &QEventLoop::quit);
-    ready_timer.start(kEvalReadyTimeoutMs);
-    ready_loop.exec();
-    QObject::disconnect(ready_conn);
-    if (!target->eval_bridge_ready) {
-      if (error_message) {
-        *error_message = QStringLiteral("eval environment unavailable");
-      }
-      return false;
+  if (wait->outcome.success) {
+    if (result) {
+      *result = wait->outcome.value;
     }
+    return true;
   }
+  if (error_message) {
+    *error_message = wait->outcome.error;
+  }
+  return false;
+}
 
-  const int request_id = target->next_eval_request_id++;
+QList<TabManager::EvalOutcome> TabManager::EvaluateJavaScriptInTabs(
+    const QString& script,
+    const QList<int>& tab_ids,
+    int timeout_ms,
+    EvalWorld world) {
+  // Every tab is started before waiting, so the total latency is that of the
+  // slowest tab rather than the sum.
+  auto outcomes = std::make_shared<QList<EvalOutcome>>();
+  auto remaining = std::make_shared<int>(0);
   QEventLoop loop;
-  QVariant callback_result;
-  QString callback_error;
-  bool completed = false;
-  bool success = false;
-
-  QPointer<WebView> view_guard(target->view);
-  QObject::connect(target->eval_bridge.get(), &QObject::destroyed, &loop,
-                   &QEventLoop::quit);
-  if (view_guard) {
-    QObject::connect(view_guard.data(), &QObject::destroyed, &loop,
-                     &QEventLoop::quit);
-  }
-
-  QMetaObject::Connection completion_conn =
-      QObject::connect(target->eval_bridge.get(), &JsEvalBridge::EvalCompleted,
-                       &loop,
-                       [&loop, &completed, &success, &callback_result,
-                        &callback_error, request_id](int completed_id,
-                                                     bool completed_success,
-                                                     const QVariant& value,
-                                                     const QString& error) {
-                         if (completed || completed_id != request_id) {
-                           return;
-                         }
-                         completed = true;
-                         success = completed_success;
-                         if (completed_success) {
-                           callback_result = value;
-                         } else {
-                           callback_error = error;
-                         }
-                         loop.quit();
-                       });
-
-  auto* page = target->view->page();
-  const QString wrapped = BuildEvalWrapper(script, request_id);
-  page->runJavaScript(wrapped, QWebEngineScript::MainWorld,
-                      [&loop, &completed, &success, &callback_result,
-                       &callback_error](
-                          const QVariant& value) {
-                        if (completed) {
-                          return;
-                        }
-                        const QVariantMap map = value.toMap();
-                        const QString status = map.value(
-                            QStringLiteral("status")).toString();
-                        if (status == QStringLiteral("promise")) {
-                          return;
-                        }
-                        if (status == QStringLiteral("ok")) {
-                          completed = true;
-                          success = true;
-                          callback_result = map.value(QStringLiteral("value"));
-                          loop.quit();
-                          return;
-                        }
-                        if (status == QStringLiteral("error")) {
-                          completed = true;
-                          success = false;
-                          callback_error = map
-                                               .value(QStringLiteral("error"))
-                                               .toString();
-                          loop.quit();
-                          return;
-                        }
-                        // Fallback: treat plain values as success.
-                        completed = true;
-                        success = true;
-                        callback_result =
-                            status.isEmpty() ? value : QVariant(map);
-                        loop.quit();
-                      });
-
-  if (!completed) {
+  QPointer<QEventLoop> loop_guard(&loop);
+  for (int tab_id : tab_ids) {
+    EvalOutcome placeholder;
+    placeholder.tab_id = tab_id;
+    placeholder.error = QStringLiteral("script did not produce a result");
+    outcomes->append(placeholder);
+  }
+  for (int i = 0; i < tab_ids.size(); ++i) {
+    QString error;
+    ++*remaining;
+    const bool started = StartEvaluation(
+        tab_ids.at(i), script, timeout_ms, world,
+        [outcomes, remaining, loop_guard, i](const EvalOutcome& outcome) {
+          (*outcomes)[i] = outcome;
+          if (--*remaining == 0 && loop_guard) {
+            loop_guard->quit();
+          }
+        },
+        &error);
+    if (!started) {
+      --*remaining;
+      (*outcomes)[i].error = error;
+    }
+  }
+  if (*remaining > 0) {
     loop.exec();
   }
-  QObject::disconnect(completion_conn);
+  return *outcomes;
+}
 
-  if (!completed) {
+bool TabManager::StartEvaluation(int tab_id,
+                                 const QString& script,
+                                 int timeout_ms,
+                                 EvalWorld world,
+                                 EvalCallback done,
+                                 QString* error_message) {
+  return StartWrappedEvaluation(tab_id, BuildEvalFunction(script, false),
+                                QStringLiteral("undefined"), script,
+                                timeout_ms, world, nullptr, std::move(done),
+                                error_message);
+}
+
+bool TabManager::StartWrappedEvaluation(int tab_id,
+                                        const QString& function_source,
+                                        const QString& args_json,
+                                        const QString& preview,
+                                        int timeout_ms,
+                                        EvalWorld world,
+                                        const EvalChunkCallback& on_chunk,
+                                        EvalCallback done,
+                                        QString* error_message) {
+  TabEntry* target = findById(tab_id);
+  if (!target) {
     if (error_message) {
-      if (!view_guard || view_guard.isNull()) {
-        *error_message = QStringLiteral("tab closed during evaluation");
-      } else {
-        *error_message = QStringLiteral("script did not produce a result");
-      }
+      *error_message = QStringLiteral("unknown tab id");
+    }
+    return false;
+  }
+  if (!target->view || !target->view->page()) {
+    if (error_message) {
+      *error_message = QStringLiteral("tab has no page");
+    }
+    return false;
+  }
+  if (!isInCurrentGroup(target)) {
+    if (error_message) {
+      *error_message = QStringLiteral("tab belongs to a suspended group");
     }
     return false;
   }
 
-  if (success) {
-    if (result) {
-      *result = callback_result;
+  auto state = std::make_shared<PendingEval>();
+  state->tab_id = tab_id;
+  state->request_id = next_eval_id_++;
+  state->timeout_ms = timeout_ms;
+  state->world_id = WorldIdFor(world);
+  state->script_preview = preview.simplified().left(kEvalPreviewLength);
+  state->started.start();
+  state->done = std::move(done);
+  state->on_chunk = on_chunk;
+  pending_evals_[state->request_id] = state;
+  // Every connection and timer for this request hangs off |context|, so
+  // finishing the request tears them all down at once.
+  state->context = new QObject(this);
+
+  QObject::connect(target->view, &QObject::destroyed, state->context,
+                   [this, state]() {
+                     FinishEval(state, false, QVariant(),
+                                QStringLiteral("tab closed during evaluation"));
+                   });
+  if (timeout_ms > 0) {
+    QTimer::singleShot(timeout_ms, state->context,
+                       [this, state, timeout_ms]() {
+                         DropEvalInPage(*state);
+                         FinishEval(state, false, QVariant(),
+                                    QStringLiteral("timed out after %1 ms")
+                                        .arg(timeout_ms));
+                       });
+  }
+
+  QPointer<TabManager> self(this);
+  target->view->page()->runJavaScript(
+      BuildEvalInvocation(function_source, state->request_id, args_json,
+                          static_cast<bool>(state->on_chunk)),
+      state->world_id, [self, state](const QVariant& value) {
+        if (state->finished || !self) {
+          return;
+        }
+        const QVariantMap map = value.toMap();
+        const QString status = map.value(QStringLiteral("status")).toString();
+        if (status == QStringLiteral("promise") ||
+            status == QStringLiteral("stream")) {
+          self->AwaitEvalPromise(state);
+          return;
+        }
+        if (status == QStringLiteral("ok")) {
+          self->FinishEval(state, true, map.value(QStringLiteral("value")),
+                           QString());
+          return;
+        }
+        if (status == QStringLiteral("error")) {
+          self->FinishEval(state, false, QVariant(),
+                           map.value(QStringLiteral("error")).toString());
+          return;
+        }
+        // Fallback: treat plain values as success.
+        self->FinishEval(state, true,
+                         status.isEmpty() ? value : QVariant(map), QString());
+      });
+  return true;
+}
+
+void TabManager::AwaitEvalPromise(const std::shared_ptr<PendingEval>& state) {
+  TabEntry* target = findById(state->tab_id);
+  if (!target || !target->view || !target->view->page()) {
+    FinishEval(state, false, QVariant(),
+               QStringLiteral("tab closed during evaluation"));
+    return;
+  }
+  // Only thenables need the WebChannel bridge; set it up on first use.
+  EnsureEvalBridge(target, state->world_id);
+  if (!target->eval_bridge) {
+    FinishEval(state, false, QVariant(),
+               QStringLiteral("eval bridge unavailable"));
+    return;
+  }
+  state->awaiting_promise = true;
+  QWebEnginePage* page = target->view->page();
+  // A navigation drops the pending promise together with its document.
+  QObject::connect(page, &QWebEnginePage::loadStarted, state->context,
+                   [this, state]() {
+                     FinishEval(state, false, QVariant(),
+                                QStringLiteral(
+                                    "page navigated during evaluation"));
+                   });
+  if (target->eval_bridge_world != state->world_id) {
+    if (state->on_chunk) {
+      FinishEval(state, false, QVariant(),
+                 QStringLiteral("streaming needs the eval bridge, which this "
+                                "tab bound to the other world"));
+      return;
     }
-    return true;
+    PollEvalResult(state);
+    return;
   }
+  if (state->on_chunk) {
+    QPointer<QWebEnginePage> page_guard(page);
+    QObject::connect(
+        target->eval_bridge.get(), &JsEvalBridge::EvalChunk, state->context,
+        [this, state, page_guard](int chunk_id, const QVariant& chunk) {
+          if (chunk_id != state->request_id || state->finished) {
+            return;
+          }
+          // Acknowledge only once the consumer has delivered the chunk, so
+          // the page never runs more than a few chunks ahead of the reader
+          // and a slow reader stalls the page rather than the UI thread.
+          QPointer<TabManager> self(this);
+          EvalChunkAck ack = [self, state, page_guard](bool consumed) {
+            if (!self || state->finished) {
+              return;
+            }
+            if (!consumed) {
+              self->DropEvalInPage(*state);
+              self->FinishEval(state, false, QVariant(),
+                               QStringLiteral("stream consumer went away"));
+              return;
+            }
+            if (page_guard) {
+              page_guard->runJavaScript(
+                  QStringLiteral("window.__rethreadAckStream && "
+                                 "window.__rethreadAckStream(%1);")
+                      .arg(state->request_id),
+                  state->world_id);
+            }
+          };
+          if (!state->on_chunk(DecodeEvalValue(chunk), ack)) {
+            ack(false);
+          }
+        });
+  }
+  QObject::connect(target->eval_bridge.get(), &JsEvalBridge::EvalCompleted,
+                   state->context,
+                   [this, state](int completed_id, bool completed_success,
+                           const QVariant& value, const QString& error) {
+                     if (completed_id != state->request_id) {
+                       return;
+                     }
+                     FinishEval(state, completed_success, value, error);
+                   });
+  page->runJavaScript(EvalBridgeBootstrapSource(), state->world_id);
+}
 
-  if (error_message) {
-    QString message = callback_error.trimmed();
-    if (message.isEmpty()) {
-      message = QStringLiteral("failed to evaluate script");
+void TabManager::PollEvalResult(const std::shared_ptr<PendingEval>& state) {
+  // The other world has no WebChannel transport, so its settled entry is
+  // fetched with runJavaScript instead.
+  QTimer::singleShot(kEvalPollIntervalMs, state->context, [this, state]() {
+    TabEntry* target = findById(state->tab_id);
+    if (state->finished || !target || !target->view ||
+        !target->view->page()) {
+      return;
+    }
+    QPointer<TabManager> self(this);
+    target->view->page()->runJavaScript(
+        QStringLiteral("(function() {"
+                       "  var settled = window.__rethreadSettled;"
+                       "  var entry = settled && settled[%1];"
+                       "  if (entry) { delete settled[%1]; }"
+                       "  return entry || null;"
+                       "})();")
+            .arg(state->request_id),
+        state->world_id, [self, state](const QVariant& value) {
+          if (state->finished || !self) {
+            return;
+          }
+          const QVariantMap entry = value.toMap();
+          if (entry.isEmpty()) {
+            self->PollEvalResult(state);
+            return;
+          }
+          if (entry.value(QStringLiteral("ok")).toBool()) {
+            self->FinishEval(state, true, entry.value(QStringLiteral("value")),
+                             QString());
+          } else {
+            self->FinishEval(state, false, QVariant(),
+                             entry.value(QStringLiteral("error")).toString());
+          }
+        });
+  });
+}
+
+void TabManager::FinishEval(const std::shared_ptr<PendingEval>& state,
+                            bool success,
+                            const QVariant& value,
+                            const QString& error) {
+  if (state->finished) {
+    return;
+  }
+  state->finished = true;
+  pending_evals_.erase(state->request_id);
+  if (state->context) {
+    state->context->deleteLater();
+  }
+  EvalOutcome outcome;
+  outcome.tab_id = state->tab_id;
+  outcome.success = success;
+  if (success) {
+    outcome.value = DecodeEvalValue(value);
+    // A streaming eval whose script returned something other than an
+    // iterable delivers that value as its only chunk.
+    if (state->on_chunk) {
+      const QVariantMap map = outcome.value.toMap();
+      const QString stream_end_key = QStringLiteral("__rethreadStreamEnd");
+      if (map.size() == 1 && map.contains(stream_end_key)) {
+        outcome.value = map.value(stream_end_key);
+      } else if (!state->on_chunk(outcome.value, [](bool) {})) {
+        outcome.success = false;
+        outcome.error = QStringLiteral("stream consumer went away");
+      }
     }
-    *error_message = message;
+  } else {
+    outcome.error = error.trimmed().isEmpty()
+                        ? QStringLiteral("failed to evaluate script")
+                        : error.trimmed();
   }
-  return false;
+  EvalCallback done = std::move(state->done);
+  state->done = nullptr;
+  if (done) {
+    done(outcome);
+  }
+}
+
+void TabManager::DropEvalInPage(const PendingEval& state) {
+  if (!state.awaiting_promise) {
+    return;
+  }
+  TabEntry* tab = findById(state.tab_id);
+  if (!tab || !tab->view || !tab->view->page()) {
+    return;
+  }
+  // Keeps a promise that settles after we gave up from parking its value in
+  // the page forever, and stops a streaming iterator at its next step.
+  tab->view->page()->runJavaScript(
+      QStringLiteral("(window.__rethreadDroppedEvals = "
+                     "window.__rethreadDroppedEvals || {})[%1] = true;"
+                     "if (window.__rethreadSettled) "
+                     "{ delete window.__rethreadSettled[%1]; }"
+                     "if (window.__rethreadStreams) "
+                     "{ delete window.__rethreadStreams[%1]; }"
+                     "if (window.__rethreadCancelStream) "
+                     "{ window.__rethreadCancelStream(%1); }")
+          .arg(state.request_id),
+      state.world_id);
+}
+
+QList<TabManager::PendingEvalInfo> TabManager::pendingEvals() const {
+  QList<PendingEvalInfo> result;
+  for (const auto& [id, state] : pending_evals_) {
+    PendingEvalInfo info;
+    info.id = id;
+    info.tab_id = state->tab_id;
+    info.elapsed_ms = state->started.elapsed();
+    info.timeout_ms = state->timeout_ms;
+    info.awaiting_promise = state->awaiting_promise;
+    info.script_preview = state->script_preview;
+    result.append(info);
+  }
+  return result;
+}
+
+bool TabManager::CancelEval(int eval_id) {
+  auto it = pending_evals_.find(eval_id);
+  if (it == pending_evals_.end()) {
+    return false;
+  }
+  std::shared_ptr<PendingEval> state = it->second;
+  DropEvalInPage(*state);
+  FinishEval(state, false, QVariant(), QStringLiteral("cancelled"));
+  return true;
 }
 
 bool TabManager::closeById(int id) {
@@ -905,6 +1956,26 @@ bool TabManager::closeById(int id) {
       return closeTabAtIndex(static_cast<int>(i));
     }
   }
+  for (auto group_it = parked_groups_.begin();
+       group_it != parked_groups_.end(); ++group_it) {
+    TabList& group = group_it->second;
+    for (auto it = group.begin(); it != group.end(); ++it) {
+      if ((*it)->id != id) {
+        continue;
+      }
+      const bool was_active = (*it)->active;
+      TabList doomed;
+      doomed.push_back(std::move(*it));
+      group.erase(it);
+      DestroyTabList(&doomed);
+      if (group.empty()) {
+        parked_groups_.erase(group_it);
+      } else if (was_active) {
+        group.front()->active = true;
+      }
+      return true;
+    }
+  }
   return false;
 }
 
@@ -1,10 +1,13 @@
 #ifndef RETHREAD_BROWSER_TAB_MANAGER_H_
 #define RETHREAD_BROWSER_TAB_MANAGER_H_
 
+#include <functional>
+#include <map>
 #include <memory>
 #include <vector>
 
 #include <QColor>
+#include <QElapsedTimer>
 #include <QPointer>
 #include <QObject>
 #include <QUrl>
@@ -15,7 +18,10 @@
 
 #include <QWebChannel>
 
+#include "browser/net_log.h"
+
 class QStackedWidget;
+class QTimer;
 class QWebEngineProfile;
 class QWebEngineView;
 class QWebEnginePage;
@@ -24,6 +30,7 @@ namespace rethread {
 
 class ContextMenuBindingManager;
 class RulesManager;
+class TabRequestInterceptor;
 class WebView;
 class JsEvalBridge;
 
@@ -31,13 +38,59 @@ class TabManager : public QObject {
   Q_OBJECT
 
  public:
+  enum class TabSortKey {
+    kUrl,
+    kTitle,
+    kHost,
+  };
+
+  enum class GroupSuspendMode {
+    kFreeze,
+    kDiscard,
+  };
+
+  // kIsolated runs in Chromium's ApplicationWorld: same DOM, separate JS
+  // globals, so pages cannot see or patch the eval helpers and vice versa.
+  enum class EvalWorld {
+    kMain,
+    kIsolated,
+  };
+
   struct TabSnapshot {
     int id = 0;
     QString url;
     QString title;
     bool active = false;
+    qint64 render_pid = 0;
   };
 
+  struct TabStats {
+    int id = 0;
+    QString url;
+    QString title;
+    bool active = false;
+    qint64 render_pid = 0;
+    quint64 request_count = 0;
+    // Sum of Performance API transferSize for the current document, or -1
+    // before the first sample has come back.
+    qint64 transfer_bytes = -1;
+  };
+
+  struct GroupSnapshot {
+    QString name;
+    int tab_count = 0;
+    bool current = false;
+  };
+
+  // Called once a streamed chunk has left the browser: true lets the page
+  // produce more, false stops the iterator and fails the eval.
+  using EvalChunkAck = std::function<void(bool consumed)>;
+  // Receives each chunk of a streaming eval (`eval --stream`) in order and
+  // calls the ack when it has been delivered, possibly later. Returning false
+  // fails the eval straight away.
+  using EvalChunkCallback =
+      std::function<bool(const QVariant&, const EvalChunkAck&)>;
+
   TabManager(QWebEngineProfile* profile,
              const QColor& background_color,
              QObject* parent = nullptr);
@@ -51,8 +104,25 @@ class TabManager : public QObject {
   bool activateTab(int id);
   bool cycleActiveTab(int delta);
   QList<TabSnapshot> snapshot() const;
+  // Returns the latest cached counters and schedules an asynchronous refresh
+  // of the transfer sizes, so callers polling once per interval see values at
+  // most one interval old without blocking on the renderers.
+  QList<TabStats> statsSnapshot();
   bool SwapTabs(int first_index, int second_index);
+  bool MoveTab(int from_index, int to_index);
+  bool SortTabs(TabSortKey key);
+  int DedupeTabs();
+  // Tab groups: only the current group lives in the tab strip; the others are
+  // parked with their pages frozen or discarded until switched back to.
+  QString currentGroup() const { return current_group_; }
+  QList<GroupSnapshot> groupSnapshot() const;
+  bool SwitchGroup(const QString& name,
+                   GroupSuspendMode mode,
+                   const QUrl& url_if_new);
+  bool MoveActiveTabToGroup(const QString& name, GroupSuspendMode mode);
+  bool CloseGroup(const QString& name);
   bool closeTabAtIndex(int index);
+  bool closeById(int id);
   bool closeActiveTab();
   void closeAllTabs();
   bool historyBack();
@@ -62,11 +132,95 @@ class TabManager : public QObject {
   bool EvaluateJavaScript(const QString& script,
                           int tab_id,
                           int tab_index,
+                          int timeout_ms,
+                          EvalWorld world,
+                          const EvalChunkCallback& on_chunk,
                           QVariant* result,
                           QString* error_message);
 
+  struct EvalScriptInfo {
+    QString name;
+    qint64 source_bytes = 0;
+  };
+
+  // Registered scripts are wrapped once and then invoked by name, so a call
+  // only ships its JSON |args_json| (bound to `args`) across IPC.
+  void RegisterEvalScript(const QString& name, const QString& script);
+  bool UnregisterEvalScript(const QString& name);
+  QList<EvalScriptInfo> registeredEvalScripts() const;
+  bool CallEvalScript(const QString& name,
+                      const QString& args_json,
+                      int tab_id,
+                      int tab_index,
+                      int timeout_ms,
+                      EvalWorld world,
+                      const EvalChunkCallback& on_chunk,
+                      QVariant* result,
+                      QString* error_message);
+
+  enum class PageCondition {
+    kDomContentLoaded,
+    kLoad,
+    kNetworkIdle,
+    kSelector,
+  };
+
+  // Resolves an eval tab selector (id, 1-based index, or the active tab).
+  int ResolveEvalTabId(int tab_id, int tab_index, QString* error_message);
+  // Waits in a local event loop until |condition| holds in the tab, driven by
+  // load signals, the tab's request interceptor, and (for kSelector) a
+  // MutationObserver in |world|.
+  bool WaitForPageCondition(int tab_id,
+                            PageCondition condition,
+                            const QString& selector,
+                            int timeout_ms,
+                            EvalWorld world,
+                            QString* error_message);
+
+  struct EvalOutcome {
+    int tab_id = 0;
+    bool success = false;
+    QVariant value;
+    QString error;
+  };
+  using EvalCallback = std::function<void(const EvalOutcome&)>;
+
+  // Runs |script| in every tab concurrently and waits for all of them; each
+  // tab gets its own |timeout_ms| (0 waits indefinitely). Outcomes keep the
+  // order of |tab_ids|.
+  QList<EvalOutcome> EvaluateJavaScriptInTabs(const QString& script,
+                                              const QList<int>& tab_ids,
+                                              int timeout_ms,
+                                              EvalWorld world);
+  // Non-blocking core shared by the eval entry points. On success |done| is
+  // invoked exactly once, always from the event loop; on failure nothing is
+  // started and |error_message| says why.
+  bool StartEvaluation(int tab_id,
+                       const QString& script,
+                       int timeout_ms,
+                       EvalWorld world,
+                       EvalCallback done,
+                       QString* error_message);
+
+  struct PendingEvalInfo {
+    int id = 0;
+    int tab_id = 0;
+    qint64 elapsed_ms = 0;
+    int timeout_ms = 0;
+    bool awaiting_promise = false;
+    QString script_preview;
+  };
+
+  // Evals still waiting for a result, oldest first.
+  QList<PendingEvalInfo> pendingEvals() const;
+  // Fails the waiting caller with "cancelled" and forgets the request; the
+  // page-side promise, if any, is left to settle into the void.
+  bool CancelEval(int eval_id);
+
   QWebEngineView* activeView() const;
   QWebEngineProfile* profile() const { return profile_; }
+  // Requests seen by the tab interceptors, most recent kCapacity kept.
+  const NetLog& netLog() const { return net_log_; }
 
   QWebEngineView* createPopupTab();
 
@@ -83,21 +237,96 @@ class TabManager : public QObject {
     WebView* view = nullptr;
     std::unique_ptr<QWebChannel> eval_channel;
     std::unique_ptr<JsEvalBridge> eval_bridge;
-    int next_eval_request_id = 1;
-    bool eval_bridge_ready = false;
+    // A page has a single WebChannel, bound to the world of the first eval
+    // that needed it.
+    quint32 eval_bridge_world = 0;
+    TabRequestInterceptor* request_interceptor = nullptr;
+    // Between loadStarted and loadFinished of a navigation.
+    bool loading = false;
+    qint64 transfer_bytes = -1;
+    bool transfer_sample_pending = false;
   };
 
+  using TabList = std::vector<std::unique_ptr<TabEntry>>;
+
+  struct PendingEval {
+    int tab_id = 0;
+    int request_id = 0;
+    int timeout_ms = 0;
+    quint32 world_id = 0;
+    bool awaiting_promise = false;
+    bool finished = false;
+    QString script_preview;
+    QElapsedTimer started;
+    QPointer<QObject> context;
+    EvalCallback done;
+    EvalChunkCallback on_chunk;
+  };
+
+  struct RegisteredEvalScript {
+    QString function_source;
+    qint64 source_bytes = 0;
+  };
+
+  TabEntry* ResolveEvalTarget(int tab_id,
+                              int tab_index,
+                              QString* error_message);
+  bool WaitForEvaluation(int tab_id,
+                         const QString& function_source,
+                         const QString& args_json,
+                         const QString& preview,
+                         int timeout_ms,
+                         EvalWorld world,
+                         const EvalChunkCallback& on_chunk,
+                         QVariant* result,
+                         QString* error_message);
+  bool StartWrappedEvaluation(int tab_id,
+                              const QString& function_source,
+                              const QString& args_json,
+                              const QString& preview,
+                              int timeout_ms,
+                              EvalWorld world,
+                              const EvalChunkCallback& on_chunk,
+                              EvalCallback done,
+                              QString* error_message);
+  bool WaitForNavigation(TabEntry* tab,
+                         bool until_loaded,
+                         int timeout_ms,
+                         QString* error_message);
+  bool WaitForNetworkIdle(TabEntry* tab,
+                          int timeout_ms,
+                          QString* error_message);
+  void AwaitEvalPromise(const std::shared_ptr<PendingEval>& state);
+  void PollEvalResult(const std::shared_ptr<PendingEval>& state);
+  void FinishEval(const std::shared_ptr<PendingEval>& state,
+                  bool success,
+                  const QVariant& value,
+                  const QString& error);
+  void DropEvalInPage(const PendingEval& state);
+
   TabEntry* findById(int id);
   const TabEntry* findById(int id) const;
+  bool isInCurrentGroup(const TabEntry* tab) const;
+  void SuspendTab(TabEntry* tab, GroupSuspendMode mode);
+  void RestoreGroup(const QString& name);
+  void DestroyTabList(TabList* tabs);
+  // Takes the view out of the stack, detaches its request interceptor, and
+  // schedules its deletion.
+  void ReleaseTabView(TabEntry* tab);
+  // Spare tabs have their view, page, interceptor, and eval helper already
+  // built but no id or navigation, so they stay valid createWindow targets.
+  std::unique_ptr<TabEntry> CreateSpareTab();
+  std::unique_ptr<TabEntry> TakeSpareTab();
+  void ScheduleSpareRefill();
+  void RefillSparePool();
   int activeIndex() const;
   void applyActiveState();
   void notifyTabsChanged();
   int nextTabId();
-  bool closeById(int id);
   void ApplyRulesToView(WebView* view, const QUrl& url) const;
   void ApplyRulesToAllTabs() const;
   void CloseDevTools(QWebEnginePage* page, bool close_view);
-  void EnsureEvalBridge(TabEntry* tab);
+  void EnsureEvalBridge(TabEntry* tab, quint32 world_id);
 
   struct DevToolsWindow {
     QPointer<QWebEngineView> view;
@@ -110,9 +339,19 @@ class TabManager : public QObject {
   ContextMenuBindingManager* context_menu_binding_manager_ = nullptr;
   RulesManager* rules_manager_ = nullptr;
   QStackedWidget* stack_ = nullptr;
-  std::vector<std::unique_ptr<TabEntry>> tabs_;
+  // Interceptors point here until ReleaseTabView detaches them.
+  NetLog net_log_;
+  TabList tabs_;
+  QString current_group_;
+  std::map<QString, TabList> parked_groups_;
+  TabList spare_tabs_;
+  QTimer* spare_refill_timer_ = nullptr;
   int next_tab_id_ = 1;
   std::unordered_map<QWebEnginePage*, DevToolsWindow> devtools_windows_;
+  // Eval request ids are global so `eval cancel ID` needs no tab selector.
+  int next_eval_id_ = 1;
+  std::map<int, std::shared_ptr<PendingEval>> pending_evals_;
+  std::map<QString, RegisteredEvalScript> eval_scripts_;
 };
 
 }  // namespace rethread
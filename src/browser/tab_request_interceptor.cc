@@ -0,0 +1,98 @@
+#include "browser/tab_request_interceptor.h"
+
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QWebEngineUrlRequestInfo>
+
+#include "browser/net_log.h"
+
+namespace rethread {
+
+namespace {
+
+qint64 UptimeMicros() {
+  static QElapsedTimer timer = [] {
+    QElapsedTimer started;
+    started.start();
+    return started;
+  }();
+  return timer.nsecsElapsed() / 1000;
+}
+
+const char* ResourceTypeName(QWebEngineUrlRequestInfo::ResourceType type) {
+  switch (type) {
+    case QWebEngineUrlRequestInfo::ResourceTypeMainFrame:
+      return "document";
+    case QWebEngineUrlRequestInfo::ResourceTypeSubFrame:
+      return "subframe";
+    case QWebEngineUrlRequestInfo::ResourceTypeStylesheet:
+      return "stylesheet";
+    case QWebEngineUrlRequestInfo::ResourceTypeScript:
+      return "script";
+    case QWebEngineUrlRequestInfo::ResourceTypeImage:
+      return "image";
+    case QWebEngineUrlRequestInfo::ResourceTypeFontResource:
+      return "font";
+    case QWebEngineUrlRequestInfo::ResourceTypeMedia:
+      return "media";
+    case QWebEngineUrlRequestInfo::ResourceTypeWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeSharedWorker:
+    case QWebEngineUrlRequestInfo::ResourceTypeServiceWorker:
+      return "worker";
+    case QWebEngineUrlRequestInfo::ResourceTypePrefetch:
+      return "prefetch";
+    case QWebEngineUrlRequestInfo::ResourceTypeFavicon:
+      return "favicon";
+    case QWebEngineUrlRequestInfo::ResourceTypeXhr:
+      return "xhr";
+    case QWebEngineUrlRequestInfo::ResourceTypePing:
+      return "ping";
+    default:
+      return "other";
+  }
+}
+
+const char* NavigationTypeName(QWebEngineUrlRequestInfo::NavigationType type) {
+  switch (type) {
+    case QWebEngineUrlRequestInfo::NavigationTypeLink:
+      return "link";
+    case QWebEngineUrlRequestInfo::NavigationTypeTyped:
+      return "typed";
+    case QWebEngineUrlRequestInfo::NavigationTypeFormSubmitted:
+      return "form";
+    case QWebEngineUrlRequestInfo::NavigationTypeBackForward:
+      return "back-forward";
+    case QWebEngineUrlRequestInfo::NavigationTypeReload:
+      return "reload";
+    case QWebEngineUrlRequestInfo::NavigationTypeRedirect:
+      return "redirect";
+    default:
+      return "other";
+  }
+}
+
+}  // namespace
+
+TabRequestInterceptor::TabRequestInterceptor(NetLog* net_log, QObject* parent)
+    : QWebEngineUrlRequestInterceptor(parent), net_log_(net_log) {}
+
+void TabRequestInterceptor::interceptRequest(QWebEngineUrlRequestInfo& info) {
+  // Qt 6 calls page interceptors on the UI thread, so no locking is needed.
+  ++request_count_;
+  if (net_log_) {
+    NetLogRecord record;
+    record.time_ms = QDateTime::currentMSecsSinceEpoch();
+    record.uptime_us = UptimeMicros();
+    record.tab_id = tab_id_;
+    record.method = info.requestMethod();
+    record.url = info.requestUrl();
+    record.first_party = info.firstPartyUrl();
+    record.initiator = info.initiator();
+    record.resource_type = ResourceTypeName(info.resourceType());
+    record.navigation_type = NavigationTypeName(info.navigationType());
+    net_log_->Record(std::move(record));
+  }
+  emit requestStarted();
+}
+
+}  // namespace rethread
@@ -0,0 +1,37 @@
+#ifndef RETHREAD_BROWSER_TAB_REQUEST_INTERCEPTOR_H_
+#define RETHREAD_BROWSER_TAB_REQUEST_INTERCEPTOR_H_
+
+#include <QWebEngineUrlRequestInterceptor>
+
+namespace rethread {
+
+class NetLog;
+
+// Per-page interceptor that runs after the profile-wide rules interceptor and
+// keeps accounting for a single tab.
+class TabRequestInterceptor : public QWebEngineUrlRequestInterceptor {
+  Q_OBJECT
+
+ public:
+  explicit TabRequestInterceptor(NetLog* net_log, QObject* parent = nullptr);
+
+  void interceptRequest(QWebEngineUrlRequestInfo& info) override;
+
+  quint64 requestCount() const { return request_count_; }
+  // Spare tabs get their id only once they are opened.
+  void setTabId(int tab_id) { tab_id_ = tab_id; }
+  // Cleared when the tab closes, since the page can outlive the log.
+  void setNetLog(NetLog* net_log) { net_log_ = net_log; }
+
+ signals:
+  void requestStarted();
+
+ private:
+  NetLog* net_log_ = nullptr;
+  int tab_id_ = 0;
+  quint64 request_count_ = 0;
+};
+
+}  // namespace rethread
+
+#endif  // RETHREAD_BROWSER_TAB_REQUEST_INTERCEPTOR_H_
@@ -0,0 +1,87 @@
+#include "common/proc_stats.h"
+
+#include <unistd.h>
+
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+namespace rethread {
+
+bool ReadProcessRssBytes(int64_t pid, uint64_t* rss_bytes) {
+  if (pid <= 0 || !rss_bytes) {
+    return false;
+  }
+  std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+  if (!status.is_open()) {
+    return false;
+  }
+  const std::string key = "VmRSS:";
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind(key, 0) != 0) {
+      continue;
+    }
+    std::istringstream fields(line.substr(key.size()));
+    uint64_t kilobytes = 0;
+    if (!(fields >> kilobytes)) {
+      return false;
+    }
+    *rss_bytes = kilobytes * 1024;
+    return true;
+  }
+  return false;
+}
+
+bool ReadProcessSample(int64_t pid, ProcessSample* sample) {
+  if (pid <= 0 || !sample) {
+    return false;
+  }
+  std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+  if (!stat_file.is_open()) {
+    return false;
+  }
+  const std::string line((std::istreambuf_iterator<char>(stat_file)),
+                         std::istreambuf_iterator<char>());
+  // The command name (field 2) may contain spaces or parentheses, so start
+  // parsing after the last ')'.
+  const size_t comm_end = line.rfind(')');
+  if (comm_end == std::string::npos) {
+    return false;
+  }
+  std::istringstream fields(line.substr(comm_end + 1));
+  std::string field;
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  uint64_t rss_pages = 0;
+  // Fields 3..24 of proc(5): utime is 14, stime 15, rss 24.
+  for (int index = 3; index <= 24; ++index) {
+    if (!(fields >> field)) {
+      return false;
+    }
+    try {
+      if (index == 14) {
+        utime = std::stoull(field);
+      } else if (index == 15) {
+        stime = std::stoull(field);
+      } else if (index == 24) {
+        rss_pages = std::stoull(field);
+      }
+    } catch (...) {
+      return false;
+    }
+  }
+  static const long page_size = sysconf(_SC_PAGESIZE);
+  sample->cpu_ticks = utime + stime;
+  sample->rss_bytes =
+      rss_pages * static_cast<uint64_t>(page_size > 0 ? page_size : 4096);
+  return true;
+}
+
+int64_t ClockTicksPerSecond() {
+  static const long ticks = sysconf(_SC_CLK_TCK);
+  return ticks > 0 ? ticks : 100;
+}
+
+}  // namespace rethread
@@ -0,0 +1,26 @@
+#ifndef RETHREAD_COMMON_PROC_STATS_H_
+#define RETHREAD_COMMON_PROC_STATS_H_
+
+#include <cstdint>
+
+namespace rethread {
+
+struct ProcessSample {
+  uint64_t rss_bytes = 0;
+  // utime + stime, in clock ticks (see ClockTicksPerSecond()).
+  uint64_t cpu_ticks = 0;
+};
+
+// Resident set size of |pid| in bytes, read from /proc/<pid>/status.
+// Returns false when the process is gone or /proc is unavailable.
+bool ReadProcessRssBytes(int64_t pid, uint64_t* rss_bytes);
+
+// CPU time and RSS of |pid| from a single read of /proc/<pid>/stat, cheap
+// enough to call for every renderer once per refresh.
+bool ReadProcessSample(int64_t pid, ProcessSample* sample);
+
+int64_t ClockTicksPerSecond();
+
+}  // namespace rethread
+
+#endif  // RETHREAD_COMMON_PROC_STATS_H_
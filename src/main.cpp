@@ -14,6 +14,7 @@
 #include <QStyleHints>
 #include <QString>
 
+#include "app/cli_util.h"
 #include "app/tab_cli.h"
 #include "app/user_dirs.h"
 #include "common/theme.h"
@@ -34,6 +35,9 @@ struct CliOptions {
   bool user_data_dir_overridden = false;
   bool cdp_enabled = true;
   int cdp_port = 9222;
+  std::string process_model;
+  int renderer_process_limit = 0;
+  bool headless = false;
 };
 
 bool ParseColorValue(const std::string& input, uint32_t* color) {
@@ -162,6 +166,40 @@ CliOptions ParseCliOptions(int argc, char* argv[]) {
       options.cdp_enabled = false;
       continue;
     }
+    if (arg == "--headless") {
+      options.headless = true;
+      continue;
+    }
+
+    const std::string process_model_prefix = "--process-model=";
+    if (arg.rfind(process_model_prefix, 0) == 0) {
+      options.process_model = arg.substr(process_model_prefix.size());
+      continue;
+    }
+    if (arg == "--process-model" && i + 1 < argc) {
+      options.process_model = argv[++i];
+      continue;
+    }
+
+    const std::string process_limit_prefix = "--renderer-process-limit=";
+    if (arg.rfind(process_limit_prefix, 0) == 0) {
+      const std::string value = arg.substr(process_limit_prefix.size());
+      if (!rethread::ParsePositiveInt(value,
+                                      &options.renderer_process_limit)) {
+        std::cerr << "Ignoring invalid --renderer-process-limit value: "
+                  << value << "\n";
+      }
+      continue;
+    }
+    if (arg == "--renderer-process-limit" && i + 1 < argc) {
+      if (!rethread::ParsePositiveInt(argv[i + 1],
+                                      &options.renderer_process_limit)) {
+        std::cerr << "Ignoring invalid --renderer-process-limit value: "
+                  << argv[i + 1] << "\n";
+      }
+      ++i;
+      continue;
+    }
 
     const std::string url_prefix = "--url=";
     if (arg.rfind(url_prefix, 0) == 0) {
@@ -242,7 +280,16 @@ void PrintHelp() {
       << "                          $XDG_CONFIG_HOME/rethread/init).\n"
       << "  --color-scheme=SCHEME   Force auto, light, or dark (default: dark).\n"
       << "  --cdp-port=PORT         Enable CDP on PORT (default: 9222).\n"
-      << "  --cdp-disable           Disable the CDP debug port.\n";
+      << "  --cdp-disable           Disable the CDP debug port.\n"
+      << "  --headless              Run without a window (Qt offscreen platform);\n"
+      << "                          drive the browser over IPC or CDP.\n"
+      << "  --process-model=MODEL   Renderer policy: site (one process per\n"
+      << "                          site), tab (Chromium default, one per\n"
+      << "                          site instance), or shared (one renderer\n"
+      << "                          process for every tab, the same as\n"
+      << "                          site with --renderer-process-limit=1).\n"
+      << "  --renderer-process-limit=N\n"
+      << "                          Cap the number of renderer processes.\n";
   std::cout << "\nEnvironment:\n"
             << "  RETHREAD_USER_DATA_DIR  Default profile directory when no flags\n"
             << "                          override it.\n";
@@ -403,6 +450,59 @@ void ApplyRemoteDebugging(bool enabled, int port) {
   qputenv("QTWEBENGINE_CHROMIUM_FLAGS", final_flags.toUtf8());
 }
 
+void ApplyProcessModel(const std::string& model, int renderer_limit) {
+  if (model.empty() && renderer_limit <= 0) {
+    return;
+  }
+  // "shared" is a renderer limit of one rather than --single-process, which
+  // QtWebEngine does not support and which would run pages in the browser
+  // process itself.
+  if (model == "shared" && renderer_limit <= 0) {
+    renderer_limit = 1;
+  }
+  const QByteArray env = qgetenv("QTWEBENGINE_CHROMIUM_FLAGS");
+  QStringList flags = SplitChromiumFlags(QString::fromUtf8(env));
+  QStringList filtered;
+  filtered.reserve(flags.size() + 2);
+  const bool override_model = !model.empty();
+  for (const QString& flag : flags) {
+    if (override_model &&
+        (flag == QStringLiteral("--process-per-site") ||
+         flag == QStringLiteral("--process-per-site-instance") ||
+         flag == QStringLiteral("--single-process"))) {
+      continue;
+    }
+    if (renderer_limit > 0 &&
+        flag.startsWith(QStringLiteral("--renderer-process-limit="))) {
+      continue;
+    }
+    filtered << flag;
+  }
+  if (model == "site") {
+    filtered << QStringLiteral("--process-per-site");
+  } else if (model == "tab") {
+    filtered << QStringLiteral("--process-per-site-instance");
+  } else if (model == "shared") {
+    filtered << QStringLiteral("--process-per-site");
+  } else if (override_model) {
+    std::cerr << "Ignoring unknown --process-model value: " << model << "\n";
+  }
+  if (renderer_limit > 0) {
+    filtered << QStringLiteral("--renderer-process-limit=%1").arg(renderer_limit);
+  }
+  const QString final_flags = ComposeChromiumFlags(filtered);
+  qputenv("QTWEBENGINE_CHROMIUM_FLAGS", final_flags.toUtf8());
+}
+
+// Selects the offscreen QPA plugin before QApplication exists. An explicit
+// QT_QPA_PLATFORM wins so callers can still pick e.g. a virtual X server.
+void ApplyHeadlessPlatform(bool headless) {
+  if (!headless || qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+    return;
+  }
+  qputenv("QT_QPA_PLATFORM", "offscreen");
+}
+
 void ApplyQtPalette(QApplication& app, rethread::ColorScheme scheme) {
   if (auto* hints = QGuiApplication::styleHints()) {
     switch (scheme) {
@@ -447,7 +547,9 @@ int main(int argc, char* argv[]) {
   rethread::ColorScheme scheme = ParseColorSchemeFlag(cli.color_scheme);
   ApplyChromiumColorPreference(scheme);
   ApplyRemoteDebugging(cli.cdp_enabled, cli.cdp_port);
+  ApplyProcessModel(cli.process_model, cli.renderer_process_limit);
   EnsureChromiumFeatureEnabled(QStringLiteral("OverlayScrollbar"));
+  ApplyHeadlessPlatform(cli.headless);
   QApplication app(argc, argv);
   ApplyQtPalette(app, scheme);
 
@@ -463,6 +565,7 @@ int main(int argc, char* argv[]) {
   options.color_scheme = scheme;
   options.cdp_enabled = cli.cdp_enabled;
   options.cdp_port = cli.cdp_port;
+  options.headless = cli.headless;
 
   rethread::BrowserApplication browser(options);
   if (!browser.Initialize()) {
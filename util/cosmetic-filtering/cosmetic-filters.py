@@ -22,6 +22,9 @@ from urllib.parse import urlparse
 CONFIG_VERSION = 1
 CONFIG_FILENAME = "cosmetic-filters.json"
 SCRIPT_ID_PREFIX = "cosmetic-filter-"
+PICKER_EVAL_NAME = "cosmetic-filter-picker"
+# Error text from `eval call` when the browser has not seen the picker yet.
+PICKER_NOT_REGISTERED = "no registered script named"
 TEMPLATE_MATCH_ANCHOR = "__RETHREAD_PICKER_MATCH__"
 TEMPLATE_CONFIG_ANCHOR = "__RETHREAD_PICKER_CONFIG__"
 
@@ -296,12 +299,24 @@ class CosmeticFilterManager:
     return None
 
   def _run_picker(self) -> Optional[Dict[str, Any]]:
-    try:
-      script = self.picker_path.read_text(encoding="utf-8")
-    except OSError as exc:
-      self.log(f"Unable to read picker script: {exc}")
-      return None
-    output = self._run_rethread(["rethread", "eval", "--stdin"], input_data=script)
+    # The picker is registered once per browser session and then called by
+    # name, so repeat runs do not resend the whole script.
+    errors: List[str] = []
+    output = self._run_rethread(["rethread", "eval", "call", PICKER_EVAL_NAME],
+                                errors=errors)
+    # Any other failure (navigation, timeout) means the picker already ran;
+    # launching it again would pop a second one.
+    if output is None and any(PICKER_NOT_REGISTERED in e for e in errors):
+      try:
+        script = self.picker_path.read_text(encoding="utf-8")
+      except OSError as exc:
+        self.log(f"Unable to read picker script: {exc}")
+        return None
+      if self._run_rethread(
+          ["rethread", "eval", "register", f"--name={PICKER_EVAL_NAME}", "--stdin"],
+          input_data=script) is None:
+        return None
+      output = self._run_rethread(["rethread", "eval", "call", PICKER_EVAL_NAME])
     if output is None:
       return None
     trimmed = output.strip()
@@ -334,7 +349,8 @@ class CosmeticFilterManager:
 
   def _run_rethread(self,
                     argv: List[str],
-                    input_data: Optional[str] = None) -> Optional[str]:
+                    input_data: Optional[str] = None,
+                    errors: Optional[List[str]] = None) -> Optional[str]:
     self.log(f"Running command: {' '.join(argv)}")
     try:
       result = subprocess.run(
@@ -350,11 +366,15 @@ class CosmeticFilterManager:
       stderr = result.stderr.strip()
       if stderr:
         self.log(stderr)
+        if errors is not None:
+          errors.append(stderr)
       self.log(f"Command failed with exit code {result.returncode}")
       return None
     stdout = result.stdout
     if stdout.strip().startswith("ERR"):
       self.log(stdout.strip())
+      if errors is not None:
+        errors.append(stdout.strip())
       return None
     return stdout
 